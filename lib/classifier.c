@@ -19,7 +19,10 @@
 #include <assert.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <string.h>
+#include "bitmap.h"
 #include "byte-order.h"
+#include "coverage.h"
 #include "dynamic-string.h"
 #include "flow.h"
 #include "hash.h"
@@ -27,6 +30,61 @@
 #include "ofp-util.h"
 #include "packets.h"
 
+COVERAGE_DEFINE(cls_lookup);
+COVERAGE_DEFINE(cls_table_probe);
+COVERAGE_DEFINE(cls_stage_probe);
+COVERAGE_DEFINE(cls_stage_miss);
+COVERAGE_DEFINE(cls_trie_skip);
+
+/* Lookup stages (see the comment on CLS_N_STAGES in classifier.h). */
+enum {
+    CLS_STAGE_METADATA,
+    CLS_STAGE_L2,
+    CLS_STAGE_L3,
+    CLS_STAGE_L4
+};
+
+/* For each stage, a MINI_N_MAPS-element bitmap of the 32-bit words in "struct
+ * flow" that belong to the stage.  The stages are disjoint and together cover
+ * all of "struct flow". */
+static uint32_t stage_ranges[CLS_N_STAGES][MINI_N_MAPS];
+
+static void init_stage_ranges(void);
+
+/* A field with a prefix trie (see the comment on CLS_N_TRIES in
+ * classifier.h). */
+struct trie_field {
+    size_t ofs;                 /* Offset in "struct flow". */
+    unsigned int n_bits;        /* Width, a multiple of 32. */
+};
+
+static const struct trie_field trie_fields[CLS_N_TRIES] = {
+    { offsetof(struct flow, nw_src), 32 },
+    { offsetof(struct flow, nw_dst), 32 },
+    { offsetof(struct flow, ipv6_src), 128 },
+    { offsetof(struct flow, ipv6_dst), 128 },
+};
+
+/* Maximum width of a trie field, in bits. */
+#define TRIE_MAX_BITS 128
+
+/* The prefix lengths found in a trie for one packet, computed on demand. */
+struct trie_ctx {
+    bool lookup_done;
+    unsigned long plens[DIV_ROUND_UP(TRIE_MAX_BITS + 1, BITMAP_ULONG_BITS)];
+};
+
+static unsigned int minimask_get_prefix_len(const struct minimask *,
+                                            const struct trie_field *);
+static void trie_insert_rule(struct classifier *, const struct cls_table *,
+                             const struct cls_rule *);
+static void trie_remove_rule(struct classifier *, const struct cls_table *,
+                             const struct cls_rule *);
+static bool trie_skip_table(const struct classifier *,
+                            const struct cls_table *, const struct flow *,
+                            struct trie_ctx[], struct flow_wildcards *);
+static void trie_destroy(struct trie_node *);
+
 static struct cls_table *find_table(const struct classifier *,
                                     const struct minimask *);
 static struct cls_table *insert_table(struct classifier *,
@@ -34,12 +92,27 @@ static struct cls_table *insert_table(struct classifier *,
 
 static void destroy_table(struct classifier *, struct cls_table *);
 
+static void update_tables_after_insertion(struct classifier *,
+                                          struct cls_table *,
+                                          unsigned int new_priority);
+static void update_tables_after_removal(struct classifier *,
+                                        struct cls_table *,
+                                        unsigned int del_priority);
+
 static struct cls_rule *find_match(const struct cls_table *,
-                                   const struct flow *);
+                                   const struct flow *,
+                                   struct flow_wildcards *);
 static struct cls_rule *find_equal(struct cls_table *,
                                    const struct miniflow *, uint32_t hash);
 static struct cls_rule *insert_rule(struct cls_table *, struct cls_rule *);
 
+static uint32_t table_hash_miniflow(const struct cls_table *,
+                                   const struct miniflow *,
+                                   uint32_t index_hashes[]);
+static void insert_indices(struct cls_table *, const struct cls_rule *);
+static void remove_indices(struct cls_table *, const struct cls_rule *);
+static void destroy_indices(struct cls_table *);
+
 /* Iterates RULE over HEAD and all of the cls_rules on HEAD->list. */
 #define FOR_EACH_RULE_IN_LIST(RULE, HEAD)                               \
     for ((RULE) = (HEAD); (RULE) != NULL; (RULE) = next_rule_in_list(RULE))
@@ -133,8 +206,14 @@ cls_rule_is_catchall(const struct cls_rule *rule)
 void
 classifier_init(struct classifier *cls)
 {
+    init_stage_ranges();
+
     cls->n_rules = 0;
     hmap_init(&cls->tables);
+    cls->tables_priority = NULL;
+    cls->allocated_tables = 0;
+    memset(cls->tries, 0, sizeof cls->tries);
+    cls->use_tries = true;
 }
 
 /* Destroys 'cls'.  Rules within 'cls', if any, are not freed; this is the
@@ -144,16 +223,32 @@ classifier_destroy(struct classifier *cls)
 {
     if (cls) {
         struct cls_table *table, *next_table;
+        int i;
 
         HMAP_FOR_EACH_SAFE (table, next_table, hmap_node, &cls->tables) {
+            destroy_indices(table);
             hmap_destroy(&table->rules);
             hmap_remove(&cls->tables, &table->hmap_node);
             free(table);
         }
         hmap_destroy(&cls->tables);
+        free(cls->tables_priority);
+        for (i = 0; i < CLS_N_TRIES; i++) {
+            trie_destroy(cls->tries[i]);
+        }
     }
 }
 
+/* Enables or disables, according to 'enable', the use of prefix tries to skip
+ * tables during lookups in 'cls'.  The tries are maintained either way, so
+ * this only affects performance, not results.  Prefix lookup is initially
+ * enabled. */
+void
+classifier_set_prefix_lookup(struct classifier *cls, bool enable)
+{
+    cls->use_tries = enable;
+}
+
 /* Returns true if 'cls' contains no classification rules, false otherwise. */
 bool
 classifier_is_empty(const struct classifier *cls)
@@ -194,6 +289,8 @@ classifier_replace(struct classifier *cls, struct cls_rule *rule)
 
     old_rule = insert_rule(table, rule);
     if (!old_rule) {
+        trie_insert_rule(cls, table, rule);
+        update_tables_after_insertion(cls, table, rule->priority);
         table->n_table_rules++;
         cls->n_rules++;
     }
@@ -227,6 +324,7 @@ classifier_remove(struct classifier *cls, struct cls_rule *rule)
     if (head != rule) {
         list_remove(&rule->list);
     } else if (list_is_empty(&rule->list)) {
+        remove_indices(table, rule);
         hmap_remove(&table->rules, &rule->hmap_node);
     } else {
         struct cls_rule *next = CONTAINER_OF(rule->list.next,
@@ -235,9 +333,12 @@ classifier_remove(struct classifier *cls, struct cls_rule *rule)
         list_remove(&rule->list);
         hmap_replace(&table->rules, &rule->hmap_node, &next->hmap_node);
     }
+    trie_remove_rule(cls, table, rule);
 
     if (--table->n_table_rules == 0) {
         destroy_table(cls, table);
+    } else {
+        update_tables_after_removal(cls, table, rule->priority);
     }
 
     cls->n_rules--;
@@ -245,16 +346,47 @@ classifier_remove(struct classifier *cls, struct cls_rule *rule)
 
 /* Finds and returns the highest-priority rule in 'cls' that matches 'flow'.
  * Returns a null pointer if no rules in 'cls' match 'flow'.  If multiple rules
- * of equal priority match 'flow', returns one arbitrarily. */
+ * of equal priority match 'flow', returns one arbitrarily.
+ *
+ * If 'wc' is nonnull, every field that the lookup examined is made significant
+ * in 'wc', so that any flow that agrees with 'flow' in all of the significant
+ * fields of 'wc' has the same result.
+ *
+ * Tables are visited in order of decreasing maximum priority, and the search
+ * stops at the first table that cannot contain a rule with higher priority
+ * than the best match found so far.  Tables whose prefix length in a trie
+ * field cannot match 'flow' are skipped.  Within a table, the lookup proceeds
+ * in stages and only the fields in the stages actually examined are made
+ * significant in 'wc'. */
 struct cls_rule *
-classifier_lookup(const struct classifier *cls, const struct flow *flow)
+classifier_lookup(const struct classifier *cls, const struct flow *flow,
+                  struct flow_wildcards *wc)
 {
-    struct cls_table *table;
+    size_t n_tables = hmap_count(&cls->tables);
+    struct trie_ctx tries[CLS_N_TRIES];
     struct cls_rule *best;
+    size_t i;
+
+    COVERAGE_INC(cls_lookup);
+
+    for (i = 0; i < CLS_N_TRIES; i++) {
+        tries[i].lookup_done = false;
+    }
 
     best = NULL;
-    HMAP_FOR_EACH (table, hmap_node, &cls->tables) {
-        struct cls_rule *rule = find_match(table, flow);
+    for (i = 0; i < n_tables; i++) {
+        struct cls_table *table = cls->tables_priority[i];
+        struct cls_rule *rule;
+
+        if (best && table->max_priority <= best->priority) {
+            break;
+        }
+
+        if (cls->use_tries && trie_skip_table(cls, table, flow, tries, wc)) {
+            continue;
+        }
+
+        rule = find_match(table, flow, wc);
         if (rule && (!best || rule->priority > best->priority)) {
             best = rule;
         }
@@ -278,8 +410,7 @@ classifier_find_rule_exactly(const struct classifier *cls,
     }
 
     head = find_equal(table, &target->match.flow,
-                      miniflow_hash_in_minimask(&target->match.flow,
-                                                &target->match.mask, 0));
+                      table_hash_miniflow(table, &target->match.flow, NULL));
     FOR_EACH_RULE_IN_LIST (rule, head) {
         if (target->priority >= rule->priority) {
             return target->priority == rule->priority ? rule : NULL;
@@ -313,13 +444,20 @@ bool
 classifier_rule_overlaps(const struct classifier *cls,
                          const struct cls_rule *target)
 {
-    struct cls_table *table;
+    size_t n_tables = hmap_count(&cls->tables);
+    size_t i;
 
-    HMAP_FOR_EACH (table, hmap_node, &cls->tables) {
+    for (i = 0; i < n_tables; i++) {
+        struct cls_table *table = cls->tables_priority[i];
         uint32_t storage[FLOW_U32S];
         struct minimask mask;
         struct cls_rule *head;
 
+        if (table->max_priority < target->priority) {
+            /* No rule in this or any later table has 'target''s priority. */
+            break;
+        }
+
         minimask_combine(&mask, &target->match.mask, &table->mask, storage);
         HMAP_FOR_EACH (head, hmap_node, &table->rules) {
             struct cls_rule *rule;
@@ -488,34 +626,334 @@ find_table(const struct classifier *cls, const struct minimask *mask)
     return NULL;
 }
 
+/* Inserts a new, empty table with the given 'mask' into 'cls'.  The new table
+ * goes at the end of 'cls->tables_priority', which is the correct position
+ * for a table whose 'max_priority' is 0. */
 static struct cls_table *
 insert_table(struct classifier *cls, const struct minimask *mask)
 {
+    size_t n_tables = hmap_count(&cls->tables);
     struct cls_table *table;
+    int i;
 
     table = xzalloc(sizeof *table);
     hmap_init(&table->rules);
     minimask_clone(&table->mask, mask);
+
+    for (i = 0; i < CLS_N_STAGES; i++) {
+        int j;
+
+        for (j = 0; j < MINI_N_MAPS; j++) {
+            if (mask->masks.map[j] & stage_ranges[i][j]) {
+                table->stages[table->n_stages++] = i;
+                break;
+            }
+        }
+    }
+    for (i = 0; i < CLS_N_STAGES - 1; i++) {
+        hmap_init(&table->indices[i]);
+    }
+    for (i = 0; i < CLS_N_TRIES; i++) {
+        table->trie_plens[i] = minimask_get_prefix_len(mask, &trie_fields[i]);
+    }
     hmap_insert(&cls->tables, &table->hmap_node, minimask_hash(mask, 0));
 
+    if (n_tables >= cls->allocated_tables) {
+        cls->tables_priority = x2nrealloc(cls->tables_priority,
+                                          &cls->allocated_tables,
+                                          sizeof *cls->tables_priority);
+    }
+    table->priority_idx = n_tables;
+    cls->tables_priority[n_tables] = table;
+
     return table;
 }
 
 static void
 destroy_table(struct classifier *cls, struct cls_table *table)
 {
+    size_t n_tables = hmap_count(&cls->tables);
+    size_t i;
+
+    for (i = table->priority_idx; i + 1 < n_tables; i++) {
+        struct cls_table *next = cls->tables_priority[i + 1];
+
+        cls->tables_priority[i] = next;
+        next->priority_idx = i;
+    }
+
     minimask_destroy(&table->mask);
     hmap_remove(&cls->tables, &table->hmap_node);
     hmap_destroy(&table->rules);
+    destroy_indices(table);
     free(table);
 }
 
+/* Exchanges the tables at positions 'i' and 'j' in 'cls->tables_priority'. */
+static void
+swap_tables(struct classifier *cls, size_t i, size_t j)
+{
+    struct cls_table *a = cls->tables_priority[i];
+    struct cls_table *b = cls->tables_priority[j];
+
+    cls->tables_priority[i] = b;
+    b->priority_idx = i;
+    cls->tables_priority[j] = a;
+    a->priority_idx = j;
+}
+
+/* Updates 'table''s maximum priority, and its position in
+ * 'cls->tables_priority', for a rule with priority 'new_priority' that was
+ * just added to it. */
+static void
+update_tables_after_insertion(struct classifier *cls, struct cls_table *table,
+                              unsigned int new_priority)
+{
+    if (new_priority == table->max_priority) {
+        table->max_count++;
+    } else if (new_priority > table->max_priority) {
+        size_t i;
+
+        table->max_priority = new_priority;
+        table->max_count = 1;
+
+        for (i = table->priority_idx; i > 0; i--) {
+            if (cls->tables_priority[i - 1]->max_priority >= new_priority) {
+                break;
+            }
+            swap_tables(cls, i - 1, i);
+        }
+    }
+}
+
+/* Updates 'table''s maximum priority, and its position in
+ * 'cls->tables_priority', for a rule with priority 'del_priority' that was
+ * just removed from it.  'table' must not be empty. */
+static void
+update_tables_after_removal(struct classifier *cls, struct cls_table *table,
+                            unsigned int del_priority)
+{
+    if (del_priority == table->max_priority && --table->max_count == 0) {
+        size_t n_tables = hmap_count(&cls->tables);
+        struct cls_rule *head;
+        size_t i;
+
+        /* Each list head has the highest priority in its list, so only the
+         * heads need to be examined. */
+        table->max_priority = 0;
+        HMAP_FOR_EACH (head, hmap_node, &table->rules) {
+            if (head->priority > table->max_priority) {
+                table->max_priority = head->priority;
+                table->max_count = 1;
+            } else if (head->priority == table->max_priority) {
+                table->max_count++;
+            }
+        }
+
+        for (i = table->priority_idx; i + 1 < n_tables; i++) {
+            if (cls->tables_priority[i + 1]->max_priority
+                <= table->max_priority) {
+                break;
+            }
+            swap_tables(cls, i, i + 1);
+        }
+    }
+}
+
+/* Adds the words [ofs, ofs + size) of "struct flow" to 'range'. */
+static void
+stage_range_add(uint32_t range[], size_t ofs, size_t size)
+{
+    size_t i;
+
+    for (i = ofs / 4; i < DIV_ROUND_UP(ofs + size, 4); i++) {
+        range[i / 32] |= 1u << (i % 32);
+    }
+}
+
+#define STAGE_ADD_FIELD(STAGE, FIELD)                           \
+    stage_range_add(stage_ranges[STAGE], offsetof(struct flow, FIELD), \
+                    sizeof ((struct flow *) NULL)->FIELD)
+
+static void
+init_stage_ranges(void)
+{
+    static bool inited;
+    uint32_t seen[MINI_N_MAPS];
+    int i, j;
+
+    if (inited) {
+        return;
+    }
+    inited = true;
+
+    STAGE_ADD_FIELD(CLS_STAGE_METADATA, tunnel);
+    STAGE_ADD_FIELD(CLS_STAGE_METADATA, metadata);
+    STAGE_ADD_FIELD(CLS_STAGE_METADATA, regs);
+    STAGE_ADD_FIELD(CLS_STAGE_METADATA, skb_priority);
+    STAGE_ADD_FIELD(CLS_STAGE_METADATA, in_port);
+
+    STAGE_ADD_FIELD(CLS_STAGE_L2, dl_src);
+    STAGE_ADD_FIELD(CLS_STAGE_L2, dl_dst);
+    STAGE_ADD_FIELD(CLS_STAGE_L2, vlan_tci);
+    STAGE_ADD_FIELD(CLS_STAGE_L2, dl_type);
+
+    STAGE_ADD_FIELD(CLS_STAGE_L3, nw_src);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, nw_dst);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, ipv6_src);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, ipv6_dst);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, ipv6_label);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, nw_proto);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, nw_tos);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, nw_ttl);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, nw_frag);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, arp_sha);
+    STAGE_ADD_FIELD(CLS_STAGE_L3, arp_tha);
+
+    /* Everything else, that is, tp_src, tp_dst, and nd_target, is L4.  A word
+     * shared by fields in two stages belongs to the earlier one. */
+    memset(seen, 0, sizeof seen);
+    for (i = 0; i < CLS_N_STAGES - 1; i++) {
+        for (j = 0; j < MINI_N_MAPS; j++) {
+            stage_ranges[i][j] &= ~seen[j];
+            seen[j] |= stage_ranges[i][j];
+        }
+    }
+    stage_range_add(stage_ranges[CLS_STAGE_L4], 0, sizeof(struct flow));
+    for (j = 0; j < MINI_N_MAPS; j++) {
+        stage_ranges[CLS_STAGE_L4][j] &= ~seen[j];
+    }
+}
+
+/* Returns the hash of 'flow' within 'table->mask', in the form used for
+ * 'table->rules'.  If 'index_hashes' is nonnull, also stores the hash for
+ * each of 'table''s 'n_stages - 1' indices into it. */
+static uint32_t
+table_hash_miniflow(const struct cls_table *table,
+                    const struct miniflow *flow, uint32_t index_hashes[])
+{
+    uint32_t basis = 0;
+    uint32_t hash = 0;
+    int i;
+
+    for (i = 0; i < table->n_stages; i++) {
+        hash = miniflow_hash_in_minimask_range(flow, &table->mask,
+                                               stage_ranges[table->stages[i]],
+                                               &basis);
+        if (index_hashes && i + 1 < table->n_stages) {
+            index_hashes[i] = hash;
+        }
+    }
+    return hash;
+}
+
+static struct cls_stage_hash *
+find_stage_hash(const struct hmap *index, uint32_t hash)
+{
+    struct cls_stage_hash *sh;
+
+    HMAP_FOR_EACH_WITH_HASH (sh, hmap_node, hash, index) {
+        return sh;
+    }
+    return NULL;
+}
+
+/* Adds 'head', which was just inserted into 'table->rules', to 'table''s
+ * stage indices. */
+static void
+insert_indices(struct cls_table *table, const struct cls_rule *head)
+{
+    uint32_t hashes[CLS_N_STAGES - 1];
+    int i;
+
+    table_hash_miniflow(table, &head->match.flow, hashes);
+    for (i = 0; i + 1 < table->n_stages; i++) {
+        struct cls_stage_hash *sh = find_stage_hash(&table->indices[i],
+                                                    hashes[i]);
+        if (!sh) {
+            sh = xmalloc(sizeof *sh);
+            sh->n_heads = 0;
+            hmap_insert(&table->indices[i], &sh->hmap_node, hashes[i]);
+        }
+        sh->n_heads++;
+    }
+}
+
+/* Removes 'head', which is about to be removed from 'table->rules', from
+ * 'table''s stage indices. */
+static void
+remove_indices(struct cls_table *table, const struct cls_rule *head)
+{
+    uint32_t hashes[CLS_N_STAGES - 1];
+    int i;
+
+    table_hash_miniflow(table, &head->match.flow, hashes);
+    for (i = 0; i + 1 < table->n_stages; i++) {
+        struct cls_stage_hash *sh = find_stage_hash(&table->indices[i],
+                                                    hashes[i]);
+        if (!--sh->n_heads) {
+            hmap_remove(&table->indices[i], &sh->hmap_node);
+            free(sh);
+        }
+    }
+}
+
+static void
+destroy_indices(struct cls_table *table)
+{
+    int i;
+
+    for (i = 0; i < CLS_N_STAGES - 1; i++) {
+        struct cls_stage_hash *sh, *next_sh;
+
+        HMAP_FOR_EACH_SAFE (sh, next_sh, hmap_node, &table->indices[i]) {
+            hmap_remove(&table->indices[i], &sh->hmap_node);
+            free(sh);
+        }
+        hmap_destroy(&table->indices[i]);
+    }
+}
+
+/* Returns the highest-priority rule in 'table' that matches 'flow', or a null
+ * pointer if there is none.  The fields of 'flow' are hashed one stage at a
+ * time, and the search gives up as soon as a stage index shows that no rule
+ * can match.  If 'wc' is nonnull, the fields in the stages that were examined
+ * are made significant in 'wc'. */
 static struct cls_rule *
-find_match(const struct cls_table *table, const struct flow *flow)
+find_match(const struct cls_table *table, const struct flow *flow,
+           struct flow_wildcards *wc)
 {
-    uint32_t hash = flow_hash_in_minimask(flow, &table->mask, 0);
+    uint32_t basis = 0;
+    uint32_t hash = 0;
     struct cls_rule *rule;
+    int i;
+
+    COVERAGE_INC(cls_table_probe);
+    for (i = 0; i < table->n_stages; i++) {
+        hash = flow_hash_in_minimask_range(flow, &table->mask,
+                                           stage_ranges[table->stages[i]],
+                                           &basis);
+        COVERAGE_INC(cls_stage_probe);
+        if (i + 1 < table->n_stages
+            && !find_stage_hash(&table->indices[i], hash)) {
+            /* No rule in 'table' agrees with 'flow' in the stages so far, so
+             * the fields in the remaining stages cannot matter. */
+            COVERAGE_INC(cls_stage_miss);
+            if (wc) {
+                int j;
+
+                for (j = 0; j <= i; j++) {
+                    flow_wildcards_fold_minimask_range(
+                        wc, &table->mask, stage_ranges[table->stages[j]]);
+                }
+            }
+            return NULL;
+        }
+    }
 
+    if (wc) {
+        flow_wildcards_fold_minimask(wc, &table->mask);
+    }
     HMAP_FOR_EACH_WITH_HASH (rule, hmap_node, hash, &table->rules) {
         if (miniflow_equal_flow_in_minimask(&rule->match.flow, flow,
                                             &table->mask)) {
@@ -544,12 +982,12 @@ insert_rule(struct cls_table *table, struct cls_rule *new)
 {
     struct cls_rule *head;
 
-    new->hmap_node.hash = miniflow_hash_in_minimask(&new->match.flow,
-                                                    &new->match.mask, 0);
+    new->hmap_node.hash = table_hash_miniflow(table, &new->match.flow, NULL);
 
     head = find_equal(table, &new->match.flow, new->hmap_node.hash);
     if (!head) {
         hmap_insert(&table->rules, &new->hmap_node, new->hmap_node.hash);
+        insert_indices(table, new);
         list_init(&new->list);
         return NULL;
     } else {
@@ -580,6 +1018,330 @@ insert_rule(struct cls_table *table, struct cls_rule *new)
     }
 }
 
+/* Prefix tries. */
+
+/* Returns a 32-bit mask with the 'n' most significant bits set. */
+static uint32_t
+prefix_mask(unsigned int n)
+{
+    return n ? UINT32_MAX << (32 - n) : 0;
+}
+
+/* Returns the length of the CIDR prefix that 'mask' matches in 'field', or 0
+ * if 'mask' does not match 'field' or matches it on something other than a
+ * CIDR prefix. */
+static unsigned int
+minimask_get_prefix_len(const struct minimask *mask,
+                        const struct trie_field *field)
+{
+    unsigned int plen = 0;
+    bool ended = false;
+    unsigned int i;
+
+    for (i = 0; i < field->n_bits / 32; i++) {
+        ovs_be32 word = (OVS_FORCE ovs_be32) minimask_get(mask,
+                                                          field->ofs / 4 + i);
+        uint32_t bits = ntohl(word);
+
+        if (ended) {
+            if (bits) {
+                return 0;
+            }
+        } else if (bits == UINT32_MAX) {
+            plen += 32;
+        } else {
+            unsigned int n = 31 - log_2_floor(~bits);
+
+            if (bits != prefix_mask(n)) {
+                return 0;
+            }
+            plen += n;
+            ended = true;
+        }
+    }
+    return plen;
+}
+
+/* Returns bit 'ofs' of 'value', counting from the most significant bit of
+ * 'value[0]'. */
+static unsigned int
+trie_get_bit(const ovs_be32 value[], unsigned int ofs)
+{
+    return (ntohl(value[ofs / 32]) >> (31 - ofs % 32)) & 1;
+}
+
+/* Returns the 'n_bits' bits of 'value' starting at bit 'ofs', in the most
+ * significant bits of the return value.  'n_bits' must be between 1 and 32. */
+static uint32_t
+trie_get_bits(const ovs_be32 value[], unsigned int ofs, unsigned int n_bits)
+{
+    unsigned int shift = ofs % 32;
+    uint32_t bits = ntohl(value[ofs / 32]) << shift;
+
+    if (shift && shift + n_bits > 32) {
+        bits |= ntohl(value[ofs / 32 + 1]) >> (32 - shift);
+    }
+    return bits & prefix_mask(n_bits);
+}
+
+/* Returns the number of leading bits of 'node''s prefix that equal the bits
+ * of 'value' starting at 'ofs', considering at most 'max_bits' bits. */
+static unsigned int
+trie_prefix_equal_bits(const struct trie_node *node, const ovs_be32 value[],
+                       unsigned int ofs, unsigned int max_bits)
+{
+    unsigned int n = MIN(node->n_bits, max_bits);
+    uint32_t diff;
+
+    if (!n) {
+        return 0;
+    }
+    diff = (node->prefix ^ trie_get_bits(value, ofs, n)) & prefix_mask(n);
+    return diff ? 31 - log_2_floor(diff) : n;
+}
+
+/* Returns a new chain of nodes for the 'n_bits' bits of 'value' starting at
+ * 'ofs', with one rule at its end. */
+static struct trie_node *
+trie_branch_create(const ovs_be32 value[], unsigned int ofs,
+                   unsigned int n_bits)
+{
+    struct trie_node *node = xzalloc(sizeof *node);
+    unsigned int n = MIN(n_bits, 32);
+
+    node->prefix = trie_get_bits(value, ofs, n);
+    node->n_bits = n;
+    if (n_bits > n) {
+        node->edges[trie_get_bit(value, ofs + n)]
+            = trie_branch_create(value, ofs + n, n_bits - n);
+    } else {
+        node->n_rules = 1;
+    }
+    return node;
+}
+
+/* Adds a rule that matches the 'plen'-bit prefix of 'value' to the trie whose
+ * root is '*root'. */
+static void
+trie_insert(struct trie_node **root, const ovs_be32 value[], unsigned int plen)
+{
+    struct trie_node **edge = root;
+    unsigned int ofs = 0;
+
+    for (;;) {
+        struct trie_node *node = *edge;
+        unsigned int eqbits;
+
+        if (!node) {
+            *edge = trie_branch_create(value, ofs, plen - ofs);
+            return;
+        }
+
+        eqbits = trie_prefix_equal_bits(node, value, ofs, plen - ofs);
+        if (eqbits < node->n_bits) {
+            /* Split 'node' after its first 'eqbits' bits. */
+            struct trie_node *new = xzalloc(sizeof *new);
+
+            new->prefix = node->prefix & prefix_mask(eqbits);
+            new->n_bits = eqbits;
+            node->prefix <<= eqbits;
+            node->n_bits -= eqbits;
+            new->edges[node->prefix >> 31] = node;
+            *edge = node = new;
+        }
+
+        ofs += node->n_bits;
+        if (ofs == plen) {
+            node->n_rules++;
+            return;
+        }
+        edge = &node->edges[trie_get_bit(value, ofs)];
+    }
+}
+
+/* Removes a rule that matches the 'plen'-bit prefix of 'value' from the trie
+ * whose root is '*root'.  The trie must contain such a rule. */
+static void
+trie_remove(struct trie_node **root, const ovs_be32 value[], unsigned int plen)
+{
+    struct trie_node **edges[TRIE_MAX_BITS + 1];
+    struct trie_node **edge = root;
+    struct trie_node *node;
+    unsigned int ofs = 0;
+    int depth = 0;
+
+    for (;;) {
+        node = *edge;
+        assert(node);
+        assert(trie_prefix_equal_bits(node, value, ofs, plen - ofs)
+               == node->n_bits);
+
+        edges[depth++] = edge;
+        ofs += node->n_bits;
+        if (ofs == plen) {
+            break;
+        }
+        edge = &node->edges[trie_get_bit(value, ofs)];
+    }
+
+    assert(node->n_rules > 0);
+    node->n_rules--;
+
+    /* Working upward, free nodes that no longer lead to any rule and merge a
+     * node without rules into its only child. */
+    while (depth-- > 0) {
+        edge = edges[depth];
+        node = *edge;
+        if (node->n_rules) {
+            break;
+        } else if (!node->edges[0] && !node->edges[1]) {
+            *edge = NULL;
+            free(node);
+        } else {
+            struct trie_node *child = node->edges[!node->edges[0]];
+
+            if ((!node->edges[0] || !node->edges[1])
+                && node->n_bits + child->n_bits <= 32) {
+                child->prefix = node->prefix | child->prefix >> node->n_bits;
+                child->n_bits += node->n_bits;
+                *edge = child;
+                free(node);
+            }
+            break;
+        }
+    }
+}
+
+/* Sets bit 'n' in 'plens' for each prefix length 'n' such that some rule in
+ * the trie with the given 'root' matches the 'n'-bit prefix of 'value', which
+ * is 'n_bits' bits wide. */
+static void
+trie_lookup(const struct trie_node *root, const ovs_be32 value[],
+            unsigned int n_bits, unsigned long plens[])
+{
+    const struct trie_node *node = root;
+    unsigned int ofs = 0;
+
+    while (node) {
+        if (trie_prefix_equal_bits(node, value, ofs, n_bits - ofs)
+            < node->n_bits) {
+            break;
+        }
+        ofs += node->n_bits;
+        if (node->n_rules) {
+            bitmap_set1(plens, ofs);
+        }
+        if (ofs >= n_bits) {
+            break;
+        }
+        node = node->edges[trie_get_bit(value, ofs)];
+    }
+}
+
+static void
+trie_destroy(struct trie_node *node)
+{
+    if (node) {
+        trie_destroy(node->edges[0]);
+        trie_destroy(node->edges[1]);
+        free(node);
+    }
+}
+
+/* Copies the value of 'field' in 'flow' into 'value'. */
+static void
+trie_get_miniflow_value(const struct miniflow *flow,
+                        const struct trie_field *field, ovs_be32 value[])
+{
+    unsigned int i;
+
+    for (i = 0; i < field->n_bits / 32; i++) {
+        value[i] = (OVS_FORCE ovs_be32) miniflow_get(flow, field->ofs / 4 + i);
+    }
+}
+
+/* Adds 'rule', which was just inserted into 'table', to 'cls''s tries. */
+static void
+trie_insert_rule(struct classifier *cls, const struct cls_table *table,
+                 const struct cls_rule *rule)
+{
+    int i;
+
+    for (i = 0; i < CLS_N_TRIES; i++) {
+        if (table->trie_plens[i]) {
+            ovs_be32 value[TRIE_MAX_BITS / 32];
+
+            trie_get_miniflow_value(&rule->match.flow, &trie_fields[i], value);
+            trie_insert(&cls->tries[i], value, table->trie_plens[i]);
+        }
+    }
+}
+
+/* Removes 'rule', which was just removed from 'table', from 'cls''s tries. */
+static void
+trie_remove_rule(struct classifier *cls, const struct cls_table *table,
+                 const struct cls_rule *rule)
+{
+    int i;
+
+    for (i = 0; i < CLS_N_TRIES; i++) {
+        if (table->trie_plens[i]) {
+            ovs_be32 value[TRIE_MAX_BITS / 32];
+
+            trie_get_miniflow_value(&rule->match.flow, &trie_fields[i], value);
+            trie_remove(&cls->tries[i], value, table->trie_plens[i]);
+        }
+    }
+}
+
+/* Returns true if 'cls''s tries show that no rule in 'table' can match 'flow'.
+ * In that case, if 'wc' is nonnull, also makes the prefix bits that this
+ * conclusion depends on significant in 'wc'.
+ *
+ * 'tries' caches the result of looking up 'flow' in each trie. */
+static bool
+trie_skip_table(const struct classifier *cls, const struct cls_table *table,
+                const struct flow *flow, struct trie_ctx tries[],
+                struct flow_wildcards *wc)
+{
+    int i;
+
+    for (i = 0; i < CLS_N_TRIES; i++) {
+        const struct trie_field *field = &trie_fields[i];
+        unsigned int plen = table->trie_plens[i];
+        struct trie_ctx *ctx = &tries[i];
+
+        if (!plen) {
+            continue;
+        }
+
+        if (!ctx->lookup_done) {
+            memset(ctx->plens, 0, sizeof ctx->plens);
+            trie_lookup(cls->tries[i],
+                        (const ovs_be32 *) ((const char *) flow + field->ofs),
+                        field->n_bits, ctx->plens);
+            ctx->lookup_done = true;
+        }
+
+        if (!bitmap_is_set(ctx->plens, plen)) {
+            /* Whether a 'plen'-bit prefix is in the trie depends only on the
+             * first 'plen' bits of the field. */
+            if (wc) {
+                ovs_be32 *masks = (ovs_be32 *) ((char *) &wc->masks
+                                                + field->ofs);
+                unsigned int j;
+
+                for (j = 0; j * 32 < plen; j++) {
+                    masks[j] |= htonl(prefix_mask(MIN(plen - j * 32, 32)));
+                }
+            }
+            COVERAGE_INC(cls_trie_skip);
+            return true;
+        }
+    }
+    return false;
+}
+
 static struct cls_rule *
 next_rule_in_list__(struct cls_rule *rule)
 {
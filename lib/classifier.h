@@ -37,10 +37,59 @@
 extern "C" {
 #endif
 
+/* Prefix tries.
+ *
+ * The classifier keeps a binary trie of the prefixes that rules match in
+ * each of CLS_N_TRIES address fields: nw_src, nw_dst, ipv6_src, and ipv6_dst.
+ * A table whose mask matches one of these fields on a CIDR prefix of length
+ * 'plen' can only contain a matching rule if some rule in the classifier
+ * matches a 'plen'-bit prefix of the packet's address.  One walk down the
+ * trie finds every prefix length that does, so a lookup can skip tables for
+ * the other prefix lengths without probing them.  This keeps a routing table
+ * with many different prefix lengths from costing one probe per length. */
+#define CLS_N_TRIES 4
+
+/* A node in a prefix trie.  Runs of bits without branches are compressed into
+ * single nodes of up to 32 bits. */
+struct trie_node {
+    uint32_t prefix;            /* 'n_bits' prefix bits, MSB first. */
+    unsigned int n_bits;        /* 0 to 32, and 0 only at the root. */
+    unsigned int n_rules;       /* Number of rules with exactly this prefix. */
+    struct trie_node *edges[2]; /* Children, by the first bit of their
+                                 * prefix. */
+};
+
 /* A flow classifier. */
 struct classifier {
     int n_rules;                /* Total number of rules. */
     struct hmap tables;         /* Contains "struct cls_table"s.  */
+
+    /* The tables in 'tables', in order of decreasing 'max_priority', so that
+     * a lookup can stop as soon as no remaining table can contain a better
+     * match. */
+    struct cls_table **tables_priority;
+    size_t allocated_tables;    /* Number of elements in 'tables_priority'. */
+
+    /* Prefix tries, and whether lookups consult them. */
+    struct trie_node *tries[CLS_N_TRIES];
+    bool use_tries;
+};
+
+/* Staged lookup.
+ *
+ * The fields of a flow are divided into CLS_N_STAGES groups ("stages"):
+ * metadata, L2, L3, and L4, in that order.  A table whose mask covers fields
+ * in more than one stage keeps an index for each stage but the last.  Index
+ * 'i' holds the hashes of the rules' fields in the table's first 'i + 1'
+ * stages, so that a lookup can give up on a table as soon as the packet's
+ * fields in some stage are not in the corresponding index, without hashing
+ * or comparing the fields in later stages. */
+#define CLS_N_STAGES 4
+
+/* A hash value in one of a cls_table's stage indices. */
+struct cls_stage_hash {
+    struct hmap_node hmap_node; /* Within a struct cls_table 'indices' hmap. */
+    unsigned int n_heads;       /* Number of rules in 'rules' with this hash. */
 };
 
 /* A set of rules that all have the same fields wildcarded. */
@@ -49,6 +98,18 @@ struct cls_table {
     struct hmap rules;          /* Contains "struct cls_rule"s. */
     struct minimask mask;       /* Wildcards for fields. */
     int n_table_rules;          /* Number of rules, including duplicates. */
+    unsigned int max_priority;  /* Max priority of any rule in the table. */
+    unsigned int max_count;     /* Number of rules with 'max_priority'. */
+    size_t priority_idx;        /* Index in classifier's 'tables_priority'. */
+
+    /* Length of the CIDR prefix that 'mask' matches in each trie field, or 0
+     * if 'mask' does not match the field on a nonempty CIDR prefix. */
+    uint8_t trie_plens[CLS_N_TRIES];
+
+    /* Staged lookup. */
+    int n_stages;               /* Number of stages that 'mask' covers. */
+    uint8_t stages[CLS_N_STAGES]; /* The stages that 'mask' covers, in order. */
+    struct hmap indices[CLS_N_STAGES - 1]; /* "struct cls_stage_hash"es. */
 };
 
 /* Returns true if 'table' is a "catch-all" table that will match every
@@ -86,13 +147,15 @@ bool cls_rule_is_loose_match(const struct cls_rule *rule,
 
 void classifier_init(struct classifier *);
 void classifier_destroy(struct classifier *);
+void classifier_set_prefix_lookup(struct classifier *, bool enable);
 bool classifier_is_empty(const struct classifier *);
 int classifier_count(const struct classifier *);
 void classifier_insert(struct classifier *, struct cls_rule *);
 struct cls_rule *classifier_replace(struct classifier *, struct cls_rule *);
 void classifier_remove(struct classifier *, struct cls_rule *);
 struct cls_rule *classifier_lookup(const struct classifier *,
-                                   const struct flow *);
+                                   const struct flow *,
+                                   struct flow_wildcards *);
 bool classifier_rule_overlaps(const struct classifier *,
                               const struct cls_rule *);
 
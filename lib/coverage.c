@@ -17,6 +17,7 @@
 #include <config.h>
 #include "coverage.h"
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include "dynamic-string.h"
 #include "hash.h"
@@ -47,6 +48,10 @@ struct coverage_counter *coverage_counters[] = {
 #define n_coverage_counters ARRAY_SIZE(coverage_counters)
 #endif  /* !USE_LINKER_SECTIONS */
 
+/* Protects 'epoch' and the 'count' and 'total' members of the counters, which
+ * coverage_flush() updates from any thread. */
+static pthread_mutex_t coverage_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static unsigned int epoch;
 
 static void coverage_read(struct svec *);
@@ -58,8 +63,11 @@ coverage_unixctl_show(struct unixctl_conn *conn, int argc OVS_UNUSED,
     struct svec lines;
     char *reply;
 
+    coverage_flush();
     svec_init(&lines);
+    pthread_mutex_lock(&coverage_mutex);
     coverage_read(&lines);
+    pthread_mutex_unlock(&coverage_mutex);
     reply = svec_join(&lines, "\n", "\n");
     unixctl_command_reply(conn, reply);
     free(reply);
@@ -167,7 +175,11 @@ coverage_log(void)
     static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 3);
 
     if (!VLOG_DROP_INFO(&rl)) {
-        uint32_t hash = coverage_hash();
+        uint32_t hash;
+
+        coverage_flush();
+        pthread_mutex_lock(&coverage_mutex);
+        hash = coverage_hash();
         if (coverage_hit(hash)) {
             VLOG_INFO("Skipping details of duplicate event coverage for "
                       "hash=%08"PRIx32" in epoch %u", hash, epoch);
@@ -183,6 +195,7 @@ coverage_log(void)
             }
             svec_destroy(&lines);
         }
+        pthread_mutex_unlock(&coverage_mutex);
     }
 }
 
@@ -193,7 +206,8 @@ coverage_read_counter(struct svec *lines, const struct coverage_counter *c)
                                      c->name, c->count, c->count + c->total));
 }
 
-/* Adds coverage counter information to 'lines'. */
+/* Adds coverage counter information to 'lines'.  The caller must hold
+ * 'coverage_mutex'. */
 static void
 coverage_read(struct svec *lines)
 {
@@ -225,16 +239,36 @@ coverage_read(struct svec *lines)
     svec_add_nocopy(lines, xasprintf("%zu events never hit", n_never_hit));
 }
 
-/* Advances to the next epoch of coverage, resetting all the counters to 0. */
+/* Advances to the next epoch of coverage, resetting all the counters to 0.
+ * Only the main thread may call this function. */
 void
 coverage_clear(void)
 {
     size_t i;
 
+    pthread_mutex_lock(&coverage_mutex);
     epoch++;
     for (i = 0; i < n_coverage_counters; i++) {
         struct coverage_counter *c = coverage_counters[i];
-        c->total += c->count;
+        c->total += c->count + c->get_count();
         c->count = 0;
     }
+    pthread_mutex_unlock(&coverage_mutex);
+}
+
+/* Adds the events that the calling thread has counted since it last called
+ * this function to the coverage counters, so that they are reported.  A thread
+ * other than the main thread should call this function regularly, and before
+ * it exits. */
+void
+coverage_flush(void)
+{
+    size_t i;
+
+    pthread_mutex_lock(&coverage_mutex);
+    for (i = 0; i < n_coverage_counters; i++) {
+        struct coverage_counter *c = coverage_counters[i];
+        c->count += c->get_count();
+    }
+    pthread_mutex_unlock(&coverage_mutex);
 }
@@ -29,9 +29,15 @@
 
 #include "vlog.h"
 
-/* A coverage counter. */
+/* A coverage counter.
+ *
+ * Each thread counts events in its own thread-local copy of the counter, so
+ * that COVERAGE_INC is safe and cheap in any thread.  The main thread's counts
+ * are gathered into 'count' automatically; any other thread must call
+ * coverage_flush() from time to time for its counts to be reported. */
 struct coverage_counter {
     const char *name;           /* Textual name. */
+    unsigned int (*get_count)(void); /* Gets, zeros this thread's count. */
     unsigned int count;         /* Count within the current epoch. */
     unsigned long long int total; /* Total count over all epochs. */
 };
@@ -45,23 +51,35 @@ struct coverage_counter {
         struct coverage_counter *counter_ptr_##COUNTER                  \
             __attribute__((section("coverage"))) = &counter_##COUNTER
 #else
-#define COVERAGE_DEFINE(MODULE) \
+#define COVERAGE_DEFINE(MODULE)                                         \
+        extern __thread unsigned int counter_##MODULE##_count;          \
         extern struct coverage_counter counter_##MODULE
 #endif
 
 /* Adds 1 to COUNTER. */
-#define COVERAGE_INC(COUNTER) counter_##COUNTER.count++;
+#define COVERAGE_INC(COUNTER) counter_##COUNTER##_count++;
 
 /* Adds AMOUNT to COUNTER. */
-#define COVERAGE_ADD(COUNTER, AMOUNT) counter_##COUNTER.count += (AMOUNT);
+#define COVERAGE_ADD(COUNTER, AMOUNT) counter_##COUNTER##_count += (AMOUNT);
 
 void coverage_init(void);
 void coverage_log(void);
 void coverage_clear(void);
+void coverage_flush(void);
 
 /* Implementation detail. */
-#define COVERAGE_DEFINE__(COUNTER)                              \
-        extern struct coverage_counter counter_##COUNTER;       \
-        struct coverage_counter counter_##COUNTER = { #COUNTER, 0, 0 }
+#define COVERAGE_DEFINE__(COUNTER)                                      \
+        extern __thread unsigned int counter_##COUNTER##_count;         \
+        __thread unsigned int counter_##COUNTER##_count;                \
+        static unsigned int                                             \
+        counter_##COUNTER##_get_count(void)                             \
+        {                                                               \
+            unsigned int count = counter_##COUNTER##_count;             \
+            counter_##COUNTER##_count = 0;                              \
+            return count;                                               \
+        }                                                               \
+        extern struct coverage_counter counter_##COUNTER;               \
+        struct coverage_counter counter_##COUNTER                       \
+            = { #COUNTER, counter_##COUNTER##_get_count, 0, 0 }
 
 #endif /* coverage.h */
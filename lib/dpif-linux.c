@@ -29,10 +29,12 @@
 #include <linux/rtnetlink.h>
 #include <linux/sockios.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <sys/epoll.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "bitmap.h"
@@ -166,16 +168,39 @@ struct dpif_sketch {
     unsigned int error;         /* Upper bound on error in 'hits'. */
 };
 
-/* One of N_CHANNELS channels per dpif between the kernel and userspace. */
+/* One of N_CHANNELS channels per dpif between the kernel and userspace.
+ *
+ * Only the handler that receives from a channel, which may run in a thread of
+ * its own, accesses the members other than 'sock'.  Times are from
+ * dpif_linux_thread_time_msec(). */
 struct dpif_channel {
     struct nl_sock *sock;       /* Netlink socket. */
     struct dpif_sketch sketches[N_SKETCHES]; /* From max to min 'hits'. */
     long long int last_poll;    /* Last time this channel was polled. */
+    long long int next_scale;   /* Next time to scale down the sketches. */
+};
+
+/* Upcalls that a handler lost because a channel's socket buffer overflowed.
+ * A handler may run in a thread of its own, where it can neither log nor use
+ * the Netlink socket that looks up port names, so it records its losses here
+ * and dpif_linux_run() reports them from the main thread. */
+struct dpif_loss {
+    unsigned int n;             /* Number of losses not yet reported. */
+    int channel;                /* Channel of the most recent loss. */
+    long long int poll_age;     /* ms since 'channel' was last polled before
+                                 * the loss, or -1 if it never was. */
+    struct dpif_sketch sketches[N_SKETCHES]; /* 'channel''s sketches. */
+};
+
+/* A handler of upcalls, which receives the upcalls from the channels whose
+ * index modulo the number of handlers is its own index. */
+struct dpif_handler {
+    int epoll_fd;               /* epoll fd that includes channel socks. */
+    uint32_t ready_mask;        /* 1-bit for each sock with unread messages. */
 };
 
-static void update_sketch(struct dpif_channel *, uint32_t port_no);
-static void scale_sketches(struct dpif *);
-static void report_loss(struct dpif *, struct dpif_channel *);
+static void update_sketch(struct dpif_channel *, uint32_t port_no,
+                          long long int now);
 
 /* Interval, in milliseconds, at which to scale down the sketch values by a
  * factor of 2.  The Metwally algorithm doesn't do this, which makes sense in
@@ -188,11 +213,15 @@ struct dpif_linux {
     struct dpif dpif;
     int dp_ifindex;
 
-    /* Upcall messages. */
+    /* Upcall messages.  'handlers' is nonnull if and only if receiving
+     * upcalls is enabled. */
     struct dpif_channel channels[N_CHANNELS];
-    uint32_t ready_mask;        /* 1-bit for each sock with unread messages. */
-    int epoll_fd;               /* epoll fd that includes channel socks. */
-    long long int next_scale;   /* Next time to scale down the sketches. */
+    struct dpif_handler *handlers;
+    uint32_t n_handlers;        /* Number of handlers. */
+
+    /* Lost upcalls. */
+    pthread_mutex_t loss_mutex; /* Protects 'loss'. */
+    struct dpif_loss loss;
 
     /* Change notification. */
     struct sset changed_ports;  /* Ports that have changed. */
@@ -203,8 +232,24 @@ struct dpif_linux {
     uint32_t alloc_port_no;
 };
 
+static void record_loss(struct dpif_linux *, struct dpif_channel *,
+                        long long int now);
+static void report_loss(struct dpif_linux *);
+
 static struct vlog_rate_limit error_rl = VLOG_RATE_LIMIT_INIT(9999, 5);
 
+/* Returns the current time in milliseconds, using the same clock as
+ * time_msec().  Unlike time_msec(), this is safe to call from an upcall
+ * handler thread, although it ignores "time/warp". */
+static long long int
+dpif_linux_thread_time_msec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_to_msec(&now);
+}
+
 /* Generic Netlink family numbers for OVS. */
 static int ovs_datapath_family;
 static int ovs_vport_family;
@@ -298,32 +343,86 @@ open_dpif(const struct dpif_linux_dp *dp, struct dpif **dpifp)
     dpif = xzalloc(sizeof *dpif);
     dpif->port_notifier = nln_notifier_create(nln, dpif_linux_port_changed,
                                               dpif);
-    dpif->epoll_fd = -1;
+    dpif->n_handlers = 1;
 
     dpif_init(&dpif->dpif, &dpif_linux_class, dp->name,
               dp->dp_ifindex, dp->dp_ifindex);
 
-    dpif->next_scale = LLONG_MAX;
+    pthread_mutex_init(&dpif->loss_mutex, NULL);
 
     dpif->dp_ifindex = dp->dp_ifindex;
     sset_init(&dpif->changed_ports);
     *dpifp = &dpif->dpif;
 }
 
+static void
+destroy_handlers(struct dpif_linux *dpif)
+{
+    if (dpif->handlers) {
+        uint32_t i;
+
+        for (i = 0; i < dpif->n_handlers; i++) {
+            if (dpif->handlers[i].epoll_fd >= 0) {
+                close(dpif->handlers[i].epoll_fd);
+            }
+        }
+        free(dpif->handlers);
+        dpif->handlers = NULL;
+    }
+}
+
+/* Creates 'dpif''s 'n_handlers' handlers and divides its channels, which must
+ * already exist, among them. */
+static int
+create_handlers(struct dpif_linux *dpif)
+{
+    uint32_t i;
+
+    dpif->handlers = xmalloc(dpif->n_handlers * sizeof *dpif->handlers);
+    for (i = 0; i < dpif->n_handlers; i++) {
+        struct dpif_handler *handler = &dpif->handlers[i];
+
+        handler->ready_mask = 0;
+        handler->epoll_fd = epoll_create(N_CHANNELS);
+        if (handler->epoll_fd < 0) {
+            int error = errno;
+
+            while (++i < dpif->n_handlers) {
+                dpif->handlers[i].epoll_fd = -1;
+            }
+            destroy_handlers(dpif);
+            return error;
+        }
+    }
+
+    for (i = 0; i < N_CHANNELS; i++) {
+        struct dpif_handler *handler = &dpif->handlers[i % dpif->n_handlers];
+        struct epoll_event event;
+
+        memset(&event, 0, sizeof event);
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        if (epoll_ctl(handler->epoll_fd, EPOLL_CTL_ADD,
+                      nl_sock_fd(dpif->channels[i].sock), &event) < 0) {
+            int error = errno;
+
+            destroy_handlers(dpif);
+            return error;
+        }
+    }
+    return 0;
+}
+
 static void
 destroy_channels(struct dpif_linux *dpif)
 {
     struct dpif_channel *ch;
 
-    if (dpif->epoll_fd >= 0) {
-        close(dpif->epoll_fd);
-        dpif->epoll_fd = -1;
-    }
+    destroy_handlers(dpif);
     for (ch = dpif->channels; ch < &dpif->channels[N_CHANNELS]; ch++) {
         nl_sock_destroy(ch->sock);
         ch->sock = NULL;
     }
-    dpif->next_scale = LLONG_MAX;
 }
 
 static void
@@ -334,6 +433,7 @@ dpif_linux_close(struct dpif *dpif_)
     nln_notifier_destroy(dpif->port_notifier);
     destroy_channels(dpif);
     sset_destroy(&dpif->changed_ports);
+    pthread_mutex_destroy(&dpif->loss_mutex);
     free(dpif);
 }
 
@@ -354,10 +454,7 @@ dpif_linux_run(struct dpif *dpif_)
 {
     struct dpif_linux *dpif = dpif_linux_cast(dpif_);
 
-    if (time_msec() >= dpif->next_scale) {
-        dpif->next_scale = time_msec() + SCALE_INTERVAL;
-        scale_sketches(dpif_);
-    }
+    report_loss(dpif);
 
     /*process the netlink notifier.*/
     if (nln) {
@@ -528,7 +625,7 @@ dpif_linux_port_get_pid(const struct dpif *dpif_, uint32_t port_no)
 {
     struct dpif_linux *dpif = dpif_linux_cast(dpif_);
 
-    if (dpif->epoll_fd < 0) {
+    if (!dpif->handlers) {
         return 0;
     } else {
         int idx;
@@ -693,6 +790,8 @@ dpif_linux_init_flow_put(struct dpif *dpif_, const struct dpif_flow_put *put,
     request->dp_ifindex = dpif->dp_ifindex;
     request->key = put->key;
     request->key_len = put->key_len;
+    /* The kernel datapath only supports exact-match flows, so 'put->mask' is
+     * ignored. */
     /* Ensure that OVS_FLOW_ATTR_ACTIONS will always be included. */
     request->actions = put->actions ? put->actions : &dummy_action;
     request->actions_len = put->actions_len;
@@ -787,6 +886,7 @@ dpif_linux_flow_dump_start(const struct dpif *dpif_, void **statep)
 static int
 dpif_linux_flow_dump_next(const struct dpif *dpif_ OVS_UNUSED, void *state_,
                           const struct nlattr **key, size_t *key_len,
+                          const struct nlattr **mask, size_t *mask_len,
                           const struct nlattr **actions, size_t *actions_len,
                           const struct dpif_flow_stats **stats)
 {
@@ -827,6 +927,10 @@ dpif_linux_flow_dump_next(const struct dpif *dpif_ OVS_UNUSED, void *state_,
         *key = state->flow.key;
         *key_len = state->flow.key_len;
     }
+    if (mask) {
+        *mask = NULL;
+        *mask_len = 0;
+    }
     if (stats) {
         dpif_linux_flow_get_stats(&state->flow, &state->stats);
         *stats = &state->stats;
@@ -894,10 +998,13 @@ dpif_linux_execute(struct dpif *dpif_, const struct dpif_execute *execute)
     return dpif_linux_execute__(dpif->dp_ifindex, execute);
 }
 
+/* Number of operations whose auxiliary data dpif_linux_operate() keeps on the
+ * stack.  Larger batches use the heap, so that nl_sock_transact_multiple()
+ * sees the whole batch and can fill each sendmsg() call. */
 #define MAX_OPS 50
 
 static void
-dpif_linux_operate__(struct dpif *dpif_, struct dpif_op **ops, size_t n_ops)
+dpif_linux_operate(struct dpif *dpif_, struct dpif_op **ops, size_t n_ops)
 {
     struct dpif_linux *dpif = dpif_linux_cast(dpif_);
 
@@ -909,12 +1016,19 @@ dpif_linux_operate__(struct dpif *dpif_, struct dpif_op **ops, size_t n_ops)
 
         struct ofpbuf reply;
         uint64_t reply_stub[1024 / 8];
-    } auxes[MAX_OPS];
+    } auxes_stub[MAX_OPS], *auxes;
 
-    struct nl_transaction *txnsp[MAX_OPS];
+    struct nl_transaction *txnsp_stub[MAX_OPS], **txnsp;
     size_t i;
 
-    assert(n_ops <= MAX_OPS);
+    if (n_ops <= MAX_OPS) {
+        auxes = auxes_stub;
+        txnsp = txnsp_stub;
+    } else {
+        auxes = xmalloc(n_ops * sizeof *auxes);
+        txnsp = xmalloc(n_ops * sizeof *txnsp);
+    }
+
     for (i = 0; i < n_ops; i++) {
         struct op_auxdata *aux = &auxes[i];
         struct dpif_op *op = ops[i];
@@ -1025,16 +1139,10 @@ dpif_linux_operate__(struct dpif *dpif_, struct dpif_op **ops, size_t n_ops)
         ofpbuf_uninit(&aux->request);
         ofpbuf_uninit(&aux->reply);
     }
-}
 
-static void
-dpif_linux_operate(struct dpif *dpif, struct dpif_op **ops, size_t n_ops)
-{
-    while (n_ops > 0) {
-        size_t chunk = MIN(n_ops, MAX_OPS);
-        dpif_linux_operate__(dpif, ops, chunk);
-        ops += chunk;
-        n_ops -= chunk;
+    if (auxes != auxes_stub) {
+        free(auxes);
+        free(txnsp);
     }
 }
 
@@ -1072,47 +1180,34 @@ dpif_linux_recv_set(struct dpif *dpif_, bool enable)
 {
     struct dpif_linux *dpif = dpif_linux_cast(dpif_);
 
-    if ((dpif->epoll_fd >= 0) == enable) {
+    if ((dpif->handlers != NULL) == enable) {
         return 0;
     }
 
     if (!enable) {
         destroy_channels(dpif);
     } else {
+        long long int now = dpif_linux_thread_time_msec();
         struct dpif_channel *ch;
         int error;
 
-        dpif->epoll_fd = epoll_create(N_CHANNELS);
-        if (dpif->epoll_fd < 0) {
-            return errno;
-        }
-
         for (ch = dpif->channels; ch < &dpif->channels[N_CHANNELS]; ch++) {
-            int indx = ch - dpif->channels;
-            struct epoll_event event;
-
             error = nl_sock_create(NETLINK_GENERIC, &ch->sock);
             if (error) {
                 destroy_channels(dpif);
                 return error;
             }
 
-            memset(&event, 0, sizeof event);
-            event.events = EPOLLIN;
-            event.data.u32 = indx;
-            if (epoll_ctl(dpif->epoll_fd, EPOLL_CTL_ADD, nl_sock_fd(ch->sock),
-                          &event) < 0) {
-                error = errno;
-                destroy_channels(dpif);
-                return error;
-            }
-
             memset(ch->sketches, 0, sizeof ch->sketches);
             ch->last_poll = LLONG_MIN;
+            ch->next_scale = now + SCALE_INTERVAL;
         }
 
-        dpif->ready_mask = 0;
-        dpif->next_scale = time_msec() + SCALE_INTERVAL;
+        error = create_handlers(dpif);
+        if (error) {
+            destroy_channels(dpif);
+            return error;
+        }
     }
 
     set_upcall_pids(dpif_);
@@ -1120,6 +1215,29 @@ dpif_linux_recv_set(struct dpif *dpif_, bool enable)
     return 0;
 }
 
+static int
+dpif_linux_handlers_set(struct dpif *dpif_, uint32_t n_handlers)
+{
+    struct dpif_linux *dpif = dpif_linux_cast(dpif_);
+    int error = 0;
+
+    if (n_handlers != dpif->n_handlers) {
+        bool enabled = dpif->handlers != NULL;
+
+        destroy_handlers(dpif);
+        dpif->n_handlers = n_handlers;
+        if (enabled) {
+            /* The channels stay the same, so the Netlink PIDs do too. */
+            error = create_handlers(dpif);
+            if (error) {
+                destroy_channels(dpif);
+                set_upcall_pids(dpif_);
+            }
+        }
+    }
+    return error;
+}
+
 static int
 dpif_linux_queue_to_priority(const struct dpif *dpif OVS_UNUSED,
                              uint32_t queue_id, uint32_t *priority)
@@ -1190,39 +1308,42 @@ parse_odp_packet(struct ofpbuf *buf, struct dpif_upcall *upcall,
 }
 
 static int
-dpif_linux_recv(struct dpif *dpif_, struct dpif_upcall *upcall,
-                struct ofpbuf *buf)
+dpif_linux_recv(struct dpif *dpif_, uint32_t handler_id,
+                struct dpif_upcall *upcall, struct ofpbuf *buf)
 {
     struct dpif_linux *dpif = dpif_linux_cast(dpif_);
+    struct dpif_handler *handler;
     int read_tries = 0;
+    long long int now;
 
-    if (dpif->epoll_fd < 0) {
+    if (!dpif->handlers || handler_id >= dpif->n_handlers) {
        return EAGAIN;
     }
+    handler = &dpif->handlers[handler_id];
 
-    if (!dpif->ready_mask) {
+    if (!handler->ready_mask) {
         struct epoll_event events[N_CHANNELS];
         int retval;
         int i;
 
         do {
-            retval = epoll_wait(dpif->epoll_fd, events, N_CHANNELS, 0);
+            retval = epoll_wait(handler->epoll_fd, events, N_CHANNELS, 0);
         } while (retval < 0 && errno == EINTR);
         if (retval < 0) {
-            static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 1);
-            VLOG_WARN_RL(&rl, "epoll_wait failed (%s)", strerror(errno));
+            return errno;
         }
 
         for (i = 0; i < retval; i++) {
-            dpif->ready_mask |= 1u << events[i].data.u32;
+            handler->ready_mask |= 1u << events[i].data.u32;
         }
     }
 
-    while (dpif->ready_mask) {
-        int indx = ffs(dpif->ready_mask) - 1;
+    now = dpif_linux_thread_time_msec();
+    while (handler->ready_mask) {
+        int indx = ffs(handler->ready_mask) - 1;
         struct dpif_channel *ch = &dpif->channels[indx];
 
-        dpif->ready_mask &= ~(1u << indx);
+        handler->ready_mask &= ~(1u << indx);
 
         for (;;) {
             int dp_ifindex;
@@ -1238,11 +1359,11 @@ dpif_linux_recv(struct dpif *dpif_, struct dpif_upcall *upcall,
                  * packets that the buffer overflowed.  Try again
                  * immediately because there's almost certainly a packet
                  * waiting for us. */
-                report_loss(dpif_, ch);
+                record_loss(dpif, ch, now);
                 continue;
             }
 
-            ch->last_poll = time_msec();
+            ch->last_poll = now;
             if (error) {
                 if (error == EAGAIN) {
                     break;
@@ -1257,7 +1378,7 @@ dpif_linux_recv(struct dpif *dpif_, struct dpif_upcall *upcall,
                 in_port = nl_attr_find__(upcall->key, upcall->key_len,
                                          OVS_KEY_ATTR_IN_PORT);
                 if (in_port) {
-                    update_sketch(ch, nl_attr_get_u32(in_port));
+                    update_sketch(ch, nl_attr_get_u32(in_port), now);
                 }
                 return 0;
             }
@@ -1271,15 +1392,25 @@ dpif_linux_recv(struct dpif *dpif_, struct dpif_upcall *upcall,
 }
 
 static void
-dpif_linux_recv_wait(struct dpif *dpif_)
+dpif_linux_recv_wait(struct dpif *dpif_, uint32_t handler_id)
 {
     struct dpif_linux *dpif = dpif_linux_cast(dpif_);
 
-    if (dpif->epoll_fd < 0) {
+    if (!dpif->handlers || handler_id >= dpif->n_handlers) {
        return;
     }
 
-    poll_fd_wait(dpif->epoll_fd, POLLIN);
+    poll_fd_wait(dpif->handlers[handler_id].epoll_fd, POLLIN);
+}
+
+static int
+dpif_linux_recv_get_fd(struct dpif *dpif_, uint32_t handler_id)
+{
+    struct dpif_linux *dpif = dpif_linux_cast(dpif_);
+
+    return (dpif->handlers && handler_id < dpif->n_handlers
+            ? dpif->handlers[handler_id].epoll_fd
+            : -1);
 }
 
 static void
@@ -1287,14 +1418,18 @@ dpif_linux_recv_purge(struct dpif *dpif_)
 {
     struct dpif_linux *dpif = dpif_linux_cast(dpif_);
     struct dpif_channel *ch;
+    uint32_t i;
 
-    if (dpif->epoll_fd < 0) {
+    if (!dpif->handlers) {
        return;
     }
 
     for (ch = dpif->channels; ch < &dpif->channels[N_CHANNELS]; ch++) {
         nl_sock_drain(ch->sock);
     }
+    for (i = 0; i < dpif->n_handlers; i++) {
+        dpif->handlers[i].ready_mask = 0;
+    }
 }
 
 const struct dpif_class dpif_linux_class = {
@@ -1327,9 +1462,11 @@ const struct dpif_class dpif_linux_class = {
     dpif_linux_execute,
     dpif_linux_operate,
     dpif_linux_recv_set,
+    dpif_linux_handlers_set,
     dpif_linux_queue_to_priority,
     dpif_linux_recv,
     dpif_linux_recv_wait,
+    dpif_linux_recv_get_fd,
     dpif_linux_recv_purge,
 };
 
@@ -1923,12 +2060,35 @@ dpif_linux_flow_get_stats(const struct dpif_linux_flow *flow,
 
 /* Metwally "space-saving" algorithm implementation. */
 
-/* Updates 'ch' to record that a packet was received on 'port_no'. */
+/* Divides the counts of all the counting elements in 'ch' by 2 for each
+ * SCALE_INTERVAL that has passed.  See the comment on SCALE_INTERVAL. */
+static void
+scale_sketches(struct dpif_channel *ch, long long int now)
+{
+    struct dpif_sketch *sk;
+    long long int shift;
+
+    shift = (now - ch->next_scale) / SCALE_INTERVAL + 1;
+    shift = MIN(shift, 31);
+    ch->next_scale = now + SCALE_INTERVAL;
+
+    for (sk = ch->sketches; sk < &ch->sketches[N_SKETCHES]; sk++) {
+        sk->hits >>= shift;
+        sk->error >>= shift;
+    }
+}
+
+/* Updates 'ch' to record that a packet was received on 'port_no' at time
+ * 'now'. */
 static void
-update_sketch(struct dpif_channel *ch, uint32_t port_no)
+update_sketch(struct dpif_channel *ch, uint32_t port_no, long long int now)
 {
     struct dpif_sketch *sk;
 
+    if (now >= ch->next_scale) {
+        scale_sketches(ch, now);
+    }
+
     /* Find an existing counting element for 'port_no' or, if none, replace the
      * counting element with the fewest hits by 'port_no'. */
     for (sk = ch->sketches; ; sk++) {
@@ -1952,50 +2112,56 @@ update_sketch(struct dpif_channel *ch, uint32_t port_no)
     }
 }
 
-/* Divide the counts of all the the counting elements in 'dpif' by 2.  See the
- * comment on SCALE_INTERVAL. */
+/* Records, for dpif_linux_run() to report, that a packet was lost in 'ch' (in
+ * 'dpif') at time 'now'.  Called by 'ch''s handler. */
 static void
-scale_sketches(struct dpif *dpif_)
+record_loss(struct dpif_linux *dpif, struct dpif_channel *ch,
+            long long int now)
 {
-    struct dpif_linux *dpif = dpif_linux_cast(dpif_);
-    struct dpif_channel *ch;
+    struct dpif_loss *loss = &dpif->loss;
 
-    for (ch = dpif->channels; ch < &dpif->channels[N_CHANNELS]; ch++) {
-        struct dpif_sketch *sk;
-
-        for (sk = ch->sketches; sk < &ch->sketches[N_SKETCHES]; sk++) {
-            sk->hits /= 2;
-            sk->error /= 2;
-        }
-    }
+    pthread_mutex_lock(&dpif->loss_mutex);
+    loss->n++;
+    loss->channel = ch - dpif->channels;
+    loss->poll_age = ch->last_poll != LLONG_MIN ? now - ch->last_poll : -1;
+    memcpy(loss->sketches, ch->sketches, sizeof loss->sketches);
+    pthread_mutex_unlock(&dpif->loss_mutex);
 }
 
-/* Logs information about a packet that was recently lost in 'ch' (in
- * 'dpif_'). */
+/* Logs information about packets that 'dpif''s handlers recently lost, if
+ * any. */
 static void
-report_loss(struct dpif *dpif_, struct dpif_channel *ch)
+report_loss(struct dpif_linux *dpif)
 {
-    struct dpif_linux *dpif = dpif_linux_cast(dpif_);
     static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 5);
-    struct dpif_sketch *sk;
+    const struct dpif_sketch *sk;
+    struct dpif_loss loss;
     struct ds s;
 
-    if (VLOG_DROP_ERR(&rl)) {
+    pthread_mutex_lock(&dpif->loss_mutex);
+    loss = dpif->loss;
+    if (loss.n && !VLOG_DROP_ERR(&rl)) {
+        dpif->loss.n = 0;
+    } else {
+        loss.n = 0;
+    }
+    pthread_mutex_unlock(&dpif->loss_mutex);
+
+    if (!loss.n) {
         return;
     }
 
     ds_init(&s);
-    if (ch->last_poll != LLONG_MIN) {
-        ds_put_format(&s, " (last polled %lld ms ago)",
-                      time_msec() - ch->last_poll);
+    if (loss.poll_age >= 0) {
+        ds_put_format(&s, " (last polled %lld ms ago)", loss.poll_age);
     }
     ds_put_cstr(&s, ", most frequent sources are");
-    for (sk = ch->sketches; sk < &ch->sketches[N_SKETCHES]; sk++) {
+    for (sk = loss.sketches; sk < &loss.sketches[N_SKETCHES]; sk++) {
         if (sk->hits) {
             struct dpif_port port;
 
             ds_put_format(&s, " %"PRIu32, sk->port_no);
-            if (!dpif_port_query_by_number(dpif_, sk->port_no, &port)) {
+            if (!dpif_port_query_by_number(&dpif->dpif, sk->port_no, &port)) {
                 ds_put_format(&s, "(%s)", port.name);
                 dpif_port_destroy(&port);
             }
@@ -2009,7 +2175,8 @@ report_loss(struct dpif *dpif_, struct dpif_channel *ch)
     }
     ds_chomp(&s, ',');
 
-    VLOG_WARN("%s: lost packet on channel %td%s",
-              dpif_name(dpif_), ch - dpif->channels, ds_cstr(&s));
+    VLOG_WARN("%s: lost %u packet%s, most recently on channel %d%s",
+              dpif_name(&dpif->dpif), loss.n, loss.n == 1 ? "" : "s",
+              loss.channel, ds_cstr(&s));
     ds_destroy(&s);
 }
@@ -15,7 +15,7 @@
  */
 
 #include <config.h>
-#include "dpif.h"
+#include "dpif-netdev.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -25,13 +25,19 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <net/if.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "classifier.h"
+#include "coverage.h"
 #include "csum.h"
 #include "dpif.h"
 #include "dpif-provider.h"
@@ -40,6 +46,7 @@
 #include "flow.h"
 #include "hmap.h"
 #include "list.h"
+#include "match.h"
 #include "netdev.h"
 #include "netlink.h"
 #include "odp-util.h"
@@ -49,6 +56,7 @@
 #include "poll-loop.h"
 #include "random.h"
 #include "shash.h"
+#include "socket-util.h"
 #include "sset.h"
 #include "timeval.h"
 #include "util.h"
@@ -70,49 +78,169 @@ enum { MAX_QUEUE_LEN = 128 };   /* Maximum number of packets per queue. */
 enum { QUEUE_MASK = MAX_QUEUE_LEN - 1 };
 BUILD_ASSERT_DECL(IS_POW2(MAX_QUEUE_LEN));
 
+/* Exact-match cache. */
+enum { EMC_SETS = 1024 };       /* Number of sets in each cache. */
+enum { EMC_WAYS = 2 };          /* Number of entries per set. */
+enum { EMC_MASK = EMC_SETS - 1 };
+enum { EMC_ALIGN = 64 };        /* Alignment of cache, in bytes. */
+BUILD_ASSERT_DECL(IS_POW2(EMC_SETS));
+
 struct dp_netdev_upcall {
     struct dpif_upcall upcall;  /* Queued upcall information. */
     struct ofpbuf buf;          /* ofpbuf instance for upcall.packet. */
 };
 
+/* A queue of upcalls.
+ *
+ * A queue filled by a forwarding thread and drained by the main thread has
+ * exactly one producer, which only writes 'head', and one consumer, which only
+ * writes 'tail', so it needs no locking, only memory barriers. */
 struct dp_netdev_queue {
     struct dp_netdev_upcall upcalls[MAX_QUEUE_LEN];
-    unsigned int head, tail;
+    volatile unsigned int head, tail;
 };
 
-/* Datapath based on the network device interface from netdev.h. */
-struct dp_netdev {
-    const struct dpif_class *class;
-    char *name;
-    int open_cnt;
-    bool destroyed;
+/* An entry in an exact-match cache.  The entry is valid only if 'version' is
+ * the datapath's current 'emc_version'. */
+struct dp_netdev_emc_entry {
+    struct dp_netdev_flow *flow;    /* Cached flow. */
+    uint32_t hash;                  /* flow_hash() of a packet 'flow' matched. */
+    unsigned int version;           /* dp_netdev's 'emc_version' at insert. */
+};
+
+/* A set in an exact-match cache.  The most recently inserted entry is in
+ * entries[0]. */
+struct dp_netdev_emc_set {
+    struct dp_netdev_emc_entry entries[EMC_WAYS];
+};
+
+/* An exact-match cache: a small, 2-way set-associative cache that maps the
+ * flow_hash() of a packet's flow key to the flow that the packet matched,
+ * consulted before the flow table itself.  A hit costs a single comparison of
+ * the packet's key against the cached flow's masked key, where a flow table
+ * lookup probes every distinct mask in the table.
+ *
+ * Each set occupies half of a cache line, and the cache as a whole is aligned
+ * on a cache line boundary, so that a lookup touches a single cache line. */
+struct dp_netdev_emc {
+    struct dp_netdev_emc_set sets[EMC_SETS];
+};
+
+/* Errors that a thread encountered receiving packets from ports or sending
+ * packets to ports.  The forwarding threads do not log, so the main thread
+ * reports these errors from dpif_netdev_run() instead. */
+struct dp_netdev_errors {
+    long long int n;            /* Number of errors. */
+    int error;                  /* Most recent error, as an errno value. */
+    int port_no;                /* Port on which 'error' occurred. */
+};
 
+/* Upcall queues, exact-match cache, and statistics for one thread of execution
+ * in a dp_netdev: either the main thread or one of the forwarding threads.
+ *
+ * Only the thread that owns a context looks up flows in its cache.  The main
+ * thread invalidates all of the caches, by incrementing the datapath's
+ * 'emc_version', whenever it deletes a flow or changes a flow's mask.  It does
+ * so with 'flow_rwlock' held for writing, so no other locking is needed. */
+struct dp_netdev_context {
     struct dp_netdev_queue queues[N_QUEUES];
-    struct hmap flow_table;     /* Flow table. */
+    struct dp_netdev_emc *emc;
 
     /* Statistics. */
     long long int n_hit;        /* Number of flow table matches. */
     long long int n_missed;     /* Number of flow table misses. */
     long long int n_lost;       /* Number of misses not passed to client. */
+    long long int n_cache_hit;  /* Number of exact-match cache hits. */
+    long long int n_cache_missed; /* Number of exact-match cache misses. */
+    struct dp_netdev_errors rx_errors;
+    struct dp_netdev_errors tx_errors;
+
+    uint32_t seed;              /* State of PRNG for "sample" actions. */
+};
+
+/* Datapath based on the network device interface from netdev.h. */
+struct dp_netdev {
+    const struct dpif_class *class;
+    char *name;
+    int open_cnt;
+    bool destroyed;
+
+    struct dp_netdev_context main;  /* Main thread's queues and statistics. */
+    long long int n_rx_errors_reported; /* Receive errors logged so far. */
+    long long int n_tx_errors_reported; /* Send errors logged so far. */
+
+    /* Flow table.
+     *
+     * 'flow_table' indexes the flows by the keys with which they were added.
+     * 'cls' holds the same flows, each with its mask, and is what packets are
+     * looked up in.  The masked flows that a client installs do not overlap
+     * in practice, so they all have the same priority.  An exact-match flow
+     * may overlap a masked flow, e.g. when dp_netdev_flow_classify() falls
+     * back to an exact mask, so exact-match flows have a higher priority.
+     *
+     * Forwarding threads hold 'flow_rwlock' for reading while they look up
+     * flows, execute their actions, and update their statistics.  The main
+     * thread holds it for writing whenever it accesses the flow table. */
+    struct hmap flow_table;
+    struct classifier cls;
+    pthread_rwlock_t flow_rwlock;
+    unsigned int emc_version;   /* Invalidates exact-match cache entries. */
 
     /* Ports. */
     struct dp_netdev_port *ports[MAX_PORTS];
     struct list port_list;
     unsigned int serial;
+
+    /* Forwarding threads.  When 'n_threads' is nonzero, the ports are polled
+     * by the forwarding threads instead of by dpif_netdev_run(). */
+    struct dp_netdev_thread *threads;
+    size_t n_threads;
+    volatile bool stop_threads; /* Tells forwarding threads to exit. */
+    int wakeup_fds[2];          /* Forwarding threads wake up main thread. */
+
+    /* Upcall handlers.  Each upcall queue is read by exactly one handler (see
+     * queue_handler()), which may run in its own thread.  Handlers hold
+     * 'upcall_rwlock' for reading while they receive upcalls.  The main
+     * thread holds it for writing while it changes the set of queues, that
+     * is, while it starts or stops forwarding threads, or purges the
+     * queues. */
+    uint32_t n_handlers;
+    pthread_rwlock_t upcall_rwlock;
+};
+
+/* A thread that receives and forwards the packets that arrive on a subset of
+ * a dp_netdev's ports.
+ *
+ * Each port is polled by exactly one thread.  Because a flow's key includes
+ * its input port, a given flow is only ever hit by one thread, so flow
+ * statistics need no locking beyond 'flow_rwlock'. */
+struct dp_netdev_thread {
+    struct dp_netdev *dp;
+    pthread_t thread;
+    struct dp_netdev_port **ports;  /* Ports polled by this thread. */
+    size_t n_ports;
+    struct dp_netdev_context ctx;   /* Upcalls and stats for main thread. */
 };
 
-/* A port in a netdev-based datapath. */
+/* A port in a netdev-based datapath.
+ *
+ * Only one thread receives packets from a port, but any of the forwarding
+ * threads, as well as the main thread in dpif_netdev_execute(), may output
+ * packets to it.  'send_mutex' serializes their calls to netdev_send(). */
 struct dp_netdev_port {
     int port_no;                /* Index into dp_netdev's 'ports'. */
     struct list node;           /* Element in dp_netdev's 'port_list'. */
     struct netdev *netdev;
     char *type;                 /* Port type as requested by user. */
+    pthread_mutex_t send_mutex; /* Held across netdev_send(). */
 };
 
 /* A flow in dp_netdev's 'flow_table'. */
 struct dp_netdev_flow {
     struct hmap_node node;      /* Element in dp_netdev's 'flow_table'. */
-    struct flow key;
+    struct cls_rule cr;         /* Element in dp_netdev's 'cls'. */
+    struct flow key;            /* Key as passed to dpif_flow_put(). */
+    bool masked;                /* Does 'cr' wildcard any part of 'key'? */
 
     /* Statistics. */
     long long int used;         /* Last used time, in monotonic msecs. */
@@ -138,24 +266,38 @@ static struct shash dp_netdevs = SHASH_INITIALIZER(&dp_netdevs);
 /* Maximum port MTU seen so far. */
 static int max_mtu = ETH_PAYLOAD_MAX;
 
+/* Maximum number of packets received from a single port per call to
+ * dpif_netdev_run(). */
+static size_t rx_batch = NETDEV_MAX_RX_BATCH;
+
+/* Number of forwarding threads per datapath.  0 means that packets are
+ * forwarded from dpif_netdev_run() in the main thread. */
+static size_t n_fwd_threads = 0;
+
 static int get_port_by_number(struct dp_netdev *, uint32_t port_no,
                               struct dp_netdev_port **portp);
 static int get_port_by_name(struct dp_netdev *, const char *devname,
                             struct dp_netdev_port **portp);
 static void dp_netdev_free(struct dp_netdev *);
+static void dp_netdev_context_init(struct dp_netdev_context *);
+static void dp_netdev_context_destroy(struct dp_netdev_context *);
 static void dp_netdev_flow_flush(struct dp_netdev *);
 static int do_add_port(struct dp_netdev *, const char *devname,
                        const char *type, uint32_t port_no);
 static int do_del_port(struct dp_netdev *, uint32_t port_no);
 static int dpif_netdev_open(const struct dpif_class *, const char *name,
                             bool create, struct dpif **);
-static int dp_netdev_output_userspace(struct dp_netdev *, const struct ofpbuf *,
-                                    int queue_no, const struct flow *,
-                                    uint64_t arg);
+static int dp_netdev_output_userspace(struct dp_netdev *,
+                                      struct dp_netdev_context *,
+                                      const struct ofpbuf *, int queue_no,
+                                      const struct flow *, uint64_t arg);
 static void dp_netdev_execute_actions(struct dp_netdev *,
+                                      struct dp_netdev_context *,
                                       struct ofpbuf *, struct flow *,
                                       const struct nlattr *actions,
                                       size_t actions_len);
+static void dp_netdev_start_threads(struct dp_netdev *);
+static void dp_netdev_stop_threads(struct dp_netdev *);
 
 static struct dpif_netdev *
 dpif_netdev_cast(const struct dpif *dpif)
@@ -236,6 +378,23 @@ choose_port(struct dp_netdev *dp, const char *name)
     return -1;
 }
 
+static void
+dp_netdev_rwlock_init(pthread_rwlock_t *rwlock)
+{
+    pthread_rwlockattr_t attr;
+
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    /* Forwarding and handler threads take our locks for reading almost
+     * continuously, so the main thread could starve if readers had
+     * preference. */
+    pthread_rwlockattr_setkind_np(
+        &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
 static int
 create_dp_netdev(const char *name, const struct dpif_class *class,
                  struct dp_netdev **dpp)
@@ -243,17 +402,20 @@ create_dp_netdev(const char *name, const struct dpif_class *class,
     struct dp_netdev *dp;
     int port_no;
     int error;
-    int i;
 
     dp = xzalloc(sizeof *dp);
     dp->class = class;
     dp->name = xstrdup(name);
     dp->open_cnt = 0;
-    for (i = 0; i < N_QUEUES; i++) {
-        dp->queues[i].head = dp->queues[i].tail = 0;
-    }
+    dp_netdev_context_init(&dp->main);
     hmap_init(&dp->flow_table);
+    classifier_init(&dp->cls);
+    dp_netdev_rwlock_init(&dp->flow_rwlock);
+    dp_netdev_rwlock_init(&dp->upcall_rwlock);
+    dp->n_handlers = 1;
+    dp->emc_version = 1;
     list_init(&dp->port_list);
+    dp->wakeup_fds[0] = dp->wakeup_fds[1] = -1;
 
     port_no = !strncmp(name, "br", 2) ? choose_port(dp, name) : OVSP_LOCAL;
     error = do_add_port(dp, name, "internal", port_no);
@@ -263,6 +425,7 @@ create_dp_netdev(const char *name, const struct dpif_class *class,
     }
 
     shash_add(&dp_netdevs, name, dp);
+    dp_netdev_start_threads(dp);
 
     *dpp = dp;
     return 0;
@@ -298,31 +461,84 @@ dpif_netdev_open(const struct dpif_class *class, const char *name,
 }
 
 static void
-dp_netdev_purge_queues(struct dp_netdev *dp)
+dp_netdev_context_init(struct dp_netdev_context *ctx)
+{
+    void *emc;
+    int i;
+
+    for (i = 0; i < N_QUEUES; i++) {
+        ctx->queues[i].head = ctx->queues[i].tail = 0;
+    }
+
+    if (posix_memalign(&emc, EMC_ALIGN, sizeof *ctx->emc)) {
+        out_of_memory();
+    }
+    ctx->emc = emc;
+    memset(ctx->emc, 0, sizeof *ctx->emc);
+
+    ctx->n_hit = ctx->n_missed = ctx->n_lost = 0;
+    ctx->n_cache_hit = ctx->n_cache_missed = 0;
+    memset(&ctx->rx_errors, 0, sizeof ctx->rx_errors);
+    memset(&ctx->tx_errors, 0, sizeof ctx->tx_errors);
+
+    /* random_uint32() never returns 0, which is not a valid seed. */
+    ctx->seed = random_uint32();
+}
+
+/* Frees 'ctx''s exact-match cache.  The caller must already have purged its
+ * queues. */
+static void
+dp_netdev_context_destroy(struct dp_netdev_context *ctx)
+{
+    free(ctx->emc);
+    ctx->emc = NULL;
+}
+
+static void
+dp_netdev_purge_context(struct dp_netdev_context *ctx)
 {
     int i;
 
     for (i = 0; i < N_QUEUES; i++) {
-        struct dp_netdev_queue *q = &dp->queues[i];
+        struct dp_netdev_queue *q = &ctx->queues[i];
 
         while (q->tail != q->head) {
-            struct dp_netdev_upcall *u = &q->upcalls[q->tail++ & QUEUE_MASK];
+            struct dp_netdev_upcall *u = &q->upcalls[q->tail & QUEUE_MASK];
             ofpbuf_uninit(&u->buf);
+            q->tail++;
         }
     }
 }
 
+static void
+dp_netdev_purge_queues(struct dp_netdev *dp)
+{
+    size_t i;
+
+    pthread_rwlock_wrlock(&dp->upcall_rwlock);
+    dp_netdev_purge_context(&dp->main);
+    for (i = 0; i < dp->n_threads; i++) {
+        dp_netdev_purge_context(&dp->threads[i].ctx);
+    }
+    pthread_rwlock_unlock(&dp->upcall_rwlock);
+}
+
 static void
 dp_netdev_free(struct dp_netdev *dp)
 {
     struct dp_netdev_port *port, *next;
 
+    dp_netdev_stop_threads(dp);
     dp_netdev_flow_flush(dp);
     LIST_FOR_EACH_SAFE (port, next, node, &dp->port_list) {
         do_del_port(dp, port->port_no);
     }
     dp_netdev_purge_queues(dp);
+    dp_netdev_context_destroy(&dp->main);
     hmap_destroy(&dp->flow_table);
+    classifier_destroy(&dp->cls);
+    pthread_rwlock_destroy(&dp->flow_rwlock);
+    pthread_rwlock_destroy(&dp->upcall_rwlock);
     free(dp->name);
     free(dp);
 }
@@ -351,10 +567,23 @@ static int
 dpif_netdev_get_stats(const struct dpif *dpif, struct dpif_dp_stats *stats)
 {
     struct dp_netdev *dp = get_dp_netdev(dpif);
+    size_t i;
+
     stats->n_flows = hmap_count(&dp->flow_table);
-    stats->n_hit = dp->n_hit;
-    stats->n_missed = dp->n_missed;
-    stats->n_lost = dp->n_lost;
+    stats->n_hit = dp->main.n_hit;
+    stats->n_missed = dp->main.n_missed;
+    stats->n_lost = dp->main.n_lost;
+    stats->n_cache_hit = dp->main.n_cache_hit;
+    stats->n_cache_missed = dp->main.n_cache_missed;
+    for (i = 0; i < dp->n_threads; i++) {
+        const struct dp_netdev_context *ctx = &dp->threads[i].ctx;
+
+        stats->n_hit += ctx->n_hit;
+        stats->n_missed += ctx->n_missed;
+        stats->n_lost += ctx->n_lost;
+        stats->n_cache_hit += ctx->n_cache_hit;
+        stats->n_cache_missed += ctx->n_cache_missed;
+    }
     return 0;
 }
 
@@ -365,6 +594,7 @@ do_add_port(struct dp_netdev *dp, const char *devname, const char *type,
     struct dp_netdev_port *port;
     struct netdev *netdev;
     const char *open_type;
+    bool had_threads;
     int mtu;
     int error;
 
@@ -381,6 +611,10 @@ do_add_port(struct dp_netdev *dp, const char *devname, const char *type,
     /* XXX reject loopback devices */
     /* XXX reject non-Ethernet devices */
 
+    /* Besides readying 'netdev' for netdev_recv_batch(), this sets up
+     * everything that netdev_send() needs, e.g. the socket that a Linux netdev
+     * bound to the device, so that sending on 'netdev' from a forwarding
+     * thread does not have to look up and cache anything. */
     error = netdev_listen(netdev);
     if (error) {
         VLOG_ERR("%s: cannot receive packets on this network device (%s)",
@@ -399,15 +633,23 @@ do_add_port(struct dp_netdev *dp, const char *devname, const char *type,
     port->port_no = port_no;
     port->netdev = netdev;
     port->type = xstrdup(type);
+    pthread_mutex_init(&port->send_mutex, NULL);
 
     error = netdev_get_mtu(netdev, &mtu);
     if (!error) {
         max_mtu = mtu;
     }
 
+    /* Restart the forwarding threads, if any, to give the new port to one of
+     * them. */
+    had_threads = dp->n_threads > 0;
+    dp_netdev_stop_threads(dp);
     list_push_back(&dp->port_list, &port->node);
     dp->ports[port_no] = port;
     dp->serial++;
+    if (had_threads) {
+        dp_netdev_start_threads(dp);
+    }
 
     return 0;
 }
@@ -482,6 +724,7 @@ static int
 do_del_port(struct dp_netdev *dp, uint32_t port_no)
 {
     struct dp_netdev_port *port;
+    bool had_threads;
     char *name;
     int error;
 
@@ -490,13 +733,19 @@ do_del_port(struct dp_netdev *dp, uint32_t port_no)
         return error;
     }
 
+    had_threads = dp->n_threads > 0;
+    dp_netdev_stop_threads(dp);
     list_remove(&port->node);
     dp->ports[port->port_no] = NULL;
     dp->serial++;
+    if (had_threads) {
+        dp_netdev_start_threads(dp);
+    }
 
     name = xstrdup(netdev_get_name(port->netdev));
     netdev_close(port->netdev);
     free(port->type);
+    pthread_mutex_destroy(&port->send_mutex);
 
     free(name);
     free(port);
@@ -549,22 +798,63 @@ dpif_netdev_get_max_ports(const struct dpif *dpif OVS_UNUSED)
     return MAX_PORTS;
 }
 
+/* Invalidates every entry in every one of 'dp''s exact-match caches.  The
+ * caller must hold 'dp->flow_rwlock' for writing. */
+static void
+dp_netdev_emc_invalidate(struct dp_netdev *dp)
+{
+    if (!++dp->emc_version) {
+        /* Wrapped around.  Clear the caches so that no stale entry can appear
+         * to be valid again. */
+        size_t i;
+
+        memset(dp->main.emc, 0, sizeof *dp->main.emc);
+        for (i = 0; i < dp->n_threads; i++) {
+            memset(dp->threads[i].ctx.emc, 0, sizeof *dp->threads[i].ctx.emc);
+        }
+        dp->emc_version = 1;
+    }
+}
+
+/* Removes 'flow' from 'dp''s flow table, invalidating the exact-match caches,
+ * and frees it.  The caller must hold 'dp->flow_rwlock' for writing.
+ *
+ * Changing a flow's actions does not require invalidating the caches, because
+ * they point to the flow itself, not to its actions. */
 static void
 dp_netdev_free_flow(struct dp_netdev *dp, struct dp_netdev_flow *flow)
 {
+    dp_netdev_emc_invalidate(dp);
+    classifier_remove(&dp->cls, &flow->cr);
+    cls_rule_destroy(&flow->cr);
     hmap_remove(&dp->flow_table, &flow->node);
     free(flow->actions);
     free(flow);
 }
 
+/* Acquires 'dp''s flow table for exclusive access by the main thread. */
+static void
+dp_netdev_lock_flows(struct dp_netdev *dp)
+{
+    pthread_rwlock_wrlock(&dp->flow_rwlock);
+}
+
+static void
+dp_netdev_unlock_flows(struct dp_netdev *dp)
+{
+    pthread_rwlock_unlock(&dp->flow_rwlock);
+}
+
 static void
 dp_netdev_flow_flush(struct dp_netdev *dp)
 {
     struct dp_netdev_flow *flow, *next;
 
+    dp_netdev_lock_flows(dp);
     HMAP_FOR_EACH_SAFE (flow, next, node, &dp->flow_table) {
         dp_netdev_free_flow(dp, flow);
     }
+    dp_netdev_unlock_flows(dp);
 }
 
 static int
@@ -640,6 +930,7 @@ dpif_netdev_port_poll_wait(const struct dpif *dpif_)
     }
 }
 
+/* Returns the flow in 'dp' that was added with exactly 'key', if any. */
 static struct dp_netdev_flow *
 dp_netdev_lookup_flow(const struct dp_netdev *dp, const struct flow *key)
 {
@@ -653,6 +944,51 @@ dp_netdev_lookup_flow(const struct dp_netdev *dp, const struct flow *key)
     return NULL;
 }
 
+/* Returns the flow in 'dp' that matches a packet whose flow key is 'key',
+ * taking flows' masks into account, if any. */
+static struct dp_netdev_flow *
+dp_netdev_classify(const struct dp_netdev *dp, const struct flow *key)
+{
+    struct cls_rule *cr = classifier_lookup(&dp->cls, key, NULL);
+    return cr ? CONTAINER_OF(cr, struct dp_netdev_flow, cr) : NULL;
+}
+
+/* Looks up a packet whose flow key is 'key', with flow_hash() 'hash', first
+ * in 'ctx''s exact-match cache, then in 'dp''s flow table.  A flow found only
+ * in the flow table is inserted into the cache.  Sets '*cache_hit' to true if
+ * the flow came from the cache, false otherwise. */
+static struct dp_netdev_flow *
+dp_netdev_emc_lookup(const struct dp_netdev *dp, struct dp_netdev_context *ctx,
+                     const struct flow *key, uint32_t hash, bool *cache_hit)
+{
+    struct dp_netdev_emc_set *set = &ctx->emc->sets[hash & EMC_MASK];
+    struct dp_netdev_flow *flow;
+    int i;
+
+    for (i = 0; i < EMC_WAYS; i++) {
+        struct dp_netdev_emc_entry *e = &set->entries[i];
+
+        if (e->version == dp->emc_version && e->hash == hash
+            && miniflow_equal_flow_in_minimask(&e->flow->cr.match.flow, key,
+                                               &e->flow->cr.match.mask)) {
+            *cache_hit = true;
+            return e->flow;
+        }
+    }
+
+    *cache_hit = false;
+    flow = dp_netdev_classify(dp, key);
+    if (flow) {
+        for (i = EMC_WAYS - 1; i > 0; i--) {
+            set->entries[i] = set->entries[i - 1];
+        }
+        set->entries[0].flow = flow;
+        set->entries[0].hash = hash;
+        set->entries[0].version = dp->emc_version;
+    }
+    return flow;
+}
+
 static void
 get_dpif_flow_stats(struct dp_netdev_flow *flow, struct dpif_flow_stats *stats)
 {
@@ -709,18 +1045,19 @@ dpif_netdev_flow_get(const struct dpif *dpif,
         return error;
     }
 
+    dp_netdev_lock_flows(dp);
     flow = dp_netdev_lookup_flow(dp, &key);
-    if (!flow) {
-        return ENOENT;
+    if (flow) {
+        if (stats) {
+            get_dpif_flow_stats(flow, stats);
+        }
+        if (actionsp) {
+            *actionsp = ofpbuf_clone_data(flow->actions, flow->actions_len);
+        }
     }
+    dp_netdev_unlock_flows(dp);
 
-    if (stats) {
-        get_dpif_flow_stats(flow, stats);
-    }
-    if (actionsp) {
-        *actionsp = ofpbuf_clone_data(flow->actions, flow->actions_len);
-    }
-    return 0;
+    return flow ? 0 : ENOENT;
 }
 
 static int
@@ -733,8 +1070,50 @@ set_flow_actions(struct dp_netdev_flow *flow,
     return 0;
 }
 
+/* Classifier priorities of masked and exact-match flows. */
+enum {
+    DP_NETDEV_MASKED_PRIORITY = 0,
+    DP_NETDEV_EXACT_PRIORITY = 1
+};
+
+/* Inserts 'flow' into 'dp''s classifier with mask 'wc', or with an exact
+ * mask if 'wc' is null.
+ *
+ * If another flow already has exactly the same masked key, then 'flow' is
+ * inserted with an exact mask instead.  Both flows then match the packets
+ * that 'flow''s key describes, and the exact-match flow's higher priority
+ * makes those packets hit 'flow'.  Packets that the other flow matched before
+ * may be cached as matching it, so inserting an exact-match flow that
+ * overlaps another flow invalidates the exact-match caches. */
+static void
+dp_netdev_flow_classify(struct dp_netdev *dp, struct dp_netdev_flow *flow,
+                        const struct flow_wildcards *wc)
+{
+    struct match match;
+
+    if (wc) {
+        match_init(&match, &flow->key, wc);
+        cls_rule_init(&flow->cr, &match, DP_NETDEV_MASKED_PRIORITY);
+        if (!classifier_find_rule_exactly(&dp->cls, &flow->cr)) {
+            flow->masked = true;
+            classifier_insert(&dp->cls, &flow->cr);
+            return;
+        }
+        cls_rule_destroy(&flow->cr);
+    }
+
+    match_init_exact(&match, &flow->key);
+    cls_rule_init(&flow->cr, &match, DP_NETDEV_EXACT_PRIORITY);
+    flow->masked = false;
+    if (classifier_lookup(&dp->cls, &flow->key, NULL)) {
+        dp_netdev_emc_invalidate(dp);
+    }
+    classifier_insert(&dp->cls, &flow->cr);
+}
+
 static int
 dp_netdev_flow_add(struct dp_netdev *dp, const struct flow *key,
+                   const struct flow_wildcards *wc,
                    const struct nlattr *actions, size_t actions_len)
 {
     struct dp_netdev_flow *flow;
@@ -749,6 +1128,7 @@ dp_netdev_flow_add(struct dp_netdev *dp, const struct flow *key,
         return error;
     }
 
+    dp_netdev_flow_classify(dp, flow, wc);
     hmap_insert(&dp->flow_table, &flow->node, flow_hash(&flow->key, 0));
     return 0;
 }
@@ -763,26 +1143,20 @@ clear_stats(struct dp_netdev_flow *flow)
 }
 
 static int
-dpif_netdev_flow_put(struct dpif *dpif, const struct dpif_flow_put *put)
+dp_netdev_flow_put(struct dp_netdev *dp, const struct flow *key,
+                   const struct flow_wildcards *wc,
+                   const struct dpif_flow_put *put)
 {
-    struct dp_netdev *dp = get_dp_netdev(dpif);
     struct dp_netdev_flow *flow;
-    struct flow key;
-    int error;
-
-    error = dpif_netdev_flow_from_nlattrs(put->key, put->key_len, &key);
-    if (error) {
-        return error;
-    }
 
-    flow = dp_netdev_lookup_flow(dp, &key);
+    flow = dp_netdev_lookup_flow(dp, key);
     if (!flow) {
         if (put->flags & DPIF_FP_CREATE) {
             if (hmap_count(&dp->flow_table) < MAX_FLOWS) {
                 if (put->stats) {
                     memset(put->stats, 0, sizeof *put->stats);
                 }
-                return dp_netdev_flow_add(dp, &key, put->actions,
+                return dp_netdev_flow_add(dp, key, wc, put->actions,
                                           put->actions_len);
             } else {
                 return EFBIG;
@@ -793,6 +1167,12 @@ dpif_netdev_flow_put(struct dpif *dpif, const struct dpif_flow_put *put)
     } else {
         if (put->flags & DPIF_FP_MODIFY) {
             int error = set_flow_actions(flow, put->actions, put->actions_len);
+            if (!error && (wc || flow->masked)) {
+                dp_netdev_emc_invalidate(dp);
+                classifier_remove(&dp->cls, &flow->cr);
+                cls_rule_destroy(&flow->cr);
+                dp_netdev_flow_classify(dp, flow, wc);
+            }
             if (!error) {
                 if (put->stats) {
                     get_dpif_flow_stats(flow, put->stats);
@@ -808,6 +1188,29 @@ dpif_netdev_flow_put(struct dpif *dpif, const struct dpif_flow_put *put)
     }
 }
 
+static int
+dpif_netdev_flow_put(struct dpif *dpif, const struct dpif_flow_put *put)
+{
+    struct dp_netdev *dp = get_dp_netdev(dpif);
+    struct flow_wildcards wc;
+    struct flow key;
+    int error;
+
+    error = dpif_netdev_flow_from_nlattrs(put->key, put->key_len, &key);
+    if (!error && put->mask_len) {
+        error = odp_flow_key_to_mask(put->mask, put->mask_len, &wc);
+    }
+    if (error) {
+        return error;
+    }
+
+    dp_netdev_lock_flows(dp);
+    error = dp_netdev_flow_put(dp, &key, put->mask_len ? &wc : NULL, put);
+    dp_netdev_unlock_flows(dp);
+
+    return error;
+}
+
 static int
 dpif_netdev_flow_del(struct dpif *dpif, const struct dpif_flow_del *del)
 {
@@ -821,16 +1224,19 @@ dpif_netdev_flow_del(struct dpif *dpif, const struct dpif_flow_del *del)
         return error;
     }
 
+    dp_netdev_lock_flows(dp);
     flow = dp_netdev_lookup_flow(dp, &key);
     if (flow) {
         if (del->stats) {
             get_dpif_flow_stats(flow, del->stats);
         }
         dp_netdev_free_flow(dp, flow);
-        return 0;
     } else {
-        return ENOENT;
+        error = ENOENT;
     }
+    dp_netdev_unlock_flows(dp);
+
+    return error;
 }
 
 struct dp_netdev_flow_state {
@@ -838,6 +1244,7 @@ struct dp_netdev_flow_state {
     uint32_t offset;
     struct nlattr *actions;
     struct odputil_keybuf keybuf;
+    struct odputil_keybuf maskbuf;
     struct dpif_flow_stats stats;
 };
 
@@ -856,6 +1263,7 @@ dpif_netdev_flow_dump_start(const struct dpif *dpif OVS_UNUSED, void **statep)
 static int
 dpif_netdev_flow_dump_next(const struct dpif *dpif, void *state_,
                            const struct nlattr **key, size_t *key_len,
+                           const struct nlattr **mask, size_t *mask_len,
                            const struct nlattr **actions, size_t *actions_len,
                            const struct dpif_flow_stats **stats)
 {
@@ -864,8 +1272,10 @@ dpif_netdev_flow_dump_next(const struct dpif *dpif, void *state_,
     struct dp_netdev_flow *flow;
     struct hmap_node *node;
 
+    dp_netdev_lock_flows(dp);
     node = hmap_at_position(&dp->flow_table, &state->bucket, &state->offset);
     if (!node) {
+        dp_netdev_unlock_flows(dp);
         return EOF;
     }
 
@@ -881,6 +1291,22 @@ dpif_netdev_flow_dump_next(const struct dpif *dpif, void *state_,
         *key_len = buf.size;
     }
 
+    if (mask && flow->masked) {
+        struct flow_wildcards wc;
+        struct ofpbuf buf;
+
+        minimask_expand(&flow->cr.match.mask, &wc);
+        ofpbuf_use_stack(&buf, &state->maskbuf, sizeof state->maskbuf);
+        odp_flow_key_from_mask(&buf, &wc.masks, &flow->key,
+                               wc.masks.in_port ? UINT32_MAX : 0);
+
+        *mask = buf.data;
+        *mask_len = buf.size;
+    } else if (mask) {
+        *mask = NULL;
+        *mask_len = 0;
+    }
+
     if (actions) {
         free(state->actions);
         state->actions = xmemdup(flow->actions, flow->actions_len);
@@ -893,6 +1319,7 @@ dpif_netdev_flow_dump_next(const struct dpif *dpif, void *state_,
         get_dpif_flow_stats(flow, &state->stats);
         *stats = &state->stats;
     }
+    dp_netdev_unlock_flows(dp);
 
     return 0;
 }
@@ -929,7 +1356,7 @@ dpif_netdev_execute(struct dpif *dpif, const struct dpif_execute *execute)
     error = dpif_netdev_flow_from_nlattrs(execute->key, execute->key_len,
                                           &key);
     if (!error) {
-        dp_netdev_execute_actions(dp, &copy, &key,
+        dp_netdev_execute_actions(dp, &dp->main, &copy, &key,
                                   execute->actions, execute->actions_len);
     }
 
@@ -951,28 +1378,67 @@ dpif_netdev_queue_to_priority(const struct dpif *dpif OVS_UNUSED,
     return 0;
 }
 
-static struct dp_netdev_queue *
-find_nonempty_queue(struct dpif *dpif)
+static int
+dpif_netdev_handlers_set(struct dpif *dpif, uint32_t n_handlers)
 {
     struct dp_netdev *dp = get_dp_netdev(dpif);
+
+    pthread_rwlock_wrlock(&dp->upcall_rwlock);
+    dp->n_handlers = n_handlers;
+    pthread_rwlock_unlock(&dp->upcall_rwlock);
+
+    return 0;
+}
+
+/* Returns the handler that reads queue 'queue_no' of the context with index
+ * 'ctx_no', where the main thread's context has index 0 and forwarding thread
+ * 'i''s has index 'i + 1'. */
+static uint32_t
+queue_handler(const struct dp_netdev *dp, size_t ctx_no, int queue_no)
+{
+    return (ctx_no * N_QUEUES + queue_no) % dp->n_handlers;
+}
+
+static struct dp_netdev_queue *
+find_nonempty_queue(struct dp_netdev *dp, uint32_t handler_id)
+{
     int i;
 
     for (i = 0; i < N_QUEUES; i++) {
-        struct dp_netdev_queue *q = &dp->queues[i];
-        if (q->head != q->tail) {
+        struct dp_netdev_queue *q = &dp->main.queues[i];
+        size_t j;
+
+        if (q->head != q->tail && queue_handler(dp, 0, i) == handler_id) {
             return q;
         }
+
+        for (j = 0; j < dp->n_threads; j++) {
+            q = &dp->threads[j].ctx.queues[i];
+            if (q->head != q->tail
+                && queue_handler(dp, j + 1, i) == handler_id) {
+                return q;
+            }
+        }
     }
     return NULL;
 }
 
 static int
-dpif_netdev_recv(struct dpif *dpif, struct dpif_upcall *upcall,
-                 struct ofpbuf *buf)
+dpif_netdev_recv(struct dpif *dpif, uint32_t handler_id,
+                 struct dpif_upcall *upcall, struct ofpbuf *buf)
 {
-    struct dp_netdev_queue *q = find_nonempty_queue(dpif);
+    struct dp_netdev *dp = get_dp_netdev(dpif);
+    struct dp_netdev_queue *q;
+    int error;
+
+    pthread_rwlock_rdlock(&dp->upcall_rwlock);
+    q = find_nonempty_queue(dp, handler_id);
     if (q) {
-        struct dp_netdev_upcall *u = &q->upcalls[q->tail++ & QUEUE_MASK];
+        struct dp_netdev_upcall *u = &q->upcalls[q->tail & QUEUE_MASK];
+
+        /* Don't read the upcall until after its producer has finished
+         * writing it. */
+        __sync_synchronize();
 
         *upcall = u->upcall;
         upcall->packet = buf;
@@ -980,17 +1446,39 @@ dpif_netdev_recv(struct dpif *dpif, struct dpif_upcall *upcall,
         ofpbuf_uninit(buf);
         *buf = u->buf;
 
-        return 0;
+        /* Finish reading the upcall before the producer can reuse it. */
+        __sync_synchronize();
+        q->tail++;
+
+        error = 0;
     } else {
-        return EAGAIN;
+        error = EAGAIN;
     }
+    pthread_rwlock_unlock(&dp->upcall_rwlock);
+
+    return error;
 }
 
 static void
-dpif_netdev_recv_wait(struct dpif *dpif)
+dpif_netdev_recv_wait(struct dpif *dpif, uint32_t handler_id)
 {
-    if (find_nonempty_queue(dpif)) {
+    struct dp_netdev *dp = get_dp_netdev(dpif);
+    bool nonempty;
+
+    if (dp->n_threads) {
+        /* Drain wakeups before checking the queues, so that an upcall queued
+         * after the check is sure to wake us up. */
+        drain_fd(dp->wakeup_fds[0], 1);
+    }
+
+    pthread_rwlock_rdlock(&dp->upcall_rwlock);
+    nonempty = find_nonempty_queue(dp, handler_id) != NULL;
+    pthread_rwlock_unlock(&dp->upcall_rwlock);
+
+    if (nonempty) {
         poll_immediate_wake();
+    } else if (dp->n_threads) {
+        poll_fd_wait(dp->wakeup_fds[0], POLLIN);
     } else {
         /* No messages ready to be received, and dp_wait() will ensure that we
          * wake up to queue new messages, so there is nothing to do. */
@@ -1003,37 +1491,246 @@ dpif_netdev_recv_purge(struct dpif *dpif)
     struct dpif_netdev *dpif_netdev = dpif_netdev_cast(dpif);
     dp_netdev_purge_queues(dpif_netdev->dp);
 }
-
+
+/* A group of packets, within a batch received from a single port, that have
+ * the same flow key. */
+struct dp_netdev_batch {
+    uint32_t hash;                  /* flow_hash() of the packets' key. */
+    struct dp_netdev_flow *flow;    /* Matching flow, or NULL on miss. */
+    bool cache_hit;                 /* Was 'flow' found in exact-match cache? */
+    size_t n_packets;               /* Number of packets in group. */
+    long long int n_bytes;          /* Total bytes in group's packets. */
+    uint8_t tcp_flags;              /* Bitwise-OR of the packets' tcp_flags. */
+};
+
 static void
-dp_netdev_flow_used(struct dp_netdev_flow *flow, const struct ofpbuf *packet)
+dp_netdev_flow_used(struct dp_netdev_flow *flow,
+                    const struct dp_netdev_batch *batch, long long int now)
 {
-    flow->used = time_msec();
-    flow->packet_count++;
-    flow->byte_count += packet->size;
-    flow->tcp_flags |= packet_get_tcp_flags(packet, &flow->key);
+    flow->used = now;
+    flow->packet_count += batch->n_packets;
+    flow->byte_count += batch->n_bytes;
+    flow->tcp_flags |= batch->tcp_flags;
 }
 
+/* Processes the 'n' packets in 'packets', all received on 'port', on behalf
+ * of the thread that owns 'ctx'.  'now' is the current time.
+ *
+ * Packets with identical flow keys are grouped together, so that the flow
+ * table lookup and the flow statistics update are done once per group rather
+ * than once per packet.  Packets within a group are processed in the order in
+ * which they were received. */
 static void
-dp_netdev_port_input(struct dp_netdev *dp, struct dp_netdev_port *port,
-                     struct ofpbuf *packet)
+dp_netdev_port_input(struct dp_netdev *dp, struct dp_netdev_context *ctx,
+                     struct dp_netdev_port *port,
+                     struct ofpbuf *packets[], size_t n, long long int now)
 {
-    struct dp_netdev_flow *flow;
-    struct flow key;
+    struct dp_netdev_batch batches[NETDEV_MAX_RX_BATCH];
+    struct flow keys[NETDEV_MAX_RX_BATCH];
+    size_t batch_idx[NETDEV_MAX_RX_BATCH];
+    size_t n_batches;
+    size_t i, j;
+
+    n_batches = 0;
+    for (i = 0; i < n; i++) {
+        struct ofpbuf *packet = packets[i];
+        struct dp_netdev_batch *batch;
+        uint32_t hash;
+
+        if (packet->size < ETH_HEADER_LEN) {
+            batch_idx[i] = SIZE_MAX;
+            continue;
+        }
+        flow_extract(packet, 0, NULL, port->port_no, &keys[i]);
+        hash = flow_hash(&keys[i], 0);
 
-    if (packet->size < ETH_HEADER_LEN) {
-        return;
+        for (j = 0; j < i; j++) {
+            if (batch_idx[j] != SIZE_MAX
+                && batches[batch_idx[j]].hash == hash
+                && flow_equal(&keys[j], &keys[i])) {
+                break;
+            }
+        }
+
+        if (j < i) {
+            batch_idx[i] = batch_idx[j];
+            batch = &batches[batch_idx[i]];
+        } else {
+            batch_idx[i] = n_batches;
+            batch = &batches[n_batches++];
+            batch->hash = hash;
+            batch->flow = dp_netdev_emc_lookup(dp, ctx, &keys[i], hash,
+                                               &batch->cache_hit);
+            batch->n_packets = 0;
+            batch->n_bytes = 0;
+            batch->tcp_flags = 0;
+        }
+
+        batch->n_packets++;
+        batch->n_bytes += packet->size;
+        if (batch->flow) {
+            batch->tcp_flags |= packet_get_tcp_flags(packet, &keys[i]);
+        }
     }
-    flow_extract(packet, 0, NULL, port->port_no, &key);
-    flow = dp_netdev_lookup_flow(dp, &key);
-    if (flow) {
-        dp_netdev_flow_used(flow, packet);
-        dp_netdev_execute_actions(dp, packet, &key,
-                                  flow->actions, flow->actions_len);
-        dp->n_hit++;
-    } else {
-        dp->n_missed++;
-        dp_netdev_output_userspace(dp, packet, DPIF_UC_MISS, &key, 0);
+
+    for (j = 0; j < n_batches; j++) {
+        struct dp_netdev_batch *batch = &batches[j];
+        struct dp_netdev_flow *flow = batch->flow;
+
+        if (flow) {
+            dp_netdev_flow_used(flow, batch, now);
+            ctx->n_hit += batch->n_packets;
+        } else {
+            ctx->n_missed += batch->n_packets;
+        }
+        if (batch->cache_hit) {
+            ctx->n_cache_hit += batch->n_packets;
+        } else {
+            ctx->n_cache_missed += batch->n_packets;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (batch_idx[i] != j) {
+                continue;
+            }
+
+            if (flow) {
+                dp_netdev_execute_actions(dp, ctx, packets[i], &keys[i],
+                                          flow->actions, flow->actions_len);
+            } else {
+                dp_netdev_output_userspace(dp, ctx, packets[i],
+                                           DPIF_UC_MISS, &keys[i], 0);
+            }
+        }
+    }
+}
+
+/* Buffers for receiving batches of packets. */
+struct dp_netdev_rx {
+    struct ofpbuf bufs[NETDEV_MAX_RX_BATCH];
+    uint8_t *space;             /* Backing store for 'bufs'. */
+    size_t buf_size;            /* Bytes of 'space' per element of 'bufs'. */
+    size_t n_bufs;              /* Number of elements of 'bufs' in use. */
+};
+
+/* Initializes 'rx' for receiving batches of up to 'n' packets. */
+static void
+dp_netdev_rx_init(struct dp_netdev_rx *rx, size_t n)
+{
+    /* All of the receive buffers are carved out of a single allocation.  A
+     * buffer that needs to grow, e.g. to push a VLAN header, is moved to its
+     * own malloc'd block by the ofpbuf library. */
+    rx->buf_size = ROUND_UP(DP_NETDEV_HEADROOM + VLAN_ETH_HEADER_LEN + max_mtu,
+                            8);
+    rx->space = xmalloc(n * rx->buf_size);
+    rx->n_bufs = n;
+}
+
+static void
+dp_netdev_rx_destroy(struct dp_netdev_rx *rx)
+{
+    free(rx->space);
+}
+
+/* Records 'error', which occurred on the port numbered 'port_no', in
+ * 'errors'. */
+static void
+dp_netdev_count_error(struct dp_netdev_errors *errors, int error, int port_no)
+{
+    errors->n++;
+    errors->error = error;
+    errors->port_no = port_no;
+}
+
+/* Receives and processes a batch of packets from 'port' on behalf of the
+ * thread that owns 'ctx', using 'rx' for buffer space.  Returns true if any
+ * packets were received, false otherwise.
+ *
+ * A forwarding thread must hold 'dp->flow_rwlock' for reading. */
+static bool
+dp_netdev_port_poll(struct dp_netdev *dp, struct dp_netdev_context *ctx,
+                    struct dp_netdev_port *port, struct dp_netdev_rx *rx,
+                    long long int now)
+{
+    struct ofpbuf *packets[NETDEV_MAX_RX_BATCH];
+    size_t n_packets;
+    size_t i;
+    int error;
+
+    /* Reset packet contents. */
+    for (i = 0; i < rx->n_bufs; i++) {
+        ofpbuf_use_stub(&rx->bufs[i], rx->space + i * rx->buf_size,
+                        rx->buf_size);
+        ofpbuf_reserve(&rx->bufs[i], DP_NETDEV_HEADROOM);
+        packets[i] = &rx->bufs[i];
+    }
+
+    error = netdev_recv_batch(port->netdev, packets, rx->n_bufs, &n_packets);
+    if (!error) {
+        dp_netdev_port_input(dp, ctx, port, packets, n_packets, now);
+    } else if (error != EAGAIN && error != EOPNOTSUPP) {
+        dp_netdev_count_error(&ctx->rx_errors, error, port->port_no);
+    }
+
+    for (i = 0; i < rx->n_bufs; i++) {
+        ofpbuf_uninit(&rx->bufs[i]);
+    }
+
+    return !error;
+}
+
+static void
+dp_netdev_errors_add(struct dp_netdev_errors *dst,
+                     const struct dp_netdev_errors *src)
+{
+    if (src->n) {
+        dst->n += src->n;
+        dst->error = src->error;
+        dst->port_no = src->port_no;
+    }
+}
+
+/* Logs the errors in 'errors' that have not yet been logged, according to
+ * '*n_reported', which this function updates.  'what' describes the operation
+ * that failed. */
+static void
+dp_netdev_log_errors(struct dp_netdev *dp, const char *what,
+                     const struct dp_netdev_errors *errors,
+                     long long int *n_reported)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+
+    if (errors->n > *n_reported && !VLOG_DROP_ERR(&rl)) {
+        const struct dp_netdev_port *port = dp->ports[errors->port_no];
+
+        VLOG_ERR("%s: %lld errors %s ports, most recently on %s (%s)",
+                 dp->name, errors->n - *n_reported, what,
+                 port ? netdev_get_name(port->netdev) : "a deleted port",
+                 strerror(errors->error));
+        *n_reported = errors->n;
+    }
+}
+
+/* Logs the errors that the main thread and the forwarding threads have
+ * encountered since the last call. */
+static void
+dp_netdev_report_errors(struct dp_netdev *dp)
+{
+    struct dp_netdev_errors rx_errors = dp->main.rx_errors;
+    struct dp_netdev_errors tx_errors = dp->main.tx_errors;
+    size_t i;
+
+    for (i = 0; i < dp->n_threads; i++) {
+        const struct dp_netdev_context *ctx = &dp->threads[i].ctx;
+
+        dp_netdev_errors_add(&rx_errors, &ctx->rx_errors);
+        dp_netdev_errors_add(&tx_errors, &ctx->tx_errors);
     }
+
+    dp_netdev_log_errors(dp, "receiving packets from", &rx_errors,
+                         &dp->n_rx_errors_reported);
+    dp_netdev_log_errors(dp, "sending packets to", &tx_errors,
+                         &dp->n_tx_errors_reported);
 }
 
 static void
@@ -1041,27 +1738,21 @@ dpif_netdev_run(struct dpif *dpif)
 {
     struct dp_netdev *dp = get_dp_netdev(dpif);
     struct dp_netdev_port *port;
-    struct ofpbuf packet;
+    struct dp_netdev_rx rx;
 
-    ofpbuf_init(&packet, DP_NETDEV_HEADROOM + VLAN_ETH_HEADER_LEN + max_mtu);
+    dp_netdev_report_errors(dp);
+    if (dp->n_threads) {
+        /* The forwarding threads do all the work. */
+        return;
+    }
 
+    dp_netdev_rx_init(&rx, rx_batch);
+    dp_netdev_lock_flows(dp);
     LIST_FOR_EACH (port, node, &dp->port_list) {
-        int error;
-
-        /* Reset packet contents. */
-        ofpbuf_clear(&packet);
-        ofpbuf_reserve(&packet, DP_NETDEV_HEADROOM);
-
-        error = netdev_recv(port->netdev, &packet);
-        if (!error) {
-            dp_netdev_port_input(dp, port, &packet);
-        } else if (error != EAGAIN && error != EOPNOTSUPP) {
-            static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
-            VLOG_ERR_RL(&rl, "error receiving data from %s: %s",
-                        netdev_get_name(port->netdev), strerror(error));
-        }
+        dp_netdev_port_poll(dp, &dp->main, port, &rx, time_msec());
     }
-    ofpbuf_uninit(&packet);
+    dp_netdev_unlock_flows(dp);
+    dp_netdev_rx_destroy(&rx);
 }
 
 static void
@@ -1070,11 +1761,187 @@ dpif_netdev_wait(struct dpif *dpif)
     struct dp_netdev *dp = get_dp_netdev(dpif);
     struct dp_netdev_port *port;
 
+    if (dp->n_threads) {
+        /* dpif_netdev_recv_wait() wakes up for upcalls from the forwarding
+         * threads. */
+        return;
+    }
+
     LIST_FOR_EACH (port, node, &dp->port_list) {
         netdev_recv_wait(port->netdev);
     }
 }
 
+/* Forwarding threads. */
+
+/* Returns the current time in milliseconds, using the same clock as
+ * time_msec().  Unlike time_msec(), this is safe to call from a forwarding
+ * thread, although it ignores "time/warp". */
+static long long int
+dp_netdev_thread_time_msec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_to_msec(&now);
+}
+
+static void *
+dp_netdev_thread_main(void *thread_)
+{
+    struct dp_netdev_thread *thread = thread_;
+    struct dp_netdev *dp = thread->dp;
+    long long int next_flush = LLONG_MIN;
+    struct dp_netdev_rx rx;
+
+    /* Errors that the netdevs encounter in this thread are counted in the
+     * thread's context and logged by the main thread. */
+    netdev_thread_disable_logging();
+
+    dp_netdev_rx_init(&rx, rx_batch);
+    while (!dp->stop_threads) {
+        long long int now = dp_netdev_thread_time_msec();
+        bool received = false;
+        size_t i;
+
+        if (now >= next_flush) {
+            coverage_flush();
+            next_flush = now + 100;
+        }
+
+        pthread_rwlock_rdlock(&dp->flow_rwlock);
+        for (i = 0; i < thread->n_ports; i++) {
+            received |= dp_netdev_port_poll(dp, &thread->ctx,
+                                            thread->ports[i], &rx, now);
+        }
+        pthread_rwlock_unlock(&dp->flow_rwlock);
+
+        if (!received) {
+            sched_yield();
+        }
+    }
+    dp_netdev_rx_destroy(&rx);
+    coverage_flush();
+
+    return NULL;
+}
+
+/* Starts the configured number of forwarding threads for 'dp' and divides its
+ * ports among them. */
+static void
+dp_netdev_start_threads(struct dp_netdev *dp)
+{
+    struct dp_netdev_port *port;
+    sigset_t sigs, oldsigs;
+    size_t n_ports;
+    size_t i;
+
+    if (!n_fwd_threads || dp->n_threads) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&dp->upcall_rwlock);
+    n_ports = list_size(&dp->port_list);
+    dp->n_threads = MAX(1, MIN(n_fwd_threads, n_ports));
+    dp->threads = xzalloc(dp->n_threads * sizeof *dp->threads);
+    for (i = 0; i < dp->n_threads; i++) {
+        struct dp_netdev_thread *thread = &dp->threads[i];
+
+        thread->dp = dp;
+        thread->ports = xmalloc(n_ports * sizeof *thread->ports);
+        dp_netdev_context_init(&thread->ctx);
+    }
+
+    i = 0;
+    LIST_FOR_EACH (port, node, &dp->port_list) {
+        struct dp_netdev_thread *thread = &dp->threads[i++ % dp->n_threads];
+        thread->ports[thread->n_ports++] = port;
+    }
+
+    xpipe_nonblocking(dp->wakeup_fds);
+    dp->stop_threads = false;
+
+    /* Signals, e.g. the SIGALRM used by the timeval module, should only be
+     * delivered to the main thread, so block them all in the forwarding
+     * threads, which inherit our signal mask. */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_SETMASK, &sigs, &oldsigs);
+    for (i = 0; i < dp->n_threads; i++) {
+        struct dp_netdev_thread *thread = &dp->threads[i];
+        int error;
+
+        error = pthread_create(&thread->thread, NULL, dp_netdev_thread_main,
+                               thread);
+        if (error) {
+            VLOG_FATAL("%s: failed to start forwarding thread (%s)",
+                       dp->name, strerror(error));
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+    pthread_rwlock_unlock(&dp->upcall_rwlock);
+
+    VLOG_INFO("%s: started %zu forwarding threads", dp->name, dp->n_threads);
+}
+
+/* Stops 'dp''s forwarding threads, if any.  Upcalls that the threads queued
+ * are moved to the main thread's queues, as long as there is room, and their
+ * statistics are added to the main thread's. */
+static void
+dp_netdev_stop_threads(struct dp_netdev *dp)
+{
+    size_t i;
+    int j;
+
+    if (!dp->n_threads) {
+        return;
+    }
+
+    dp->stop_threads = true;
+    for (i = 0; i < dp->n_threads; i++) {
+        pthread_join(dp->threads[i].thread, NULL);
+    }
+
+    pthread_rwlock_wrlock(&dp->upcall_rwlock);
+    for (i = 0; i < dp->n_threads; i++) {
+        struct dp_netdev_context *ctx = &dp->threads[i].ctx;
+
+        for (j = 0; j < N_QUEUES; j++) {
+            struct dp_netdev_queue *src = &ctx->queues[j];
+            struct dp_netdev_queue *dst = &dp->main.queues[j];
+
+            while (src->tail != src->head) {
+                struct dp_netdev_upcall *u;
+
+                u = &src->upcalls[src->tail++ & QUEUE_MASK];
+                if (dst->head - dst->tail < MAX_QUEUE_LEN) {
+                    dst->upcalls[dst->head++ & QUEUE_MASK] = *u;
+                } else {
+                    ofpbuf_uninit(&u->buf);
+                    ctx->n_lost++;
+                }
+            }
+        }
+
+        dp->main.n_hit += ctx->n_hit;
+        dp->main.n_missed += ctx->n_missed;
+        dp->main.n_lost += ctx->n_lost;
+        dp->main.n_cache_hit += ctx->n_cache_hit;
+        dp->main.n_cache_missed += ctx->n_cache_missed;
+        dp_netdev_errors_add(&dp->main.rx_errors, &ctx->rx_errors);
+        dp_netdev_errors_add(&dp->main.tx_errors, &ctx->tx_errors);
+        dp_netdev_context_destroy(ctx);
+        free(dp->threads[i].ports);
+    }
+    free(dp->threads);
+    dp->threads = NULL;
+    dp->n_threads = 0;
+    pthread_rwlock_unlock(&dp->upcall_rwlock);
+
+    close(dp->wakeup_fds[0]);
+    close(dp->wakeup_fds[1]);
+    dp->wakeup_fds[0] = dp->wakeup_fds[1] = -1;
+}
+
 static void
 dp_netdev_set_dl(struct ofpbuf *packet, const struct ovs_key_ethernet *eth_key)
 {
@@ -1085,31 +1952,43 @@ dp_netdev_set_dl(struct ofpbuf *packet, const struct ovs_key_ethernet *eth_key)
 }
 
 static void
-dp_netdev_output_port(struct dp_netdev *dp, struct ofpbuf *packet,
-                      uint32_t out_port)
+dp_netdev_output_port(struct dp_netdev *dp, struct dp_netdev_context *ctx,
+                      struct ofpbuf *packet, uint32_t out_port)
 {
     struct dp_netdev_port *p = dp->ports[out_port];
     if (p) {
-        netdev_send(p->netdev, packet);
+        int error;
+
+        pthread_mutex_lock(&p->send_mutex);
+        error = netdev_send(p->netdev, packet);
+        pthread_mutex_unlock(&p->send_mutex);
+        if (error && error != EAGAIN && error != EOPNOTSUPP) {
+            dp_netdev_count_error(&ctx->tx_errors, error, p->port_no);
+        }
     }
 }
 
+/* Queues an upcall for 'packet' with key 'flow' to 'ctx''s queue
+ * 'queue_no'. */
 static int
-dp_netdev_output_userspace(struct dp_netdev *dp, const struct ofpbuf *packet,
-                         int queue_no, const struct flow *flow, uint64_t arg)
+dp_netdev_output_userspace(struct dp_netdev *dp, struct dp_netdev_context *ctx,
+                           const struct ofpbuf *packet, int queue_no,
+                           const struct flow *flow, uint64_t arg)
 {
-    struct dp_netdev_queue *q = &dp->queues[queue_no];
+    struct dp_netdev_queue *q = &ctx->queues[queue_no];
     struct dp_netdev_upcall *u;
     struct dpif_upcall *upcall;
     struct ofpbuf *buf;
+    unsigned int head;
     size_t key_len;
 
-    if (q->head - q->tail >= MAX_QUEUE_LEN) {
-        dp->n_lost++;
+    head = q->head;
+    if (head - q->tail >= MAX_QUEUE_LEN) {
+        ctx->n_lost++;
         return ENOBUFS;
     }
 
-    u = &q->upcalls[q->head++ & QUEUE_MASK];
+    u = &q->upcalls[head & QUEUE_MASK];
 
     buf = &u->buf;
     ofpbuf_init(buf, ODPUTIL_FLOW_KEY_BYTES + 2 + packet->size);
@@ -1126,11 +2005,20 @@ dp_netdev_output_userspace(struct dp_netdev *dp, const struct ofpbuf *packet,
     upcall->key_len = key_len;
     upcall->userdata = arg;
 
+    /* Publish the upcall only after it is completely written. */
+    __sync_synchronize();
+    q->head = head + 1;
+
+    if (ctx != &dp->main && head == q->tail) {
+        /* The queue was empty, so the main thread might be waiting. */
+        ignore(write(dp->wakeup_fds[1], "", 1));
+    }
+
     return 0;
 }
 
 static void
-dp_netdev_sample(struct dp_netdev *dp,
+dp_netdev_sample(struct dp_netdev *dp, struct dp_netdev_context *ctx,
                  struct ofpbuf *packet, struct flow *key,
                  const struct nlattr *action)
 {
@@ -1143,7 +2031,7 @@ dp_netdev_sample(struct dp_netdev *dp,
 
         switch ((enum ovs_sample_attr) type) {
         case OVS_SAMPLE_ATTR_PROBABILITY:
-            if (random_uint32() >= nl_attr_get_u32(a)) {
+            if (random_uint32_r(&ctx->seed) >= nl_attr_get_u32(a)) {
                 return;
             }
             break;
@@ -1159,21 +2047,22 @@ dp_netdev_sample(struct dp_netdev *dp,
         }
     }
 
-    dp_netdev_execute_actions(dp, packet, key, nl_attr_get(subactions),
+    dp_netdev_execute_actions(dp, ctx, packet, key, nl_attr_get(subactions),
                               nl_attr_get_size(subactions));
 }
 
 static void
-dp_netdev_action_userspace(struct dp_netdev *dp,
-                          struct ofpbuf *packet, struct flow *key,
-                          const struct nlattr *a)
+dp_netdev_action_userspace(struct dp_netdev *dp, struct dp_netdev_context *ctx,
+                           struct ofpbuf *packet, struct flow *key,
+                           const struct nlattr *a)
 {
     const struct nlattr *userdata_attr;
     uint64_t userdata;
 
     userdata_attr = nl_attr_find_nested(a, OVS_USERSPACE_ATTR_USERDATA);
     userdata = userdata_attr ? nl_attr_get_u64(userdata_attr) : 0;
-    dp_netdev_output_userspace(dp, packet, DPIF_UC_ACTION, key, userdata);
+    dp_netdev_output_userspace(dp, ctx, packet, DPIF_UC_ACTION, key,
+                               userdata);
 }
 
 static void
@@ -1229,7 +2118,7 @@ execute_set_action(struct ofpbuf *packet, const struct nlattr *a)
 }
 
 static void
-dp_netdev_execute_actions(struct dp_netdev *dp,
+dp_netdev_execute_actions(struct dp_netdev *dp, struct dp_netdev_context *ctx,
                           struct ofpbuf *packet, struct flow *key,
                           const struct nlattr *actions,
                           size_t actions_len)
@@ -1243,11 +2132,11 @@ dp_netdev_execute_actions(struct dp_netdev *dp,
 
         switch ((enum ovs_action_attr) type) {
         case OVS_ACTION_ATTR_OUTPUT:
-            dp_netdev_output_port(dp, packet, nl_attr_get_u32(a));
+            dp_netdev_output_port(dp, ctx, packet, nl_attr_get_u32(a));
             break;
 
         case OVS_ACTION_ATTR_USERSPACE:
-            dp_netdev_action_userspace(dp, packet, key, a);
+            dp_netdev_action_userspace(dp, ctx, packet, key, a);
             break;
 
         case OVS_ACTION_ATTR_PUSH_VLAN:
@@ -1264,7 +2153,7 @@ dp_netdev_execute_actions(struct dp_netdev *dp,
             break;
 
         case OVS_ACTION_ATTR_SAMPLE:
-            dp_netdev_sample(dp, packet, key, a);
+            dp_netdev_sample(dp, ctx, packet, key, a);
             break;
 
         case OVS_ACTION_ATTR_UNSPEC:
@@ -1304,12 +2193,47 @@ const struct dpif_class dpif_netdev_class = {
     dpif_netdev_execute,
     NULL,                       /* operate */
     dpif_netdev_recv_set,
+    dpif_netdev_handlers_set,
     dpif_netdev_queue_to_priority,
     dpif_netdev_recv,
     dpif_netdev_recv_wait,
+    NULL,                       /* recv_get_fd */
     dpif_netdev_recv_purge,
 };
 
+/* Sets the maximum number of packets that the userspace datapath receives from
+ * a single port in one pass of its main loop to 'n', which is clamped to the
+ * range 1 through NETDEV_MAX_RX_BATCH.  A value of 1 disables batching. */
+void
+dpif_netdev_set_rx_batch(size_t n)
+{
+    rx_batch = MAX(1, MIN(n, NETDEV_MAX_RX_BATCH));
+}
+
+/* Sets the number of forwarding threads used by each userspace datapath to
+ * 'n', but no more than DPIF_NETDEV_MAX_THREADS.  If 'n' is 0, packets are
+ * forwarded by dpif_run() in the main thread, which is the default.  Otherwise, each datapath divides its ports among up
+ * to 'n' threads, each of which continuously polls its ports for packets.
+ * Upcalls are passed to the main thread through per-thread queues. */
+void
+dpif_netdev_set_n_threads(size_t n)
+{
+    struct shash_node *node;
+
+    n = MIN(n, DPIF_NETDEV_MAX_THREADS);
+    if (n == n_fwd_threads) {
+        return;
+    }
+
+    SHASH_FOR_EACH (node, &dp_netdevs) {
+        dp_netdev_stop_threads(node->data);
+    }
+    n_fwd_threads = n;
+    SHASH_FOR_EACH (node, &dp_netdevs) {
+        dp_netdev_start_threads(node->data);
+    }
+}
+
 static void
 dpif_dummy_register__(const char *type)
 {
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DPIF_NETDEV_H
+#define DPIF_NETDEV_H 1
+
+#include <stddef.h>
+#include "dpif.h"
+
+/* Tuning for the netdev-based userspace datapath. */
+#define DPIF_NETDEV_MAX_THREADS 256
+void dpif_netdev_set_rx_batch(size_t n);
+void dpif_netdev_set_n_threads(size_t n);
+
+#endif /* dpif-netdev.h */
@@ -225,6 +225,10 @@ struct dpif_class {
      * Netlink attributes with types OVS_ACTION_ATTR_* in the
      * 'put->actions_len' bytes starting at 'put->actions'.
      *
+     * If 'put->mask_len' is nonzero, then 'put->mask' specifies the bits of
+     * the key that are significant, as described for dpif_flow_put().  A
+     * datapath that does not support wildcarded flows may ignore the mask.
+     *
      * - If the flow's key does not exist in 'dpif', then the flow will be
      *   added if 'put->flags' includes DPIF_FP_CREATE.  Otherwise the
      *   operation will fail with ENOENT.
@@ -271,7 +275,9 @@ struct dpif_class {
      *
      * On success, if 'key' and 'key_len' are nonnull then '*key' and
      * '*key_len' must be set to Netlink attributes with types OVS_KEY_ATTR_*
-     * representing the dumped flow's key.  If 'actions' and 'actions_len' are
+     * representing the dumped flow's key.  If 'mask' and 'mask_len' are
+     * nonnull then they must be set to the flow's mask, or to NULL and 0 for
+     * an exact-match flow.  If 'actions' and 'actions_len' are
      * nonnull then they should be set to Netlink attributes with types
      * OVS_ACTION_ATTR_* representing the dumped flow's actions.  If 'stats'
      * is nonnull then it should be set to the dumped flow's statistics.
@@ -282,6 +288,7 @@ struct dpif_class {
      * 'flow_dump_next' or 'flow_dump_done' for 'state'. */
     int (*flow_dump_next)(const struct dpif *dpif, void *state,
                           const struct nlattr **key, size_t *key_len,
+                          const struct nlattr **mask, size_t *mask_len,
                           const struct nlattr **actions, size_t *actions_len,
                           const struct dpif_flow_stats **stats);
 
@@ -311,14 +318,24 @@ struct dpif_class {
      * updating flows as necessary if it does this. */
     int (*recv_set)(struct dpif *dpif, bool enable);
 
+    /* Divides the upcalls that 'dpif' receives among 'n_handlers' handlers,
+     * numbered 0 through 'n_handlers - 1', each of which receives a disjoint
+     * subset of the upcalls with dpif_recv().  'n_handlers' is at least 1.
+     * The number of handlers is initially 1.
+     *
+     * This function is optional.  A dpif that does not implement it supports
+     * only a single handler. */
+    int (*handlers_set)(struct dpif *dpif, uint32_t n_handlers);
+
     /* Translates OpenFlow queue ID 'queue_id' (in host byte order) into a
      * priority value used for setting packet priority. */
     int (*queue_to_priority)(const struct dpif *dpif, uint32_t queue_id,
                              uint32_t *priority);
 
-    /* Polls for an upcall from 'dpif'.  If successful, stores the upcall into
-     * '*upcall', using 'buf' for storage.  Should only be called if 'recv_set'
-     * has been used to enable receiving packets from 'dpif'.
+    /* Polls for an upcall from 'dpif' for handler 'handler_id'.  If
+     * successful, stores the upcall into '*upcall', using 'buf' for storage.
+     * Should only be called if 'recv_set' has been used to enable receiving
+     * packets from 'dpif'.
      *
      * The implementation should point 'upcall->packet' and 'upcall->key' into
      * data in the caller-provided 'buf'.  If necessary to make room, the
@@ -327,13 +344,27 @@ struct dpif_class {
      * so far.)
      *
      * This function must not block.  If no upcall is pending when it is
-     * called, it should return EAGAIN without blocking. */
-    int (*recv)(struct dpif *dpif, struct dpif_upcall *upcall,
-                struct ofpbuf *buf);
+     * called, it should return EAGAIN without blocking.
+     *
+     * This function may be called from several threads at once, as long as
+     * each uses a different 'handler_id', concurrently with any other member
+     * function except 'recv_set', 'handlers_set', 'recv_purge', and
+     * 'close'. */
+    int (*recv)(struct dpif *dpif, uint32_t handler_id,
+                struct dpif_upcall *upcall, struct ofpbuf *buf);
 
     /* Arranges for the poll loop to wake up when 'dpif' has a message queued
-     * to be received with the recv member function. */
-    void (*recv_wait)(struct dpif *dpif);
+     * to be received with the recv member function for 'handler_id'. */
+    void (*recv_wait)(struct dpif *dpif, uint32_t handler_id);
+
+    /* Returns a file descriptor that becomes readable when 'dpif' may have a
+     * message queued for 'handler_id', for use by a thread that cannot use
+     * the poll loop, or -1 if there is no such file descriptor.  The caller
+     * must not read from or close the file descriptor.
+     *
+     * This function is optional.  If it is not implemented, or it returns -1,
+     * a handler thread has to poll 'recv' periodically. */
+    int (*recv_get_fd)(struct dpif *dpif, uint32_t handler_id);
 
     /* Throws away any queued upcalls that 'dpif' currently has ready to
      * return. */
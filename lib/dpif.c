@@ -83,6 +83,7 @@ static struct vlog_rate_limit error_rl = VLOG_RATE_LIMIT_INIT(60, 5);
 static void log_flow_message(const struct dpif *dpif, int error,
                              const char *operation,
                              const struct nlattr *key, size_t key_len,
+                             const struct nlattr *mask, size_t mask_len,
                              const struct dpif_flow_stats *stats,
                              const struct nlattr *actions, size_t actions_len);
 static void log_operation(const struct dpif *, const char *operation,
@@ -410,7 +411,10 @@ dpif_delete(struct dpif *dpif)
 int
 dpif_get_dp_stats(const struct dpif *dpif, struct dpif_dp_stats *stats)
 {
-    int error = dpif->dpif_class->get_stats(dpif, stats);
+    int error;
+
+    stats->n_cache_hit = stats->n_cache_missed = UINT64_MAX;
+    error = dpif->dpif_class->get_stats(dpif, stats);
     if (error) {
         memset(stats, 0, sizeof *stats);
     }
@@ -793,8 +797,8 @@ dpif_flow_get(const struct dpif *dpif,
             actions = NULL;
             actions_len = 0;
         }
-        log_flow_message(dpif, error, "flow_get", key, key_len, stats,
-                         actions, actions_len);
+        log_flow_message(dpif, error, "flow_get", key, key_len, NULL, 0,
+                         stats, actions, actions_len);
     }
     return error;
 }
@@ -824,6 +828,14 @@ dpif_flow_put__(struct dpif *dpif, const struct dpif_flow_put *put)
  * 'key'.  The associated actions are specified by the Netlink attributes with
  * types OVS_ACTION_ATTR_* in the 'actions_len' bytes starting at 'actions'.
  *
+ * If 'mask_len' is nonzero, then the flow is wildcarded: the 'mask_len' bytes
+ * starting at 'mask', in the format generated by odp_flow_key_from_mask(),
+ * specify which bits of the key are significant, and the flow matches every
+ * packet whose key agrees with 'key' in those bits.  A datapath that does not
+ * support wildcarded flows ignores 'mask' and adds an exact-match flow, which
+ * is always a correct, if less effective, substitute.  The mask of an existing
+ * flow is replaced by 'mask' when the flow's actions are updated.
+ *
  * - If the flow's key does not exist in 'dpif', then the flow will be added if
  *   'flags' includes DPIF_FP_CREATE.  Otherwise the operation will fail with
  *   ENOENT.
@@ -842,6 +854,7 @@ dpif_flow_put__(struct dpif *dpif, const struct dpif_flow_put *put)
 int
 dpif_flow_put(struct dpif *dpif, enum dpif_flow_put_flags flags,
               const struct nlattr *key, size_t key_len,
+              const struct nlattr *mask, size_t mask_len,
               const struct nlattr *actions, size_t actions_len,
               struct dpif_flow_stats *stats)
 {
@@ -850,6 +863,8 @@ dpif_flow_put(struct dpif *dpif, enum dpif_flow_put_flags flags,
     put.flags = flags;
     put.key = key;
     put.key_len = key_len;
+    put.mask = mask;
+    put.mask_len = mask_len;
     put.actions = actions;
     put.actions_len = actions_len;
     put.stats = stats;
@@ -913,7 +928,10 @@ dpif_flow_dump_start(struct dpif_flow_dump *dump, const struct dpif *dpif)
  *
  * On success, if 'key' and 'key_len' are nonnull then '*key' and '*key_len'
  * will be set to Netlink attributes with types OVS_KEY_ATTR_* representing the
- * dumped flow's key.  If 'actions' and 'actions_len' are nonnull then they are
+ * dumped flow's key.  If 'mask' and 'mask_len' are nonnull then they are set
+ * to the dumped flow's mask, in the format described for dpif_flow_put(), or
+ * to NULL and 0 if the flow is an exact-match flow.  If 'actions' and
+ * 'actions_len' are nonnull then they are
  * set to Netlink attributes with types OVS_ACTION_ATTR_* representing the
  * dumped flow's actions.  If 'stats' is nonnull then it will be set to the
  * dumped flow's statistics.
@@ -925,6 +943,7 @@ dpif_flow_dump_start(struct dpif_flow_dump *dump, const struct dpif *dpif)
 bool
 dpif_flow_dump_next(struct dpif_flow_dump *dump,
                     const struct nlattr **key, size_t *key_len,
+                    const struct nlattr **mask, size_t *mask_len,
                     const struct nlattr **actions, size_t *actions_len,
                     const struct dpif_flow_stats **stats)
 {
@@ -934,6 +953,7 @@ dpif_flow_dump_next(struct dpif_flow_dump *dump,
     if (!error) {
         error = dpif->dpif_class->flow_dump_next(dpif, dump->state,
                                                  key, key_len,
+                                                 mask, mask_len,
                                                  actions, actions_len,
                                                  stats);
         if (error) {
@@ -945,6 +965,10 @@ dpif_flow_dump_next(struct dpif_flow_dump *dump,
             *key = NULL;
             *key_len = 0;
         }
+        if (mask) {
+            *mask = NULL;
+            *mask_len = 0;
+        }
         if (actions) {
             *actions = NULL;
             *actions_len = 0;
@@ -959,6 +983,7 @@ dpif_flow_dump_next(struct dpif_flow_dump *dump,
         } else if (should_log_flow_message(error)) {
             log_flow_message(dpif, error, "flow_dump",
                              key ? *key : NULL, key ? *key_len : 0,
+                             mask ? *mask : NULL, mask ? *mask_len : 0,
                              stats ? *stats : NULL, actions ? *actions : NULL,
                              actions ? *actions_len : 0);
         }
@@ -1101,21 +1126,52 @@ dpif_recv_set(struct dpif *dpif, bool enable)
     return error;
 }
 
-/* Polls for an upcall from 'dpif'.  If successful, stores the upcall into
- * '*upcall', using 'buf' for storage.  Should only be called if
- * dpif_recv_set() has been used to enable receiving packets on 'dpif'.
+/* Divides the upcalls received on 'dpif' among 'n_handlers' handlers,
+ * numbered 0 through 'n_handlers - 1'.  Each handler receives a disjoint
+ * subset of the upcalls, by passing its number to dpif_recv(), so that each
+ * handler can run in its own thread.  Returns 0 if successful, otherwise a
+ * positive errno value.  A datapath that cannot divide its upcalls supports
+ * only a single handler, and returns EOPNOTSUPP for any larger number.
+ *
+ * Like dpif_recv_set(), this may change the Netlink PID assignments returned
+ * by dpif_port_get_pid(). */
+int
+dpif_handlers_set(struct dpif *dpif, uint32_t n_handlers)
+{
+    int error;
+
+    if (!n_handlers) {
+        error = EINVAL;
+    } else if (dpif->dpif_class->handlers_set) {
+        error = dpif->dpif_class->handlers_set(dpif, n_handlers);
+    } else {
+        error = n_handlers == 1 ? 0 : EOPNOTSUPP;
+    }
+    log_operation(dpif, "handlers_set", error);
+    return error;
+}
+
+/* Polls for an upcall from 'dpif' for handler 'handler_id'.  If successful,
+ * stores the upcall into '*upcall', using 'buf' for storage.  Should only be
+ * called if dpif_recv_set() has been used to enable receiving packets on
+ * 'dpif'.
  *
  * 'upcall->packet' and 'upcall->key' point into data in the caller-provided
  * 'buf', so their memory cannot be freed separately from 'buf'.  (This is
  * hardly a great way to do things but it works out OK for the dpif providers
  * and clients that exist so far.)
  *
+ * Threads may call this function concurrently for different 'handler_id's
+ * while another thread uses 'dpif' for anything other than dpif_recv_set(),
+ * dpif_handlers_set(), dpif_recv_purge(), or dpif_close().
+ *
  * Returns 0 if successful, otherwise a positive errno value.  Returns EAGAIN
  * if no upcall is immediately available. */
 int
-dpif_recv(struct dpif *dpif, struct dpif_upcall *upcall, struct ofpbuf *buf)
+dpif_recv(struct dpif *dpif, uint32_t handler_id, struct dpif_upcall *upcall,
+          struct ofpbuf *buf)
 {
-    int error = dpif->dpif_class->recv(dpif, upcall, buf);
+    int error = dpif->dpif_class->recv(dpif, handler_id, upcall, buf);
     if (!error && !VLOG_DROP_DBG(&dpmsg_rl)) {
         struct ds flow;
         char *packet;
@@ -1150,11 +1206,24 @@ dpif_recv_purge(struct dpif *dpif)
 }
 
 /* Arranges for the poll loop to wake up when 'dpif' has a message queued to be
- * received with dpif_recv(). */
+ * received with dpif_recv() for 'handler_id'. */
 void
-dpif_recv_wait(struct dpif *dpif)
+dpif_recv_wait(struct dpif *dpif, uint32_t handler_id)
 {
-    dpif->dpif_class->recv_wait(dpif);
+    dpif->dpif_class->recv_wait(dpif, handler_id);
+}
+
+/* Returns a file descriptor that becomes readable when 'dpif' may have a
+ * message queued for 'handler_id', for a thread that cannot use the poll loop
+ * to wait, or -1 if 'dpif' has no such file descriptor.  In the latter case,
+ * the thread must poll dpif_recv() periodically instead.  The caller must not
+ * read from or close the returned file descriptor. */
+int
+dpif_recv_get_fd(struct dpif *dpif, uint32_t handler_id)
+{
+    return (dpif->dpif_class->recv_get_fd
+            ? dpif->dpif_class->recv_get_fd(dpif, handler_id)
+            : -1);
 }
 
 /* Obtains the NetFlow engine type and engine ID for 'dpif' into '*engine_type'
@@ -1248,6 +1317,7 @@ should_log_flow_message(int error)
 static void
 log_flow_message(const struct dpif *dpif, int error, const char *operation,
                  const struct nlattr *key, size_t key_len,
+                 const struct nlattr *mask, size_t mask_len,
                  const struct dpif_flow_stats *stats,
                  const struct nlattr *actions, size_t actions_len)
 {
@@ -1261,6 +1331,10 @@ log_flow_message(const struct dpif *dpif, int error, const char *operation,
         ds_put_format(&ds, "(%s) ", strerror(error));
     }
     odp_flow_key_format(key, key_len, &ds);
+    if (mask_len) {
+        ds_put_cstr(&ds, ", mask:");
+        odp_flow_key_format(mask, mask_len, &ds);
+    }
     if (stats) {
         ds_put_cstr(&ds, ", ");
         dpif_flow_stats_format(stats, &ds);
@@ -1292,7 +1366,8 @@ log_flow_put_message(struct dpif *dpif, const struct dpif_flow_put *put,
             ds_put_cstr(&s, "[zero]");
         }
         log_flow_message(dpif, error, ds_cstr(&s),
-                         put->key, put->key_len, put->stats,
+                         put->key, put->key_len, put->mask, put->mask_len,
+                         put->stats,
                          put->actions, put->actions_len);
         ds_destroy(&s);
     }
@@ -1304,6 +1379,7 @@ log_flow_del_message(struct dpif *dpif, const struct dpif_flow_del *del,
 {
     if (should_log_flow_message(error)) {
         log_flow_message(dpif, error, "flow_del", del->key, del->key_len,
+                         NULL, 0,
                          !error ? del->stats : NULL, NULL, 0);
     }
 }
@@ -19,6 +19,8 @@
 
 #include <stdbool.h>
 
+struct ofpbuf;
+
 /* For client programs to call directly to enable dummy support. */
 void dummy_enable(bool override);
 
@@ -27,4 +29,7 @@ void dpif_dummy_register(bool override);
 void netdev_dummy_register(bool override);
 void timeval_dummy_register(void);
 
+/* For test programs to inject packets into dummy network devices. */
+int netdev_dummy_queue_packet(const char *name, const struct ofpbuf *);
+
 #endif /* dummy.h */
@@ -528,6 +528,22 @@ flow_wildcards_is_catchall(const struct flow_wildcards *wc)
     return true;
 }
 
+/* Returns true if 'wc' does not wildcard any bits or fields, false
+ * otherwise. */
+bool
+flow_wildcards_is_exact(const struct flow_wildcards *wc)
+{
+    const uint32_t *wc_u32 = (const uint32_t *) &wc->masks;
+    size_t i;
+
+    for (i = 0; i < FLOW_U32S; i++) {
+        if (wc_u32[i] != UINT32_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /* Initializes 'dst' as the combination of wildcards in 'src1' and 'src2'.
  * That is, a bit or a field is wildcarded in 'dst' if it is wildcarded in
  * 'src1' or 'src2' or both.  */
@@ -546,6 +562,53 @@ flow_wildcards_combine(struct flow_wildcards *dst,
     }
 }
 
+/* Makes every bit that is significant (1) in 'mask' significant in 'wc' as
+ * well, leaving the other bits in 'wc' unchanged. */
+void
+flow_wildcards_fold_minimask(struct flow_wildcards *wc,
+                             const struct minimask *mask)
+{
+    uint32_t *dst_u32 = (uint32_t *) &wc->masks;
+    const struct miniflow *masks = &mask->masks;
+    int ofs;
+    int i;
+
+    ofs = 0;
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        uint32_t map;
+
+        for (map = masks->map[i]; map; map = zero_rightmost_1bit(map)) {
+            dst_u32[raw_ctz(map) + i * 32] |= masks->values[ofs++];
+        }
+    }
+}
+
+/* Same as flow_wildcards_fold_minimask(), except that only the 32-bit words
+ * of 'mask' selected by the MINI_N_MAPS-element bitmap 'range' are folded
+ * into 'wc'. */
+void
+flow_wildcards_fold_minimask_range(struct flow_wildcards *wc,
+                                   const struct minimask *mask,
+                                   const uint32_t range[])
+{
+    uint32_t *dst_u32 = (uint32_t *) &wc->masks;
+    const struct miniflow *masks = &mask->masks;
+    int ofs;
+    int i;
+
+    ofs = 0;
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        uint32_t map;
+
+        for (map = masks->map[i]; map; map = zero_rightmost_1bit(map)) {
+            if (range[i] & rightmost_1bit(map)) {
+                dst_u32[raw_ctz(map) + i * 32] |= masks->values[ofs];
+            }
+            ofs++;
+        }
+    }
+}
+
 /* Returns a hash of the wildcards in 'wc'. */
 uint32_t
 flow_wildcards_hash(const struct flow_wildcards *wc, uint32_t basis)
@@ -1082,6 +1145,38 @@ miniflow_hash_in_minimask(const struct miniflow *flow,
     return mhash_finish(hash, p - mask->masks.values);
 }
 
+/* Same as flow_hash_in_minimask_range(), except that 'flow' is a "struct
+ * miniflow".  The hash values returned by the two functions are the same. */
+uint32_t
+miniflow_hash_in_minimask_range(const struct miniflow *flow,
+                                const struct minimask *mask,
+                                const uint32_t range[], uint32_t *basis)
+{
+    const uint32_t *p = mask->masks.values;
+    uint32_t hash;
+    int n;
+    int i;
+
+    hash = *basis;
+    n = 0;
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        uint32_t map;
+
+        for (map = mask->masks.map[i]; map; map = zero_rightmost_1bit(map)) {
+            if (range[i] & rightmost_1bit(map)) {
+                int ofs = raw_ctz(map) + i * 32;
+
+                hash = mhash_add(hash, miniflow_get(flow, ofs) & *p);
+                n++;
+            }
+            p++;
+        }
+    }
+    *basis = hash;
+
+    return mhash_finish(hash, n);
+}
+
 /* Returns a hash value for the bits of 'flow' where there are 1-bits in
  * 'mask', given 'basis'.
  *
@@ -1111,6 +1206,48 @@ flow_hash_in_minimask(const struct flow *flow, const struct minimask *mask,
     return mhash_finish(hash, p - mask->masks.values);
 }
 
+/* Returns a hash value for the bits of 'flow' where there are 1-bits in
+ * 'mask', considering only the 32-bit words of 'flow' selected by the
+ * MINI_N_MAPS-element bitmap 'range'.
+ *
+ * '*basis' is the running hash of any ranges hashed earlier and is updated to
+ * cover this range as well, so that hashing a series of disjoint ranges one
+ * after another yields hashes of successively larger parts of 'flow'.
+ *
+ * The hash values returned by this function are the same as those returned by
+ * miniflow_hash_in_minimask_range(), only the form of the arguments
+ * differ. */
+uint32_t
+flow_hash_in_minimask_range(const struct flow *flow,
+                            const struct minimask *mask,
+                            const uint32_t range[], uint32_t *basis)
+{
+    const uint32_t *flow_u32 = (const uint32_t *) flow;
+    const uint32_t *p = mask->masks.values;
+    uint32_t hash;
+    int n;
+    int i;
+
+    hash = *basis;
+    n = 0;
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        uint32_t map;
+
+        for (map = mask->masks.map[i]; map; map = zero_rightmost_1bit(map)) {
+            if (range[i] & rightmost_1bit(map)) {
+                int ofs = raw_ctz(map) + i * 32;
+
+                hash = mhash_add(hash, flow_u32[ofs] & *p);
+                n++;
+            }
+            p++;
+        }
+    }
+    *basis = hash;
+
+    return mhash_finish(hash, n);
+}
+
 /* Initializes 'dst' as a copy of 'src'.  The caller must eventually free 'dst'
  * with minimask_destroy(). */
 void
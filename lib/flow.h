@@ -154,6 +154,9 @@ flow_hash(const struct flow *flow, uint32_t basis)
 
 uint32_t flow_hash_in_minimask(const struct flow *, const struct minimask *,
                                uint32_t basis);
+uint32_t flow_hash_in_minimask_range(const struct flow *,
+                                     const struct minimask *,
+                                     const uint32_t range[], uint32_t *basis);
 
 /* Wildcards for a flow.
  *
@@ -168,6 +171,7 @@ void flow_wildcards_init_catchall(struct flow_wildcards *);
 void flow_wildcards_init_exact(struct flow_wildcards *);
 
 bool flow_wildcards_is_catchall(const struct flow_wildcards *);
+bool flow_wildcards_is_exact(const struct flow_wildcards *);
 
 void flow_wildcards_set_reg_mask(struct flow_wildcards *,
                                  int idx, uint32_t mask);
@@ -177,6 +181,11 @@ void flow_wildcards_combine(struct flow_wildcards *dst,
                             const struct flow_wildcards *src2);
 bool flow_wildcards_has_extra(const struct flow_wildcards *,
                               const struct flow_wildcards *);
+void flow_wildcards_fold_minimask(struct flow_wildcards *,
+                                  const struct minimask *);
+void flow_wildcards_fold_minimask_range(struct flow_wildcards *,
+                                        const struct minimask *,
+                                        const uint32_t range[]);
 
 uint32_t flow_wildcards_hash(const struct flow_wildcards *, uint32_t basis);
 bool flow_wildcards_equal(const struct flow_wildcards *,
@@ -252,6 +261,10 @@ bool miniflow_equal_flow_in_minimask(const struct miniflow *a,
 uint32_t miniflow_hash(const struct miniflow *, uint32_t basis);
 uint32_t miniflow_hash_in_minimask(const struct miniflow *,
                                    const struct minimask *, uint32_t basis);
+uint32_t miniflow_hash_in_minimask_range(const struct miniflow *,
+                                         const struct minimask *,
+                                         const uint32_t range[],
+                                         uint32_t *basis);
 
 /* Compressed flow wildcards. */
 
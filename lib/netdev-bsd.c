@@ -552,7 +552,9 @@ proc_pkt(u_char *args_, const struct pcap_pkthdr *hdr, const u_char *packet)
     struct pcap_arg *args = (struct pcap_arg *)args_;
 
     if (args->size < hdr->len) {
-        VLOG_WARN_RL(&rl, "packet truncated");
+        if (netdev_thread_may_log()) {
+            VLOG_WARN_RL(&rl, "packet truncated");
+        }
         args->retval = args->size;
     } else {
         args->retval = hdr->len;
@@ -616,7 +618,7 @@ netdev_bsd_recv_tap(struct netdev_bsd *netdev, void *data, size_t size)
         if (retval >= 0) {
             return retval;
         } else if (errno != EINTR) {
-            if (errno != EAGAIN) {
+            if (errno != EAGAIN && netdev_thread_may_log()) {
                 VLOG_WARN_RL(&rl, "error receiving Ethernet packet on %s: %s",
                              strerror(errno), netdev->netdev.netdev_dev->name);
             }
@@ -709,15 +711,17 @@ netdev_bsd_send(struct netdev *netdev_, const void *data, size_t size)
         if (retval < 0) {
             if (errno == EINTR) {
                 continue;
-            } else if (errno != EAGAIN) {
+            } else if (errno != EAGAIN && netdev_thread_may_log()) {
                 VLOG_WARN_RL(&rl, "error sending Ethernet packet on %s: %s",
                              netdev_get_name(netdev_), strerror(errno));
             }
             return errno;
         } else if (retval != size) {
-            VLOG_WARN_RL(&rl, "sent partial Ethernet packet (%zd bytes of "
-                         "%zu) on %s", retval, size,
-                         netdev_get_name(netdev_));
+            if (netdev_thread_may_log()) {
+                VLOG_WARN_RL(&rl, "sent partial Ethernet packet (%zd bytes of "
+                             "%zu) on %s", retval, size,
+                             netdev_get_name(netdev_));
+            }
            return EMSGSIZE;
         } else {
             return 0;
@@ -1262,6 +1266,7 @@ const struct netdev_class netdev_bsd_class = {
     netdev_bsd_listen,
 
     netdev_bsd_recv,
+    NULL, /* recv_batch */
     netdev_bsd_recv_wait,
     netdev_bsd_drain,
 
@@ -1322,6 +1327,7 @@ const struct netdev_class netdev_tap_class = {
     netdev_bsd_listen,
 
     netdev_bsd_recv,
+    NULL, /* recv_batch */
     netdev_bsd_recv_wait,
     netdev_bsd_drain,
 
@@ -19,6 +19,7 @@
 #include "dummy.h"
 
 #include <errno.h>
+#include <pthread.h>
 
 #include "flow.h"
 #include "list.h"
@@ -49,8 +50,13 @@ struct netdev_dev_dummy {
 struct netdev_dummy {
     struct netdev netdev;
     struct list node;           /* In netdev_dev_dummy's "devs" list. */
-    struct list recv_queue;
     bool listening;
+
+    /* Packets waiting to be received.  Protected by 'mutex', because the
+     * userspace datapath's forwarding threads receive from dummy devices
+     * concurrently with the main thread queuing packets to them. */
+    pthread_mutex_t mutex;
+    struct list recv_queue;
 };
 
 static struct shash dummy_netdev_devs = SHASH_INITIALIZER(&dummy_netdev_devs);
@@ -132,6 +138,7 @@ netdev_dummy_open(struct netdev_dev *netdev_dev_, struct netdev **netdevp)
 
     netdev = xmalloc(sizeof *netdev);
     netdev_init(&netdev->netdev, netdev_dev_);
+    pthread_mutex_init(&netdev->mutex, NULL);
     list_init(&netdev->recv_queue);
     netdev->listening = false;
 
@@ -146,6 +153,7 @@ netdev_dummy_close(struct netdev *netdev_)
     struct netdev_dummy *netdev = netdev_dummy_cast(netdev_);
     list_remove(&netdev->node);
     ofpbuf_list_delete(&netdev->recv_queue);
+    pthread_mutex_destroy(&netdev->mutex);
     free(netdev);
 }
 
@@ -164,12 +172,15 @@ netdev_dummy_recv(struct netdev *netdev_, void *buffer, size_t size)
     struct ofpbuf *packet;
     size_t packet_size;
 
-    if (list_is_empty(&netdev->recv_queue)) {
-        return -EAGAIN;
-    }
+    pthread_mutex_lock(&netdev->mutex);
+    packet = (list_is_empty(&netdev->recv_queue) ? NULL
+              : ofpbuf_from_list(list_pop_front(&netdev->recv_queue)));
+    pthread_mutex_unlock(&netdev->mutex);
 
-    packet = ofpbuf_from_list(list_pop_front(&netdev->recv_queue));
-    if (packet->size > size) {
+    if (!packet) {
+        return -EAGAIN;
+    } else if (packet->size > size) {
+        ofpbuf_delete(packet);
         return -EMSGSIZE;
     }
     packet_size = packet->size;
@@ -184,7 +195,13 @@ static void
 netdev_dummy_recv_wait(struct netdev *netdev_)
 {
     struct netdev_dummy *netdev = netdev_dummy_cast(netdev_);
-    if (!list_is_empty(&netdev->recv_queue)) {
+    bool empty;
+
+    pthread_mutex_lock(&netdev->mutex);
+    empty = list_is_empty(&netdev->recv_queue);
+    pthread_mutex_unlock(&netdev->mutex);
+
+    if (!empty) {
         poll_immediate_wake();
     }
 }
@@ -193,7 +210,11 @@ static int
 netdev_dummy_drain(struct netdev *netdev_)
 {
     struct netdev_dummy *netdev = netdev_dummy_cast(netdev_);
+
+    pthread_mutex_lock(&netdev->mutex);
     ofpbuf_list_delete(&netdev->recv_queue);
+    pthread_mutex_unlock(&netdev->mutex);
+
     return 0;
 }
 
@@ -325,6 +346,7 @@ static const struct netdev_class dummy_class = {
 
     netdev_dummy_listen,
     netdev_dummy_recv,
+    NULL,                       /* recv_batch */
     netdev_dummy_recv_wait,
     netdev_dummy_drain,
 
@@ -410,6 +432,39 @@ eth_from_packet_or_flow(const char *s)
     return packet;
 }
 
+static int
+netdev_dev_dummy_queue_packet(struct netdev_dev_dummy *dummy_dev,
+                              const struct ofpbuf *packet)
+{
+    struct netdev_dummy *dev;
+    int n_listeners;
+
+    n_listeners = 0;
+    LIST_FOR_EACH (dev, node, &dummy_dev->devs) {
+        if (dev->listening) {
+            struct ofpbuf *copy = ofpbuf_clone(packet);
+
+            pthread_mutex_lock(&dev->mutex);
+            list_push_back(&dev->recv_queue, &copy->list_node);
+            pthread_mutex_unlock(&dev->mutex);
+            n_listeners++;
+        }
+    }
+    return n_listeners;
+}
+
+/* Queues a copy of 'packet' for reception on each listening instance of the
+ * dummy network device named 'name'.  Returns the number of listeners, or -1
+ * if there is no dummy network device named 'name'. */
+int
+netdev_dummy_queue_packet(const char *name, const struct ofpbuf *packet)
+{
+    struct netdev_dev_dummy *dummy_dev;
+
+    dummy_dev = shash_find_data(&dummy_netdev_devs, name);
+    return dummy_dev ? netdev_dev_dummy_queue_packet(dummy_dev, packet) : -1;
+}
+
 static void
 netdev_dummy_receive(struct unixctl_conn *conn,
                      int argc, const char *argv[], void *aux OVS_UNUSED)
@@ -426,7 +481,6 @@ netdev_dummy_receive(struct unixctl_conn *conn,
 
     n_listeners = 0;
     for (i = 2; i < argc; i++) {
-        struct netdev_dummy *dev;
         struct ofpbuf *packet;
 
         packet = eth_from_packet_or_flow(argv[i]);
@@ -435,14 +489,7 @@ netdev_dummy_receive(struct unixctl_conn *conn,
             return;
         }
 
-        n_listeners = 0;
-        LIST_FOR_EACH (dev, node, &dummy_dev->devs) {
-            if (dev->listening) {
-                struct ofpbuf *copy = ofpbuf_clone(packet);
-                list_push_back(&dev->recv_queue, &copy->list_node);
-                n_listeners++;
-            }
-        }
+        n_listeners = netdev_dev_dummy_queue_packet(dummy_dev, packet);
         ofpbuf_delete(packet);
     }
 
@@ -79,6 +79,7 @@ COVERAGE_DEFINE(netdev_get_hwaddr);
 COVERAGE_DEFINE(netdev_set_hwaddr);
 COVERAGE_DEFINE(netdev_get_ethtool);
 COVERAGE_DEFINE(netdev_set_ethtool);
+COVERAGE_DEFINE(netdev_linux_long_packet);
 
 
 /* These were introduced in Linux 2.6.14, so they might be missing if we have
@@ -873,7 +874,7 @@ netdev_linux_recv(struct netdev *netdev_, void *data, size_t size)
         if (retval >= 0) {
             return retval <= size ? retval : -EMSGSIZE;
         } else if (errno != EINTR) {
-            if (errno != EAGAIN) {
+            if (errno != EAGAIN && netdev_thread_may_log()) {
                 VLOG_WARN_RL(&rl, "error receiving Ethernet packet on %s: %s",
                              strerror(errno), netdev_get_name(netdev_));
             }
@@ -882,6 +883,83 @@ netdev_linux_recv(struct netdev *netdev_, void *data, size_t size)
     }
 }
 
+static int
+netdev_linux_recv_batch(struct netdev *netdev_, struct ofpbuf *buffers[],
+                        size_t n)
+{
+    struct netdev_linux *netdev = netdev_linux_cast(netdev_);
+    size_t i;
+
+    if (netdev->fd < 0) {
+        /* Device is not listening. */
+        return -EAGAIN;
+    }
+
+#ifdef HAVE_RECVMMSG
+    if (netdev_->netdev_dev->netdev_class != &netdev_tap_class) {
+        struct mmsghdr msgs[NETDEV_MAX_RX_BATCH];
+        struct iovec iovs[NETDEV_MAX_RX_BATCH];
+        int retval;
+
+        n = MIN(n, NETDEV_MAX_RX_BATCH);
+        memset(msgs, 0, n * sizeof *msgs);
+        for (i = 0; i < n; i++) {
+            iovs[i].iov_base = buffers[i]->data;
+            iovs[i].iov_len = ofpbuf_tailroom(buffers[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        do {
+            retval = recvmmsg(netdev->fd, msgs, n, MSG_TRUNC, NULL);
+        } while (retval < 0 && errno == EINTR);
+
+        if (retval > 0) {
+            size_t n_received = 0;
+
+            for (i = 0; i < retval; i++) {
+                struct ofpbuf *buffer = buffers[i];
+
+                if (msgs[i].msg_len > iovs[i].iov_len) {
+                    COVERAGE_INC(netdev_linux_long_packet);
+                    if (netdev_thread_may_log()) {
+                        VLOG_WARN_RL(&rl, "%s: discarding %u-byte packet "
+                                     "that is too long to receive",
+                                     netdev_get_name(netdev_),
+                                     msgs[i].msg_len);
+                    }
+                    continue;
+                }
+
+                buffer->size = msgs[i].msg_len;
+                buffers[i] = buffers[n_received];
+                buffers[n_received++] = buffer;
+            }
+            return n_received ? n_received : -EAGAIN;
+        } else {
+            if (errno != EAGAIN && netdev_thread_may_log()) {
+                VLOG_WARN_RL(&rl, "error receiving Ethernet packets on %s: "
+                             "%s", netdev_get_name(netdev_), strerror(errno));
+            }
+            return -errno;
+        }
+    }
+#endif
+
+    for (i = 0; i < n; i++) {
+        struct ofpbuf *buffer = buffers[i];
+        int retval;
+
+        retval = netdev_linux_recv(netdev_, buffer->data,
+                                   ofpbuf_tailroom(buffer));
+        if (retval < 0) {
+            return i ? i : retval;
+        }
+        buffer->size = retval;
+    }
+    return n;
+}
+
 /* Registers with the poll loop to wake up from the next call to poll_block()
  * when a packet is ready to be received with netdev_recv() on 'netdev'. */
 static void
@@ -931,7 +1009,12 @@ netdev_linux_send(struct netdev *netdev_, const void *data, size_t size)
         ssize_t retval;
 
         if (netdev->fd < 0) {
-            /* Use our AF_PACKET socket to send to this device. */
+            /* Use our AF_PACKET socket to send to this device.  This caches
+             * the device's ifindex and creates the shared AF_PACKET socket, so
+             * it is only safe in the main thread.  A thread other than the
+             * main thread only sends on a netdev that is listening, which
+             * uses the socket that netdev_linux_listen() bound to the device
+             * instead. */
             struct sockaddr_ll sll;
             struct msghdr msg;
             struct iovec iov;
@@ -983,14 +1066,17 @@ netdev_linux_send(struct netdev *netdev_, const void *data, size_t size)
                 return EAGAIN;
             } else if (errno == EINTR) {
                 continue;
-            } else if (errno != EAGAIN) {
+            } else if (errno != EAGAIN && netdev_thread_may_log()) {
                 VLOG_WARN_RL(&rl, "error sending Ethernet packet on %s: %s",
                              netdev_get_name(netdev_), strerror(errno));
             }
             return errno;
         } else if (retval != size) {
-            VLOG_WARN_RL(&rl, "sent partial Ethernet packet (%zd bytes of "
-                         "%zu) on %s", retval, size, netdev_get_name(netdev_));
+            if (netdev_thread_may_log()) {
+                VLOG_WARN_RL(&rl, "sent partial Ethernet packet (%zd bytes of "
+                             "%zu) on %s", retval, size,
+                             netdev_get_name(netdev_));
+            }
             return EMSGSIZE;
         } else {
             return 0;
@@ -2402,6 +2488,7 @@ netdev_linux_change_seq(const struct netdev *netdev)
                                                                 \
     netdev_linux_listen,                                        \
     netdev_linux_recv,                                          \
+    netdev_linux_recv_batch,                                    \
     netdev_linux_recv_wait,                                     \
     netdev_linux_drain,                                         \
                                                                 \
@@ -157,7 +157,16 @@ struct netdev_class {
  *
  * (However, the "dpif-netdev" implementation, which is the easiest way to
  * integrate Open vSwitch with a new operating system or hardware, does require
- * the ability to receive packets.) */
+ * the ability to receive packets.)
+ *
+ * Once ->listen() has succeeded, ->recv(), ->recv_batch(), and ->send() may be
+ * called from a thread other than the main thread, e.g. one of dpif-netdev's
+ * forwarding threads.  The caller ensures that only one thread at a time
+ * receives from a given netdev and that only one thread at a time sends on it,
+ * but one thread may be receiving from a netdev while another sends on it.
+ * These functions therefore must not update state that the main thread also
+ * updates, and they may log only if netdev_thread_may_log() returns true.
+ * Otherwise they report errors only through their return values. */
 
     /* Attempts to set up 'netdev' for receiving packets with ->recv().
      * Returns 0 if successful, otherwise a positive errno value.  Return
@@ -183,6 +192,23 @@ struct netdev_class {
      * implement packet reception through the 'recv' member function. */
     int (*recv)(struct netdev *netdev, void *buffer, size_t size);
 
+    /* Attempts to receive up to 'n' packets from 'netdev'.  Each of the 'n'
+     * ofpbufs in 'buffers' is empty and has enough tailroom for the largest
+     * packet that ->recv() could return.  If successful, fills in the first
+     * N buffers with the received packets and returns N, which is at least
+     * 1 and no more than 'n'.  Otherwise returns a negative errno value, with
+     * the same meanings as for ->recv().  Packets that are too long to fit
+     * in their buffer are discarded.  The implementation may reorder the
+     * pointers in 'buffers'.
+     *
+     * This function can only be expected to return packets if ->listen() has
+     * been called successfully.
+     *
+     * May be null, in which case netdev_recv_batch() falls back to calling
+     * ->recv() repeatedly. */
+    int (*recv_batch)(struct netdev *netdev, struct ofpbuf *buffers[],
+                      size_t n);
+
     /* Registers with the poll loop to wake up from the next call to
      * poll_block() when a packet is ready to be received with netdev_recv() on
      * 'netdev'.
@@ -589,6 +615,8 @@ struct netdev_class {
     unsigned int (*change_seq)(const struct netdev *netdev);
 };
 
+bool netdev_thread_may_log(void);
+
 int netdev_register_provider(const struct netdev_class *);
 int netdev_unregister_provider(const char *type);
 const struct netdev_class *netdev_lookup_provider(const char *type);
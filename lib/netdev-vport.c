@@ -922,6 +922,7 @@ unparse_patch_config(const char *name OVS_UNUSED, const char *type OVS_UNUSED,
                                                             \
     NULL,                       /* listen */                \
     NULL,                       /* recv */                  \
+    NULL,                       /* recv_batch */            \
     NULL,                       /* recv_wait */             \
     NULL,                       /* drain */                 \
                                                             \
@@ -57,6 +57,9 @@ static struct shash netdev_dev_shash = SHASH_INITIALIZER(&netdev_dev_shash);
 /* All open network devices. */
 static struct list netdev_list = LIST_INITIALIZER(&netdev_list);
 
+/* True in a thread that has called netdev_thread_disable_logging(). */
+static __thread bool netdev_thread_quiet;
+
 /* This is set pretty low because we probably won't learn anything from the
  * additional log messages. */
 static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 20);
@@ -411,6 +414,70 @@ netdev_recv(struct netdev *netdev, struct ofpbuf *buffer)
     }
 }
 
+/* Attempts to receive up to 'n' packets from 'netdev' into the first 'n'
+ * elements of 'buffers', each of which the caller must have initialized as
+ * described for netdev_recv().  'n' must be at least 1 and at most
+ * NETDEV_MAX_RX_BATCH.
+ *
+ * If at least one packet is successfully retrieved, stores the number of
+ * packets received in '*n_received' and returns 0.  In this case the packets
+ * are in the first '*n_received' elements of 'buffers', in the order that
+ * they were received, and each of them is guaranteed to contain at least
+ * ETH_TOTAL_MIN bytes.  The pointers in 'buffers' may be reordered.
+ * Otherwise, stores 0 in '*n_received' and returns a positive errno value,
+ * with the same meanings as for netdev_recv().
+ *
+ * Network devices that can receive several packets with a single system call
+ * do so; for the rest this is equivalent to calling netdev_recv() until it
+ * fails or 'n' packets have been received. */
+int
+netdev_recv_batch(struct netdev *netdev, struct ofpbuf *buffers[], size_t n,
+                  size_t *n_received)
+{
+    int (*recv_batch)(struct netdev *, struct ofpbuf *[], size_t);
+    int retval;
+    size_t i;
+
+    assert(n > 0 && n <= NETDEV_MAX_RX_BATCH);
+
+    recv_batch = netdev_get_dev(netdev)->netdev_class->recv_batch;
+    if (!recv_batch) {
+        int error = 0;
+
+        for (i = 0; i < n; i++) {
+            error = netdev_recv(netdev, buffers[i]);
+            if (error) {
+                break;
+            }
+        }
+        *n_received = i;
+        return i ? 0 : error;
+    }
+
+    for (i = 0; i < n; i++) {
+        assert(buffers[i]->size == 0);
+        assert(ofpbuf_tailroom(buffers[i]) >= ETH_TOTAL_MIN);
+    }
+
+    retval = recv_batch(netdev, buffers, n);
+    if (retval > 0) {
+        assert(retval <= n);
+        for (i = 0; i < retval; i++) {
+            struct ofpbuf *buffer = buffers[i];
+
+            COVERAGE_INC(netdev_received);
+            if (buffer->size < ETH_TOTAL_MIN) {
+                ofpbuf_put_zeros(buffer, ETH_TOTAL_MIN - buffer->size);
+            }
+        }
+        *n_received = retval;
+        return 0;
+    } else {
+        *n_received = 0;
+        return retval ? -retval : EAGAIN;
+    }
+}
+
 /* Registers with the poll loop to wake up from the next call to poll_block()
  * when a packet is ready to be received with netdev_recv() on 'netdev'. */
 void
@@ -478,6 +545,25 @@ netdev_send_wait(struct netdev *netdev)
     }
 }
 
+/* Marks the calling thread as one that receives and sends packets but must not
+ * log, e.g. one of dpif-netdev's forwarding threads.  Afterward, network
+ * device providers report the errors that they encounter in this thread only
+ * through their return values, which leaves it to the caller to count and
+ * report them. */
+void
+netdev_thread_disable_logging(void)
+{
+    netdev_thread_quiet = true;
+}
+
+/* Returns true if a network device provider may log from the calling thread,
+ * false if it must not.  See netdev_thread_disable_logging(). */
+bool
+netdev_thread_may_log(void)
+{
+    return !netdev_thread_quiet;
+}
+
 /* Attempts to set 'netdev''s MAC address to 'mac'.  Returns 0 if successful,
  * otherwise a positive errno value. */
 int
@@ -104,14 +104,22 @@ int netdev_set_mtu(const struct netdev *, int mtu);
 int netdev_get_ifindex(const struct netdev *);
 
 /* Packet send and receive. */
+
+/* Maximum number of packets that netdev_recv_batch() returns in one call. */
+enum { NETDEV_MAX_RX_BATCH = 32 };
+
 int netdev_listen(struct netdev *);
 int netdev_recv(struct netdev *, struct ofpbuf *);
+int netdev_recv_batch(struct netdev *, struct ofpbuf *buffers[], size_t n,
+                      size_t *n_received);
 void netdev_recv_wait(struct netdev *);
 int netdev_drain(struct netdev *);
 
 int netdev_send(struct netdev *, const struct ofpbuf *);
 void netdev_send_wait(struct netdev *);
 
+void netdev_thread_disable_logging(void);
+
 /* Hardware address. */
 int netdev_set_etheraddr(struct netdev *, const uint8_t mac[6]);
 int netdev_get_etheraddr(const struct netdev *, uint8_t mac[6]);
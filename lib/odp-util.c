@@ -1276,48 +1276,46 @@ odp_flow_key_from_string(const char *s, const struct simap *port_names,
 }
 
 static uint8_t
-ovs_to_odp_frag(uint8_t nw_frag)
+ovs_to_odp_frag(uint8_t nw_frag, bool is_mask)
 {
+    if (is_mask) {
+        return nw_frag ? UINT8_MAX : 0;
+    }
+
     return (nw_frag == 0 ? OVS_FRAG_TYPE_NONE
           : nw_frag == FLOW_NW_FRAG_ANY ? OVS_FRAG_TYPE_FIRST
           : OVS_FRAG_TYPE_LATER);
 }
 
-/* Appends a representation of 'flow' as OVS_KEY_ATTR_* attributes to 'buf'.
- * 'flow->in_port' is ignored (since it is likely to be an OpenFlow port
- * number rather than a datapath port number).  Instead, if 'odp_in_port'
- * is anything other than OVSP_NONE, it is included in 'buf' as the input
- * port.
- *
- * 'buf' must have at least ODPUTIL_FLOW_KEY_BYTES bytes of space, or be
- * capable of being expanded to allow for that much space. */
-void
-odp_flow_key_from_flow(struct ofpbuf *buf, const struct flow *flow,
-                       uint32_t odp_in_port)
+static void
+odp_flow_key_from_flow__(struct ofpbuf *buf, const struct flow *data,
+                         const struct flow *flow, uint32_t odp_in_port,
+                         bool is_mask)
 {
     struct ovs_key_ethernet *eth_key;
     size_t encap;
 
-    if (flow->skb_priority) {
-        nl_msg_put_u32(buf, OVS_KEY_ATTR_PRIORITY, flow->skb_priority);
+    if (data->skb_priority) {
+        nl_msg_put_u32(buf, OVS_KEY_ATTR_PRIORITY, data->skb_priority);
     }
 
-    if (flow->tunnel.tun_id != htonll(0)) {
-        nl_msg_put_be64(buf, OVS_KEY_ATTR_TUN_ID, flow->tunnel.tun_id);
+    if (data->tunnel.tun_id != htonll(0)) {
+        nl_msg_put_be64(buf, OVS_KEY_ATTR_TUN_ID, data->tunnel.tun_id);
     }
 
-    if (odp_in_port != OVSP_NONE) {
+    if (is_mask ? odp_in_port != 0 : odp_in_port != OVSP_NONE) {
         nl_msg_put_u32(buf, OVS_KEY_ATTR_IN_PORT, odp_in_port);
     }
 
     eth_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_ETHERNET,
                                        sizeof *eth_key);
-    memcpy(eth_key->eth_src, flow->dl_src, ETH_ADDR_LEN);
-    memcpy(eth_key->eth_dst, flow->dl_dst, ETH_ADDR_LEN);
+    memcpy(eth_key->eth_src, data->dl_src, ETH_ADDR_LEN);
+    memcpy(eth_key->eth_dst, data->dl_dst, ETH_ADDR_LEN);
 
     if (flow->vlan_tci != htons(0) || flow->dl_type == htons(ETH_TYPE_VLAN)) {
-        nl_msg_put_be16(buf, OVS_KEY_ATTR_ETHERTYPE, htons(ETH_TYPE_VLAN));
-        nl_msg_put_be16(buf, OVS_KEY_ATTR_VLAN, flow->vlan_tci);
+        nl_msg_put_be16(buf, OVS_KEY_ATTR_ETHERTYPE,
+                        is_mask ? htons(UINT16_MAX) : htons(ETH_TYPE_VLAN));
+        nl_msg_put_be16(buf, OVS_KEY_ATTR_VLAN, data->vlan_tci);
         encap = nl_msg_start_nested(buf, OVS_KEY_ATTR_ENCAP);
         if (flow->vlan_tci == htons(0)) {
             goto unencap;
@@ -1330,31 +1328,31 @@ odp_flow_key_from_flow(struct ofpbuf *buf, const struct flow *flow,
         goto unencap;
     }
 
-    nl_msg_put_be16(buf, OVS_KEY_ATTR_ETHERTYPE, flow->dl_type);
+    nl_msg_put_be16(buf, OVS_KEY_ATTR_ETHERTYPE, data->dl_type);
 
     if (flow->dl_type == htons(ETH_TYPE_IP)) {
         struct ovs_key_ipv4 *ipv4_key;
 
         ipv4_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_IPV4,
                                             sizeof *ipv4_key);
-        ipv4_key->ipv4_src = flow->nw_src;
-        ipv4_key->ipv4_dst = flow->nw_dst;
-        ipv4_key->ipv4_proto = flow->nw_proto;
-        ipv4_key->ipv4_tos = flow->nw_tos;
-        ipv4_key->ipv4_ttl = flow->nw_ttl;
-        ipv4_key->ipv4_frag = ovs_to_odp_frag(flow->nw_frag);
+        ipv4_key->ipv4_src = data->nw_src;
+        ipv4_key->ipv4_dst = data->nw_dst;
+        ipv4_key->ipv4_proto = data->nw_proto;
+        ipv4_key->ipv4_tos = data->nw_tos;
+        ipv4_key->ipv4_ttl = data->nw_ttl;
+        ipv4_key->ipv4_frag = ovs_to_odp_frag(data->nw_frag, is_mask);
     } else if (flow->dl_type == htons(ETH_TYPE_IPV6)) {
         struct ovs_key_ipv6 *ipv6_key;
 
         ipv6_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_IPV6,
                                             sizeof *ipv6_key);
-        memcpy(ipv6_key->ipv6_src, &flow->ipv6_src, sizeof ipv6_key->ipv6_src);
-        memcpy(ipv6_key->ipv6_dst, &flow->ipv6_dst, sizeof ipv6_key->ipv6_dst);
-        ipv6_key->ipv6_label = flow->ipv6_label;
-        ipv6_key->ipv6_proto = flow->nw_proto;
-        ipv6_key->ipv6_tclass = flow->nw_tos;
-        ipv6_key->ipv6_hlimit = flow->nw_ttl;
-        ipv6_key->ipv6_frag = ovs_to_odp_frag(flow->nw_frag);
+        memcpy(ipv6_key->ipv6_src, &data->ipv6_src, sizeof ipv6_key->ipv6_src);
+        memcpy(ipv6_key->ipv6_dst, &data->ipv6_dst, sizeof ipv6_key->ipv6_dst);
+        ipv6_key->ipv6_label = data->ipv6_label;
+        ipv6_key->ipv6_proto = data->nw_proto;
+        ipv6_key->ipv6_tclass = data->nw_tos;
+        ipv6_key->ipv6_hlimit = data->nw_ttl;
+        ipv6_key->ipv6_frag = ovs_to_odp_frag(data->nw_frag, is_mask);
     } else if (flow->dl_type == htons(ETH_TYPE_ARP) ||
                flow->dl_type == htons(ETH_TYPE_RARP)) {
         struct ovs_key_arp *arp_key;
@@ -1362,11 +1360,11 @@ odp_flow_key_from_flow(struct ofpbuf *buf, const struct flow *flow,
         arp_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_ARP,
                                            sizeof *arp_key);
         memset(arp_key, 0, sizeof *arp_key);
-        arp_key->arp_sip = flow->nw_src;
-        arp_key->arp_tip = flow->nw_dst;
-        arp_key->arp_op = htons(flow->nw_proto);
-        memcpy(arp_key->arp_sha, flow->arp_sha, ETH_ADDR_LEN);
-        memcpy(arp_key->arp_tha, flow->arp_tha, ETH_ADDR_LEN);
+        arp_key->arp_sip = data->nw_src;
+        arp_key->arp_tip = data->nw_dst;
+        arp_key->arp_op = htons(data->nw_proto);
+        memcpy(arp_key->arp_sha, data->arp_sha, ETH_ADDR_LEN);
+        memcpy(arp_key->arp_tha, data->arp_tha, ETH_ADDR_LEN);
     }
 
     if ((flow->dl_type == htons(ETH_TYPE_IP)
@@ -1378,42 +1376,42 @@ odp_flow_key_from_flow(struct ofpbuf *buf, const struct flow *flow,
 
             tcp_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_TCP,
                                                sizeof *tcp_key);
-            tcp_key->tcp_src = flow->tp_src;
-            tcp_key->tcp_dst = flow->tp_dst;
+            tcp_key->tcp_src = data->tp_src;
+            tcp_key->tcp_dst = data->tp_dst;
         } else if (flow->nw_proto == IPPROTO_UDP) {
             struct ovs_key_udp *udp_key;
 
             udp_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_UDP,
                                                sizeof *udp_key);
-            udp_key->udp_src = flow->tp_src;
-            udp_key->udp_dst = flow->tp_dst;
+            udp_key->udp_src = data->tp_src;
+            udp_key->udp_dst = data->tp_dst;
         } else if (flow->dl_type == htons(ETH_TYPE_IP)
                 && flow->nw_proto == IPPROTO_ICMP) {
             struct ovs_key_icmp *icmp_key;
 
             icmp_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_ICMP,
                                                 sizeof *icmp_key);
-            icmp_key->icmp_type = ntohs(flow->tp_src);
-            icmp_key->icmp_code = ntohs(flow->tp_dst);
+            icmp_key->icmp_type = ntohs(data->tp_src);
+            icmp_key->icmp_code = ntohs(data->tp_dst);
         } else if (flow->dl_type == htons(ETH_TYPE_IPV6)
                 && flow->nw_proto == IPPROTO_ICMPV6) {
             struct ovs_key_icmpv6 *icmpv6_key;
 
             icmpv6_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_ICMPV6,
                                                   sizeof *icmpv6_key);
-            icmpv6_key->icmpv6_type = ntohs(flow->tp_src);
-            icmpv6_key->icmpv6_code = ntohs(flow->tp_dst);
+            icmpv6_key->icmpv6_type = ntohs(data->tp_src);
+            icmpv6_key->icmpv6_code = ntohs(data->tp_dst);
 
-            if (icmpv6_key->icmpv6_type == ND_NEIGHBOR_SOLICIT
-                    || icmpv6_key->icmpv6_type == ND_NEIGHBOR_ADVERT) {
+            if (flow->tp_src == htons(ND_NEIGHBOR_SOLICIT)
+                || flow->tp_src == htons(ND_NEIGHBOR_ADVERT)) {
                 struct ovs_key_nd *nd_key;
 
                 nd_key = nl_msg_put_unspec_uninit(buf, OVS_KEY_ATTR_ND,
                                                     sizeof *nd_key);
-                memcpy(nd_key->nd_target, &flow->nd_target,
+                memcpy(nd_key->nd_target, &data->nd_target,
                         sizeof nd_key->nd_target);
-                memcpy(nd_key->nd_sll, flow->arp_sha, ETH_ADDR_LEN);
-                memcpy(nd_key->nd_tll, flow->arp_tha, ETH_ADDR_LEN);
+                memcpy(nd_key->nd_sll, data->arp_sha, ETH_ADDR_LEN);
+                memcpy(nd_key->nd_tll, data->arp_tha, ETH_ADDR_LEN);
             }
         }
     }
@@ -1424,6 +1422,37 @@ unencap:
     }
 }
 
+/* Appends a representation of 'flow' as OVS_KEY_ATTR_* attributes to 'buf'.
+ * 'flow->in_port' is ignored (since it is likely to be an OpenFlow port
+ * number rather than a datapath port number).  Instead, if 'odp_in_port'
+ * is anything other than OVSP_NONE, it is included in 'buf' as the input
+ * port.
+ *
+ * 'buf' must have at least ODPUTIL_FLOW_KEY_BYTES bytes of space, or be
+ * capable of being expanded to allow for that much space. */
+void
+odp_flow_key_from_flow(struct ofpbuf *buf, const struct flow *flow,
+                       uint32_t odp_in_port)
+{
+    odp_flow_key_from_flow__(buf, flow, flow, odp_in_port, false);
+}
+
+/* Appends a representation of 'mask' as OVS_KEY_ATTR_* attributes to 'buf',
+ * for use as the mask of a wildcarded datapath flow whose key is 'flow'.  The
+ * attributes are the same ones that odp_flow_key_from_flow() would generate
+ * for 'flow', except that those whose mask is all-zero may be omitted, but
+ * each of them holds the bits of 'mask' instead of the values in 'flow'.
+ * 'odp_in_port_mask' is the mask for the datapath input port.
+ *
+ * 'buf' must have at least ODPUTIL_FLOW_KEY_BYTES bytes of space, or be
+ * capable of being expanded to allow for that much space. */
+void
+odp_flow_key_from_mask(struct ofpbuf *buf, const struct flow *mask,
+                       const struct flow *flow, uint32_t odp_in_port_mask)
+{
+    odp_flow_key_from_flow__(buf, mask, flow, odp_in_port_mask, true);
+}
+
 uint32_t
 odp_flow_key_hash(const struct nlattr *key, size_t key_len)
 {
@@ -1833,6 +1862,169 @@ odp_flow_key_to_flow(const struct nlattr *key, size_t key_len,
                            expected_attrs, flow, key, key_len);
 }
 
+static int
+odp_flow_key_to_mask__(const struct nlattr *key, size_t key_len,
+                       struct flow *mask)
+{
+    const struct nlattr *nla;
+    size_t left;
+
+    NL_ATTR_FOR_EACH (nla, left, key, key_len) {
+        uint16_t type = nl_attr_type(nla);
+        int expected_len = odp_flow_key_attr_len(type);
+
+        if (expected_len == -1
+            || (expected_len >= 0 && nl_attr_get_size(nla) != expected_len)) {
+            return EINVAL;
+        }
+
+        switch ((enum ovs_key_attr) type) {
+        case OVS_KEY_ATTR_ENCAP: {
+            int error = odp_flow_key_to_mask__(nl_attr_get(nla),
+                                               nl_attr_get_size(nla), mask);
+            if (error) {
+                return error;
+            }
+            break;
+        }
+
+        case OVS_KEY_ATTR_PRIORITY:
+            mask->skb_priority = nl_attr_get_u32(nla);
+            break;
+
+        case OVS_KEY_ATTR_TUN_ID:
+            mask->tunnel.tun_id = nl_attr_get_be64(nla);
+            break;
+
+        case OVS_KEY_ATTR_IN_PORT:
+            mask->in_port = nl_attr_get_u32(nla) ? UINT16_MAX : 0;
+            break;
+
+        case OVS_KEY_ATTR_ETHERNET: {
+            const struct ovs_key_ethernet *eth_key = nl_attr_get(nla);
+
+            memcpy(mask->dl_src, eth_key->eth_src, ETH_ADDR_LEN);
+            memcpy(mask->dl_dst, eth_key->eth_dst, ETH_ADDR_LEN);
+            break;
+        }
+
+        case OVS_KEY_ATTR_VLAN:
+            mask->vlan_tci = nl_attr_get_be16(nla);
+            break;
+
+        case OVS_KEY_ATTR_ETHERTYPE:
+            /* The ethertype inside OVS_KEY_ATTR_ENCAP, if any, comes later and
+             * overrides the 802.1Q TPID. */
+            mask->dl_type = nl_attr_get_be16(nla);
+            break;
+
+        case OVS_KEY_ATTR_IPV4: {
+            const struct ovs_key_ipv4 *ipv4_key = nl_attr_get(nla);
+
+            mask->nw_src = ipv4_key->ipv4_src;
+            mask->nw_dst = ipv4_key->ipv4_dst;
+            mask->nw_proto = ipv4_key->ipv4_proto;
+            mask->nw_tos = ipv4_key->ipv4_tos;
+            mask->nw_ttl = ipv4_key->ipv4_ttl;
+            mask->nw_frag = ipv4_key->ipv4_frag ? FLOW_NW_FRAG_MASK : 0;
+            break;
+        }
+
+        case OVS_KEY_ATTR_IPV6: {
+            const struct ovs_key_ipv6 *ipv6_key = nl_attr_get(nla);
+
+            memcpy(&mask->ipv6_src, ipv6_key->ipv6_src, sizeof mask->ipv6_src);
+            memcpy(&mask->ipv6_dst, ipv6_key->ipv6_dst, sizeof mask->ipv6_dst);
+            mask->ipv6_label = ipv6_key->ipv6_label;
+            mask->nw_proto = ipv6_key->ipv6_proto;
+            mask->nw_tos = ipv6_key->ipv6_tclass;
+            mask->nw_ttl = ipv6_key->ipv6_hlimit;
+            mask->nw_frag = ipv6_key->ipv6_frag ? FLOW_NW_FRAG_MASK : 0;
+            break;
+        }
+
+        case OVS_KEY_ATTR_TCP: {
+            const struct ovs_key_tcp *tcp_key = nl_attr_get(nla);
+
+            mask->tp_src = tcp_key->tcp_src;
+            mask->tp_dst = tcp_key->tcp_dst;
+            break;
+        }
+
+        case OVS_KEY_ATTR_UDP: {
+            const struct ovs_key_udp *udp_key = nl_attr_get(nla);
+
+            mask->tp_src = udp_key->udp_src;
+            mask->tp_dst = udp_key->udp_dst;
+            break;
+        }
+
+        case OVS_KEY_ATTR_ICMP: {
+            const struct ovs_key_icmp *icmp_key = nl_attr_get(nla);
+
+            mask->tp_src = htons(icmp_key->icmp_type);
+            mask->tp_dst = htons(icmp_key->icmp_code);
+            break;
+        }
+
+        case OVS_KEY_ATTR_ICMPV6: {
+            const struct ovs_key_icmpv6 *icmpv6_key = nl_attr_get(nla);
+
+            mask->tp_src = htons(icmpv6_key->icmpv6_type);
+            mask->tp_dst = htons(icmpv6_key->icmpv6_code);
+            break;
+        }
+
+        case OVS_KEY_ATTR_ARP: {
+            const struct ovs_key_arp *arp_key = nl_attr_get(nla);
+
+            mask->nw_src = arp_key->arp_sip;
+            mask->nw_dst = arp_key->arp_tip;
+            mask->nw_proto = ntohs(arp_key->arp_op) & 0xff;
+            memcpy(mask->arp_sha, arp_key->arp_sha, ETH_ADDR_LEN);
+            memcpy(mask->arp_tha, arp_key->arp_tha, ETH_ADDR_LEN);
+            break;
+        }
+
+        case OVS_KEY_ATTR_ND: {
+            const struct ovs_key_nd *nd_key = nl_attr_get(nla);
+
+            memcpy(&mask->nd_target, nd_key->nd_target,
+                   sizeof mask->nd_target);
+            memcpy(mask->arp_sha, nd_key->nd_sll, ETH_ADDR_LEN);
+            memcpy(mask->arp_tha, nd_key->nd_tll, ETH_ADDR_LEN);
+            break;
+        }
+
+        case OVS_KEY_ATTR_IPV4_TUNNEL:
+            /* Tunnel metadata other than the tunnel ID is not maskable. */
+            break;
+
+        case OVS_KEY_ATTR_UNSPEC:
+        case __OVS_KEY_ATTR_MAX:
+        default:
+            return EINVAL;
+        }
+    }
+
+    return left ? EINVAL : 0;
+}
+
+/* Converts the 'key_len' bytes of OVS_KEY_ATTR_* attributes in 'key', as
+ * generated by odp_flow_key_from_mask(), into flow wildcards in '*wc'.  Fields
+ * for which 'key' has no attribute are wildcarded.  As in the flows that
+ * odp_flow_key_to_flow() produces, the input port in 'wc' refers to the
+ * datapath port.
+ *
+ * Returns 0 if successful, otherwise EINVAL. */
+int
+odp_flow_key_to_mask(const struct nlattr *key, size_t key_len,
+                     struct flow_wildcards *wc)
+{
+    flow_wildcards_init_catchall(wc);
+    return odp_flow_key_to_mask__(key, key_len, &wc->masks);
+}
+
 /* Returns 'fitness' as a string, for use in debug messages. */
 const char *
 odp_key_fitness_to_string(enum odp_key_fitness fitness)
@@ -1960,7 +2152,7 @@ commit_set_ipv4_action(const struct flow *flow, struct flow *base,
     ipv4_key.ipv4_tos = base->nw_tos = flow->nw_tos;
     ipv4_key.ipv4_ttl = base->nw_ttl = flow->nw_ttl;
     ipv4_key.ipv4_proto = base->nw_proto;
-    ipv4_key.ipv4_frag = ovs_to_odp_frag(base->nw_frag);
+    ipv4_key.ipv4_frag = ovs_to_odp_frag(base->nw_frag, false);
 
     commit_set_action(odp_actions, OVS_KEY_ATTR_IPV4,
                       &ipv4_key, sizeof(ipv4_key));
@@ -1990,7 +2182,7 @@ commit_set_ipv6_action(const struct flow *flow, struct flow *base,
     ipv6_key.ipv6_tclass = base->nw_tos = flow->nw_tos;
     ipv6_key.ipv6_hlimit = base->nw_ttl = flow->nw_ttl;
     ipv6_key.ipv6_proto = base->nw_proto;
-    ipv6_key.ipv6_frag = ovs_to_odp_frag(base->nw_frag);
+    ipv6_key.ipv6_frag = ovs_to_odp_frag(base->nw_frag, false);
 
     commit_set_action(odp_actions, OVS_KEY_ATTR_IPV6,
                       &ipv6_key, sizeof(ipv6_key));
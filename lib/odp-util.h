@@ -28,6 +28,7 @@
 
 struct ds;
 struct flow;
+struct flow_wildcards;
 struct nlattr;
 struct ofpbuf;
 struct simap;
@@ -85,6 +86,9 @@ int odp_flow_key_from_string(const char *s, const struct simap *port_names,
 
 void odp_flow_key_from_flow(struct ofpbuf *, const struct flow *,
                             uint32_t odp_in_port);
+void odp_flow_key_from_mask(struct ofpbuf *, const struct flow *mask,
+                            const struct flow *flow,
+                            uint32_t odp_in_port_mask);
 
 uint32_t odp_flow_key_hash(const struct nlattr *, size_t);
 
@@ -104,6 +108,8 @@ enum odp_key_fitness {
 enum odp_key_fitness odp_flow_key_to_flow(const struct nlattr *, size_t,
                                           struct flow *);
 const char *odp_key_fitness_to_string(enum odp_key_fitness);
+int odp_flow_key_to_mask(const struct nlattr *, size_t,
+                         struct flow_wildcards *);
 
 void commit_odp_actions(const struct flow *, struct flow *base,
                         struct ofpbuf *odp_actions);
@@ -2391,23 +2391,44 @@ ofputil_encode_packet_in(const struct ofputil_packet_in *pin,
     size_t send_len = MIN(pin->send_len, pin->packet_len);
     struct ofpbuf *packet;
 
-    /* Add OFPT_PACKET_IN. */
+    packet = ofpbuf_clone_data_with_headroom(pin->packet, send_len,
+                                             OFPUTIL_PACKET_IN_HEADROOM);
+    return ofputil_encode_packet_in_buf(pin, protocol, packet_in_format,
+                                        packet);
+}
+
+/* Like ofputil_encode_packet_in(), except that the packet comes from 'packet'
+ * instead of from pin->packet and pin->packet_len.  Takes ownership of
+ * 'packet' and composes the PACKET_IN message in it, by truncating it to the
+ * send length and then adding the PACKET_IN header in its headroom, and
+ * returns it.  If 'packet' has at least OFPUTIL_PACKET_IN_HEADROOM bytes of
+ * headroom, this does not copy the packet. */
+struct ofpbuf *
+ofputil_encode_packet_in_buf(const struct ofputil_packet_in *pin,
+                             enum ofputil_protocol protocol,
+                             enum nx_packet_in_format packet_in_format,
+                             struct ofpbuf *packet)
+{
+    uint64_t hdr_stub[OFPUTIL_PACKET_IN_HEADROOM / 8];
+    size_t send_len = MIN(pin->send_len, packet->size);
+    struct ofpbuf hdr;
+    size_t body_ofs;
+
+    /* Compose OFPT_PACKET_IN, minus the packet, in 'hdr'. */
+    ofpbuf_use_stub(&hdr, hdr_stub, sizeof hdr_stub);
     if (protocol == OFPUTIL_P_OF12) {
         struct ofp12_packet_in *opi;
         struct match match;
 
         ofputil_packet_in_to_match(pin, &match);
 
-        /* The final argument is just an estimate of the space required. */
-        packet = ofpraw_alloc_xid(OFPRAW_OFPT12_PACKET_IN, OFP12_VERSION,
-                                  htonl(0), (sizeof(struct flow_metadata) * 2
-                                             + 2 + send_len));
-        ofpbuf_put_zeros(packet, sizeof *opi);
-        oxm_put_match(packet, &match);
-        ofpbuf_put_zeros(packet, 2);
-        ofpbuf_put(packet, pin->packet, send_len);
+        ofpraw_put_xid(OFPRAW_OFPT12_PACKET_IN, OFP12_VERSION, htonl(0),
+                       &hdr);
+        ofpbuf_put_zeros(&hdr, sizeof *opi);
+        oxm_put_match(&hdr, &match);
+        ofpbuf_put_zeros(&hdr, 2);
 
-        opi = packet->l3;
+        opi = hdr.l3;
         opi->buffer_id = htonl(pin->buffer_id);
         opi->total_len = htons(pin->total_len);
         opi->reason = pin->reason;
@@ -2415,15 +2436,13 @@ ofputil_encode_packet_in(const struct ofputil_packet_in *pin,
    } else if (packet_in_format == NXPIF_OPENFLOW10) {
         struct ofp_packet_in *opi;
 
-        packet = ofpraw_alloc_xid(OFPRAW_OFPT10_PACKET_IN, OFP10_VERSION,
-                                  htonl(0), send_len);
-        opi = ofpbuf_put_zeros(packet, offsetof(struct ofp_packet_in, data));
+        ofpraw_put_xid(OFPRAW_OFPT10_PACKET_IN, OFP10_VERSION, htonl(0),
+                       &hdr);
+        opi = ofpbuf_put_zeros(&hdr, offsetof(struct ofp_packet_in, data));
         opi->total_len = htons(pin->total_len);
         opi->in_port = htons(pin->fmd.in_port);
         opi->reason = pin->reason;
         opi->buffer_id = htonl(pin->buffer_id);
-
-        ofpbuf_put(packet, pin->packet, send_len);
     } else if (packet_in_format == NXPIF_NXM) {
         struct nx_packet_in *npi;
         struct match match;
@@ -2431,16 +2450,12 @@ ofputil_encode_packet_in(const struct ofputil_packet_in *pin,
 
         ofputil_packet_in_to_match(pin, &match);
 
-        /* The final argument is just an estimate of the space required. */
-        packet = ofpraw_alloc_xid(OFPRAW_NXT_PACKET_IN, OFP10_VERSION,
-                                  htonl(0), (sizeof(struct flow_metadata) * 2
-                                             + 2 + send_len));
-        ofpbuf_put_zeros(packet, sizeof *npi);
-        match_len = nx_put_match(packet, &match, 0, 0);
-        ofpbuf_put_zeros(packet, 2);
-        ofpbuf_put(packet, pin->packet, send_len);
+        ofpraw_put_xid(OFPRAW_NXT_PACKET_IN, OFP10_VERSION, htonl(0), &hdr);
+        ofpbuf_put_zeros(&hdr, sizeof *npi);
+        match_len = nx_put_match(&hdr, &match, 0, 0);
+        ofpbuf_put_zeros(&hdr, 2);
 
-        npi = packet->l3;
+        npi = hdr.l3;
         npi->buffer_id = htonl(pin->buffer_id);
         npi->total_len = htons(pin->total_len);
         npi->reason = pin->reason;
@@ -2450,6 +2465,15 @@ ofputil_encode_packet_in(const struct ofputil_packet_in *pin,
     } else {
         NOT_REACHED();
     }
+    body_ofs = (char *) hdr.l3 - (char *) hdr.data;
+
+    /* Put the header in front of the packet. */
+    packet->size = send_len;
+    packet->l2 = ofpbuf_push(packet, hdr.data, hdr.size);
+    packet->l3 = (char *) packet->l2 + body_ofs;
+    packet->l4 = packet->l7 = NULL;
+    ofpbuf_uninit(&hdr);
+
     ofpmsg_update_length(packet);
 
     return packet;
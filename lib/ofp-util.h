@@ -305,11 +305,23 @@ struct ofputil_packet_in {
     struct flow_metadata fmd;   /* Metadata at creation time. */
 };
 
+/* Headroom that ofputil_encode_packet_in_buf() needs in front of a packet to
+ * compose any kind of PACKET_IN in place.  The largest PACKET_IN header, an
+ * NXT_PACKET_IN that matches on every metadata field, is about 140 bytes.
+ *
+ * Every PACKET_IN format puts the packet 2 bytes past a multiple of 8 bytes,
+ * to align the packet's L3 header, so this is, too. */
+#define OFPUTIL_PACKET_IN_HEADROOM (256 + 2)
+
 enum ofperr ofputil_decode_packet_in(struct ofputil_packet_in *,
                                      const struct ofp_header *);
 struct ofpbuf *ofputil_encode_packet_in(const struct ofputil_packet_in *,
                                         enum ofputil_protocol protocol,
                                         enum nx_packet_in_format);
+struct ofpbuf *ofputil_encode_packet_in_buf(const struct ofputil_packet_in *,
+                                            enum ofputil_protocol protocol,
+                                            enum nx_packet_in_format,
+                                            struct ofpbuf *packet);
 
 const char *ofputil_packet_in_reason_to_string(enum ofp_packet_in_reason);
 bool ofputil_packet_in_reason_from_string(const char *,
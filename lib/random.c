@@ -118,12 +118,25 @@ random_range(int max)
     return random_uint32() % max;
 }
 
+/* Returns the next random number from the PRNG whose state is '*seedp', which
+ * must be nonzero, and updates '*seedp'.  A thread other than the main thread
+ * must use this function, with a seed of its own, instead of the functions
+ * above, which share a single global seed. */
+uint32_t
+random_uint32_r(uint32_t *seedp)
+{
+    uint32_t x = *seedp;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    *seedp = x;
+    return x;
+}
+
 static uint32_t
 random_next(void)
 {
-    seed ^= seed << 13;
-    seed ^= seed >> 17;
-    seed ^= seed << 5;
-
-    return seed;
+    return random_uint32_r(&seed);
 }
@@ -30,4 +30,6 @@ uint32_t random_uint32(void);
 uint64_t random_uint64(void);
 int random_range(int max);
 
+uint32_t random_uint32_r(uint32_t *seedp);
+
 #endif /* random.h */
@@ -36,14 +36,30 @@
 
 VLOG_DEFINE_THIS_MODULE(vconn_stream);
 
-/* Active stream socket vconn. */
+/* Active stream socket vconn.
+ *
+ * To keep the number of system calls per message low, a stream vconn reads
+ * as much as it can, up to RX_BATCH bytes, into 'rxbuf' in each call to
+ * stream_recv(), then returns the messages that it finds there one by one.
+ * Similarly, vconn_stream_send() only appends messages to 'txbuf', which
+ * vconn_stream_run() then sends with a single stream_send() call, or when
+ * 'txbuf' reaches TX_FLUSH bytes, vconn_stream_send() itself. */
+
+/* Number of bytes that vconn_stream_recv() tries to read at a time. */
+#define RX_BATCH 65536
+
+/* When this many bytes are waiting to be sent, vconn_stream_send() tries to
+ * send them immediately and, if they still can't all be sent, refuses to
+ * queue more. */
+#define TX_FLUSH 65536
 
 struct vconn_stream
 {
     struct vconn vconn;
     struct stream *stream;
-    struct ofpbuf *rxbuf;
-    struct ofpbuf *txbuf;
+    struct ofpbuf *rxbuf;       /* Received data not yet returned. */
+    struct ofpbuf *txbuf;       /* Data not yet sent. */
+    int tx_error;               /* Error that discarded 'txbuf', if any. */
     int n_packets;
 };
 
@@ -52,6 +68,7 @@ static struct vconn_class stream_vconn_class;
 static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(10, 25);
 
 static void vconn_stream_clear_txbuf(struct vconn_stream *);
+static void vconn_stream_flush(struct vconn_stream *);
 
 static struct vconn *
 vconn_stream_new(struct stream *stream, int connect_status,
@@ -65,6 +82,7 @@ vconn_stream_new(struct stream *stream, int connect_status,
     s->stream = stream;
     s->txbuf = NULL;
     s->rxbuf = NULL;
+    s->tx_error = 0;
     s->n_packets = 0;
     s->vconn.remote_ip = stream_get_remote_ip(stream);
     s->vconn.remote_port = stream_get_remote_port(stream);
@@ -114,6 +132,12 @@ vconn_stream_close(struct vconn *vconn)
                               THIS_MODULE, vconn_get_name(vconn));
     }
 
+    /* Give queued messages a last chance to go out, as they would have if
+     * they had been sent as soon as they were queued. */
+    if (s->txbuf && s->txbuf->size) {
+        stream_send(s->stream, s->txbuf->data, s->txbuf->size);
+    }
+
     stream_close(s->stream);
     vconn_stream_clear_txbuf(s);
     ofpbuf_delete(s->rxbuf);
@@ -127,18 +151,37 @@ vconn_stream_connect(struct vconn *vconn)
     return stream_connect(s->stream);
 }
 
+/* Moves the data in 'b' to the start of its buffer, to make room at its tail
+ * without reallocating. */
+static void
+vconn_stream_compact(struct ofpbuf *b)
+{
+    if (b->data != b->base) {
+        memmove(b->base, b->data, b->size);
+        b->data = b->base;
+    }
+}
+
+/* Reads as much data as is available, up to RX_BATCH bytes, plus however much
+ * more is needed to complete a message of 'min_size' bytes, into 's->rxbuf'.
+ * Returns 0 if it read any data, otherwise a positive errno value or EOF. */
 static int
-vconn_stream_recv__(struct vconn_stream *s, int rx_len)
+vconn_stream_fill(struct vconn_stream *s, size_t min_size)
 {
     struct ofpbuf *rx = s->rxbuf;
-    int want_bytes, retval;
+    size_t want_bytes;
+    int retval;
+
+    want_bytes = MAX(RX_BATCH, min_size) - rx->size;
+    if (ofpbuf_tailroom(rx) < want_bytes) {
+        vconn_stream_compact(rx);
+        ofpbuf_prealloc_tailroom(rx, want_bytes);
+    }
 
-    want_bytes = rx_len - rx->size;
-    ofpbuf_prealloc_tailroom(rx, want_bytes);
-    retval = stream_recv(s->stream, ofpbuf_tail(rx), want_bytes);
+    retval = stream_recv(s->stream, ofpbuf_tail(rx), ofpbuf_tailroom(rx));
     if (retval > 0) {
         rx->size += retval;
-        return retval == want_bytes ? 0 : EAGAIN;
+        return 0;
     } else if (retval == 0) {
         if (rx->size) {
             VLOG_ERR_RL(&rl, "connection dropped mid-packet");
@@ -150,45 +193,75 @@ vconn_stream_recv__(struct vconn_stream *s, int rx_len)
     }
 }
 
+/* Returns the length of the OpenFlow message at the start of 's->rxbuf', if
+ * all of its header has been received, otherwise the length of an OpenFlow
+ * header. */
+static size_t
+vconn_stream_rx_len(const struct vconn_stream *s)
+{
+    const struct ofp_header *oh = s->rxbuf->data;
+
+    return (s->rxbuf->size < sizeof *oh
+            ? sizeof *oh
+            : ntohs(oh->length));
+}
+
 static int
 vconn_stream_recv(struct vconn *vconn, struct ofpbuf **bufferp)
 {
     struct vconn_stream *s = vconn_stream_cast(vconn);
-    const struct ofp_header *oh;
-    int rx_len;
+    size_t rx_len;
 
     /* Allocate new receive buffer if we don't have one. */
     if (s->rxbuf == NULL) {
-        s->rxbuf = ofpbuf_new(1564);
+        s->rxbuf = ofpbuf_new(RX_BATCH);
     }
 
-    /* Read ofp_header. */
-    if (s->rxbuf->size < sizeof(struct ofp_header)) {
-        int retval = vconn_stream_recv__(s, sizeof(struct ofp_header));
-        if (retval) {
-            return retval;
+    /* Read until a whole message is buffered. */
+    for (;;) {
+        int retval;
+
+        rx_len = vconn_stream_rx_len(s);
+        if (rx_len < sizeof(struct ofp_header)) {
+            VLOG_ERR_RL(&rl, "received too-short ofp_header (%zu bytes)",
+                        rx_len);
+            return EPROTO;
+        } else if (s->rxbuf->size >= rx_len) {
+            break;
         }
-    }
 
-    /* Read payload. */
-    oh = s->rxbuf->data;
-    rx_len = ntohs(oh->length);
-    if (rx_len < sizeof(struct ofp_header)) {
-        VLOG_ERR_RL(&rl, "received too-short ofp_header (%d bytes)", rx_len);
-        return EPROTO;
-    } else if (s->rxbuf->size < rx_len) {
-        int retval = vconn_stream_recv__(s, rx_len);
+        retval = vconn_stream_fill(s, rx_len);
         if (retval) {
-            return retval;
+            if (retval != EAGAIN && s->txbuf && s->txbuf->size) {
+                /* The connection failed.  Report the error that sending the
+                 * queued messages gets, if any, as it would have been
+                 * reported if they had been sent as soon as they were
+                 * queued. */
+                vconn_stream_flush(s);
+            }
+            return s->tx_error ? s->tx_error : retval;
         }
     }
 
     s->n_packets++;
-    *bufferp = s->rxbuf;
-    s->rxbuf = NULL;
+    *bufferp = ofpbuf_clone_data(s->rxbuf->data, rx_len);
+    ofpbuf_pull(s->rxbuf, rx_len);
+    if (!s->rxbuf->size) {
+        ofpbuf_clear(s->rxbuf);
+    }
     return 0;
 }
 
+/* Returns true if 's->rxbuf' holds a whole message, or at least enough of one
+ * to tell that it is invalid, so that vconn_stream_recv() need not wait. */
+static bool
+vconn_stream_rx_ready(const struct vconn_stream *s)
+{
+    return (s->rxbuf
+            && s->rxbuf->size >= sizeof(struct ofp_header)
+            && s->rxbuf->size >= vconn_stream_rx_len(s));
+}
+
 static void
 vconn_stream_clear_txbuf(struct vconn_stream *s)
 {
@@ -196,56 +269,71 @@ vconn_stream_clear_txbuf(struct vconn_stream *s)
     s->txbuf = NULL;
 }
 
+/* Sends as much of 's->txbuf' as the stream will take.  On a send error,
+ * discards 's->txbuf' and saves the error in 's->tx_error', for
+ * vconn_stream_send() to report. */
+static void
+vconn_stream_flush(struct vconn_stream *s)
+{
+    struct ofpbuf *tx = s->txbuf;
+    ssize_t retval;
+
+    retval = stream_send(s->stream, tx->data, tx->size);
+    if (retval < 0) {
+        if (retval != -EAGAIN) {
+            VLOG_ERR_RL(&rl, "send: %s", strerror(-retval));
+            vconn_stream_clear_txbuf(s);
+            s->tx_error = -retval;
+        }
+    } else if (retval > 0) {
+        ofpbuf_pull(tx, retval);
+        if (!tx->size) {
+            ofpbuf_clear(tx);
+        }
+    }
+}
+
 static int
 vconn_stream_send(struct vconn *vconn, struct ofpbuf *buffer)
 {
     struct vconn_stream *s = vconn_stream_cast(vconn);
-    ssize_t retval;
+    struct ofpbuf *tx;
 
-    if (s->txbuf) {
-        return EAGAIN;
+    if (s->tx_error) {
+        return s->tx_error;
     }
 
-    retval = stream_send(s->stream, buffer->data, buffer->size);
-    if (retval == buffer->size) {
-        ofpbuf_delete(buffer);
-        return 0;
-    } else if (retval >= 0 || retval == -EAGAIN) {
-        leak_checker_claim(buffer);
-        s->txbuf = buffer;
-        if (retval > 0) {
-            ofpbuf_pull(buffer, retval);
+    if (!s->txbuf) {
+        s->txbuf = ofpbuf_new(TX_FLUSH);
+        leak_checker_claim(s->txbuf);
+    }
+    tx = s->txbuf;
+
+    if (tx->size >= TX_FLUSH) {
+        vconn_stream_flush(s);
+        if (s->tx_error) {
+            return s->tx_error;
+        } else if (tx->size >= TX_FLUSH) {
+            return EAGAIN;
         }
-        return 0;
-    } else {
-        return -retval;
     }
+
+    if (ofpbuf_tailroom(tx) < buffer->size) {
+        vconn_stream_compact(tx);
+    }
+    ofpbuf_put(tx, buffer->data, buffer->size);
+    ofpbuf_delete(buffer);
+    return 0;
 }
 
 static void
 vconn_stream_run(struct vconn *vconn)
 {
     struct vconn_stream *s = vconn_stream_cast(vconn);
-    ssize_t retval;
 
     stream_run(s->stream);
-    if (!s->txbuf) {
-        return;
-    }
-
-    retval = stream_send(s->stream, s->txbuf->data, s->txbuf->size);
-    if (retval < 0) {
-        if (retval != -EAGAIN) {
-            VLOG_ERR_RL(&rl, "send: %s", strerror(-retval));
-            vconn_stream_clear_txbuf(s);
-            return;
-        }
-    } else if (retval > 0) {
-        ofpbuf_pull(s->txbuf, retval);
-        if (!s->txbuf->size) {
-            vconn_stream_clear_txbuf(s);
-            return;
-        }
+    if (s->txbuf && s->txbuf->size) {
+        vconn_stream_flush(s);
     }
 }
 
@@ -255,7 +343,7 @@ vconn_stream_run_wait(struct vconn *vconn)
     struct vconn_stream *s = vconn_stream_cast(vconn);
 
     stream_run_wait(s->stream);
-    if (s->txbuf) {
+    if (s->txbuf && s->txbuf->size) {
         stream_send_wait(s->stream);
     }
 }
@@ -270,8 +358,8 @@ vconn_stream_wait(struct vconn *vconn, enum vconn_wait_type wait)
         break;
 
     case WAIT_SEND:
-        if (!s->txbuf) {
-            stream_send_wait(s->stream);
+        if (!s->txbuf || s->txbuf->size < TX_FLUSH) {
+            poll_immediate_wake();
         } else {
             /* Nothing to do: need to drain txbuf first.
              * vconn_stream_run_wait() will arrange to wake up when there room
@@ -281,14 +369,18 @@ vconn_stream_wait(struct vconn *vconn, enum vconn_wait_type wait)
         break;
 
     case WAIT_RECV:
-        stream_recv_wait(s->stream);
+        if (vconn_stream_rx_ready(s)) {
+            poll_immediate_wake();
+        } else {
+            stream_recv_wait(s->stream);
+        }
         break;
 
     default:
         NOT_REACHED();
     }
 }
-
+
 /* Passive stream socket vconn. */
 
 struct pvconn_pstream
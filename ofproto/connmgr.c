@@ -65,7 +65,8 @@ struct ofconn {
     enum nx_packet_in_format packet_in_format; /* OFPT_PACKET_IN format. */
 
     /* Asynchronous flow table operation support. */
-    struct list opgroups;       /* Contains pending "ofopgroups", if any. */
+    struct list opgroups;       /* Contains pending "ofopgroups" and flow
+                                 * stats dumps, if any. */
     struct ofpbuf *blocked;     /* Postponed OpenFlow message, if any. */
     bool retry;                 /* True if 'blocked' is ready to try again. */
 
@@ -916,6 +917,15 @@ ofconn_send_reply(const struct ofconn *ofconn, struct ofpbuf *msg)
     ofconn_send(ofconn, msg, ofconn->reply_counter);
 }
 
+/* Returns the number of replies that have been sent on 'ofconn' with
+ * ofconn_send_reply() or ofconn_send_replies() but are still queued, waiting
+ * for the controller to accept them. */
+unsigned int
+ofconn_get_reply_backlog(const struct ofconn *ofconn)
+{
+    return ofconn->reply_counter->n_packets;
+}
+
 /* Sends each of the messages in list 'replies' on 'ofconn' in order,
  * accounting them as replies. */
 void
@@ -975,7 +985,9 @@ ofconn_has_pending_opgroups(const struct ofconn *ofconn)
     return !list_is_empty(&ofconn->opgroups);
 }
 
-/* Adds 'ofconn_node' to 'ofconn''s list of pending opgroups.
+/* Adds 'ofconn_node' to 'ofconn''s list of pending opgroups.  (ofproto also
+ * uses this list for flow stats dumps in progress, so that requests that must
+ * wait for pending opgroups, such as barriers, wait for those too.)
  *
  * If 'ofconn' is destroyed or its connection drops, then 'ofconn' will remove
  * 'ofconn_node' from the list and re-initialize it with list_init().  The
@@ -1156,6 +1168,9 @@ ofconn_may_recv(const struct ofconn *ofconn)
     return (!ofconn->blocked || ofconn->retry) && count < OFCONN_REPLY_MAX;
 }
 
+/* Maximum number of flow_mods that ofconn_run() processes in one call. */
+#define OFCONN_FLOW_MOD_BATCH 1000
+
 /**
  * Handle openflow protocols.
  */
@@ -1173,9 +1188,17 @@ ofconn_run(struct ofconn *ofconn,
     rconn_run(ofconn->rconn); //connect the controller
 
     if (handle_openflow) {
-        /* Limit the number of iterations to avoid starving other tasks. */
-        for (i = 0; i < 50 && ofconn_may_recv(ofconn); i++) {
+        size_t n_flow_mods = 0;
+
+        /* Limit the number of iterations to avoid starving other tasks.
+         *
+         * Flow_mods have a separate, higher limit, because ofproto applies
+         * each run of flow_mods as a single batch (see handle_flow_mod__() in
+         * ofproto.c), which makes them much cheaper than other messages. */
+        for (i = 0; i < 50 && n_flow_mods < OFCONN_FLOW_MOD_BATCH
+                 && ofconn_may_recv(ofconn); ) {
             struct ofpbuf *of_msg;
+            enum ofptype type;
 
             of_msg = (ofconn->blocked
                       ? ofconn->blocked
@@ -1187,6 +1210,13 @@ ofconn_run(struct ofconn *ofconn,
                 fail_open_maybe_recover(mgr->fail_open);
             }
 
+            if (!ofptype_decode(&type, of_msg->data)
+                && type == OFPTYPE_FLOW_MOD) {
+                n_flow_mods++;
+            } else {
+                i++;
+            }
+
             if (handle_openflow(ofconn, of_msg)) { //handle of msg from controller.
                 ofpbuf_delete(of_msg);
                 ofconn->blocked = NULL;
@@ -1298,7 +1328,8 @@ ofconn_send(const struct ofconn *ofconn, struct ofpbuf *msg,
 
 /* Sending asynchronous messages. */
 
-static void schedule_packet_in(struct ofconn *, struct ofputil_packet_in);
+static void schedule_packet_in(struct ofconn *, struct ofputil_packet_in,
+                               struct ofpbuf *packet);
 
 /* Sends an OFPT_PORT_STATUS message with 'opp' and 'reason' to appropriate
  * controllers managed by 'mgr'. */
@@ -1349,19 +1380,36 @@ connmgr_send_flow_removed(struct connmgr *mgr,
  * necessary according to their individual configurations. 
  * For pkt that missed in the flow table or that had a OFPP_CONTROLLER output action.
  *
- * The caller doesn't need to fill in pin->buffer_id or pin->total_len. */
+ * The packet itself is in 'packet', which this function takes over.  To
+ * avoid copying the packet, it should have OFPUTIL_PACKET_IN_HEADROOM bytes
+ * of headroom.
+ *
+ * The caller doesn't need to fill in pin->packet, pin->packet_len,
+ * pin->buffer_id, or pin->total_len. */
 void
 connmgr_send_packet_in(struct connmgr *mgr,
-                       const struct ofputil_packet_in *pin)
+                       const struct ofputil_packet_in *pin,
+                       struct ofpbuf *packet)
 {
-    struct ofconn *ofconn;
+    struct ofconn *ofconn, *prev;
 
+    /* Every controller but the last one to receive the packet gets a copy. */
+    prev = NULL;
     LIST_FOR_EACH (ofconn, node, &mgr->all_conns) {
         if (ofconn_receives_async_msg(ofconn, OAM_PACKET_IN, pin->reason)
             && ofconn->controller_id == pin->controller_id) {
-            schedule_packet_in(ofconn, *pin);
+            if (prev) {
+                schedule_packet_in(prev, *pin, ofpbuf_clone_with_headroom(
+                                       packet, OFPUTIL_PACKET_IN_HEADROOM));
+            }
+            prev = ofconn;
         }
     }
+    if (prev) {
+        schedule_packet_in(prev, *pin, packet);
+    } else {
+        ofpbuf_delete(packet);
+    }
 }
 
 /* pinsched callback for sending 'ofp_packet_in' on 'ofconn'. */
@@ -1374,16 +1422,22 @@ do_send_packet_in(struct ofpbuf *ofp_packet_in, void *ofconn_)
                           ofconn->packet_in_counter, 100);
 }
 
-/* Takes 'pin', composes an OpenFlow packet-in message from it, and passes it
- * to 'ofconn''s packet scheduler for sending. */
+/* Takes 'pin' and 'packet', composes an OpenFlow packet-in message from
+ * them, and passes it to 'ofconn''s packet scheduler for sending. */
 static void
-schedule_packet_in(struct ofconn *ofconn, struct ofputil_packet_in pin)
+schedule_packet_in(struct ofconn *ofconn, struct ofputil_packet_in pin,
+                   struct ofpbuf *packet)
 {
     struct connmgr *mgr = ofconn->connmgr;
+    struct ofpbuf *msg;
 
+    pin.packet = packet->data;
+    pin.packet_len = packet->size;
     pin.total_len = pin.packet_len;
 
-    /* Get OpenFlow buffer_id. */
+    /* Get OpenFlow buffer_id.  A buffered packet goes into 'ofconn''s packet
+     * buffer as is, so the packet-in then needs its own copy of the part of
+     * the packet that it includes. */
     if (pin.reason == OFPR_ACTION) {
         pin.buffer_id = UINT32_MAX;
     } else if (mgr->fail_open && fail_open_is_active(mgr->fail_open)) {
@@ -1391,8 +1445,12 @@ schedule_packet_in(struct ofconn *ofconn, struct ofputil_packet_in pin)
     } else if (!ofconn->pktbuf) {
         pin.buffer_id = UINT32_MAX;
     } else {
-        pin.buffer_id = pktbuf_save(ofconn->pktbuf, pin.packet, pin.packet_len,
-                                    pin.fmd.in_port);
+        pin.buffer_id = pktbuf_adopt(ofconn->pktbuf, packet, pin.fmd.in_port);
+        if (pin.buffer_id != UINT32_MAX) {
+            /* pktbuf_adopt() may have reallocated 'packet' to add headroom. */
+            pin.packet = packet->data;
+            packet = NULL;
+        }
     }
 
     /* Figure out how much of the packet to send. */
@@ -1409,11 +1467,13 @@ schedule_packet_in(struct ofconn *ofconn, struct ofputil_packet_in pin)
     /* Make OFPT_PACKET_IN and hand over to packet scheduler.  It might
      * immediately call into do_send_packet_in() or it might buffer it for a
      * while (until a later call to pinsched_run()). */
+    msg = (packet
+           ? ofputil_encode_packet_in_buf(&pin, ofconn->protocol,
+                                          ofconn->packet_in_format, packet)
+           : ofputil_encode_packet_in(&pin, ofconn->protocol,
+                                      ofconn->packet_in_format));
     pinsched_send(ofconn->schedulers[pin.reason == OFPR_NO_MATCH ? 0 : 1],
-                  pin.fmd.in_port,
-                  ofputil_encode_packet_in(&pin, ofconn->protocol,
-                                           ofconn->packet_in_format),
-                  do_send_packet_in, ofconn);
+                  pin.fmd.in_port, msg, do_send_packet_in, ofconn);
 }
 
 /* Fail-open settings. */
@@ -1576,6 +1636,14 @@ connmgr_msg_in_hook(struct connmgr *mgr, const struct flow *flow,
     return mgr->in_band && in_band_msg_in_hook(mgr->in_band, flow, packet);
 }
 
+/* Returns true if in-band control is active on 'mgr', in which case
+ * connmgr_may_set_up_flow() may consult any field of the flow. */
+bool
+connmgr_has_in_band(const struct connmgr *mgr)
+{
+    return mgr->in_band != NULL;
+}
+
 bool
 connmgr_may_set_up_flow(struct connmgr *mgr, const struct flow *flow,
                         const struct nlattr *odp_actions,
@@ -118,6 +118,7 @@ void ofconn_set_async_config(struct ofconn *,
 
 void ofconn_send_reply(const struct ofconn *, struct ofpbuf *);
 void ofconn_send_replies(const struct ofconn *, struct list *);
+unsigned int ofconn_get_reply_backlog(const struct ofconn *);
 void ofconn_send_error(const struct ofconn *, const struct ofp_header *request,
                        enum ofperr);
 
@@ -135,7 +136,8 @@ void connmgr_send_port_status(struct connmgr *,
 void connmgr_send_flow_removed(struct connmgr *,
                                const struct ofputil_flow_removed *);
 void connmgr_send_packet_in(struct connmgr *,
-                            const struct ofputil_packet_in *);
+                            const struct ofputil_packet_in *,
+                            struct ofpbuf *packet);
 
 /* Fail-open settings. */
 enum ofproto_fail_mode connmgr_get_fail_mode(const struct connmgr *);
@@ -155,6 +157,7 @@ void connmgr_set_in_band_queue(struct connmgr *, int queue_id);
 /* In-band implementation. */
 bool connmgr_msg_in_hook(struct connmgr *, const struct flow *,
                          const struct ofpbuf *packet);
+bool connmgr_has_in_band(const struct connmgr *);
 bool connmgr_may_set_up_flow(struct connmgr *, const struct flow *,
                              const struct nlattr *odp_actions,
                              size_t actions_len);
@@ -125,12 +125,12 @@ send_bogus_packet_ins(struct fail_open *fo)
     compose_rarp(&b, mac);
 
     memset(&pin, 0, sizeof pin);
-    pin.packet = b.data;
-    pin.packet_len = b.size;
     pin.reason = OFPR_NO_MATCH;
     pin.send_len = b.size;
     pin.fmd.in_port = OFPP_LOCAL;
-    connmgr_send_packet_in(fo->connmgr, &pin);
+    connmgr_send_packet_in(fo->connmgr, &pin,
+                           ofpbuf_clone_with_headroom(
+                               &b, OFPUTIL_PACKET_IN_HEADROOM));
 
     ofpbuf_uninit(&b);
 }
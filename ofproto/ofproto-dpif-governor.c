@@ -21,10 +21,16 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include "byte-order.h"
 #include "coverage.h"
+#include "dynamic-string.h"
+#include "flow.h"
+#include "hash.h"
+#include "packets.h"
 #include "poll-loop.h"
 #include "random.h"
 #include "timeval.h"
+#include "token-bucket.h"
 #include "util.h"
 #include "valgrind.h"
 #include "vlog.h"
@@ -52,16 +58,43 @@ BUILD_ASSERT_DECL(IS_POW2(MAX_SIZE));
 enum { MIN_ELAPSED = 1000 }; /* In milliseconds. */
 enum { MAX_ELAPSED = 5000 }; /* In milliseconds. */
 
+/* A source of flows, e.g. an input port. */
+struct governor_source {
+    struct hmap_node hmap_node; /* In struct governor's 'sources'. */
+    uint32_t in_port;           /* Input port. */
+    uint64_t id;                /* VLAN or tunnel ID, depending on 'key'. */
+
+    /* Flow setup budget, if the governor has one.  Each flow setup takes
+     * TOKEN_SCALE tokens. */
+    struct token_bucket bucket;
+
+    long long int used;         /* Time a flow from this source last missed. */
+    unsigned long long int n_admitted; /* Flows set up. */
+    unsigned long long int n_deferred; /* Flows processed packet-by-packet. */
+};
+
+/* Number of tokens for one flow setup.  A token bucket gains tokens every
+ * millisecond, so a bucket that gains 'rate' tokens per millisecond allows
+ * 'rate' flow setups per second. */
+#define TOKEN_SCALE 1000
+
+/* A source that has not missed on any flow for this long is forgotten. */
+enum { SOURCE_IDLE = 60 * 1000 }; /* In milliseconds. */
+
 static void governor_new_generation(struct governor *, unsigned int size);
+static void governor_clear_sources(struct governor *);
 
 /* Creates and returns a new governor named 'name' (which is used only for log
- * messages). */
+ * messages).  The governor starts out without a budget and with its hash table
+ * disengaged. */
 struct governor *
 governor_create(const char *name)
 {
     struct governor *g = xzalloc(sizeof *g);
     g->name = xstrdup(name);
-    governor_new_generation(g, MIN_SIZE);
+    hmap_init(&g->sources);
+    g->key = GOVERNOR_KEY_PORT;
+    g->next_sweep = time_msec() + SOURCE_IDLE;
     return g;
 }
 
@@ -70,23 +103,116 @@ void
 governor_destroy(struct governor *g)
 {
     if (g) {
+        governor_disengage(g);
+        governor_clear_sources(g);
+        hmap_destroy(&g->sources);
+        free(g->name);
+        free(g);
+    }
+}
+
+/* Engages 'g''s hash table, so that governor_should_install_flow() sets up
+ * only flows whose hashes it has seen often enough.  Does nothing if 'g' is
+ * already engaged. */
+void
+governor_engage(struct governor *g)
+{
+    if (!g->size) {
+        governor_new_generation(g, MIN_SIZE);
+    }
+}
+
+/* Disengages and frees 'g''s hash table.  Does nothing if 'g' is not
+ * engaged. */
+void
+governor_disengage(struct governor *g)
+{
+    if (g->size) {
         VLOG_INFO("%s: disengaging", g->name);
         free(g->table);
-        free(g);
+        g->table = NULL;
+        g->size = 0;
+        g->n_packets = 0;
+        g->n_flows = 0;
+        g->n_setups = 0;
+        g->n_shortcuts = 0;
+    }
+}
+
+/* Returns true if 'g''s hash table is engaged. */
+bool
+governor_is_engaged(const struct governor *g)
+{
+    return g->size != 0;
+}
+
+/* Limits each source of flows in 'g', as distinguished according to 'key', to
+ * setting up 'rate' flows per second, in bursts of up to 'burst' flows.  A
+ * 'rate' of 0 removes the limit. */
+void
+governor_set_budget(struct governor *g, unsigned int rate, unsigned int burst,
+                    enum governor_key key)
+{
+    struct governor_source *src;
+
+    if (key != g->key) {
+        governor_clear_sources(g);
+        g->key = key;
+    }
+
+    g->rate = MIN(rate, UINT_MAX / TOKEN_SCALE);
+    g->burst = rate ? MIN(MAX(burst, 1), UINT_MAX / TOKEN_SCALE) : 0;
+    HMAP_FOR_EACH (src, hmap_node, &g->sources) {
+        token_bucket_set(&src->bucket, g->rate, g->burst * TOKEN_SCALE);
+    }
+}
+
+/* Returns true if 'g' limits the rate at which each source sets up flows. */
+bool
+governor_has_budget(const struct governor *g)
+{
+    return g->rate != 0;
+}
+
+static const char *
+governor_key_to_string(enum governor_key key)
+{
+    switch (key) {
+    case GOVERNOR_KEY_PORT:
+        return "port";
+    case GOVERNOR_KEY_VLAN:
+        return "vlan";
+    case GOVERNOR_KEY_TUNNEL:
+        return "tunnel";
     }
+    NOT_REACHED();
 }
 
 /* Performs periodic maintenance work on 'g'. */
 void
 governor_run(struct governor *g)
 {
-    if (time_msec() - g->start > MAX_ELAPSED) {
+    long long int now = time_msec();
+
+    if (g->size && now - g->start > MAX_ELAPSED) {
         if (g->size > MIN_SIZE) {
             governor_new_generation(g, g->size / 2);
         } else {
             /* Don't start a new generation (we'd never go idle). */
         }
     }
+
+    if (now >= g->next_sweep) {
+        struct governor_source *src, *next;
+
+        HMAP_FOR_EACH_SAFE (src, next, hmap_node, &g->sources) {
+            if (now - src->used > SOURCE_IDLE) {
+                hmap_remove(&g->sources, &src->hmap_node);
+                free(src);
+            }
+        }
+        g->next_sweep = now + SOURCE_IDLE;
+    }
 }
 
 /* Arranges for the poll loop to wake up when 'g' needs to do some work. */
@@ -98,30 +224,88 @@ governor_wait(struct governor *g)
     }
 }
 
-/* Returns true if 'g' has been doing only a minimal amount of work and thus
- * the client should consider getting rid of it entirely.  */
+/* Returns true if 'g''s hash table has been doing only a minimal amount of
+ * work and thus the client should consider disengaging it.  */
 bool
 governor_is_idle(struct governor *g)
 {
     return g->size == MIN_SIZE && time_msec() - g->start > MAX_ELAPSED;
 }
 
+/* Frees all of 'g''s sources. */
+static void
+governor_clear_sources(struct governor *g)
+{
+    struct governor_source *src, *next;
+
+    HMAP_FOR_EACH_SAFE (src, next, hmap_node, &g->sources) {
+        hmap_remove(&g->sources, &src->hmap_node);
+        free(src);
+    }
+}
+
+/* Returns the source of 'flow' in 'g', creating it if necessary. */
+static struct governor_source *
+governor_get_source(struct governor *g, const struct flow *flow)
+{
+    struct governor_source *src;
+    uint64_t id;
+    uint32_t hash;
+
+    id = (g->key == GOVERNOR_KEY_VLAN ? vlan_tci_to_vid(flow->vlan_tci)
+          : g->key == GOVERNOR_KEY_TUNNEL ? ntohll(flow->tunnel.tun_id)
+          : 0);
+    hash = hash_2words(flow->in_port, hash_bytes(&id, sizeof id, 0));
+
+    HMAP_FOR_EACH_WITH_HASH (src, hmap_node, hash, &g->sources) {
+        if (src->in_port == flow->in_port && src->id == id) {
+            goto found;
+        }
+    }
+
+    src = xzalloc(sizeof *src);
+    hmap_insert(&g->sources, &src->hmap_node, hash);
+    src->in_port = flow->in_port;
+    src->id = id;
+    token_bucket_init(&src->bucket, g->rate, g->burst * TOKEN_SCALE);
+
+found:
+    src->used = time_msec();
+    return src;
+}
+
+/* Withdraws the tokens for one flow setup from 'src''s token bucket.  Returns
+ * 1 if the bucket held at least half of its capacity beyond those tokens, 0 if
+ * it held fewer than that, or -1 if it held too few tokens for a flow setup
+ * (in which case nothing is withdrawn). */
+static int
+governor_source_withdraw(struct governor_source *src)
+{
+    unsigned int half = src->bucket.burst / 2;
+
+    /* Withdrawing more tokens than needed brings the bucket up to date if it
+     * holds fewer than that, so put the excess back afterward. */
+    if (token_bucket_withdraw(&src->bucket, half + TOKEN_SCALE)) {
+        src->bucket.tokens += half;
+        return 1;
+    } else if (token_bucket_withdraw(&src->bucket, TOKEN_SCALE)) {
+        return 0;
+    } else {
+        return -1;
+    }
+}
+
 /* Tests whether a flow whose hash is 'hash' and for which 'n' packets have
  * just arrived should be set up in the datapath or just processed on a
- * packet-by-packet basis.  Returns true to set up a datapath flow, false to
- * process the packets individually.
- *
- * One would expect 'n' to ordinarily be 1, if batching leads multiple packets
- * to be processed at a time then it could be greater. */
-bool
-governor_should_install_flow(struct governor *g, uint32_t hash, int n)
+ * packet-by-packet basis, according to 'g''s hash table.  'g' must be
+ * engaged. */
+static bool
+governor_check_hash(struct governor *g, uint32_t hash, int n)
 {
     int old_count, new_count;
     bool install_flow;
     uint8_t *e;
 
-    assert(n > 0);
-
     /* Count these packets and begin a new generation if necessary. */
     g->n_packets += n;
     if (g->n_packets >= g->size / 4) {
@@ -170,6 +354,107 @@ governor_should_install_flow(struct governor *g, uint32_t hash, int n)
 
     return install_flow;
 }
+
+/* Tests whether a flow whose hash is 'hash' and for which 'n' packets have
+ * just arrived should be set up in the datapath or just processed on a
+ * packet-by-packet basis.  Returns true to set up a datapath flow, false to
+ * process the packets individually.  'flow' is the flow itself, which 'g'
+ * uses to find the flow's source.
+ *
+ * One would expect 'n' to ordinarily be 1, if batching leads multiple packets
+ * to be processed at a time then it could be greater. */
+bool
+governor_should_install_flow(struct governor *g, uint32_t hash, int n,
+                             const struct flow *flow)
+{
+    struct governor_source *src;
+    bool install_flow;
+    int budget;
+
+    assert(n > 0);
+
+    src = governor_get_source(g, flow);
+    budget = g->rate ? governor_source_withdraw(src) : 0;
+    if (budget < 0) {
+        /* The source has used up its budget. */
+        install_flow = false;
+    } else if (!g->size || budget > 0) {
+        /* Either there is no pressure, or the source is well within its
+         * budget, so that its flows are preferred over the flows of sources
+         * that are using up theirs. */
+        install_flow = true;
+    } else {
+        install_flow = governor_check_hash(g, hash, n);
+        if (!install_flow && g->rate) {
+            /* Return the tokens for the flow setup that did not happen. */
+            src->bucket.tokens += TOKEN_SCALE;
+        }
+    }
+
+    if (install_flow) {
+        src->n_admitted++;
+    } else {
+        src->n_deferred++;
+    }
+    return install_flow;
+}
+
+static int
+compare_sources(const void *a_, const void *b_)
+{
+    const struct governor_source *const *a = a_;
+    const struct governor_source *const *b = b_;
+
+    return ((*a)->in_port != (*b)->in_port
+            ? ((*a)->in_port > (*b)->in_port ? 1 : -1)
+            : (*a)->id != (*b)->id
+            ? ((*a)->id > (*b)->id ? 1 : -1)
+            : 0);
+}
+
+/* Appends a description of 'g''s state and of the flows that each of its
+ * sources has set up and deferred to 's'. */
+void
+governor_format(const struct governor *g, struct ds *s)
+{
+    const struct governor_source **sources;
+    const struct governor_source *src;
+    size_t n, i;
+
+    if (g->size) {
+        ds_put_format(s, "governor: engaged, %u kB hash table\n",
+                      g->size / 1024);
+    } else {
+        ds_put_cstr(s, "governor: disengaged\n");
+    }
+    if (g->rate) {
+        ds_put_format(s, "budget: %u flows/s, burst %u, per %s\n",
+                      g->rate, g->burst, governor_key_to_string(g->key));
+    } else {
+        ds_put_cstr(s, "budget: unlimited\n");
+    }
+
+    n = 0;
+    sources = xmalloc(hmap_count(&g->sources) * sizeof *sources);
+    HMAP_FOR_EACH (src, hmap_node, &g->sources) {
+        sources[n++] = src;
+    }
+    qsort(sources, n, sizeof *sources, compare_sources);
+
+    for (i = 0; i < n; i++) {
+        src = sources[i];
+        ds_put_format(s, "port %"PRIu32, src->in_port);
+        if (g->key == GOVERNOR_KEY_VLAN) {
+            ds_put_format(s, " vlan %"PRIu64, src->id);
+        } else if (g->key == GOVERNOR_KEY_TUNNEL) {
+            ds_put_format(s, " tun_id %#"PRIx64, src->id);
+        }
+        ds_put_format(s, ": admitted:%llu deferred:%llu",
+                      src->n_admitted, src->n_deferred);
+        ds_put_char(s, '\n');
+    }
+    free(sources);
+}
 
 /* Starts a new generation in 'g' with a table size of 'size' bytes.  'size'
  * must be a power of two between MIN_SIZE and MAX_SIZE, inclusive. */
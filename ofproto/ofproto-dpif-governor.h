@@ -27,15 +27,37 @@
  * datapath flow for that flow.
  *
  * The same tracking could be done in terms of facets and subfacets directly,
- * but the governor code uses much less time and space to do the same job. */
+ * but the governor code uses much less time and space to do the same job.
+ *
+ * The client engages the governor's hash table only when the datapath holds
+ * many flows.  Independently, the governor keeps track of the flows that each
+ * source sets up, where a source is an input port or, optionally, an input
+ * port and a VLAN or tunnel ID.  If the client sets a budget, then each
+ * source may set up flows only as fast as a token bucket with the budget's
+ * rate and burst size allows, and while the hash table is engaged, flows from
+ * sources that have used less than half of their burst are set up without
+ * waiting for their hashes to be seen often enough.  This keeps a single
+ * source that misses on many flows, e.g. a port scan, from taking flow setups
+ * away from the others. */
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "hmap.h"
+
+struct ds;
+struct flow;
+
+/* What distinguishes the sources of flows in a governor. */
+enum governor_key {
+    GOVERNOR_KEY_PORT,          /* Input port. */
+    GOVERNOR_KEY_VLAN,          /* Input port and VLAN ID. */
+    GOVERNOR_KEY_TUNNEL         /* Input port and tunnel ID. */
+};
 
 struct governor {
     char *name;                 /* Name, for log messages. */
     uint8_t *table;             /* Table of counters, two per byte. */
-    unsigned int size;          /* Table size in bytes. */
+    unsigned int size;          /* Table size in bytes, 0 if not engaged. */
     long long int start;        /* Time when the table was last cleared. */
     unsigned int n_packets;     /* Number of packets processed. */
 
@@ -43,16 +65,36 @@ struct governor {
     unsigned int n_flows;       /* Number of unique flows seen. */
     unsigned int n_setups;      /* Number of flows set up based on counters. */
     unsigned int n_shortcuts;   /* Number of flows set up based on history. */
+
+    /* Sources of flows.  Contains "struct governor_source"s. */
+    struct hmap sources;
+    enum governor_key key;
+    long long int next_sweep;   /* Time to remove idle sources. */
+
+    /* Flow setup budget for each source, if 'rate' is nonzero. */
+    unsigned int rate;          /* Flow setups per second. */
+    unsigned int burst;         /* Maximum flow setups in a burst. */
 };
 
 struct governor *governor_create(const char *name);
 void governor_destroy(struct governor *);
 
+void governor_engage(struct governor *);
+void governor_disengage(struct governor *);
+bool governor_is_engaged(const struct governor *);
+
+void governor_set_budget(struct governor *, unsigned int rate,
+                         unsigned int burst, enum governor_key);
+bool governor_has_budget(const struct governor *);
+
 void governor_run(struct governor *);
 void governor_wait(struct governor *);
 
 bool governor_is_idle(struct governor *);
 
-bool governor_should_install_flow(struct governor *, uint32_t hash, int n);
+bool governor_should_install_flow(struct governor *, uint32_t hash, int n,
+                                  const struct flow *);
+
+void governor_format(const struct governor *, struct ds *);
 
 #endif /* ofproto/ofproto-dpif-governor.h */
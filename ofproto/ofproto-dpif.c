@@ -19,6 +19,10 @@
 #include "ofproto/ofproto-provider.h"
 
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
 
 #include "autopath.h"
 #include "bond.h"
@@ -30,6 +34,7 @@
 #include "dpif.h"
 #include "dynamic-string.h"
 #include "fail-open.h"
+#include "heap.h"
 #include "hmapx.h"
 #include "lacp.h"
 #include "learn.h"
@@ -50,6 +55,7 @@
 #include "poll-loop.h"
 #include "simap.h"
 #include "smap.h"
+#include "socket-util.h"
 #include "timer.h"
 #include "unaligned.h"
 #include "unixctl.h"
@@ -59,11 +65,29 @@
 VLOG_DEFINE_THIS_MODULE(ofproto_dpif);
 
 COVERAGE_DEFINE(ofproto_dpif_expired);
+COVERAGE_DEFINE(ofproto_dpif_expire_check);
 COVERAGE_DEFINE(ofproto_dpif_xlate);
 COVERAGE_DEFINE(facet_changed_rule);
 COVERAGE_DEFINE(facet_revalidate);
 COVERAGE_DEFINE(facet_unexpected);
 COVERAGE_DEFINE(facet_suppress);
+COVERAGE_DEFINE(revalidate_parallel);
+COVERAGE_DEFINE(revalidate_sliced);
+COVERAGE_DEFINE(miss_xlate_parallel);
+COVERAGE_DEFINE(dump_stats_by_key);
+COVERAGE_DEFINE(dump_stats_parsed);
+COVERAGE_DEFINE(facet_xc_hit);
+COVERAGE_DEFINE(facet_xc_miss);
+COVERAGE_DEFINE(subfacet_evicted);
+COVERAGE_DEFINE(flow_miss_coalesced);
+COVERAGE_DEFINE(upcall_slow_cfm);
+COVERAGE_DEFINE(upcall_slow_lacp);
+COVERAGE_DEFINE(upcall_slow_stp);
+COVERAGE_DEFINE(upcall_slow_in_band);
+COVERAGE_DEFINE(upcall_slow_controller);
+COVERAGE_DEFINE(upcall_slow_match);
+COVERAGE_DEFINE(upcall_slow_special);
+COVERAGE_DEFINE(upcall_slow_drop);
 
 /* Maximum depth of flow table recursion (due to resubmit actions) in a
  * flow translation. */
@@ -96,9 +120,12 @@ struct rule_dpif {
     uint64_t packet_count;       /* Number of packets received. */
     uint64_t byte_count;         /* Number of bytes received. */
 
-    tag_type tag;                /* Caches rule_calculate_tag() result. */
-
     struct list facets;          /* List of "struct facet"s. */
+
+    /* Expiration.  A rule with an idle or hard timeout is in its ofproto's
+     * 'expirations' heap, keyed on the earliest time it might expire. */
+    struct heap_node expiration_node;
+    bool in_expirations;         /* True if in 'expirations'. */
 };
 
 static struct rule_dpif *rule_dpif_cast(const struct rule *rule)
@@ -110,17 +137,21 @@ static struct rule_dpif *rule_dpif_lookup(struct ofproto_dpif *,
                                           const struct flow *);
 static struct rule_dpif *rule_dpif_lookup__(struct ofproto_dpif *,
                                             const struct flow *,
-                                            uint8_t table);
+                                            uint8_t table,
+                                            struct flow_wildcards *);
 static struct rule_dpif *rule_dpif_miss_rule(struct ofproto_dpif *ofproto,
-                                             const struct flow *flow);
+                                             const struct flow *flow,
+                                             bool warn);
 
 static void rule_credit_stats(struct rule_dpif *,
                               const struct dpif_flow_stats *);
-static void flow_push_stats(struct rule_dpif *, const struct flow *,
-                            const struct dpif_flow_stats *);
-static tag_type rule_calculate_tag(const struct flow *,
-                                   const struct minimask *, uint32_t basis);
+static void rule_schedule_expiration(struct rule_dpif *);
+static void rule_unschedule_expiration(struct rule_dpif *);
+static void rule_reduce_timeouts(struct rule_dpif *,
+                                 uint16_t idle, uint16_t hard);
 static void rule_invalidate(const struct rule_dpif *);
+static void clear_table_changes(struct ofproto_dpif *);
+static void revalidate_changed_facets(struct ofproto_dpif *);
 
 #define MAX_MIRRORS 32
 typedef uint32_t mirror_mask_t;
@@ -226,6 +257,11 @@ struct action_xlate_ctx {
      * not if we are just revalidating. */
     bool may_learn;
 
+    /* May translation log problems?  Translation in a revalidator thread may
+     * not, because logging is not thread-safe.  Its caller instead reports
+     * 'max_resubmit_trigger' from the main thread. */
+    bool may_log;
+
     /* The rule that we are currently translating, or NULL. */
     struct rule_dpif *rule;
 
@@ -257,6 +293,22 @@ struct action_xlate_ctx {
      * calling action_xlate_ctx_init(). */
     const struct dpif_flow_stats *resubmit_stats;
 
+    /* If nonnull, xlate_actions() replaces the contents of this buffer by an
+     * array of "struct xlate_dep"s, one for each OpenFlow table lookup that
+     * translation performs.  facet_set_deps() attaches them to a facet.
+     *
+     * This is normally null so the client has to set it manually after
+     * calling action_xlate_ctx_init(). */
+    struct ofpbuf *deps;
+
+    /* If nonnull, xlate_actions() replaces the contents of this buffer by an
+     * array of "struct xc_entry"s, one for each side effect of translation
+     * that accounting for traffic must repeat.  See "xlate cache".
+     *
+     * This is normally null so the client has to set it manually after
+     * calling action_xlate_ctx_init(). */
+    struct ofpbuf *xc;
+
 /* xlate_actions() initializes and uses these members.  The client might want
  * to look at them after it returns. */
 
@@ -268,12 +320,18 @@ struct action_xlate_ctx {
     bool has_fin_timeout;       /* Actions include NXAST_FIN_TIMEOUT? */
     uint16_t nf_output_iface;   /* Output interface index for NetFlow. */
     mirror_mask_t mirrors;      /* Bitmap of associated mirrors. */
+    bool max_resubmit_trigger;  /* Recursed too deeply during translation. */
+
+    /* The fields of 'flow' that translation examined.  Datapath flows with
+     * the resulting actions may wildcard all other fields.  Exact if
+     * megaflows are disabled or translation used a feature that may examine
+     * any field. */
+    struct flow_wildcards wc;
 
 /* xlate_actions() initializes and uses these members, but the client has no
  * reason to look at them. */
 
     int recurse;                /* Recursion level, via xlate_table_action. */
-    bool max_resubmit_trigger;  /* Recursed too deeply during translation. */
     struct flow base_flow;      /* Flow at the last commit. */
     uint32_t orig_skb_priority; /* Priority when packet arrived. */
     uint8_t table_id;           /* OpenFlow table ID where flow was found. */
@@ -294,6 +352,11 @@ static void xlate_actions(struct action_xlate_ctx *,
 static void xlate_actions_for_side_effects(struct action_xlate_ctx *,
                                            const struct ofpact *ofpacts,
                                            size_t ofpacts_len);
+static void log_resubmit_recursion(void);
+static void report_resubmit_limit(struct ofproto_dpif *,
+                                  const struct flow *orig_flow,
+                                  const struct ofpbuf *packet,
+                                  ovs_be16 initial_tci);
 
 static size_t put_userspace_action(const struct ofproto_dpif *,
                                    struct ofpbuf *odp_actions,
@@ -329,6 +392,26 @@ enum subfacet_path {
 
 static const char *subfacet_path_to_string(enum subfacet_path);
 
+/* A set of datapath actions, shared by every subfacet that has the same
+ * actions.
+ *
+ * Most subfacets have one of only a few distinct sets of datapath actions
+ * (e.g. "output to port N"), so subfacets refer to a single interned copy of
+ * their actions in 'all_odp_actions' instead of each keeping their own.  The
+ * actions themselves follow the structure in memory.  Only the main thread
+ * may intern or release actions. */
+struct odp_actions {
+    struct hmap_node hmap_node; /* In 'all_odp_actions'. */
+    unsigned int n_refs;        /* Number of subfacets that refer to this. */
+    unsigned int size;          /* Number of bytes of actions. */
+};
+
+static struct hmap all_odp_actions = HMAP_INITIALIZER(&all_odp_actions);
+
+static struct odp_actions *odp_actions_intern(const struct nlattr *,
+                                              size_t size);
+static void odp_actions_unref(struct odp_actions *);
+
 /* A dpif flow and actions associated with a facet.
  *
  * See also the large comment on struct facet. */
@@ -343,21 +426,21 @@ struct subfacet {
      * To save memory in the common case, 'key' is NULL if 'key_fitness' is
      * ODP_FIT_PERFECT, that is, odp_flow_key_from_flow() can accurately
      * regenerate the ODP flow key from ->facet->flow. */
-    enum odp_key_fitness key_fitness;
     struct nlattr *key;
     int key_len;
+    enum odp_key_fitness key_fitness;
 
     long long int used;         /* Time last used; time created if not used. */
 
     uint64_t dp_packet_count;   /* Last known packet count in the datapath. */
     uint64_t dp_byte_count;     /* Last known byte count in the datapath. */
 
-    /* Datapath actions.
+    /* Datapath actions, or NULL if they have not yet been composed.  Use
+     * subfacet_actions() and subfacet_actions_len() to access them.
      *
      * These should be essentially identical for every subfacet in a facet, but
      * may differ in trivial ways due to VLAN splinters. */
-    size_t actions_len;         /* Number of bytes in actions[]. */
-    struct nlattr *actions;     /* Datapath actions. */
+    struct odp_actions *actions;
 
     enum slow_path_reason slow; /* 0 if fast path may be used. */
     enum subfacet_path path;    /* Installed in datapath? */
@@ -366,10 +449,38 @@ struct subfacet {
      * splinters can cause it to differ.  This value should be removed when
      * the VLAN splinters feature is no longer needed.  */
     ovs_be16 initial_tci;       /* Initial VLAN TCI value. */
+
+    /* Has a datapath flow put that is still pending in a dpif_operate()
+     * batch?  See backer_reserve_flow(). */
+    bool put_pending;
+
+    /* The backer's 'stats_dump_seq' when the subfacet was last installed. */
+    unsigned int install_seq;
+
+    /* In the backer's 'installed' heap, if 'path' is not SF_NOT_INSTALLED and
+     * 'put_pending' is false.  See "Datapath flow limit". */
+    struct heap_node evict_node;
 };
 
 #define SUBFACET_DESTROY_MAX_BATCH 50
 
+/* Maximum number of datapath flow updates that revalidation passes to
+ * dpif_operate() at once. */
+#define REVALIDATE_MAX_OPS 50
+
+/* An update to a subfacet's datapath flow, as a dpif_op together with the
+ * storage that the op refers to, so that updates to many subfacets can be
+ * executed in a batch with dpif_operate(). */
+struct subfacet_put {
+    struct subfacet *subfacet;
+    enum subfacet_path path;    /* Path that the update installs. */
+    struct dpif_op op;
+    struct dpif_flow_stats stats;
+    struct odputil_keybuf keybuf;
+    struct odputil_keybuf maskbuf;
+    uint64_t slow_path_stub[128 / 8];
+};
+
 static struct subfacet *subfacet_create(struct facet *, enum odp_key_fitness,
                                         const struct nlattr *key,
                                         size_t key_len, ovs_be16 initial_tci,
@@ -384,6 +495,7 @@ static void subfacet_destroy_batch(struct ofproto_dpif *,
                                    struct subfacet **, int n);
 static void subfacet_get_key(struct subfacet *, struct odputil_keybuf *,
                              struct ofpbuf *key);
+static void subfacet_get_mask(const struct subfacet *, struct ofpbuf *mask);
 static void subfacet_reset_dp_stats(struct subfacet *,
                                     struct dpif_flow_stats *);
 static void subfacet_update_time(struct subfacet *, long long int used);
@@ -392,10 +504,22 @@ static void subfacet_update_stats(struct subfacet *,
 static void subfacet_make_actions(struct subfacet *,
                                   const struct ofpbuf *packet,
                                   struct ofpbuf *odp_actions);
+static const struct nlattr *subfacet_actions(const struct subfacet *);
+static size_t subfacet_actions_len(const struct subfacet *);
+static void subfacet_set_actions(struct subfacet *,
+                                 const struct ofpbuf *odp_actions);
+static void subfacet_put_init(struct subfacet_put *, struct subfacet *,
+                              const struct nlattr *actions,
+                              size_t actions_len, bool want_stats,
+                              enum slow_path_reason);
+static int subfacet_put_finish(struct subfacet_put *);
 static int subfacet_install(struct subfacet *,
                             const struct nlattr *actions, size_t actions_len,
                             struct dpif_flow_stats *, enum slow_path_reason);
 static void subfacet_uninstall(struct subfacet *);
+static void subfacet_set_path(struct subfacet *, enum subfacet_path);
+static void subfacet_update_eviction_value(struct subfacet *,
+                                           uint64_t n_packets);
 
 static enum subfacet_path subfacet_want_path(enum slow_path_reason);
 
@@ -448,7 +572,11 @@ struct facet {
 
     /* Accounting. */
     uint64_t accounted_bytes;    /* Bytes processed by facet_account(). */
-    struct netflow_flow nf_flow; /* Per-flow NetFlow tracking data. */
+
+    /* Per-flow NetFlow tracking data, allocated by facet_get_nf_flow() only
+     * when NetFlow is enabled, otherwise NULL. */
+    struct netflow_flow *nf_flow;
+    uint16_t nf_output_iface;    /* Output interface index for NetFlow. */
     uint8_t tcp_flags;           /* TCP flags seen for this 'rule'. */
 
     /* Properties of datapath actions.
@@ -460,26 +588,97 @@ struct facet {
     bool has_learn;              /* Actions include NXAST_LEARN? */
     bool has_normal;             /* Actions output to OFPP_NORMAL? */
     bool has_fin_timeout;        /* Actions include NXAST_FIN_TIMEOUT? */
+    bool stale;                  /* Queued by revalidate_changed_facets()? */
+    bool has_mask;               /* Is 'mask' initialized?  See below. */
     tag_type tags;               /* Tags that would require revalidation. */
     mirror_mask_t mirrors;       /* Bitmap of dependent mirrors. */
 
+    /* OpenFlow table lookups done by translation.  See struct facet_dep. */
+    struct facet_dep *deps;
+    size_t n_deps;
+
+    /* In ofproto's 'pending_facets' if a revalidation pass has yet to reach
+     * this facet, otherwise initialized with list_init(). */
+    struct list pending_node;
+
+    /* Side effects of translation.  See "xlate cache". */
+    struct xc_entry *xc;
+    size_t n_xc;
+    unsigned int xc_seq;         /* ofproto's 'xc_seq' if 'xc' is valid. */
+
+    /* Datapath flow mask.  If 'has_mask' is true, then 'mask' is the set of
+     * fields of 'flow' that translation examined, and subfacets with a
+     * perfect key fitness are installed as wildcarded datapath flows that
+     * match only those fields.  Otherwise 'mask' is not initialized and
+     * subfacets are installed as exact-match flows. */
+    struct minimask mask;
+
     /* Storage for a single subfacet, to reduce malloc() time and space
      * overhead.  (A facet always has at least one subfacet and in the common
      * case has exactly one subfacet.) */
     struct subfacet one_subfacet;
 };
 
+/* The results of translating a facet's actions during revalidation.
+ *
+ * Revalidation first translates with facet_xlate_run(), which does not modify
+ * the facet, and then updates the facet and its datapath flows with
+ * facet_xlate_apply(). */
+struct facet_xlate {
+    struct facet *facet;
+    struct rule_dpif *rule;         /* Rule that 'facet' now matches. */
+
+    /* Properties of the new datapath actions, as in struct facet. */
+    struct flow_wildcards wc;       /* Fields that translation examined. */
+    tag_type tags;
+    bool has_learn;
+    bool has_normal;
+    bool has_fin_timeout;
+    uint16_t nf_output_iface;
+    mirror_mask_t mirrors;
+    struct ofpbuf deps;             /* Contains "struct xlate_dep"s. */
+
+    /* Translation in a revalidator thread cannot log, so facet_xlate_apply()
+     * reports translations that recursed too deeply. */
+    bool max_resubmit_trigger;      /* Some subfacet recursed too deeply? */
+    ovs_be16 resubmit_initial_tci;  /* That subfacet's initial_tci. */
+    struct ofpbuf xc;               /* Contains "struct xc_entry"s. */
+    unsigned int xc_seq;            /* ofproto's 'xc_seq' before translating. */
+
+    /* One for each subfacet, in the same order as 'facet->subfacets'. */
+    struct subfacet_xlate *subfacets;
+    size_t n_subfacets;
+};
+
+/* The results of translating a subfacet's actions during revalidation. */
+struct subfacet_xlate {
+    struct ofpbuf odp_actions;      /* New datapath actions. */
+    enum slow_path_reason slow;     /* Slow path reasons from translation. */
+    bool install;                   /* Datapath flow needs to be updated? */
+    uint64_t odp_actions_stub[256 / 8];
+};
+
 static struct facet *facet_create(struct rule_dpif *,
                                   const struct flow *, uint32_t hash);
 static void facet_remove(struct facet *);
 static void facet_free(struct facet *);
+static struct netflow_flow *facet_get_nf_flow(struct facet *);
+static void facet_set_nf_output_iface(struct facet *, uint16_t output_iface);
 
 static struct facet *facet_find(struct ofproto_dpif *,
                                 const struct flow *, uint32_t hash);
 static struct facet *facet_lookup_valid(struct ofproto_dpif *,
                                         const struct flow *, uint32_t hash);
 static void facet_revalidate(struct facet *);
+static void revalidate_facets(struct ofproto_dpif *,
+                              struct facet **, size_t n);
+static bool facet_is_pending(const struct facet *);
+static void revalidate_pending_facets(struct ofproto_dpif *);
+static void set_n_revalidator_threads(size_t n);
 static bool facet_check_consistency(struct facet *);
+static void facet_set_deps(struct facet *, const struct ofpbuf *xlate_deps);
+static void facet_clear_deps(struct facet *);
+static bool facet_has_changed_deps(const struct facet *);
 
 static void facet_flush_stats(struct facet *);
 
@@ -511,6 +710,15 @@ struct ofport_dpif {
 
     struct hmap priorities;     /* Map of attached 'priority_to_dscp's. */
 
+    /* Upcall scheduling (see handle_upcalls()). */
+    struct list upcalls;        /* Received "struct upcall"s, in order. */
+    size_t n_upcalls;           /* Number of elements in 'upcalls'. */
+    struct list sched_node;     /* In backer's 'sched_ports' iff 'n_upcalls'. */
+    unsigned int upcall_weight; /* Upcalls handled per round, at least 1. */
+    unsigned int upcall_deficit; /* Upcalls left in this port's turn. */
+    uint64_t n_upcalls_handled; /* Upcalls passed on for handling. */
+    uint64_t n_upcalls_dropped; /* Upcalls dropped because 'upcalls' full. */
+
     /* Linux VLAN device support (e.g. "eth0.10" for VLAN 10.)
      *
      * This is deprecated.  It is only for compatibility with broken device
@@ -574,17 +782,108 @@ struct dpif_completion {
     struct ofoperation *op;
 };
 
+/* A facet's dependency on the contents of one OpenFlow table.
+ *
+ * Translating a facet's actions looks up a flow in OpenFlow table 0 and then
+ * in every table that a resubmit or goto_table action reaches.  Each of those
+ * lookups is recorded as a facet_dep in the facet and in its table's 'deps'
+ * list, so that a change to a rule in a table needs to consider only the
+ * facets that actually searched that table.  See facet_dep_is_affected(). */
+struct facet_dep {
+    struct list list_node;      /* In struct table_dpif's 'deps' list. */
+    struct facet *facet;        /* Facet whose translation did the lookup. */
+    struct flow *flow;          /* Flow looked up, if not the facet's flow. */
+    unsigned int priority;      /* Priority of rule found, if 'matched'. */
+    bool matched;               /* False if the lookup found no rule. */
+    uint8_t table_id;           /* OpenFlow table searched. */
+};
+
+/* Xlate cache.
+ *
+ * Accounting for a facet's traffic repeats some side effects of translating
+ * its actions: crediting statistics to the rules that resubmits reach,
+ * refreshing the flows that "learn" actions add, feeding the MAC learning
+ * table for OFPP_NORMAL, and shortening rule timeouts for "fin_timeout"
+ * actions.  Translation records each of these as a "struct xc_entry", and the
+ * facet keeps them so that facet_learn() and facet_push_stats() can replay
+ * them instead of translating the facet's actions again.
+ *
+ * Entries point to rules, so destroying any rule invalidates every facet's
+ * cache in its ofproto, by incrementing the ofproto's 'xc_seq'.  A facet whose
+ * cache is invalid falls back to translation, which rebuilds the cache. */
+enum xc_type {
+    XC_RULE,                    /* A resubmit reached 'u.rule'. */
+    XC_LEARN,                   /* A "learn" action, as 'u.learn'. */
+    XC_NORMAL,                  /* OFPP_NORMAL, as 'u.normal'. */
+    XC_FIN_TIMEOUT              /* A "fin_timeout" action, as 'u.fin'. */
+};
+
+struct xc_entry {
+    enum xc_type type;
+    union {
+        struct rule_dpif *rule;
+        struct xc_learn *learn;
+        struct {
+            struct flow *flow;  /* Flow that reached OFPP_NORMAL, or NULL
+                                 * in a facet if it is the facet's flow. */
+            int vlan;           /* VLAN that 'flow' was received on. */
+        } normal;
+        struct {
+            struct rule_dpif *rule; /* Rule whose timeouts to reduce. */
+            uint16_t idle;
+            uint16_t hard;
+        } fin;
+    } u;
+};
+
+/* The flow_mod that a "learn" action composed. */
+struct xc_learn {
+    struct ofputil_flow_mod fm;
+    struct ofpbuf ofpacts;      /* Holds 'fm.ofpacts'. */
+};
+
+static void xc_clear(struct ofpbuf *);
+static void xc_entries_destroy(struct xc_entry *, size_t n);
+static void facet_set_xc(struct facet *, struct ofpbuf *xc,
+                         unsigned int xc_seq);
+static void execute_learned_flow_mod(struct ofproto_dpif *,
+                                     const struct ofputil_flow_mod *);
+
+/* A facet_dep as recorded by flow translation, before it is attached to a
+ * facet by facet_set_deps(). */
+struct xlate_dep {
+    struct flow flow;           /* Flow looked up. */
+    unsigned int priority;      /* Priority of rule found, if 'matched'. */
+    bool matched;               /* False if the lookup found no rule. */
+    uint8_t table_id;           /* OpenFlow table searched. */
+};
+
+/* A rule that was added, modified, or deleted in an OpenFlow table. */
+struct table_change {
+    struct minimatch match;     /* The rule's match. */
+    unsigned int priority;      /* The rule's priority. */
+};
+
+/* Maximum number of rule changes to track in each OpenFlow table between
+ * revalidations.  After that many changes, every facet that searched the
+ * table is revalidated. */
+#define MAX_TABLE_CHANGES 32
+
 /* Extra information about a classifier table.
  * Currently used just for optimized flow revalidation. */
 struct table_dpif {
-    /* If either of these is nonnull, then this table has a form that allows
-     * flows to be tagged to avoid revalidating most flows for the most common
-     * kinds of flow table changes. */
-    struct cls_table *catchall_table; /* Table that wildcards all fields. */
-    struct cls_table *other_table;    /* Table with any other wildcard set. */
-    uint32_t basis;                   /* Keeps each table's tags separate. */
+    struct list deps;           /* Contains "struct facet_dep"s. */
+
+    /* Rules changed since the last revalidation.  'changes' has room for
+     * MAX_TABLE_CHANGES entries once allocated.  If 'changes_overflow' is true
+     * then more rules than that changed and 'n_changes' is 0. */
+    struct table_change *changes;
+    size_t n_changes;
+    bool changes_overflow;
 };
 
+static void table_clear_changes(struct table_dpif *);
+
 /* Reasons that we might need to revalidate every facet, and corresponding
  * coverage counters.
  *
@@ -597,13 +896,14 @@ enum revalidate_reason {
     REV_RECONFIGURE = 1,       /* Switch configuration changed. */
     REV_STP,                   /* Spanning tree protocol port status change. */
     REV_PORT_TOGGLED,          /* Port enabled or disabled by CFM, LACP, ...*/
-    REV_FLOW_TABLE,            /* Flow table changed. */
     REV_INCONSISTENCY          /* Facet self-check failed. */
 };
 COVERAGE_DEFINE(rev_reconfigure);
 COVERAGE_DEFINE(rev_stp);
 COVERAGE_DEFINE(rev_port_toggled);
 COVERAGE_DEFINE(rev_flow_table);
+COVERAGE_DEFINE(rev_flow_table_check);
+COVERAGE_DEFINE(rev_flow_table_facet);
 COVERAGE_DEFINE(rev_inconsistency);
 
 /* All datapaths of a given type share a single dpif backer instance. */
@@ -613,8 +913,45 @@ struct dpif_backer {
     struct dpif *dpif;
     struct timer next_expiration;
     struct hmap odp_to_ofport_map; /* ODP port to ofport mapping. */
+
+    /* Upcall handler threads.  When 'n_handlers' is 0, the main thread
+     * receives upcalls from 'dpif' itself. */
+    struct upcall_handler *handlers;
+    size_t n_handlers;
+    unsigned n_handler_threads; /* 'n_handler_threads' when last started. */
+    size_t next_handler;        /* Handler to take upcalls from first. */
+    volatile bool stop_handlers; /* Tells handler threads to exit. */
+    int wakeup_fds[2];          /* Handler threads wake up main thread. */
+    int exit_fds[2];            /* Main thread wakes up handler threads. */
+
+    /* Upcall scheduling.  Received upcalls wait in their input ports' queues,
+     * which handle_upcalls() serves in deficit round robin order. */
+    struct list sched_ports;    /* "struct ofport_dpif"s with queued upcalls. */
+    size_t n_queued;            /* Upcalls queued in all ports. */
+    long long int hold_until;   /* Handle a partial batch at this time. */
+
+    /* Slow path upcalls wait here instead, to be handled by
+     * handle_slow_upcalls() with a budget of their own.  CFM, LACP, and STP
+     * upcalls have a queue of their own, which is served first. */
+    struct list special_upcalls; /* Contains "struct upcall"s. */
+    size_t n_special_queued;    /* Number of elements in 'special_upcalls'. */
+    struct list slow_upcalls;   /* Contains "struct upcall"s. */
+    size_t n_slow_queued;       /* Number of elements in 'slow_upcalls'. */
+
+    /* Datapath flow statistics collection.  See update_stats(). */
+    struct dpif_flow_dump stats_dump;
+    bool stats_dumping;         /* Is 'stats_dump' in progress? */
+    unsigned int stats_dump_seq; /* Incremented when a dump starts. */
+
+    /* Installed subfacets, as "struct subfacet"s by 'evict_node'.  See
+     * "Datapath flow limit". */
+    struct heap installed;
+    size_t n_reserved;          /* Flows reserved by backer_reserve_flow(). */
 };
 
+static void backer_reserve_flow(struct subfacet *);
+static void backer_release_flow(struct subfacet *);
+
 /* All existing ofproto_backer instances, indexed by ofproto->up.type. */
 static struct shash all_dpif_backers = SHASH_INITIALIZER(&all_dpif_backers);
 
@@ -647,10 +984,24 @@ struct ofproto_dpif {
     struct hmap subfacets;
     struct governor *governor;
 
+    /* Rules with timeouts, keyed on their approximate expiration times by
+     * rule_schedule_expiration(). */
+    struct heap expirations;
+
     /* Revalidation. */
     struct table_dpif tables[N_TABLES];
     enum revalidate_reason need_revalidate;
     struct tag_set revalidate_set;
+    bool tables_changed;        /* Does any 'tables' member have changes? */
+
+    /* Facets that a pass over every facet has yet to revalidate.  See
+     * revalidate_pending_facets(). */
+    struct list pending_facets; /* Contains "struct facet"s. */
+    unsigned int n_revalidation_passes;
+    long long int max_revalidation_msec; /* Longest revalidation in run(). */
+
+    /* Facets' xlate caches are valid only if built since this changed. */
+    unsigned int xc_seq;
 
     /* Support for debugging async flow mods. */
     struct list completions;
@@ -677,6 +1028,11 @@ struct ofproto_dpif {
  * for debugging the asynchronous flow_mod implementation.) */
 static bool clogged;
 
+/* Install wildcarded datapath flows ("megaflows") when translation allows it?
+ * ("ovs-appctl dpif/disable-megaflows" turns this off, which is useful for
+ * debugging and for testing per-microflow behavior.) */
+static bool enable_megaflows = true;
+
 /* All existing ofproto_dpif instances, indexed by ->up.name. */
 static struct hmap all_ofproto_dpifs = HMAP_INITIALIZER(&all_ofproto_dpifs);
 
@@ -702,8 +1058,15 @@ static void update_learning_table(struct ofproto_dpif *,
                                   const struct flow *, int vlan,
                                   struct ofbundle *);
 /* Upcalls. */
-#define FLOW_MISS_MAX_BATCH 50
+#define FLOW_MISS_MAX_BATCH OFPROTO_DEFAULT_MISS_BATCH
 static int handle_upcalls(struct dpif_backer *, unsigned int max_batch);
+static int handle_slow_upcalls(struct dpif_backer *);
+static void purge_slow_upcalls(struct dpif_backer *);
+static bool upcalls_held(const struct dpif_backer *);
+static void port_purge_upcalls(struct ofport_dpif *);
+static void backer_start_handlers(struct dpif_backer *);
+static void backer_stop_handlers(struct dpif_backer *);
+static void backer_wait_handlers(struct dpif_backer *);
 
 /* Flow expiration. */
 static int expire(struct dpif_backer *);
@@ -798,6 +1161,12 @@ type_run(const char *type)
 
     dpif_run(backer->dpif);
 
+    set_n_revalidator_threads(n_revalidator_threads);
+    if (backer->n_handler_threads != n_handler_threads) {
+        backer_stop_handlers(backer);
+        backer_start_handlers(backer);
+    }
+
     if (timer_expired(&backer->next_expiration)) {
         int delay = expire(backer);
         timer_set_duration(&backer->next_expiration, delay);
@@ -878,10 +1247,14 @@ type_run_fast(const char *type)
      * because in some cases handling a packet can cause another packet to be
      * queued almost immediately as part of the return flow.  Both
      * optimizations can make major improvements on some benchmarks and
-     * presumably for real traffic as well. */
+     * presumably for real traffic as well.
+     *
+     * Slow path upcalls, e.g. CFM and LACP keepalives, have a budget of their
+     * own, so that a flood of flow misses cannot starve them. */
+    handle_slow_upcalls(backer);
     work = 0;
-    while (work < FLOW_MISS_MAX_BATCH) {
-        int retval = handle_upcalls(backer, FLOW_MISS_MAX_BATCH - work);
+    while (work < flow_miss_batch) {
+        int retval = handle_upcalls(backer, flow_miss_batch - work);
         if (retval <= 0) {
             return -retval;
         }
@@ -904,6 +1277,16 @@ type_wait(const char *type)
     }
 
     timer_wait(&backer->next_expiration);
+    if (backer->n_special_queued || backer->n_slow_queued) {
+        poll_immediate_wake();
+    } else if (backer->n_queued) {
+        if (upcalls_held(backer)) {
+            poll_timer_wait_until(backer->hold_until);
+        } else {
+            poll_immediate_wake();
+        }
+    }
+    backer_wait_handlers(backer);
 }
 
 /* Basic life-cycle. */
@@ -935,6 +1318,12 @@ close_dpif_backer(struct dpif_backer *backer)
         return;
     }
 
+    backer_stop_handlers(backer);
+    purge_slow_upcalls(backer);
+    if (backer->stats_dumping) {
+        dpif_flow_dump_done(&backer->stats_dump);
+    }
+    heap_destroy(&backer->installed);
     hmap_destroy(&backer->odp_to_ofport_map);
     node = shash_find(&all_dpif_backers, backer->type);
     free(backer->type);
@@ -1008,6 +1397,24 @@ open_dpif_backer(const char *type, struct dpif_backer **backerp)
     backer->refcount = 1;
     hmap_init(&backer->odp_to_ofport_map);
     timer_set_duration(&backer->next_expiration, 1000);
+    backer->handlers = NULL;
+    backer->n_handlers = 0;
+    backer->n_handler_threads = 0;
+    backer->next_handler = 0;
+    backer->stop_handlers = false;
+    backer->wakeup_fds[0] = backer->wakeup_fds[1] = -1;
+    backer->exit_fds[0] = backer->exit_fds[1] = -1;
+    list_init(&backer->sched_ports);
+    backer->n_queued = 0;
+    backer->hold_until = LLONG_MIN;
+    list_init(&backer->special_upcalls);
+    backer->n_special_queued = 0;
+    list_init(&backer->slow_upcalls);
+    backer->n_slow_queued = 0;
+    backer->stats_dumping = false;
+    backer->stats_dump_seq = 0;
+    heap_init(&backer->installed);
+    backer->n_reserved = 0;
     *backerp = backer;
 
     dpif_flow_flush(backer->dpif);
@@ -1041,6 +1448,7 @@ open_dpif_backer(const char *type, struct dpif_backer **backerp)
         close_dpif_backer(backer);
         return error;
     }
+    backer_start_handlers(backer);
 
     return error;
 }
@@ -1077,16 +1485,23 @@ construct(struct ofproto *ofproto_)
     hmap_init(&ofproto->facets);
     hmap_init(&ofproto->subfacets);
     ofproto->governor = NULL;
+    heap_init(&ofproto->expirations);
 
     for (i = 0; i < N_TABLES; i++) {
         struct table_dpif *table = &ofproto->tables[i];
 
-        table->catchall_table = NULL;
-        table->other_table = NULL;
-        table->basis = random_uint32();
+        list_init(&table->deps);
+        table->changes = NULL;
+        table->n_changes = 0;
+        table->changes_overflow = false;
     }
     ofproto->need_revalidate = 0;
     tag_set_init(&ofproto->revalidate_set);
+    ofproto->tables_changed = false;
+    list_init(&ofproto->pending_facets);
+    ofproto->n_revalidation_passes = 0;
+    ofproto->max_revalidation_msec = 0;
+    ofproto->xc_seq = 1;
 
     list_init(&ofproto->completions);
 
@@ -1158,7 +1573,7 @@ add_internal_flow(struct ofproto_dpif *ofproto, int id,
         return error;
     }
 
-    *rulep = rule_dpif_lookup__(ofproto, &fm.match.flow, TBL_INTERNAL);
+    *rulep = rule_dpif_lookup__(ofproto, &fm.match.flow, TBL_INTERNAL, NULL);
     assert(*rulep != NULL);
 
     return 0;
@@ -1237,6 +1652,12 @@ destruct(struct ofproto *ofproto_)
     hmap_destroy(&ofproto->facets);
     hmap_destroy(&ofproto->subfacets);
     governor_destroy(ofproto->governor);
+    heap_destroy(&ofproto->expirations);
+
+    for (i = 0; i < N_TABLES; i++) {
+        table_clear_changes(&ofproto->tables[i]);
+        free(ofproto->tables[i].changes);
+    }
 
     hmap_destroy(&ofproto->vlandev_map);
     hmap_destroy(&ofproto->realdev_vid_map);
@@ -1270,6 +1691,7 @@ run(struct ofproto *ofproto_)
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(ofproto_);
     struct ofport_dpif *ofport;
     struct ofbundle *bundle;
+    long long int start, elapsed;
     int error;
 
     if (!clogged) {
@@ -1307,17 +1729,21 @@ run(struct ofproto *ofproto_)
     mac_learning_run(ofproto->ml, &ofproto->revalidate_set);
 
     /* Now revalidate if there's anything to do. */
+    time_refresh();
+    start = time_msec();
     if (ofproto->need_revalidate
-        || !tag_set_is_empty(&ofproto->revalidate_set)) {
+        || !tag_set_is_empty(&ofproto->revalidate_set)
+        || ofproto->tables_changed) {
         struct tag_set revalidate_set = ofproto->revalidate_set;
         bool revalidate_all = ofproto->need_revalidate;
+        struct facet **facets;
         struct facet *facet;
+        size_t n_facets;
 
         switch (ofproto->need_revalidate) {
         case REV_RECONFIGURE:   COVERAGE_INC(rev_reconfigure);   break;
         case REV_STP:           COVERAGE_INC(rev_stp);           break;
         case REV_PORT_TOGGLED:  COVERAGE_INC(rev_port_toggled);  break;
-        case REV_FLOW_TABLE:    COVERAGE_INC(rev_flow_table);    break;
         case REV_INCONSISTENCY: COVERAGE_INC(rev_inconsistency); break;
         }
 
@@ -1325,13 +1751,41 @@ run(struct ofproto *ofproto_)
         tag_set_init(&ofproto->revalidate_set);
         ofproto->need_revalidate = 0;
 
-        HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
-            if (revalidate_all
-                || tag_set_intersects(&revalidate_set, facet->tags)) {
-                facet_revalidate(facet);
+        if (ofproto->tables_changed && !revalidate_all) {
+            revalidate_changed_facets(ofproto);
+        }
+        clear_table_changes(ofproto);
+
+        if (revalidate_all) {
+            /* Start a pass over every facet, restarting any pass that is
+             * already in progress. */
+            HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
+                if (!facet_is_pending(facet)) {
+                    list_push_back(&ofproto->pending_facets,
+                                   &facet->pending_node);
+                }
+            }
+            ofproto->n_revalidation_passes++;
+        } else if (!tag_set_is_empty(&revalidate_set)) {
+            facets = xmalloc(hmap_count(&ofproto->facets) * sizeof *facets);
+            n_facets = 0;
+            HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
+                if (tag_set_intersects(&revalidate_set, facet->tags)) {
+                    facets[n_facets++] = facet;
+                }
             }
+            revalidate_facets(ofproto, facets, n_facets);
+            free(facets);
         }
     }
+    if (!list_is_empty(&ofproto->pending_facets)) {
+        revalidate_pending_facets(ofproto);
+    }
+    time_refresh();
+    elapsed = time_msec() - start;
+    if (elapsed > ofproto->max_revalidation_msec) {
+        ofproto->max_revalidation_msec = elapsed;
+    }
 
     /* Check the consistency of a random facet, to aid debugging. */
     if (!hmap_is_empty(&ofproto->facets) && !ofproto->need_revalidate) {
@@ -1339,7 +1793,8 @@ run(struct ofproto *ofproto_)
 
         facet = CONTAINER_OF(hmap_random_node(&ofproto->facets),
                              struct facet, hmap_node);
-        if (!tag_set_intersects(&ofproto->revalidate_set, facet->tags)) {
+        if (!tag_set_intersects(&ofproto->revalidate_set, facet->tags)
+            && !facet_is_pending(facet)) {
             if (!facet_check_consistency(facet)) {
                 ofproto->need_revalidate = REV_INCONSISTENCY;
             }
@@ -1352,13 +1807,18 @@ run(struct ofproto *ofproto_)
         governor_run(ofproto->governor);
 
         /* If the governor has shrunk to its minimum size and the number of
-         * subfacets has dwindled, then drop the governor entirely.
+         * subfacets has dwindled, then disengage the governor, and drop it
+         * entirely unless it enforces a flow setup budget.
          *
-         * For hysteresis, the number of subfacets to drop the governor is
-         * smaller than the number needed to trigger its creation. */
+         * For hysteresis, the number of subfacets to disengage the governor
+         * is smaller than the number needed to trigger its engagement. */
         n_subfacets = hmap_count(&ofproto->subfacets);
         if (n_subfacets * 4 < ofproto->up.flow_eviction_threshold
             && governor_is_idle(ofproto->governor)) {
+            governor_disengage(ofproto->governor);
+        }
+        if (!governor_is_engaged(ofproto->governor)
+            && !governor_has_budget(ofproto->governor)) {
             governor_destroy(ofproto->governor);
             ofproto->governor = NULL;
         }
@@ -1379,11 +1839,15 @@ wait(struct ofproto *ofproto_)
     }
 
     dpif_wait(ofproto->backer->dpif);
-    dpif_recv_wait(ofproto->backer->dpif);
+    if (!ofproto->backer->n_handlers) {
+        dpif_recv_wait(ofproto->backer->dpif, 0);
+    }
     if (ofproto->sflow) {
         dpif_sflow_wait(ofproto->sflow);
     }
-    if (!tag_set_is_empty(&ofproto->revalidate_set)) {
+    if (!tag_set_is_empty(&ofproto->revalidate_set)
+        || ofproto->tables_changed
+        || !list_is_empty(&ofproto->pending_facets)) {
         poll_immediate_wake();
     }
     HMAP_FOR_EACH (ofport, up.hmap_node, &ofproto->up.ports) {
@@ -1407,13 +1871,81 @@ wait(struct ofproto *ofproto_)
     }
 }
 
+/* Returns the approximate number of bytes of memory that 'facet' and its
+ * subfacets occupy, counting each subfacet's share of its interned datapath
+ * actions. */
+static size_t
+facet_memory_usage(const struct facet *facet)
+{
+    const struct subfacet *subfacet;
+    size_t bytes;
+    size_t i;
+
+    bytes = sizeof *facet;
+    LIST_FOR_EACH (subfacet, list_node, &facet->subfacets) {
+        if (subfacet != &facet->one_subfacet) {
+            bytes += sizeof *subfacet;
+        }
+        if (subfacet->key) {
+            bytes += subfacet->key_len;
+        }
+        if (subfacet->actions) {
+            bytes += ((sizeof *subfacet->actions + subfacet->actions->size)
+                      / subfacet->actions->n_refs);
+        }
+    }
+
+    bytes += facet->n_deps * sizeof *facet->deps;
+    for (i = 0; i < facet->n_deps; i++) {
+        if (facet->deps[i].flow) {
+            bytes += sizeof *facet->deps[i].flow;
+        }
+    }
+
+    bytes += facet->n_xc * sizeof *facet->xc;
+    for (i = 0; i < facet->n_xc; i++) {
+        const struct xc_entry *entry = &facet->xc[i];
+
+        if (entry->type == XC_LEARN) {
+            bytes += (sizeof *entry->u.learn
+                      + entry->u.learn->ofpacts.allocated);
+        } else if (entry->type == XC_NORMAL && entry->u.normal.flow) {
+            bytes += sizeof *entry->u.normal.flow;
+        }
+    }
+
+    if (facet->has_mask
+        && facet->mask.masks.values != facet->mask.masks.inline_values) {
+        for (i = 0; i < MINI_N_MAPS; i++) {
+            bytes += popcount(facet->mask.masks.map[i]) * sizeof(uint32_t);
+        }
+    }
+    if (facet->nf_flow) {
+        bytes += sizeof *facet->nf_flow;
+    }
+
+    return bytes;
+}
+
 static void
 get_memory_usage(const struct ofproto *ofproto_, struct simap *usage)
 {
     const struct ofproto_dpif *ofproto = ofproto_dpif_cast(ofproto_);
+    const struct facet *facet;
+    size_t facet_bytes;
+
+    facet_bytes = 0;
+    HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
+        facet_bytes += facet_memory_usage(facet);
+    }
 
     simap_increase(usage, "facets", hmap_count(&ofproto->facets));
+    simap_increase(usage, "facet-bytes", MIN(facet_bytes, UINT_MAX));
     simap_increase(usage, "subfacets", hmap_count(&ofproto->subfacets));
+
+    /* Datapath actions are shared among all bridges, so report their number
+     * only once instead of adding it up across bridges. */
+    simap_put(usage, "odp-actions", hmap_count(&all_odp_actions));
 }
 
 static void
@@ -1509,6 +2041,12 @@ port_construct(struct ofport *port_)
     port->realdev_ofp_port = 0;
     port->vlandev_vid = 0;
     port->carrier_seq = netdev_get_carrier_resets(port->up.netdev);
+    list_init(&port->upcalls);
+    port->n_upcalls = 0;
+    port->upcall_weight = 1;
+    port->upcall_deficit = 0;
+    port->n_upcalls_handled = 0;
+    port->n_upcalls_dropped = 0;
 
     error = dpif_port_query_by_name(ofproto->backer->dpif,
                                     netdev_get_name(port->up.netdev),
@@ -1556,6 +2094,7 @@ port_destruct(struct ofport *port_)
 
     sset_find_and_delete(&ofproto->ports, netdev_get_name(port->up.netdev));
     hmap_remove(&ofproto->backer->odp_to_ofport_map, &port->odp_port_node);
+    port_purge_upcalls(port);
     ofproto->need_revalidate = REV_RECONFIGURE;
     bundle_remove(port_);
     set_cfm(port_, NULL);
@@ -1967,6 +2506,17 @@ ofport_clear_priorities(struct ofport_dpif *ofport)
     }
 }
 
+static int
+set_upcall_weight(struct ofport *ofport_, unsigned int weight)
+{
+    struct ofport_dpif *ofport = ofport_dpif_cast(ofport_);
+
+    ofport->upcall_weight = MAX(weight, 1);
+    ofport->upcall_deficit = MIN(ofport->upcall_deficit,
+                                 ofport->upcall_weight);
+    return 0;
+}
+
 static int
 set_queues(struct ofport *ofport_,
            const struct ofproto_port_queue *qdscp_list,
@@ -2761,6 +3311,36 @@ forward_bpdu_changed(struct ofproto *ofproto_)
     ofproto->need_revalidate = REV_RECONFIGURE;
 }
 
+static enum governor_key
+governor_key_from_flow_setup_key(enum ofproto_flow_setup_key key)
+{
+    switch (key) {
+    case OFPROTO_FLOW_SETUP_PER_PORT:
+        return GOVERNOR_KEY_PORT;
+    case OFPROTO_FLOW_SETUP_PER_VLAN:
+        return GOVERNOR_KEY_VLAN;
+    case OFPROTO_FLOW_SETUP_PER_TUNNEL:
+        return GOVERNOR_KEY_TUNNEL;
+    }
+    NOT_REACHED();
+}
+
+static void
+flow_setup_budget_changed(struct ofproto *ofproto_)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(ofproto_);
+
+    if (ofproto->up.flow_setup_rate && !ofproto->governor) {
+        ofproto->governor = governor_create(ofproto->up.name);
+    }
+    if (ofproto->governor) {
+        governor_set_budget(
+            ofproto->governor, ofproto->up.flow_setup_rate,
+            ofproto->up.flow_setup_burst,
+            governor_key_from_flow_setup_key(ofproto->up.flow_setup_key));
+    }
+}
+
 static void
 set_mac_idle_time(struct ofproto *ofproto_, unsigned int idle_time)
 {
@@ -3071,6 +3651,29 @@ struct flow_miss {
     ovs_be16 initial_tci;
     struct list packets;
     enum dpif_upcall_type upcall_type;
+
+    /* Set by flow_miss_get_facet(). */
+    struct facet *facet;        /* Facet for 'flow', if any. */
+    long long int now;          /* Time at which the packets arrived. */
+};
+
+/* An upcall received from a dpif backer, together with the flows that can be
+ * derived from it without looking at any ofproto state.  Upcall handler
+ * threads fill these in and queue them for the main thread. */
+struct upcall {
+    struct list list_node;      /* In "struct upcall_handler"'s 'upcalls'. */
+    struct dpif_upcall dpif_upcall;
+    struct ofpbuf buf;          /* Holds 'dpif_upcall''s key and packet. */
+
+    /* 'key_flow' is the result of odp_flow_key_to_flow() on the upcall's flow
+     * key, so its in_port is a datapath port number.  Unless 'key_fitness' is
+     * ODP_FIT_ERROR, 'flow' is flow_extract() of the upcall's packet, with the
+     * same in_port. */
+    enum odp_key_fitness key_fitness;
+    struct flow key_flow;
+    struct flow flow;
+
+    uint64_t stub[4096 / 8];    /* Initial storage for 'buf'. */
 };
 
 struct flow_miss_op {
@@ -3089,8 +3692,6 @@ send_packet_in_miss(struct ofproto_dpif *ofproto, const struct ofpbuf *packet,
 {
     struct ofputil_packet_in pin;
 
-    pin.packet = packet->data;
-    pin.packet_len = packet->size;
     pin.reason = OFPR_NO_MATCH;
     pin.controller_id = 0;
 
@@ -3101,7 +3702,9 @@ send_packet_in_miss(struct ofproto_dpif *ofproto, const struct ofpbuf *packet,
 
     flow_get_metadata(flow, &pin.fmd);
 
-    connmgr_send_packet_in(ofproto->up.connmgr, &pin);
+    connmgr_send_packet_in(ofproto->up.connmgr, &pin,
+                           ofpbuf_clone_with_headroom(
+                               packet, OFPUTIL_PACKET_IN_HEADROOM));
 }
 
 static enum slow_path_reason
@@ -3207,24 +3810,33 @@ handle_flow_miss_common(struct rule_dpif *rule,
  * installing a datapath flow.  The answer is usually "yes" (a return value of
  * true).  However, for short flows the cost of bookkeeping is much higher than
  * the benefits, so when the datapath holds a large number of flows we impose
- * some heuristics to decide which flows are likely to be worth tracking. */
+ * some heuristics to decide which flows are likely to be worth tracking.  The
+ * governor also defers flows from sources that exceed their flow setup
+ * budget, if one is set with ofproto_set_flow_setup_budget(). */
 static bool
 flow_miss_should_make_facet(struct ofproto_dpif *ofproto,
                             struct flow_miss *miss, uint32_t hash)
 {
-    if (!ofproto->governor) { /*flow setup rate limiter*/
+    struct governor *governor = ofproto->governor;
+
+    if (!governor || !governor_is_engaged(governor)) {
         size_t n_subfacets;
 
         n_subfacets = hmap_count(&ofproto->subfacets);
-        if (n_subfacets * 2 <= ofproto->up.flow_eviction_threshold) {
+        if (n_subfacets * 2 > ofproto->up.flow_eviction_threshold) {
+            if (!governor) {
+                governor = ofproto->governor
+                    = governor_create(ofproto->up.name);
+            }
+            governor_engage(governor);
+        } else if (!governor) {
             return true;
         }
-
-        ofproto->governor = governor_create(ofproto->up.name);
     }
 
-    return governor_should_install_flow(ofproto->governor, hash,
-                                        list_size(&miss->packets));
+    return governor_should_install_flow(governor, hash,
+                                        list_size(&miss->packets),
+                                        &miss->flow);
 }
 
 /* Handles 'miss', which matches 'rule', without creating a facet or subfacet
@@ -3316,14 +3928,14 @@ handle_flow_miss_with_facet(struct flow_miss *miss, struct facet *facet,
         dpif_flow_stats_extract(&facet->flow, packet, now, &stats);
         subfacet_update_stats(subfacet, &stats);
 
-        if (subfacet->actions_len) { //has action
+        if (subfacet_actions_len(subfacet)) { //has action
             struct dpif_execute *execute = &op->dpif_op.u.execute;
 
             init_flow_miss_execute_op(miss, packet, op); //init op with miss and packet
             op->subfacet = subfacet;
             if (!subfacet->slow) { //fast path may be used
-                execute->actions = subfacet->actions;
-                execute->actions_len = subfacet->actions_len;
+                execute->actions = subfacet_actions(subfacet);
+                execute->actions_len = subfacet_actions_len(subfacet);
                 ofpbuf_uninit(&odp_actions);
             } else {
                 execute->actions = odp_actions.data;
@@ -3344,14 +3956,23 @@ handle_flow_miss_with_facet(struct flow_miss *miss, struct facet *facet,
         struct dpif_flow_put *put = &op->dpif_op.u.flow_put;
 
         op->subfacet = subfacet;
+        backer_reserve_flow(subfacet);
         op->garbage = NULL;
         op->dpif_op.type = DPIF_OP_FLOW_PUT;
         put->flags = DPIF_FP_CREATE | DPIF_FP_MODIFY;
         put->key = miss->key;
         put->key_len = miss->key_len;
+        put->mask = NULL;
+        put->mask_len = 0;
         if (want_path == SF_FAST_PATH) {
-            put->actions = subfacet->actions;
-            put->actions_len = subfacet->actions_len;
+            struct ofpbuf mask;
+
+            ofpbuf_use_stack(&mask, op->stub, sizeof op->stub);
+            subfacet_get_mask(subfacet, &mask);
+            put->mask = mask.data;
+            put->mask_len = mask.size;
+            put->actions = subfacet_actions(subfacet);
+            put->actions_len = subfacet_actions_len(subfacet);
         } else {
             compose_slow_path(ofproto, &facet->flow, subfacet->slow,
                               op->stub, sizeof op->stub,
@@ -3361,38 +3982,57 @@ handle_flow_miss_with_facet(struct flow_miss *miss, struct facet *facet,
     }
 }
 
-/* Handles flow miss 'miss'.  May add any required datapath operations
- * to 'ops', incrementing '*n_ops' for each new op. */
-static void
-handle_flow_miss(struct flow_miss *miss, struct flow_miss_op *ops,
-                 size_t *n_ops)
+/* Looks up or creates the facet for flow miss 'miss' and stores it in
+ * 'miss->facet', and the time at which to consider its packets to have
+ * arrived in 'miss->now'.  Returns true if it created a new facet.
+ *
+ * If 'miss' is not worth a facet, instead handles it entirely and sets
+ * 'miss->facet' to NULL.  May then add an "execute" operation to 'ops' and
+ * increment '*n_ops'. */
+static bool
+flow_miss_get_facet(struct flow_miss *miss, struct flow_miss_op *ops,
+                    size_t *n_ops)
 {
     struct ofproto_dpif *ofproto = miss->ofproto;
-    struct facet *facet;
-    long long int now;
     uint32_t hash;
 
     /* The caller must ensure that miss->hmap_node.hash contains
      * flow_hash(miss->flow, 0). */
     hash = miss->hmap_node.hash;
 
-    facet = facet_lookup_valid(ofproto, &miss->flow, hash);//if exist matched rule in ofproto
-    if (!facet) { /*no found exact match*/
+    miss->facet = facet_lookup_valid(ofproto, &miss->flow, hash);//if exist matched rule in ofproto
+    if (!miss->facet) { /*no found exact match*/
         struct rule_dpif *rule = rule_dpif_lookup(ofproto, &miss->flow);
 
         if (!flow_miss_should_make_facet(ofproto, miss, hash)) { //no enough room in ofproto
             handle_flow_miss_without_facet(miss, rule, ops, n_ops);
-            return;
+            return false;
         }
 
-        facet = facet_create(rule, &miss->flow, hash);
-        now = facet->used;
+        miss->facet = facet_create(rule, &miss->flow, hash);
+        miss->now = miss->facet->used;
+        return true;
     } else {
-        now = time_msec();
+        miss->now = time_msec();
+        return false;
+    }
+}
+
+/* Handles flow miss 'miss'.  May add any required datapath operations
+ * to 'ops', incrementing '*n_ops' for each new op. */
+static void
+handle_flow_miss(struct flow_miss *miss, struct flow_miss_op *ops,
+                 size_t *n_ops)
+{
+    flow_miss_get_facet(miss, ops, n_ops);
+    if (miss->facet) {
+        handle_flow_miss_with_facet(miss, miss->facet, miss->now, ops, n_ops);
     }
-    handle_flow_miss_with_facet(miss, facet, now, ops, n_ops);
 }
 
+static void handle_flow_misses_parallel(struct hmap *todo,
+                                        struct flow_miss_op *, size_t *n_ops);
+
 /* This function does post-processing on data returned from
  * odp_flow_key_to_flow() to help make VLAN splinters transparent to the
  * rest of the upcall processing logic.  In particular, if the extracted
@@ -3450,14 +4090,16 @@ ofproto_dpif_vsp_adjust(const struct ofproto_dpif *ofproto,
  * Handle the MISS upcalls from the datapath kernel module.
  */
 static void
-handle_miss_upcalls(struct dpif_backer *backer, struct dpif_upcall *upcalls,
+handle_miss_upcalls(struct dpif_backer *backer, struct upcall **upcalls,
                     size_t n_upcalls)
 {
-    struct dpif_upcall *upcall;
+    struct flow_miss misses_stub[FLOW_MISS_MAX_BATCH];
+    struct flow_miss_op flow_miss_ops_stub[FLOW_MISS_MAX_BATCH * 2];
+    struct dpif_op *dpif_ops_stub[FLOW_MISS_MAX_BATCH * 2];
+    struct flow_miss_op *flow_miss_ops;
+    struct dpif_op **dpif_ops;
+    struct flow_miss *misses;
     struct flow_miss *miss;
-    struct flow_miss misses[FLOW_MISS_MAX_BATCH];
-    struct flow_miss_op flow_miss_ops[FLOW_MISS_MAX_BATCH * 2];
-    struct dpif_op *dpif_ops[FLOW_MISS_MAX_BATCH * 2];
     struct hmap todo;
     int n_misses;
     size_t n_ops;
@@ -3467,6 +4109,17 @@ handle_miss_upcalls(struct dpif_backer *backer, struct dpif_upcall *upcalls,
         return;
     }
 
+    /* A batch larger than the default does not fit on the stack. */
+    if (n_upcalls <= FLOW_MISS_MAX_BATCH) {
+        misses = misses_stub;
+        flow_miss_ops = flow_miss_ops_stub;
+        dpif_ops = dpif_ops_stub;
+    } else {
+        misses = xmalloc(n_upcalls * sizeof *misses);
+        flow_miss_ops = xmalloc(n_upcalls * 2 * sizeof *flow_miss_ops);
+        dpif_ops = xmalloc(n_upcalls * 2 * sizeof *dpif_ops);
+    }
+
     /* Construct the to-do list.
      *
      * This just amounts to extracting the flow from each packet and sticking
@@ -3475,16 +4128,16 @@ handle_miss_upcalls(struct dpif_backer *backer, struct dpif_upcall *upcalls,
     hmap_init(&todo);
     n_misses = 0;
     /*check every miss call, classy them into flows, stored in a to-do list*/
-    for (upcall = upcalls; upcall < &upcalls[n_upcalls]; upcall++) {
+    for (i = 0; i < n_upcalls; i++) {
+        struct dpif_upcall *upcall = &upcalls[i]->dpif_upcall;
         struct flow_miss *miss = &misses[n_misses];
         struct flow_miss *existing_miss;
-        enum odp_key_fitness fitness;
         struct ofproto_dpif *ofproto;
         struct ofport_dpif *port;
         struct flow flow;
         uint32_t hash;
 
-        fitness = odp_flow_key_to_flow(upcall->key, upcall->key_len, &flow);
+        flow = upcalls[i]->key_flow;
         port = odp_port_to_ofport(backer, flow.in_port);
         if (!port) {
             /* Received packet on port for which we couldn't associate
@@ -3500,13 +4153,23 @@ handle_miss_upcalls(struct dpif_backer *backer, struct dpif_upcall *upcalls,
 
         /* Obtain metadata and check userspace/kernel agreement on flow match,
          * then set 'flow''s header pointers. */
-        miss->key_fitness = ofproto_dpif_vsp_adjust(ofproto, fitness,
-                                &flow, &miss->initial_tci, upcall->packet);
+        miss->key_fitness = ofproto_dpif_vsp_adjust(ofproto,
+                                                    upcalls[i]->key_fitness,
+                                                    &flow, &miss->initial_tci,
+                                                    upcall->packet);
         if (miss->key_fitness == ODP_FIT_ERROR) {/*invalid, then try next upcall*/
             continue;
         }
-        flow_extract(upcall->packet, flow.skb_priority,
-                     &flow.tunnel, flow.in_port, &miss->flow);//extract upcall->packet into miss->flow.
+        if (flow.in_port != port->up.ofp_port
+            || flow.vlan_tci != miss->initial_tci) {
+            /* VLAN splinter adjustment modified the packet, so the flow
+             * extracted on receipt is stale. */
+            flow_extract(upcall->packet, flow.skb_priority,
+                         &flow.tunnel, flow.in_port, &miss->flow);
+        } else {
+            miss->flow = upcalls[i]->flow;
+            miss->flow.in_port = flow.in_port;
+        }
 
         /* Add other packets of the same flow to a to-do list, classified by flow. */
         hash = flow_hash(&miss->flow, 0);
@@ -3521,6 +4184,7 @@ handle_miss_upcalls(struct dpif_backer *backer, struct dpif_upcall *upcalls,
 
             n_misses++;
         } else {
+            COVERAGE_INC(flow_miss_coalesced);
             miss = existing_miss;
         }
         list_push_back(&miss->packets, &upcall->packet->list_node);
@@ -3529,10 +4193,14 @@ handle_miss_upcalls(struct dpif_backer *backer, struct dpif_upcall *upcalls,
     /* Process each element in the to-do list, constructing the set of
      * operations to the flow_miss_ops. */
     n_ops = 0;
-    HMAP_FOR_EACH (miss, hmap_node, &todo) {
-        handle_flow_miss(miss, flow_miss_ops, &n_ops);
+    if (backer->n_handlers) {
+        handle_flow_misses_parallel(&todo, flow_miss_ops, &n_ops);
+    } else {
+        HMAP_FOR_EACH (miss, hmap_node, &todo) {
+            handle_flow_miss(miss, flow_miss_ops, &n_ops);
+        }
     }
-    assert(n_ops <= ARRAY_SIZE(flow_miss_ops));
+    assert(n_ops <= n_upcalls * 2);
 
     /* Execute the flow_miss_ops. */
     for (i = 0; i < n_ops; i++) {
@@ -3550,8 +4218,11 @@ handle_miss_upcalls(struct dpif_backer *backer, struct dpif_upcall *upcalls,
 
         case DPIF_OP_FLOW_PUT:
             if (!op->dpif_op.error) {
-                op->subfacet->path = subfacet_want_path(op->subfacet->slow);
+                subfacet_set_path(op->subfacet,
+                                  subfacet_want_path(op->subfacet->slow));
+                op->subfacet->install_seq = backer->stats_dump_seq;
             }
+            backer_release_flow(op->subfacet);
             break;
 
         case DPIF_OP_FLOW_DEL:
@@ -3561,6 +4232,12 @@ handle_miss_upcalls(struct dpif_backer *backer, struct dpif_upcall *upcalls,
         free(op->garbage);
     }
     hmap_destroy(&todo);
+
+    if (misses != misses_stub) {
+        free(misses);
+        free(flow_miss_ops);
+        free(dpif_ops);
+    }
 }
 
 static enum { SFLOW_UPCALL, MISS_UPCALL, BAD_UPCALL }
@@ -3635,117 +4312,806 @@ handle_sflow_upcall(struct dpif_backer *backer,
                         odp_in_port, &cookie);
 }
 
-/**
- * handle the upcalls from the kernel space (the datapath module)
- */
+/* Receives an upcall for 'handler_id' from 'dpif' into 'upcall' and extracts
+ * its flows.  Returns 0 if successful, otherwise a positive errno value, in
+ * which case 'upcall' needs no cleanup.  On success, the caller must
+ * eventually call upcall_destroy(upcall). */
 static int
-handle_upcalls(struct dpif_backer *backer, unsigned int max_batch)
+upcall_receive(struct dpif *dpif, uint32_t handler_id, struct upcall *upcall)
 {
-    struct dpif_upcall misses[FLOW_MISS_MAX_BATCH];
-    struct ofpbuf miss_bufs[FLOW_MISS_MAX_BATCH];
-    uint64_t miss_buf_stubs[FLOW_MISS_MAX_BATCH][4096 / 8];
-    int n_processed;
-    int n_misses;
-    int i;
-
-    assert(max_batch <= FLOW_MISS_MAX_BATCH);
-
-    n_misses = 0;
-    for (n_processed = 0; n_processed < max_batch; n_processed++) { /*handle max_batch upcalls*/
-        struct dpif_upcall *upcall = &misses[n_misses];
-        struct ofpbuf *buf = &miss_bufs[n_misses];
-        int error;
-
-        ofpbuf_use_stub(buf, miss_buf_stubs[n_misses],
-                        sizeof miss_buf_stubs[n_misses]);/*let buf point to miss_buf_stubs*/
-        error = dpif_recv(backer->dpif, upcall, buf);/*receive upcall from dpif, stored in buf*/
-        if (error) {
-            ofpbuf_uninit(buf); /*free the memory by buf*/
-            break;
-        }
+    struct dpif_upcall *dupcall = &upcall->dpif_upcall;
+    int error;
 
-        switch (classify_upcall(upcall)) { /*check the upcall type, will handle them later */
-        case MISS_UPCALL: /*miss msg*/
-            n_misses++;
-            break;
-        case SFLOW_UPCALL:
-            handle_sflow_upcall(backer, upcall);
-            ofpbuf_uninit(buf);
-            break;
-        case BAD_UPCALL:
-            ofpbuf_uninit(buf);
-            break;
-        }
+    ofpbuf_use_stub(&upcall->buf, upcall->stub, sizeof upcall->stub);
+    error = dpif_recv(dpif, handler_id, dupcall, &upcall->buf);
+    if (error) {
+        ofpbuf_uninit(&upcall->buf);
+        return error;
     }
 
-    /* Handle deferred MISS_UPCALL processing. */
-    handle_miss_upcalls(backer, misses, n_misses);
-    for (i = 0; i < n_misses; i++) {
-        ofpbuf_uninit(&miss_bufs[i]);
+    upcall->key_fitness = odp_flow_key_to_flow(dupcall->key, dupcall->key_len,
+                                               &upcall->key_flow);
+    if (upcall->key_fitness != ODP_FIT_ERROR) {
+        flow_extract(dupcall->packet, upcall->key_flow.skb_priority,
+                     &upcall->key_flow.tunnel, upcall->key_flow.in_port,
+                     &upcall->flow);
     }
+    return 0;
+}
 
-    return n_processed;
+static void
+upcall_destroy(struct upcall *upcall)
+{
+    ofpbuf_uninit(&upcall->buf);
 }
-
-/* Flow expiration. */
 
-static int subfacet_max_idle(const struct ofproto_dpif *);
-static void update_stats(struct dpif_backer *);
-static void rule_expire(struct rule_dpif *);
-static void expire_subfacets(struct ofproto_dpif *, int dp_max_idle);
+static size_t take_handler_upcalls(struct dpif_backer *,
+                                   struct upcall **upcalls, size_t max);
 
-/* This function is called periodically by run().  Its job is to collect
- * updates for the flows that have been installed into the datapath, most
- * importantly when they last were used, and then use that information to
- * expire flows that have not been used recently.
+/* Upcall scheduling.
  *
- * Returns the number of milliseconds after which it should be called again. */
-static int
-expire(struct dpif_backer *backer)
-{
-    struct ofproto_dpif *ofproto;
-    int max_idle = INT32_MAX;
+ * A single busy port must not be able to monopolize flow setup for every
+ * other port on a backer.  So, handle_upcalls() first receives upcalls into
+ * per-input-port queues, then takes the upcalls to handle from those queues in
+ * deficit round robin order: each port with queued upcalls, in turn, may have
+ * up to its weight (see set_upcall_weight()) of them handled before the next
+ * port's turn.  A port whose queue is full loses its newly received upcalls,
+ * so that a busy port's excess is dropped instead of delaying other ports.
+ * When all the queues together are full, upcalls wait in the datapath.
+ *
+ * Upcalls are handled in batches of up to 'flow_miss_batch'.  The misses in a
+ * batch that have the same flow are translated together, and all of the
+ * batch's flow installs and packet executions go to the datapath in a single
+ * dpif_operate() call.  If 'flow_miss_hold' is nonzero, a partial batch waits
+ * up to that many milliseconds, from the time that its first upcall was
+ * queued, for more upcalls to fill it, so that a burst of packets in the same
+ * new flow sets up the flow only once. */
 
-    /* Update stats for each flow in the backer. */
-    update_stats(backer);
+/* Number of upcalls that the queues below are sized for. */
+#define UPCALL_QUEUE_BATCH MAX(flow_miss_batch, FLOW_MISS_MAX_BATCH)
 
-    HMAP_FOR_EACH (ofproto, all_ofproto_dpifs_node, &all_ofproto_dpifs) {
-        struct rule_dpif *rule, *next_rule;
-        struct oftable *table;
-        int dp_max_idle;
+/* Maximum number of upcalls queued in a single port. */
+#define PORT_MAX_UPCALLS UPCALL_QUEUE_BATCH
 
-        if (ofproto->backer != backer) {
-            continue;
-        }
+/* Maximum number of upcalls queued in all of a backer's ports. */
+#define BACKER_MAX_UPCALLS (UPCALL_QUEUE_BATCH * 20)
 
-        /* Expire subfacets that have been idle too long. */
-        dp_max_idle = subfacet_max_idle(ofproto);
-        expire_subfacets(ofproto, dp_max_idle);
+/* Maximum number of upcalls received in a single call to handle_upcalls(). */
+#define UPCALL_INTAKE_MAX (UPCALL_QUEUE_BATCH * 4)
 
-        max_idle = MIN(max_idle, dp_max_idle);
+/* Maximum number of upcalls queued in each of a backer's slow path queues. */
+#define SLOW_MAX_UPCALLS (FLOW_MISS_MAX_BATCH * 4)
 
-        /* Expire OpenFlow flows whose idle_timeout or hard_timeout
-         * has passed. */
-        OFPROTO_FOR_EACH_TABLE (table, &ofproto->up) {
-            struct cls_cursor cursor;
+COVERAGE_DEFINE(upcall_port_drop);
 
-            cls_cursor_init(&cursor, &table->cls, NULL);
-            CLS_CURSOR_FOR_EACH_SAFE (rule, next_rule, up.cr, &cursor) {
-                rule_expire(rule);
-            }
-        }
+static void
+upcall_free(struct upcall *upcall)
+{
+    upcall_destroy(upcall);
+    free(upcall);
+}
 
-        /* All outstanding data in existing flows has been accounted, so it's a
-         * good time to do bond rebalancing. */
-        if (ofproto->has_bonded_bundles) {
-            struct ofbundle *bundle;
+/* Returns the reasons that 'upcall' was sent to the slow path, or 0 if it is
+ * not a slow path upcall. */
+static enum slow_path_reason
+upcall_slow_reasons(const struct dpif_upcall *upcall)
+{
+    union user_action_cookie cookie;
 
-            HMAP_FOR_EACH (bundle, hmap_node, &ofproto->bundles) {
-                if (bundle->bond) {
-                    bond_rebalance(bundle->bond, &ofproto->revalidate_set);
-                }
-            }
-        }
+    if (upcall->type != DPIF_UC_ACTION) {
+        return 0;
+    }
+    memcpy(&cookie, &upcall->userdata, sizeof cookie);
+    return (cookie.type == USER_ACTION_COOKIE_SLOW_PATH
+            ? cookie.slow_path.reason
+            : 0);
+}
+
+/* Adds 'upcall' to the queue of its input port, or drops it if that port's
+ * queue is full or if it was not received on a known port.  A slow path
+ * upcall goes to one of 'backer''s slow path queues instead. */
+static void
+enqueue_upcall(struct dpif_backer *backer, struct upcall *upcall)
+{
+    enum slow_path_reason slow = upcall_slow_reasons(&upcall->dpif_upcall);
+    struct ofport_dpif *port;
+
+    if (slow) {
+        bool special = (slow & (SLOW_CFM | SLOW_LACP | SLOW_STP)) != 0;
+        struct list *queue = (special
+                              ? &backer->special_upcalls
+                              : &backer->slow_upcalls);
+        size_t *n_queued = (special
+                            ? &backer->n_special_queued
+                            : &backer->n_slow_queued);
+
+        if (*n_queued >= SLOW_MAX_UPCALLS) {
+            COVERAGE_INC(upcall_slow_drop);
+            upcall_free(upcall);
+        } else {
+            list_push_back(queue, &upcall->list_node);
+            (*n_queued)++;
+        }
+        return;
+    }
+
+    port = odp_port_to_ofport(backer, upcall->key_flow.in_port);
+    if (!port) {
+        /* Received packet on port for which we couldn't associate an
+         * ofproto.  This can happen if a port is removed while traffic is
+         * being received.  Print a rate-limited message in case it happens
+         * frequently. */
+        VLOG_INFO_RL(&rl, "received packet on unassociated port %"PRIu32,
+                     upcall->key_flow.in_port);
+        upcall_free(upcall);
+    } else if (port->n_upcalls >= PORT_MAX_UPCALLS) {
+        COVERAGE_INC(upcall_port_drop);
+        port->n_upcalls_dropped++;
+        upcall_free(upcall);
+    } else {
+        if (!backer->n_queued) {
+            backer->hold_until = time_msec() + flow_miss_hold;
+        }
+        if (!port->n_upcalls) {
+            list_push_back(&backer->sched_ports, &port->sched_node);
+        }
+        list_push_back(&port->upcalls, &upcall->list_node);
+        port->n_upcalls++;
+        backer->n_queued++;
+    }
+}
+
+/* Receives up to 'max' upcalls for 'backer', from its dpif or from its
+ * handler threads, into its ports' queues. */
+static void
+receive_upcalls(struct dpif_backer *backer, size_t max)
+{
+    struct upcall *upcalls_stub[FLOW_MISS_MAX_BATCH * 4];
+    struct upcall **upcalls;
+    size_t n_upcalls;
+    size_t i;
+
+    /* An intake larger than the default does not fit on the stack. */
+    max = MIN(max, UPCALL_INTAKE_MAX);
+    upcalls = (max <= ARRAY_SIZE(upcalls_stub)
+               ? upcalls_stub
+               : xmalloc(max * sizeof *upcalls));
+    if (backer->n_handlers) {
+        n_upcalls = take_handler_upcalls(backer, upcalls, max);
+    } else {
+        for (n_upcalls = 0; n_upcalls < max; n_upcalls++) {
+            struct upcall *upcall = xmalloc(sizeof *upcall);
+
+            if (upcall_receive(backer->dpif, 0, upcall)) {
+                free(upcall);
+                break;
+            }
+            upcalls[n_upcalls] = upcall;
+        }
+    }
+
+    for (i = 0; i < n_upcalls; i++) {
+        enqueue_upcall(backer, upcalls[i]);
+    }
+    if (upcalls != upcalls_stub) {
+        free(upcalls);
+    }
+}
+
+/* Returns true if 'backer''s queued upcalls should wait for more upcalls to
+ * fill out a batch. */
+static bool
+upcalls_held(const struct dpif_backer *backer)
+{
+    return (flow_miss_hold
+            && backer->n_queued < flow_miss_batch
+            && time_msec() < backer->hold_until);
+}
+
+/* Takes up to 'max' upcalls from 'backer''s port queues, in deficit round
+ * robin order, and stores them in 'upcalls'.  Returns the number of upcalls
+ * taken.  The caller must free them with upcall_free(). */
+static size_t
+schedule_upcalls(struct dpif_backer *backer, struct upcall **upcalls,
+                 size_t max)
+{
+    size_t n = 0;
+
+    while (n < max && !list_is_empty(&backer->sched_ports)) {
+        struct ofport_dpif *port = CONTAINER_OF(
+            list_front(&backer->sched_ports), struct ofport_dpif, sched_node);
+
+        if (!port->upcall_deficit) {
+            /* Start of this port's turn. */
+            port->upcall_deficit = port->upcall_weight;
+        }
+        while (n < max && port->upcall_deficit && port->n_upcalls) {
+            struct list *node = list_pop_front(&port->upcalls);
+
+            upcalls[n++] = CONTAINER_OF(node, struct upcall, list_node);
+            port->n_upcalls--;
+            port->upcall_deficit--;
+            port->n_upcalls_handled++;
+            backer->n_queued--;
+        }
+
+        if (!port->n_upcalls) {
+            /* An idle port does not save up its unused turn for later. */
+            port->upcall_deficit = 0;
+            list_remove(&port->sched_node);
+        } else if (!port->upcall_deficit) {
+            list_remove(&port->sched_node);
+            list_push_back(&backer->sched_ports, &port->sched_node);
+        }
+    }
+
+    return n;
+}
+
+/* Drops the upcalls queued in 'port'. */
+static void
+port_purge_upcalls(struct ofport_dpif *port)
+{
+    struct dpif_backer *backer = ofproto_dpif_cast(port->up.ofproto)->backer;
+    struct upcall *upcall, *next;
+
+    if (!port->n_upcalls) {
+        return;
+    }
+
+    LIST_FOR_EACH_SAFE (upcall, next, list_node, &port->upcalls) {
+        upcall_free(upcall);
+    }
+    list_init(&port->upcalls);
+    list_remove(&port->sched_node);
+    backer->n_queued -= port->n_upcalls;
+    port->n_upcalls = 0;
+    port->upcall_deficit = 0;
+}
+
+/**
+ * handle the upcalls from the kernel space (the datapath module)
+ */
+static int
+handle_upcalls(struct dpif_backer *backer, unsigned int max_batch)
+{
+    struct upcall *upcalls_stub[FLOW_MISS_MAX_BATCH * 2];
+    struct upcall **upcalls;
+    struct upcall **misses;
+    size_t n_upcalls;
+    size_t n_misses;
+    size_t i;
+
+    assert(max_batch <= flow_miss_batch);
+
+    if (backer->n_queued < BACKER_MAX_UPCALLS) {
+        receive_upcalls(backer, MIN(UPCALL_INTAKE_MAX,
+                                    BACKER_MAX_UPCALLS - backer->n_queued));
+    }
+    if (upcalls_held(backer)) {
+        return 0;
+    }
+
+    /* A batch larger than the default does not fit on the stack. */
+    upcalls = (max_batch <= FLOW_MISS_MAX_BATCH
+               ? upcalls_stub
+               : xmalloc(max_batch * 2 * sizeof *upcalls));
+    misses = upcalls + max_batch;
+    n_upcalls = schedule_upcalls(backer, upcalls, max_batch);
+
+    n_misses = 0;
+    for (i = 0; i < n_upcalls; i++) {
+        struct upcall *upcall = upcalls[i];
+
+        switch (classify_upcall(&upcall->dpif_upcall)) {
+        case MISS_UPCALL:
+            misses[n_misses++] = upcall;
+            break;
+        case SFLOW_UPCALL:
+            handle_sflow_upcall(backer, &upcall->dpif_upcall);
+            break;
+        case BAD_UPCALL:
+            break;
+        }
+    }
+
+    /* Handle deferred MISS_UPCALL processing. */
+    handle_miss_upcalls(backer, misses, n_misses);
+
+    for (i = 0; i < n_upcalls; i++) {
+        upcall_free(upcalls[i]);
+    }
+    if (upcalls != upcalls_stub) {
+        free(upcalls);
+    }
+
+    return n_upcalls;
+}
+
+/* Slow path upcalls.
+ *
+ * A datapath flow that needs userspace to see each of its packets (see enum
+ * slow_path_reason) sends them up as slow path upcalls.  These bypass the
+ * per-port queues above, so that keepalive protocols such as CFM and LACP
+ * keep working even while a flood of new flows fills those queues, and
+ * type_run_fast() handles up to SLOW_UPCALL_MAX_BATCH of them in each
+ * iteration apart from its budget for flow misses.  CFM, LACP, and STP
+ * upcalls have their own queue, which is served before the queue for other
+ * slow path upcalls, so that a flood of packets to a controller cannot crowd
+ * out the keepalives either.
+ *
+ * A CFM, LACP, or STP packet only needs to be passed to its protocol
+ * module, so handle_special_upcall() does that directly, without looking up
+ * a facet or translating actions.  Other slow path packets take the same
+ * path as flow misses. */
+
+#define SLOW_UPCALL_MAX_BATCH FLOW_MISS_MAX_BATCH
+
+/* Counts the reasons in 'slow' in the coverage counters. */
+static void
+count_slow_path_reasons(enum slow_path_reason slow)
+{
+    while (slow) {
+        enum slow_path_reason bit = rightmost_1bit(slow);
+
+        switch (bit) {
+        case SLOW_CFM:
+            COVERAGE_INC(upcall_slow_cfm);
+            break;
+        case SLOW_LACP:
+            COVERAGE_INC(upcall_slow_lacp);
+            break;
+        case SLOW_STP:
+            COVERAGE_INC(upcall_slow_stp);
+            break;
+        case SLOW_IN_BAND:
+            COVERAGE_INC(upcall_slow_in_band);
+            break;
+        case SLOW_CONTROLLER:
+            COVERAGE_INC(upcall_slow_controller);
+            break;
+        case SLOW_MATCH:
+            COVERAGE_INC(upcall_slow_match);
+            break;
+        }
+
+        slow &= ~bit;
+    }
+}
+
+/* Passes the packet in 'upcall', a slow path upcall for a CFM, LACP, or STP
+ * flow, directly to the module that implements its protocol.  Returns true
+ * if successful, false if 'upcall' needs to be handled like a flow miss. */
+static bool
+handle_special_upcall(struct dpif_backer *backer, struct upcall *upcall)
+{
+    struct ofproto_dpif *ofproto;
+    struct ofport_dpif *port;
+    struct flow flow;
+
+    if (upcall->key_fitness == ODP_FIT_ERROR) {
+        return false;
+    }
+
+    port = odp_port_to_ofport(backer, upcall->key_flow.in_port);
+    if (!port) {
+        return false;
+    }
+    ofproto = ofproto_dpif_cast(port->up.ofproto);
+
+    flow = upcall->flow;
+    flow.in_port = port->up.ofp_port;
+    if (vsp_adjust_flow(ofproto, &flow)) {
+        /* The packet needs a VLAN header pushed onto it first. */
+        return false;
+    }
+
+    return process_special(ofproto, &flow, upcall->dpif_upcall.packet) != 0;
+}
+
+/* Handles up to SLOW_UPCALL_MAX_BATCH of 'backer''s queued slow path
+ * upcalls, CFM, LACP, and STP upcalls first.  Returns the number of upcalls
+ * handled. */
+static int
+handle_slow_upcalls(struct dpif_backer *backer)
+{
+    struct upcall *upcalls[SLOW_UPCALL_MAX_BATCH];
+    struct upcall *misses[SLOW_UPCALL_MAX_BATCH];
+    size_t n_upcalls;
+    size_t n_misses;
+    size_t i;
+
+    n_upcalls = 0;
+    while (n_upcalls < SLOW_UPCALL_MAX_BATCH && backer->n_special_queued) {
+        struct list *node = list_pop_front(&backer->special_upcalls);
+
+        upcalls[n_upcalls++] = CONTAINER_OF(node, struct upcall, list_node);
+        backer->n_special_queued--;
+    }
+    while (n_upcalls < SLOW_UPCALL_MAX_BATCH && backer->n_slow_queued) {
+        struct list *node = list_pop_front(&backer->slow_upcalls);
+
+        upcalls[n_upcalls++] = CONTAINER_OF(node, struct upcall, list_node);
+        backer->n_slow_queued--;
+    }
+
+    n_misses = 0;
+    for (i = 0; i < n_upcalls; i++) {
+        struct upcall *upcall = upcalls[i];
+        enum slow_path_reason slow;
+
+        slow = upcall_slow_reasons(&upcall->dpif_upcall);
+        count_slow_path_reasons(slow);
+        if (slow & (SLOW_CFM | SLOW_LACP | SLOW_STP)
+            && handle_special_upcall(backer, upcall)) {
+            COVERAGE_INC(upcall_slow_special);
+        } else {
+            misses[n_misses++] = upcall;
+        }
+    }
+    handle_miss_upcalls(backer, misses, n_misses);
+
+    for (i = 0; i < n_upcalls; i++) {
+        upcall_free(upcalls[i]);
+    }
+
+    return n_upcalls;
+}
+
+/* Drops the upcalls queued in 'backer''s slow path queues. */
+static void
+purge_slow_upcalls(struct dpif_backer *backer)
+{
+    struct upcall *upcall, *next;
+
+    LIST_FOR_EACH_SAFE (upcall, next, list_node, &backer->special_upcalls) {
+        upcall_free(upcall);
+    }
+    list_init(&backer->special_upcalls);
+    backer->n_special_queued = 0;
+
+    LIST_FOR_EACH_SAFE (upcall, next, list_node, &backer->slow_upcalls) {
+        upcall_free(upcall);
+    }
+    list_init(&backer->slow_upcalls);
+    backer->n_slow_queued = 0;
+}
+
+/* Upcall handler threads.
+ *
+ * By default, the main thread receives each backer's upcalls itself, in
+ * handle_upcalls().  With other_config:n-handler-threads=N in the Open_vSwitch
+ * table (see ofproto_set_n_handler_threads()), each backer instead divides its
+ * upcalls among N handlers (see dpif_handlers_set()), each served by its own
+ * thread.  A handler thread receives upcalls, converts their
+ * flow keys and extracts their packets' flows, and passes them to the main
+ * thread in batches.  Facet lookup and creation and the batched flow setup
+ * through dpif_operate() stay in the main thread, because they modify ofproto
+ * state that is not thread-safe.  While the main thread translates a batch of
+ * new facets, it wakes up the handler threads through 'xlate_wakeup_fds', and
+ * those that are idle help to translate it (see "Parallel flow miss
+ * translation"). */
+
+/* A handler thread stops receiving upcalls while this many are waiting for
+ * the main thread, leaving further upcalls queued in the datapath. */
+#define MAX_HANDLER_UPCALLS (FLOW_MISS_MAX_BATCH * 8)
+
+/* How long a handler thread sleeps, in milliseconds, when it cannot wait for
+ * its dpif to become readable. */
+#define HANDLER_POLL_INTERVAL 1
+
+/* Readable while the main thread has facets for the handler threads to help
+ * translate.  Shared by every backer's handler threads. */
+static int xlate_wakeup_fds[2] = { -1, -1 };
+
+static void xlate_help(void);
+
+struct upcall_handler {
+    struct dpif_backer *backer;
+    pthread_t thread;
+    uint32_t id;                /* Handler number passed to dpif_recv(). */
+
+    pthread_mutex_t mutex;      /* Protects the members below. */
+    struct list upcalls;        /* Contains "struct upcall"s. */
+    size_t n_upcalls;           /* Number of elements in 'upcalls'. */
+};
+
+/* Waits until 'fd', if it is nonnegative, becomes readable, or until 'backer'
+ * asks its handler threads to exit.  If 'fd' is negative, waits at most
+ * HANDLER_POLL_INTERVAL ms.  Helps the main thread translate facets if it
+ * asks for help in the meantime. */
+static void
+upcall_handler_wait(const struct dpif_backer *backer, int fd)
+{
+    struct pollfd pfds[3];
+    int n_pfds = 0;
+
+    pfds[n_pfds].fd = backer->exit_fds[0];
+    pfds[n_pfds].events = POLLIN;
+    n_pfds++;
+    pfds[n_pfds].fd = xlate_wakeup_fds[0];
+    pfds[n_pfds].events = POLLIN;
+    n_pfds++;
+    if (fd >= 0) {
+        pfds[n_pfds].fd = fd;
+        pfds[n_pfds].events = POLLIN;
+        n_pfds++;
+    }
+
+    if (poll(pfds, n_pfds, fd >= 0 ? -1 : HANDLER_POLL_INTERVAL) < 0) {
+        if (errno != EINTR) {
+            VLOG_FATAL("poll failed in upcall handler thread (%s)",
+                       strerror(errno));
+        }
+    } else if (pfds[1].revents & POLLIN) {
+        xlate_help();
+    }
+}
+
+static void *
+upcall_handler_main(void *handler_)
+{
+    struct upcall_handler *handler = handler_;
+    struct dpif_backer *backer = handler->backer;
+    struct upcall *spare = NULL;
+
+    while (!backer->stop_handlers) {
+        struct list batch;
+        size_t n_queued;
+        size_t n;
+
+        pthread_mutex_lock(&handler->mutex);
+        n_queued = handler->n_upcalls;
+        pthread_mutex_unlock(&handler->mutex);
+        if (n_queued >= MAX_HANDLER_UPCALLS) {
+            upcall_handler_wait(backer, -1);
+            continue;
+        }
+
+        list_init(&batch);
+        for (n = 0; n < FLOW_MISS_MAX_BATCH; n++) {
+            if (!spare) {
+                spare = xmalloc(sizeof *spare);
+            }
+            if (upcall_receive(backer->dpif, handler->id, spare)) {
+                break;
+            }
+            list_push_back(&batch, &spare->list_node);
+            spare = NULL;
+        }
+
+        if (n) {
+            pthread_mutex_lock(&handler->mutex);
+            list_splice(&handler->upcalls, batch.next, &batch);
+            handler->n_upcalls += n;
+            pthread_mutex_unlock(&handler->mutex);
+
+            ignore(write(backer->wakeup_fds[1], "", 1));
+            coverage_flush();
+        } else {
+            upcall_handler_wait(backer,
+                                dpif_recv_get_fd(backer->dpif, handler->id));
+        }
+    }
+    free(spare);
+    coverage_flush();
+
+    return NULL;
+}
+
+/* Starts 'n_handler_threads' upcall handler threads for 'backer', if that is
+ * nonzero and 'backer' does not already have them. */
+static void
+backer_start_handlers(struct dpif_backer *backer)
+{
+    sigset_t sigs, oldsigs;
+    size_t i;
+    int error;
+
+    backer->n_handler_threads = n_handler_threads;
+    if (!n_handler_threads || backer->n_handlers) {
+        return;
+    }
+
+    error = dpif_handlers_set(backer->dpif, n_handler_threads);
+    if (error) {
+        VLOG_WARN("%s: failed to divide upcalls among %u handler threads "
+                  "(%s)", dpif_name(backer->dpif), n_handler_threads,
+                  strerror(error));
+        return;
+    }
+
+    backer->n_handlers = n_handler_threads;
+    backer->handlers = xmalloc(backer->n_handlers * sizeof *backer->handlers);
+    backer->next_handler = 0;
+    backer->stop_handlers = false;
+    xpipe_nonblocking(backer->wakeup_fds);
+    xpipe_nonblocking(backer->exit_fds);
+    if (xlate_wakeup_fds[0] < 0) {
+        xpipe_nonblocking(xlate_wakeup_fds);
+    }
+
+    /* Signals, e.g. the SIGALRM used by the timeval module, should only be
+     * delivered to the main thread, so block them all in the handler threads,
+     * which inherit our signal mask. */
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_SETMASK, &sigs, &oldsigs);
+    for (i = 0; i < backer->n_handlers; i++) {
+        struct upcall_handler *handler = &backer->handlers[i];
+
+        handler->backer = backer;
+        handler->id = i;
+        pthread_mutex_init(&handler->mutex, NULL);
+        list_init(&handler->upcalls);
+        handler->n_upcalls = 0;
+
+        error = pthread_create(&handler->thread, NULL, upcall_handler_main,
+                               handler);
+        if (error) {
+            VLOG_FATAL("%s: failed to start upcall handler thread (%s)",
+                       dpif_name(backer->dpif), strerror(error));
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    VLOG_INFO("%s: started %zu upcall handler threads",
+              dpif_name(backer->dpif), backer->n_handlers);
+}
+
+/* Stops 'backer''s upcall handler threads, if any, and returns to receiving
+ * upcalls in the main thread.  Upcalls that the threads received but the main
+ * thread did not yet handle are dropped. */
+static void
+backer_stop_handlers(struct dpif_backer *backer)
+{
+    size_t i;
+
+    if (!backer->n_handlers) {
+        return;
+    }
+
+    backer->stop_handlers = true;
+    ignore(write(backer->exit_fds[1], "", 1));
+    for (i = 0; i < backer->n_handlers; i++) {
+        pthread_join(backer->handlers[i].thread, NULL);
+    }
+
+    for (i = 0; i < backer->n_handlers; i++) {
+        struct upcall_handler *handler = &backer->handlers[i];
+        struct upcall *upcall, *next;
+
+        LIST_FOR_EACH_SAFE (upcall, next, list_node, &handler->upcalls) {
+            upcall_free(upcall);
+        }
+        pthread_mutex_destroy(&handler->mutex);
+    }
+    free(backer->handlers);
+    backer->handlers = NULL;
+    backer->n_handlers = 0;
+
+    close(backer->wakeup_fds[0]);
+    close(backer->wakeup_fds[1]);
+    close(backer->exit_fds[0]);
+    close(backer->exit_fds[1]);
+    backer->wakeup_fds[0] = backer->wakeup_fds[1] = -1;
+    backer->exit_fds[0] = backer->exit_fds[1] = -1;
+
+    dpif_handlers_set(backer->dpif, 1);
+}
+
+/* Moves up to 'max' upcalls queued by 'backer''s handler threads into
+ * 'upcalls', which the caller must destroy and free.  Returns the number of
+ * upcalls moved. */
+static size_t
+take_handler_upcalls(struct dpif_backer *backer, struct upcall **upcalls,
+                     size_t max)
+{
+    size_t n = 0;
+    size_t i;
+
+    /* Start from a different handler each time, so that a busy handler
+     * cannot starve the others. */
+    backer->next_handler = (backer->next_handler + 1) % backer->n_handlers;
+    for (i = 0; i < backer->n_handlers && n < max; i++) {
+        size_t idx = (backer->next_handler + i) % backer->n_handlers;
+        struct upcall_handler *handler = &backer->handlers[idx];
+
+        pthread_mutex_lock(&handler->mutex);
+        while (n < max && !list_is_empty(&handler->upcalls)) {
+            struct list *node = list_pop_front(&handler->upcalls);
+
+            upcalls[n++] = CONTAINER_OF(node, struct upcall, list_node);
+            handler->n_upcalls--;
+        }
+        pthread_mutex_unlock(&handler->mutex);
+    }
+
+    return n;
+}
+
+static void
+backer_wait_handlers(struct dpif_backer *backer)
+{
+    bool nonempty = false;
+    size_t i;
+
+    if (!backer->n_handlers) {
+        return;
+    }
+
+    /* Drain wakeups before checking the queues, so that an upcall queued
+     * after the check is sure to wake us up. */
+    drain_fd(backer->wakeup_fds[0], 1);
+
+    for (i = 0; i < backer->n_handlers && !nonempty; i++) {
+        struct upcall_handler *handler = &backer->handlers[i];
+
+        pthread_mutex_lock(&handler->mutex);
+        nonempty = handler->n_upcalls > 0;
+        pthread_mutex_unlock(&handler->mutex);
+    }
+
+    if (nonempty) {
+        poll_immediate_wake();
+    } else {
+        poll_fd_wait(backer->wakeup_fds[0], POLLIN);
+    }
+}
+
+/* Flow expiration. */
+
+static int subfacet_max_idle(const struct ofproto_dpif *);
+static bool update_stats(struct dpif_backer *);
+static void expire_rules(struct ofproto_dpif *);
+static void expire_subfacets(struct ofproto_dpif *, int dp_max_idle);
+
+/* This function is called periodically by run().  Its job is to collect
+ * updates for the flows that have been installed into the datapath, most
+ * importantly when they last were used, and then use that information to
+ * expire flows that have not been used recently.
+ *
+ * Returns the number of milliseconds after which it should be called again. */
+static int
+expire(struct dpif_backer *backer)
+{
+    struct ofproto_dpif *ofproto;
+    int max_idle = INT32_MAX;
+
+    /* Update stats for each flow in the backer.  Expiring subfacets before
+     * the statistics for all of them are in would expire busy ones, so if
+     * update_stats() has more to do, come back as soon as possible. */
+    if (!update_stats(backer)) {
+        return 0;
+    }
+
+    HMAP_FOR_EACH (ofproto, all_ofproto_dpifs_node, &all_ofproto_dpifs) {
+        int dp_max_idle;
+
+        if (ofproto->backer != backer) {
+            continue;
+        }
+
+        /* Expire subfacets that have been idle too long. */
+        dp_max_idle = subfacet_max_idle(ofproto);
+        expire_subfacets(ofproto, dp_max_idle);
+
+        max_idle = MIN(max_idle, dp_max_idle);
+
+        /* Expire OpenFlow flows whose idle_timeout or hard_timeout
+         * has passed. */
+        expire_rules(ofproto);
+
+        /* All outstanding data in existing flows has been accounted, so it's a
+         * good time to do bond rebalancing. */
+        if (ofproto->has_bonded_bundles) {
+            struct ofbundle *bundle;
+
+            HMAP_FOR_EACH (bundle, hmap_node, &ofproto->bundles) {
+                if (bundle->bond) {
+                    bond_rebalance(bundle->bond, &ofproto->revalidate_set);
+                }
+            }
+        }
     }
 
     return MIN(max_idle, 1000);
@@ -3772,6 +5138,10 @@ update_subfacet_stats(struct subfacet *subfacet,
         VLOG_WARN_RL(&rl, "unexpected byte count from datapath");
     }
 
+    if (stats->n_packets >= subfacet->dp_packet_count) {
+        subfacet_update_eviction_value(
+            subfacet, stats->n_packets - subfacet->dp_packet_count);
+    }
     subfacet->dp_packet_count = stats->n_packets;
     subfacet->dp_byte_count = stats->n_bytes;
 
@@ -3805,37 +5175,71 @@ delete_unexpected_flow(struct ofproto_dpif *ofproto,
     dpif_flow_del(ofproto->backer->dpif, key, key_len, NULL);
 }
 
-/* Update 'packet_count', 'byte_count', and 'used' members of installed facets.
+/* Returns the subfacet in 'backer' whose datapath flow key is exactly the
+ * 'key_len' bytes in 'key', whose hash is 'key_hash', or NULL if there is
+ * none.
  *
- * This function also pushes statistics updates to rules which each facet
- * resubmits into.  Generally these statistics will be accurate.  However, if a
- * facet changes the rule it resubmits into at some time in between
- * update_stats() runs, it is possible that statistics accrued to the
- * old rule will be incorrectly attributed to the new rule.  This could be
- * avoided by calling update_stats() whenever rules are created or
- * deleted.  However, the performance impact of making so many calls to the
- * datapath do not justify the benefit of having perfectly accurate statistics.
- */
-static void
-update_stats(struct dpif_backer *backer)
+ * This avoids the cost of odp_flow_key_to_flow() for flows whose keys are in
+ * the form that subfacet_get_key() produces, which is the common case.  A
+ * null return does not prove that no subfacet corresponds to 'key', because
+ * the datapath may encode a key differently. */
+static struct subfacet *
+subfacet_find_by_key(const struct dpif_backer *backer,
+                     const struct nlattr *key, size_t key_len,
+                     uint32_t key_hash)
 {
-    const struct dpif_flow_stats *stats;
-    struct dpif_flow_dump dump;
-    const struct nlattr *key;
-    size_t key_len;
+    const struct nlattr *in_port;
+    struct ofproto_dpif *ofproto;
+    struct ofport_dpif *port;
+    struct subfacet *subfacet;
 
-    dpif_flow_dump_start(&dump, backer->dpif);
-    while (dpif_flow_dump_next(&dump, &key, &key_len, NULL, NULL, &stats)) {
-        struct flow flow;
-        struct subfacet *subfacet;
-        enum odp_key_fitness fitness;
-        struct ofproto_dpif *ofproto;
-        struct ofport_dpif *port;
-        uint32_t key_hash;
+    in_port = nl_attr_find__(key, key_len, OVS_KEY_ATTR_IN_PORT);
+    if (!in_port || nl_attr_get_size(in_port) != sizeof(uint32_t)) {
+        return NULL;
+    }
+    port = odp_port_to_ofport(backer, nl_attr_get_u32(in_port));
+    if (!port) {
+        return NULL;
+    }
 
+    ofproto = ofproto_dpif_cast(port->up.ofproto);
+    HMAP_FOR_EACH_WITH_HASH (subfacet, hmap_node, key_hash,
+                             &ofproto->subfacets) {
+        struct odputil_keybuf keybuf;
+        struct ofpbuf sf_key;
+
+        subfacet_get_key(subfacet, &keybuf, &sf_key);
+        if (sf_key.size == key_len && !memcmp(sf_key.data, key, key_len)) {
+            return subfacet;
+        }
+    }
+    return NULL;
+}
+
+/* Updates statistics given that the datapath in 'backer' reported 'stats' for
+ * its flow with the 'key_len' bytes of key in 'key'. */
+static void
+update_flow_stats(struct dpif_backer *backer,
+                  const struct nlattr *key, size_t key_len,
+                  const struct dpif_flow_stats *stats)
+{
+    struct flow flow;
+    struct subfacet *subfacet;
+    enum odp_key_fitness fitness;
+    struct ofproto_dpif *ofproto;
+    struct ofport_dpif *port;
+    uint32_t key_hash;
+
+    key_hash = odp_flow_key_hash(key, key_len);
+    subfacet = subfacet_find_by_key(backer, key, key_len, key_hash);
+    if (subfacet) {
+        COVERAGE_INC(dump_stats_by_key);
+        ofproto = ofproto_dpif_cast(subfacet->facet->rule->up.ofproto);
+    } else {
+        COVERAGE_INC(dump_stats_parsed);
         fitness = odp_flow_key_to_flow(key, key_len, &flow);
         if (fitness == ODP_FIT_ERROR) {
-            continue;
+            return;
         }
 
         port = odp_port_to_ofport(backer, flow.in_port);
@@ -3847,30 +5251,75 @@ update_stats(struct dpif_backer *backer)
             VLOG_INFO_RL(&rl,
                         "stats update for flow with unassociated port %"PRIu32,
                         flow.in_port);
-            continue;
+            return;
         }
 
         ofproto = ofproto_dpif_cast(port->up.ofproto);
         flow.in_port = port->up.ofp_port;
-        key_hash = odp_flow_key_hash(key, key_len);
-
         subfacet = subfacet_find(ofproto, key, key_len, key_hash, &flow);
-        switch (subfacet ? subfacet->path : SF_NOT_INSTALLED) {
-        case SF_FAST_PATH:
-            update_subfacet_stats(subfacet, stats);
-            break;
+    }
 
-        case SF_SLOW_PATH:
-            /* Stats are updated per-packet. */
-            break;
+    if (subfacet && subfacet->install_seq == backer->stats_dump_seq) {
+        /* The subfacet was installed after the dump started, so 'stats'
+         * might be left over from an earlier flow with the same key. */
+        return;
+    }
 
-        case SF_NOT_INSTALLED:
-        default:
-            delete_unexpected_flow(ofproto, key, key_len);
-            break;
+    switch (subfacet ? subfacet->path : SF_NOT_INSTALLED) {
+    case SF_FAST_PATH:
+        update_subfacet_stats(subfacet, stats);
+        break;
+
+    case SF_SLOW_PATH:
+        /* Stats are updated per-packet. */
+        break;
+
+    case SF_NOT_INSTALLED:
+    default:
+        delete_unexpected_flow(ofproto, key, key_len);
+        break;
+    }
+}
+
+/* Update 'packet_count', 'byte_count', and 'used' members of installed facets.
+ *
+ * This function also pushes statistics updates to rules which each facet
+ * resubmits into.  Generally these statistics will be accurate.  However, if a
+ * facet changes the rule it resubmits into at some time in between
+ * update_stats() runs, it is possible that statistics accrued to the
+ * old rule will be incorrectly attributed to the new rule.  This could be
+ * avoided by calling update_stats() whenever rules are created or
+ * deleted.  However, the performance impact of making so many calls to the
+ * datapath do not justify the benefit of having perfectly accurate statistics.
+ *
+ * With a nonzero 'stats_batch' (see ofproto_set_stats_batch()), one call
+ * examines at most that many datapath flows, leaving the dump open for the next call.  Returns true if the dump
+ * finished, false if it has more flows to examine.
+ */
+static bool
+update_stats(struct dpif_backer *backer)
+{
+    const struct dpif_flow_stats *stats;
+    const struct nlattr *key;
+    size_t key_len;
+    size_t n;
+
+    if (!backer->stats_dumping) {
+        dpif_flow_dump_start(&backer->stats_dump, backer->dpif);
+        backer->stats_dumping = true;
+        backer->stats_dump_seq++;
+    }
+
+    for (n = 0; !stats_batch || n < stats_batch; n++) {
+        if (!dpif_flow_dump_next(&backer->stats_dump, &key, &key_len,
+                                 NULL, NULL, NULL, NULL, &stats)) {
+            dpif_flow_dump_done(&backer->stats_dump);
+            backer->stats_dumping = false;
+            return true;
         }
+        update_flow_stats(backer, key, key_len, stats);
     }
-    dpif_flow_dump_done(&dump);
+    return false;
 }
 
 /* Calculates and returns the number of milliseconds of idle time after which
@@ -4002,17 +5451,19 @@ expire_subfacets(struct ofproto_dpif *ofproto, int dp_max_idle)
 }
 
 /* If 'rule' is an OpenFlow rule, that has expired according to OpenFlow rules,
- * then delete it entirely. */
-static void
+ * then delete it entirely and returns true.  Otherwise, returns false. */
+static bool
 rule_expire(struct rule_dpif *rule)
 {
     struct facet *facet, *next_facet;
     long long int now;
     uint8_t reason;
 
+    COVERAGE_INC(ofproto_dpif_expire_check);
+
     if (rule->up.pending) {
         /* We'll have to expire it later. */
-        return;
+        return false;
     }
 
     /* Has 'rule' expired? */
@@ -4024,19 +5475,114 @@ rule_expire(struct rule_dpif *rule)
                && now > rule->up.used + rule->up.idle_timeout * 1000) {
         reason = OFPRR_IDLE_TIMEOUT;
     } else {
-        return;
+        return false;
     }
 
     COVERAGE_INC(ofproto_dpif_expired);
 
-    /* Update stats.  (This is a no-op if the rule expired due to an idle
-     * timeout, because that only happens when the rule has no facets left.) */
-    LIST_FOR_EACH_SAFE (facet, next_facet, list_node, &rule->facets) {
-        facet_remove(facet);
+    /* Update stats.  (This is a no-op if the rule expired due to an idle
+     * timeout, because that only happens when the rule has no facets left.) */
+    LIST_FOR_EACH_SAFE (facet, next_facet, list_node, &rule->facets) {
+        facet_remove(facet);
+    }
+
+    /* Get rid of the rule. */
+    ofproto_rule_expire(&rule->up, reason);
+    return true;
+}
+
+/* Returns the heap priority for a rule that might expire at 'expiration'.
+ * Like rule_eviction_priority() in ofproto.c, this uses approximate seconds
+ * since startup, inverted because 'expirations' is a max-heap. */
+static uint32_t
+expiration_priority(long long int expiration)
+{
+    return UINT32_MAX - ((expiration >> 10) - (time_boot_msec() >> 10));
+}
+
+/* Adds 'rule' to, moves it within, or removes it from its ofproto's
+ * 'expirations', according to its current timeouts.  This must be called
+ * whenever 'rule''s timeouts change.
+ *
+ * 'rule''s position reflects when it was last used as of this call.  Its
+ * later use only makes it expire later than that, so expire_rules() just
+ * checks it again when that time comes. */
+static void
+rule_schedule_expiration(struct rule_dpif *rule)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
+    long long int hard_expiration, idle_expiration;
+    uint32_t priority;
+
+    hard_expiration = (rule->up.hard_timeout
+                       ? rule->up.modified + rule->up.hard_timeout * 1000
+                       : LLONG_MAX);
+    idle_expiration = (rule->up.idle_timeout
+                       ? rule->up.used + rule->up.idle_timeout * 1000
+                       : LLONG_MAX);
+    if (hard_expiration == LLONG_MAX && idle_expiration == LLONG_MAX) {
+        rule_unschedule_expiration(rule);
+        return;
+    }
+
+    priority = expiration_priority(MIN(hard_expiration, idle_expiration));
+    if (rule->in_expirations) {
+        heap_change(&ofproto->expirations, &rule->expiration_node, priority);
+    } else {
+        heap_insert(&ofproto->expirations, &rule->expiration_node, priority);
+        rule->in_expirations = true;
+    }
+}
+
+static void
+rule_unschedule_expiration(struct rule_dpif *rule)
+{
+    if (rule->in_expirations) {
+        struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
+
+        heap_remove(&ofproto->expirations, &rule->expiration_node);
+        rule->in_expirations = false;
+    }
+}
+
+/* Expires the rules in 'ofproto' whose idle or hard timeouts have passed.
+ *
+ * This examines only the rules that 'expirations' says might have expired by
+ * now, so its cost does not depend on the number of rules in the flow
+ * table.  A rule that turns out not to have expired yet, because it was used
+ * or modified since it was scheduled or because it is in the current second,
+ * is rescheduled. */
+static void
+expire_rules(struct ofproto_dpif *ofproto)
+{
+    uint32_t now_priority = expiration_priority(time_msec());
+    struct rule_dpif **retry = NULL;
+    size_t n_retry = 0;
+    size_t allocated_retry = 0;
+    size_t i;
+
+    while (!heap_is_empty(&ofproto->expirations)) {
+        struct heap_node *node = heap_max(&ofproto->expirations);
+        struct rule_dpif *rule;
+
+        if (node->priority < now_priority) {
+            break;
+        }
+
+        rule = CONTAINER_OF(node, struct rule_dpif, expiration_node);
+        rule_unschedule_expiration(rule);
+        if (!rule_expire(rule)) {
+            if (n_retry >= allocated_retry) {
+                retry = x2nrealloc(retry, &allocated_retry, sizeof *retry);
+            }
+            retry[n_retry++] = rule;
+        }
     }
 
-    /* Get rid of the rule. */
-    ofproto_rule_expire(&rule->up, reason);
+    for (i = 0; i < n_retry; i++) {
+        rule_schedule_expiration(retry[i]);
+    }
+    free(retry);
 }
 
 /* Facets. */
@@ -4064,8 +5610,8 @@ facet_create(struct rule_dpif *rule, const struct flow *flow, uint32_t hash)
     facet->rule = rule;
     facet->flow = *flow;
     list_init(&facet->subfacets);
-    netflow_flow_init(&facet->nf_flow);
-    netflow_flow_update_time(ofproto->netflow, &facet->nf_flow, facet->used);
+    list_init(&facet->pending_node);
+    facet_get_nf_flow(facet);
 
     return facet;
 }
@@ -4073,9 +5619,79 @@ facet_create(struct rule_dpif *rule, const struct flow *flow, uint32_t hash)
 static void
 facet_free(struct facet *facet)
 {
+    facet_clear_deps(facet);
+    xc_entries_destroy(facet->xc, facet->n_xc);
+    free(facet->xc);
+    if (facet->has_mask) {
+        minimask_destroy(&facet->mask);
+    }
+    free(facet->nf_flow);
     free(facet);
 }
 
+/* Returns 'facet''s NetFlow tracking data, allocating and initializing it if
+ * 'facet' does not have any yet, or NULL if NetFlow is not enabled on
+ * 'facet''s bridge. */
+static struct netflow_flow *
+facet_get_nf_flow(struct facet *facet)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+
+    if (!ofproto->netflow) {
+        return NULL;
+    }
+    if (!facet->nf_flow) {
+        facet->nf_flow = xzalloc(sizeof *facet->nf_flow);
+        netflow_flow_init(facet->nf_flow);
+        netflow_flow_update_time(ofproto->netflow, facet->nf_flow,
+                                 facet->used);
+        facet->nf_flow->output_iface = facet->nf_output_iface;
+    }
+    return facet->nf_flow;
+}
+
+/* Sets 'facet''s NetFlow output interface to 'output_iface'. */
+static void
+facet_set_nf_output_iface(struct facet *facet, uint16_t output_iface)
+{
+    facet->nf_output_iface = output_iface;
+    if (facet->nf_flow) {
+        facet->nf_flow->output_iface = output_iface;
+    }
+}
+
+/* Updates 'facet''s datapath flow mask from 'wc', the wildcards produced by
+ * translating its actions.  Returns true if the mask changed, in which case
+ * any installed subfacets must be reinstalled, false otherwise. */
+static bool
+facet_set_mask(struct facet *facet, const struct flow_wildcards *wc)
+{
+    bool has_mask = !flow_wildcards_is_exact(wc);
+    struct minimask mask;
+
+    if (!has_mask) {
+        if (facet->has_mask) {
+            minimask_destroy(&facet->mask);
+            facet->has_mask = false;
+            return true;
+        }
+        return false;
+    }
+
+    minimask_init(&mask, wc);
+    if (facet->has_mask) {
+        if (minimask_equal(&mask, &facet->mask)) {
+            minimask_destroy(&mask);
+            return false;
+        }
+        minimask_destroy(&facet->mask);
+    }
+    minimask_clone(&facet->mask, &mask);
+    minimask_destroy(&mask);
+    facet->has_mask = true;
+    return true;
+}
+
 /* Executes, within 'ofproto', the 'n_actions' actions in 'actions' on
  * 'packet', which arrived on 'in_port'.
  *
@@ -4134,16 +5750,117 @@ facet_remove(struct facet *facet)
     }
     hmap_remove(&ofproto->facets, &facet->hmap_node);
     list_remove(&facet->list_node);
+    list_remove(&facet->pending_node);
     facet_free(facet);
 }
 
+/* Frees the memory that the 'n' entries in 'entries' own, but not 'entries'
+ * itself. */
+static void
+xc_entries_destroy(struct xc_entry *entries, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        struct xc_entry *entry = &entries[i];
+
+        switch (entry->type) {
+        case XC_LEARN:
+            ofpbuf_uninit(&entry->u.learn->ofpacts);
+            free(entry->u.learn);
+            break;
+
+        case XC_NORMAL:
+            free(entry->u.normal.flow);
+            break;
+
+        case XC_RULE:
+        case XC_FIN_TIMEOUT:
+            break;
+        }
+    }
+}
+
+/* Destroys the "struct xc_entry"s in 'xc' and empties it. */
+static void
+xc_clear(struct ofpbuf *xc)
+{
+    xc_entries_destroy(xc->data, xc->size / sizeof(struct xc_entry));
+    ofpbuf_clear(xc);
+}
+
+/* Replaces 'facet''s xlate cache by the "struct xc_entry"s in 'xc', which
+ * translation recorded starting when its ofproto's 'xc_seq' was 'xc_seq', and
+ * empties 'xc'. */
+static void
+facet_set_xc(struct facet *facet, struct ofpbuf *xc, unsigned int xc_seq)
+{
+    size_t i;
+
+    xc_entries_destroy(facet->xc, facet->n_xc);
+    free(facet->xc);
+
+    facet->n_xc = xc->size / sizeof *facet->xc;
+    facet->xc = facet->n_xc ? xmemdup(xc->data, xc->size) : NULL;
+    facet->xc_seq = xc_seq;
+    ofpbuf_clear(xc);
+
+    for (i = 0; i < facet->n_xc; i++) {
+        struct xc_entry *entry = &facet->xc[i];
+
+        if (entry->type == XC_NORMAL
+            && flow_equal(entry->u.normal.flow, &facet->flow)) {
+            free(entry->u.normal.flow);
+            entry->u.normal.flow = NULL;
+        }
+    }
+}
+
+/* Returns true if 'facet''s xlate cache may be replayed. */
+static bool
+facet_xc_is_valid(const struct facet *facet)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+
+    return facet->xc_seq == ofproto->xc_seq;
+}
+
+/* Translates 'facet''s actions only for their side effects, rebuilding its
+ * xlate cache along the way.  Credits 'stats' to the rules reached through
+ * resubmits, if 'stats' is nonnull, and updates the learning tables if
+ * 'may_learn' is true. */
+static void
+facet_xlate_side_effects(struct facet *facet,
+                         const struct dpif_flow_stats *stats, bool may_learn)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+    unsigned int xc_seq = ofproto->xc_seq;
+    struct action_xlate_ctx ctx;
+    struct ofpbuf xc;
+
+    COVERAGE_INC(facet_xc_miss);
+    ofpbuf_init(&xc, 0);
+    action_xlate_ctx_init(&ctx, ofproto, &facet->flow, facet->flow.vlan_tci,
+                          facet->rule, may_learn ? facet->tcp_flags : 0,
+                          NULL);
+    ctx.may_learn = may_learn;
+    ctx.resubmit_stats = stats;
+    ctx.xc = &xc;
+    xlate_actions_for_side_effects(&ctx, facet->rule->up.ofpacts,
+                                   facet->rule->up.ofpacts_len);
+    facet_set_xc(facet, &xc, xc_seq);
+    ofpbuf_uninit(&xc);
+}
+
 /* Feed information from 'facet' back into the learning table to keep it in
  * sync with what is actually flowing through the datapath. */
 static void
 facet_learn(struct facet *facet)
 {
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
-    struct action_xlate_ctx ctx;
+    struct rule_dpif *rule = facet->rule;
+    bool was_evictable;
+    size_t i;
 
     if (!facet->has_learn
         && !facet->has_normal
@@ -4152,12 +5869,50 @@ facet_learn(struct facet *facet)
         return;
     }
 
-    action_xlate_ctx_init(&ctx, ofproto, &facet->flow,
-                          facet->flow.vlan_tci,
-                          facet->rule, facet->tcp_flags, NULL);
-    ctx.may_learn = true;
-    xlate_actions_for_side_effects(&ctx, facet->rule->up.ofpacts,
-                                   facet->rule->up.ofpacts_len);
+    if (!facet_xc_is_valid(facet)) {
+        facet_xlate_side_effects(facet, NULL, true);
+        return;
+    }
+
+    /* As in do_xlate_actions(), don't let a learned flow evict the facet's
+     * rule, which would revalidate the facet and replace its cache. */
+    COVERAGE_INC(facet_xc_hit);
+    was_evictable = rule->up.evictable;
+    rule->up.evictable = false;
+    for (i = 0; i < facet->n_xc && facet_xc_is_valid(facet); i++) {
+        const struct xc_entry *entry = &facet->xc[i];
+        struct ofbundle *in_bundle;
+        const struct flow *flow;
+
+        switch (entry->type) {
+        case XC_LEARN:
+            /* This can evict other rules and so invalidate the cache, in
+             * which case the loop stops and the next call rebuilds it. */
+            execute_learned_flow_mod(ofproto, &entry->u.learn->fm);
+            break;
+
+        case XC_NORMAL:
+            flow = entry->u.normal.flow ? entry->u.normal.flow : &facet->flow;
+            in_bundle = lookup_input_bundle(ofproto, flow->in_port, false,
+                                            NULL);
+            if (in_bundle) {
+                update_learning_table(ofproto, flow, entry->u.normal.vlan,
+                                      in_bundle);
+            }
+            break;
+
+        case XC_FIN_TIMEOUT:
+            if (facet->tcp_flags & (TCP_FIN | TCP_RST)) {
+                rule_reduce_timeouts(entry->u.fin.rule, entry->u.fin.idle,
+                                     entry->u.fin.hard);
+            }
+            break;
+
+        case XC_RULE:
+            break;
+        }
+    }
+    rule->up.evictable = was_evictable;
 }
 
 static void
@@ -4187,7 +5942,8 @@ facet_account(struct facet *facet)
                             struct subfacet, list_node);
     vlan_tci = facet->flow.vlan_tci;
     NL_ATTR_FOR_EACH_UNSAFE (a, left,
-                             subfacet->actions, subfacet->actions_len) {
+                             subfacet_actions(subfacet),
+                             subfacet_actions_len(subfacet)) {
         const struct ovs_action_push_vlan *vlan;
         struct ofport_dpif *port;
 
@@ -4259,7 +6015,7 @@ facet_flush_stats(struct facet *facet)
         expired.packet_count = facet->packet_count;
         expired.byte_count = facet->byte_count;
         expired.used = facet->used;
-        netflow_expire(ofproto->netflow, &facet->nf_flow, &expired);
+        netflow_expire(ofproto->netflow, facet_get_nf_flow(facet), &expired);
     }
 
     facet->rule->packet_count += facet->packet_count;
@@ -4269,7 +6025,9 @@ facet_flush_stats(struct facet *facet)
      * reinstalled. */
     facet_reset_counters(facet);
 
-    netflow_flow_clear(&facet->nf_flow);
+    if (facet->nf_flow) {
+        netflow_flow_clear(facet->nf_flow);
+    }
     facet->tcp_flags = 0;
 }
 
@@ -4311,7 +6069,9 @@ facet_lookup_valid(struct ofproto_dpif *ofproto, const struct flow *flow,
     facet = facet_find(ofproto, flow, hash);
     if (facet
         && (ofproto->need_revalidate
-        || tag_set_intersects(&ofproto->revalidate_set, facet->tags))) {
+            || tag_set_intersects(&ofproto->revalidate_set, facet->tags)
+            || facet_is_pending(facet)
+            || facet_has_changed_deps(facet))) {
         facet_revalidate(facet);
     }
 
@@ -4351,9 +6111,9 @@ subfacet_should_install(struct subfacet *subfacet, enum slow_path_reason slow,
     enum subfacet_path want_path = subfacet_want_path(slow);
     return (want_path != subfacet->path
             || (want_path == SF_FAST_PATH
-                && (subfacet->actions_len != want_actions->size
-                    || memcmp(subfacet->actions, want_actions->data,
-                              subfacet->actions_len))));
+                && (subfacet_actions_len(subfacet) != want_actions->size
+                    || memcmp(subfacet_actions(subfacet), want_actions->data,
+                              want_actions->size))));
 }
 
 static bool
@@ -4450,128 +6210,667 @@ facet_check_consistency(struct facet *facet)
                           subfacet_path_to_string(want_path));
         } else if (want_path == SF_FAST_PATH) {
             ds_put_cstr(&s, " (actions were: ");
-            format_odp_actions(&s, subfacet->actions,
-                               subfacet->actions_len);
+            format_odp_actions(&s, subfacet_actions(subfacet),
+                               subfacet_actions_len(subfacet));
             ds_put_cstr(&s, ") (correct actions: ");
             format_odp_actions(&s, odp_actions.data, odp_actions.size);
             ds_put_char(&s, ')');
         } else {
             ds_put_cstr(&s, " (actions: ");
-            format_odp_actions(&s, subfacet->actions,
-                               subfacet->actions_len);
+            format_odp_actions(&s, subfacet_actions(subfacet),
+                               subfacet_actions_len(subfacet));
             ds_put_char(&s, ')');
         }
-        VLOG_WARN("%s", ds_cstr(&s));
-        ds_destroy(&s);
+        VLOG_WARN("%s", ds_cstr(&s));
+        ds_destroy(&s);
+    }
+    ofpbuf_uninit(&odp_actions);
+
+    return ok;
+}
+
+/* Translates 'fx->facet''s actions afresh, storing the results in 'fx' for
+ * facet_xlate_apply() to use.  Does not modify 'fx->facet' or any other
+ * ofproto state, so revalidator threads may call this in parallel for
+ * different facets (see xlate_facets()). */
+static void
+facet_xlate_run(struct facet_xlate *fx)
+{
+    struct facet *facet = fx->facet;
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+    struct action_xlate_ctx ctx;
+    struct subfacet *subfacet;
+    size_t i;
+
+    fx->rule = rule_dpif_lookup__(ofproto, &facet->flow, 0, NULL);
+    if (!fx->rule) {
+        fx->rule = rule_dpif_miss_rule(ofproto, &facet->flow, false);
+    }
+    fx->n_subfacets = list_size(&facet->subfacets);
+    fx->subfacets = xmalloc(fx->n_subfacets * sizeof *fx->subfacets);
+    ofpbuf_init(&fx->deps, 0);
+    ofpbuf_init(&fx->xc, 0);
+    fx->xc_seq = ofproto->xc_seq;
+    fx->max_resubmit_trigger = false;
+
+    i = 0;
+    memset(&ctx, 0, sizeof ctx);
+    LIST_FOR_EACH (subfacet, list_node, &facet->subfacets) {
+        struct subfacet_xlate *sx = &fx->subfacets[i];
+
+        ofpbuf_use_stub(&sx->odp_actions, sx->odp_actions_stub,
+                        sizeof sx->odp_actions_stub);
+        action_xlate_ctx_init(&ctx, ofproto, &facet->flow,
+                              subfacet->initial_tci, fx->rule, 0, NULL);
+        ctx.may_log = false;
+        ctx.deps = &fx->deps;
+        ctx.xc = &fx->xc;
+        xlate_actions(&ctx, fx->rule->up.ofpacts, fx->rule->up.ofpacts_len,
+                      &sx->odp_actions);
+        sx->slow = ctx.slow;
+        sx->install = false;
+        if (ctx.max_resubmit_trigger) {
+            fx->max_resubmit_trigger = true;
+            fx->resubmit_initial_tci = subfacet->initial_tci;
+        }
+
+        /* The datapath flow mask comes from the first subfacet, the rest of
+         * the facet's properties from the last one. */
+        if (!i) {
+            fx->wc = ctx.wc;
+        }
+        i++;
+    }
+
+    fx->tags = ctx.tags;
+    fx->has_learn = ctx.has_learn;
+    fx->has_normal = ctx.has_normal;
+    fx->has_fin_timeout = ctx.has_fin_timeout;
+    fx->nf_output_iface = ctx.nf_output_iface;
+    fx->mirrors = ctx.mirrors;
+}
+
+static void
+facet_xlate_destroy(struct facet_xlate *fx)
+{
+    size_t i;
+
+    for (i = 0; i < fx->n_subfacets; i++) {
+        ofpbuf_uninit(&fx->subfacets[i].odp_actions);
+    }
+    free(fx->subfacets);
+    ofpbuf_uninit(&fx->deps);
+    xc_clear(&fx->xc);
+    ofpbuf_uninit(&fx->xc);
+}
+
+/* Updates 'fx->facet' from the translation results in 'fx', after
+ * facet_xlate_apply() has updated its datapath flows. */
+static void
+facet_xlate_finish(struct facet_xlate *fx)
+{
+    struct facet *facet = fx->facet;
+    struct rule_dpif *new_rule = fx->rule;
+    struct subfacet *subfacet;
+    bool installed;
+    size_t i;
+
+    installed = false;
+    for (i = 0; i < fx->n_subfacets; i++) {
+        installed = installed || fx->subfacets[i].install;
+    }
+    if (installed) {
+        facet_flush_stats(facet);
+    }
+
+    /* Update 'facet' now that we've taken care of all the old state. */
+    facet->tags = fx->tags;
+    facet_set_deps(facet, &fx->deps);
+    facet_set_xc(facet, &fx->xc, fx->xc_seq);
+    facet_set_nf_output_iface(facet, fx->nf_output_iface);
+    facet->has_learn = fx->has_learn;
+    facet->has_normal = fx->has_normal;
+    facet->has_fin_timeout = fx->has_fin_timeout;
+    facet->mirrors = fx->mirrors;
+
+    i = 0;
+    LIST_FOR_EACH (subfacet, list_node, &facet->subfacets) {
+        struct subfacet_xlate *sx = &fx->subfacets[i++];
+
+        subfacet->slow = (subfacet->slow & SLOW_MATCH) | sx->slow;
+        if (sx->install) {
+            subfacet_set_actions(subfacet, &sx->odp_actions);
+        }
+    }
+
+    if (facet->rule != new_rule) {
+        COVERAGE_INC(facet_changed_rule);
+        list_remove(&facet->list_node);
+        list_push_back(&new_rule->facets, &facet->list_node);
+        facet->rule = new_rule;
+        facet->used = new_rule->up.created;
+        facet->prev_used = facet->used;
+    }
+}
+
+/* Applies the 'n' translation results in 'fxs', all for facets in 'ofproto'
+ * and all produced by facet_xlate_run():
+ *
+ *   - Moves each facet to the rule it now matches, if that changed.
+ *
+ *   - Updates the datapath flows whose actions, installability, or mask
+ *     changed, in batches through dpif_operate().
+ *
+ * We do not modify any facet state until the datapath flows have been
+ * updated, because we might need to, e.g., emit a NetFlow expiration and, if
+ * so, we need to have the old state around to properly compose it. */
+static void
+facet_xlate_apply(struct ofproto_dpif *ofproto,
+                  struct facet_xlate *fxs, size_t n)
+{
+    struct subfacet_put *puts;
+    size_t n_puts, max_puts;
+    size_t i;
+
+    max_puts = 0;
+    for (i = 0; i < n; i++) {
+        max_puts += fxs[i].n_subfacets;
+    }
+    puts = xmalloc(max_puts * sizeof *puts);
+
+    /* Figure out which datapath flows need to change.  The datapath flow mask
+     * has to be updated before reinstalling any subfacet.  It plays no part
+     * in NetFlow expiration, so it is safe to change it already. */
+    n_puts = 0;
+    for (i = 0; i < n; i++) {
+        struct facet_xlate *fx = &fxs[i];
+        struct facet *facet = fx->facet;
+        struct subfacet *subfacet;
+        bool mask_changed;
+        size_t j;
+
+        COVERAGE_INC(facet_revalidate);
+        if (facet_is_pending(facet)) {
+            list_remove(&facet->pending_node);
+            list_init(&facet->pending_node);
+        }
+
+        if (fx->max_resubmit_trigger) {
+            log_resubmit_recursion();
+            report_resubmit_limit(ofproto, &facet->flow, NULL,
+                                  fx->resubmit_initial_tci);
+        }
+
+        mask_changed = fx->n_subfacets && facet_set_mask(facet, &fx->wc);
+        j = 0;
+        LIST_FOR_EACH (subfacet, list_node, &facet->subfacets) {
+            struct subfacet_xlate *sx = &fx->subfacets[j++];
+            enum slow_path_reason slow;
+
+            slow = (subfacet->slow & SLOW_MATCH) | sx->slow;
+            if ((mask_changed && subfacet->path == SF_FAST_PATH)
+                || subfacet_should_install(subfacet, slow, &sx->odp_actions)) {
+                sx->install = true;
+                subfacet_put_init(&puts[n_puts++], subfacet,
+                                  sx->odp_actions.data, sx->odp_actions.size,
+                                  true, slow);
+            }
+        }
+    }
+
+    /* Update the datapath flows and credit their final statistics. */
+    for (i = 0; i < n_puts; i += REVALIDATE_MAX_OPS) {
+        struct dpif_op *opsp[REVALIDATE_MAX_OPS];
+        size_t n_ops = MIN(n_puts - i, REVALIDATE_MAX_OPS);
+        size_t j;
+
+        for (j = 0; j < n_ops; j++) {
+            opsp[j] = &puts[i + j].op;
+        }
+        dpif_operate(ofproto->backer->dpif, opsp, n_ops);
+        for (j = 0; j < n_ops; j++) {
+            struct subfacet_put *put = &puts[i + j];
+
+            subfacet_put_finish(put);
+            subfacet_update_stats(put->subfacet, &put->stats);
+        }
+    }
+    free(puts);
+
+    for (i = 0; i < n; i++) {
+        facet_xlate_finish(&fxs[i]);
+    }
+}
+
+/* Re-searches the classifier for 'facet':
+ *
+ *   - If the rule found is different from 'facet''s current rule, moves
+ *     'facet' to the new rule and recompiles its actions.
+ *
+ *   - If the rule found is the same as 'facet''s current rule, leaves 'facet'
+ *     where it is and recompiles its actions anyway.
+ *
+ * revalidate_facets() does the same for many facets at once. */
+static void
+facet_revalidate(struct facet *facet)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+    struct facet_xlate fx;
+
+    fx.facet = facet;
+    facet_xlate_run(&fx);
+    facet_xlate_apply(ofproto, &fx, 1);
+    facet_xlate_destroy(&fx);
+}
+
+/* Facet revalidation threads.
+ *
+ * Revalidating many facets at once, e.g. every facet after a port goes down,
+ * spends most of its time translating actions.  revalidate_facets() therefore
+ * works through its facets in batches of up to REVALIDATE_MAX_BATCH.  With
+ * other_config:n-revalidator-threads=N in the Open_vSwitch table (see
+ * ofproto_set_n_revalidator_threads()), the main thread and N revalidator
+ * threads translate each batch in parallel.  Each thread takes
+ * REVALIDATE_SHARD facets at a time.  Translation for revalidation only reads
+ * ofproto state, and the main thread does nothing else until the batch is
+ * translated.  Then the main thread applies the results and updates the
+ * datapath flows that changed through dpif_operate().
+ *
+ * Idle upcall handler threads help to translate every batch, too, and the
+ * main thread uses the same machinery to translate new facets for flow misses
+ * (see handle_flow_misses_parallel()).
+ *
+ * Translating output to a bond updates the bond's state, so an ofproto with
+ * bonds always translates in the main thread only. */
+
+/* Number of running revalidator threads.  0 means that the main thread
+ * translates every facet itself. */
+static size_t n_revalidators = 0;
+static pthread_t *revalidator_threads;
+
+/* Number of facets revalidated at a time, and the number that a thread takes
+ * for translation at a time. */
+#define REVALIDATE_MAX_BATCH 1024
+#define REVALIDATE_SHARD 64
+
+/* Shared by the main thread, the revalidator threads, and the upcall handler
+ * threads. */
+static pthread_mutex_t xlate_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t xlate_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t xlate_done_cond = PTHREAD_COND_INITIALIZER;
+static struct facet_xlate *xlate_work; /* Batch being translated. */
+static size_t xlate_n_work;     /* Number of facets in the batch. */
+static size_t xlate_next;       /* First facet that no thread took yet. */
+static size_t xlate_n_done;     /* Number of facets translated. */
+static size_t xlate_shard;      /* Number of facets that a thread takes. */
+static unsigned int xlate_seq;  /* Incremented for each batch. */
+static bool revalidators_exit;  /* Tells revalidator threads to exit. */
+
+/* Takes up to 'xlate_shard' facets from the batch being translated,
+ * translates them, and returns true, or returns false if there is nothing left
+ * to take.  Must be called with 'xlate_mutex' held, which it releases
+ * while translating. */
+static bool
+xlate_take_shard(void)
+{
+    struct facet_xlate *fxs = xlate_work;
+    size_t start, n, i;
+
+    if (xlate_next >= xlate_n_work) {
+        return false;
+    }
+    start = xlate_next;
+    n = MIN(xlate_shard, xlate_n_work - start);
+    xlate_next += n;
+
+    pthread_mutex_unlock(&xlate_mutex);
+    for (i = start; i < start + n; i++) {
+        facet_xlate_run(&fxs[i]);
+    }
+    coverage_flush();
+    pthread_mutex_lock(&xlate_mutex);
+
+    xlate_n_done += n;
+    if (xlate_n_done >= xlate_n_work) {
+        /* Upcall handler threads wait for the batch to finish, too. */
+        pthread_cond_broadcast(&xlate_done_cond);
+    }
+    return true;
+}
+
+static void *
+revalidator_main(void *aux OVS_UNUSED)
+{
+    pthread_mutex_lock(&xlate_mutex);
+    while (!revalidators_exit) {
+        if (!xlate_take_shard()) {
+            pthread_cond_wait(&xlate_work_cond, &xlate_mutex);
+        }
+    }
+    pthread_mutex_unlock(&xlate_mutex);
+
+    return NULL;
+}
+
+/* Called by an upcall handler thread when 'xlate_wakeup_fds[0]' is readable.
+ * Helps to translate the batch being translated, if any, and then waits for
+ * the main thread to finish the batch, which drains the wakeup. */
+static void
+xlate_help(void)
+{
+    unsigned int seq;
+
+    pthread_mutex_lock(&xlate_mutex);
+    seq = xlate_seq;
+    if (xlate_work) {
+        while (xlate_take_shard()) {
+            continue;
+        }
+        while (xlate_work && xlate_seq == seq) {
+            pthread_cond_wait(&xlate_done_cond, &xlate_mutex);
+        }
+    }
+    pthread_mutex_unlock(&xlate_mutex);
+}
+
+/* Runs facet_xlate_run() on each of the 'n' elements of 'fxs' in the main
+ * thread, the revalidator threads, and any idle upcall handler threads, each
+ * of which takes 'shard' facets at a time. */
+static void
+xlate_facets_parallel(struct facet_xlate *fxs, size_t n, size_t shard)
+{
+    pthread_mutex_lock(&xlate_mutex);
+    xlate_work = fxs;
+    xlate_n_work = n;
+    xlate_next = 0;
+    xlate_n_done = 0;
+    xlate_shard = shard;
+    xlate_seq++;
+    pthread_cond_broadcast(&xlate_work_cond);
+    if (xlate_wakeup_fds[1] >= 0) {
+        ignore(write(xlate_wakeup_fds[1], "", 1));
+    }
+
+    while (xlate_take_shard()) {
+        continue;
+    }
+    while (xlate_n_done < xlate_n_work) {
+        pthread_cond_wait(&xlate_done_cond, &xlate_mutex);
+    }
+
+    if (xlate_wakeup_fds[0] >= 0) {
+        drain_fd(xlate_wakeup_fds[0], 1);
+    }
+    xlate_work = NULL;
+    xlate_n_work = xlate_next = xlate_n_done = 0;
+    pthread_cond_broadcast(&xlate_done_cond);
+    pthread_mutex_unlock(&xlate_mutex);
+}
+
+/* Runs facet_xlate_run() on each of the 'n' elements of 'fxs', all for facets
+ * in 'ofproto', spreading the work over the revalidator threads if that is
+ * possible and worthwhile. */
+static void
+xlate_facets(const struct ofproto_dpif *ofproto,
+             struct facet_xlate *fxs, size_t n)
+{
+    if (!n_revalidators || ofproto->has_bonded_bundles
+        || n <= REVALIDATE_SHARD) {
+        size_t i;
+
+        for (i = 0; i < n; i++) {
+            facet_xlate_run(&fxs[i]);
+        }
+        return;
     }
-    ofpbuf_uninit(&odp_actions);
 
-    return ok;
+    COVERAGE_INC(revalidate_parallel);
+    xlate_facets_parallel(fxs, n, REVALIDATE_SHARD);
 }
 
-/* Re-searches the classifier for 'facet':
- *
- *   - If the rule found is different from 'facet''s current rule, moves
- *     'facet' to the new rule and recompiles its actions.
- *
- *   - If the rule found is the same as 'facet''s current rule, leaves 'facet'
- *     where it is and recompiles its actions anyway. */
+/* Revalidates the 'n' facets in 'facets', all of which must be in
+ * 'ofproto'. */
 static void
-facet_revalidate(struct facet *facet)
+revalidate_facets(struct ofproto_dpif *ofproto,
+                  struct facet **facets, size_t n)
 {
-    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
-    struct actions {
-        struct nlattr *odp_actions;
-        size_t actions_len;
-    };
-    struct actions *new_actions;
+    struct facet_xlate *fxs;
+    size_t ofs;
 
-    struct action_xlate_ctx ctx;
-    uint64_t odp_actions_stub[1024 / 8];
-    struct ofpbuf odp_actions;
+    fxs = xmalloc(MIN(n, REVALIDATE_MAX_BATCH) * sizeof *fxs);
+    for (ofs = 0; ofs < n; ofs += REVALIDATE_MAX_BATCH) {
+        size_t batch = MIN(n - ofs, REVALIDATE_MAX_BATCH);
+        size_t i;
 
-    struct rule_dpif *new_rule;
-    struct subfacet *subfacet;
-    int i;
+        for (i = 0; i < batch; i++) {
+            fxs[i].facet = facets[ofs + i];
+        }
+        xlate_facets(ofproto, fxs, batch);
+        facet_xlate_apply(ofproto, fxs, batch);
+        for (i = 0; i < batch; i++) {
+            facet_xlate_destroy(&fxs[i]);
+        }
+    }
+    free(fxs);
+}
 
-    COVERAGE_INC(facet_revalidate);
+/* Parallel flow miss translation.
+ *
+ * With upcall handler threads, handle_miss_upcalls() handles each batch of
+ * flow misses in two passes.  The first pass looks up or creates the facet
+ * for each miss.  If more than MISS_XLATE_SHARD of the facets are new, the
+ * main thread and the idle handler threads then translate the new facets in
+ * parallel with facet_xlate_run(), and facet_xlate_init() gives them their
+ * actions.  The second pass executes the misses' packets and sets up their
+ * datapath flows, as handle_flow_miss() does.
+ *
+ * facet_xlate_run() translates without a packet, so it does not update the
+ * MAC learning table or execute "learn" actions.  facet_xlate_init() replays
+ * these side effects from the new facet's xlate cache instead.  A subfacet
+ * that needs the slow path is still translated again for each of its
+ * packets. */
+
+/* Number of new facets that a thread takes for translation at a time. */
+#define MISS_XLATE_SHARD 8
+
+/* Gives 'fx->facet', a new facet whose subfacets do not have actions yet, the
+ * results of translating it with facet_xlate_run(), as subfacet_make_actions()
+ * would.  Returns true if the caller should then call facet_learn() to update
+ * the learning tables as translating the facet's first packet would have,
+ * false if none of its subfacets takes the fast path, so that translating
+ * each of its packets takes care of that. */
+static bool
+facet_xlate_init(struct facet_xlate *fx)
+{
+    struct facet *facet = fx->facet;
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+    struct subfacet *subfacet;
+    bool slow;
+    size_t i;
 
-    new_rule = rule_dpif_lookup(ofproto, &facet->flow);
+    if (fx->max_resubmit_trigger) {
+        log_resubmit_recursion();
+        report_resubmit_limit(ofproto, &facet->flow, NULL,
+                              fx->resubmit_initial_tci);
+    }
 
-    /* Calculate new datapath actions.
-     *
-     * We do not modify any 'facet' state yet, because we might need to, e.g.,
-     * emit a NetFlow expiration and, if so, we need to have the old state
-     * around to properly compose it. */
+    facet->tags = fx->tags;
+    facet_set_deps(facet, &fx->deps);
+    facet_set_xc(facet, &fx->xc, fx->xc_seq);
+    facet->has_learn = fx->has_learn;
+    facet->has_normal = fx->has_normal;
+    facet->has_fin_timeout = fx->has_fin_timeout;
+    facet_set_nf_output_iface(facet, fx->nf_output_iface);
+    facet->mirrors = fx->mirrors;
+    facet_set_mask(facet, &fx->wc);
 
-    /* If the datapath actions changed or the installability changed,
-     * then we need to talk to the datapath. */
     i = 0;
-    new_actions = NULL;
-    memset(&ctx, 0, sizeof ctx);
-    ofpbuf_use_stub(&odp_actions, odp_actions_stub, sizeof odp_actions_stub);
+    slow = false;
     LIST_FOR_EACH (subfacet, list_node, &facet->subfacets) {
-        enum slow_path_reason slow;
+        struct subfacet_xlate *sx = &fx->subfacets[i++];
 
-        action_xlate_ctx_init(&ctx, ofproto, &facet->flow,
-                              subfacet->initial_tci, new_rule, 0, NULL);
-        xlate_actions(&ctx, new_rule->up.ofpacts, new_rule->up.ofpacts_len,
-                      &odp_actions);
+        subfacet->slow = (subfacet->slow & SLOW_MATCH) | sx->slow;
+        subfacet_set_actions(subfacet, &sx->odp_actions);
+        slow = slow || subfacet->slow;
+    }
+    return !slow;
+}
 
-        slow = (subfacet->slow & SLOW_MATCH) | ctx.slow;
-        if (subfacet_should_install(subfacet, slow, &odp_actions)) {
-            struct dpif_flow_stats stats;
+/* Handles the flow misses in 'todo' as handle_flow_miss() would, except that
+ * it translates new facets in parallel.  Adds any required datapath
+ * operations to 'ops', incrementing '*n_ops' for each new op. */
+static void
+handle_flow_misses_parallel(struct hmap *todo, struct flow_miss_op *ops,
+                            size_t *n_ops)
+{
+    struct facet_xlate *fxs;
+    struct flow_miss *miss;
+    size_t n_fxs;
+    size_t i;
 
-            subfacet_install(subfacet,
-                             odp_actions.data, odp_actions.size, &stats, slow);
-            subfacet_update_stats(subfacet, &stats);
+    fxs = xmalloc(hmap_count(todo) * sizeof *fxs);
+    n_fxs = 0;
+    HMAP_FOR_EACH (miss, hmap_node, todo) {
+        bool created = flow_miss_get_facet(miss, ops, n_ops);
 
-            if (!new_actions) {
-                new_actions = xcalloc(list_size(&facet->subfacets),
-                                      sizeof *new_actions);
+        if (miss->facet) {
+            subfacet_create(miss->facet, miss->key_fitness, miss->key,
+                            miss->key_len, miss->initial_tci, miss->now);
+            if (created && !miss->ofproto->has_bonded_bundles) {
+                fxs[n_fxs++].facet = miss->facet;
             }
-            new_actions[i].odp_actions = xmemdup(odp_actions.data,
-                                                 odp_actions.size);
-            new_actions[i].actions_len = odp_actions.size;
         }
+    }
 
-        i++;
+    /* Otherwise handle_flow_miss_with_facet() translates the new facets. */
+    if (n_fxs > MISS_XLATE_SHARD) {
+        COVERAGE_INC(miss_xlate_parallel);
+        xlate_facets_parallel(fxs, n_fxs, MISS_XLATE_SHARD);
+        for (i = 0; i < n_fxs; i++) {
+            if (!facet_xlate_init(&fxs[i])) {
+                fxs[i].facet = NULL;
+            }
+            facet_xlate_destroy(&fxs[i]);
+        }
+
+        /* Learning can revalidate facets, so it waits until every new facet
+         * has its actions. */
+        for (i = 0; i < n_fxs; i++) {
+            if (fxs[i].facet) {
+                facet_learn(fxs[i].facet);
+            }
+        }
     }
-    ofpbuf_uninit(&odp_actions);
+    free(fxs);
 
-    if (new_actions) {
-        facet_flush_stats(facet);
+    HMAP_FOR_EACH (miss, hmap_node, todo) {
+        if (miss->facet) {
+            handle_flow_miss_with_facet(miss, miss->facet, miss->now,
+                                        ops, n_ops);
+        }
     }
+}
 
-    /* Update 'facet' now that we've taken care of all the old state. */
-    facet->tags = ctx.tags;
-    facet->nf_flow.output_iface = ctx.nf_output_iface;
-    facet->has_learn = ctx.has_learn;
-    facet->has_normal = ctx.has_normal;
-    facet->has_fin_timeout = ctx.has_fin_timeout;
-    facet->mirrors = ctx.mirrors;
+/* Time-sliced revalidation.
+ *
+ * Revalidating every facet, e.g. after a configuration change, can take much
+ * longer than a single main loop iteration should.  run() therefore only
+ * queues every facet on 'pending_facets', and each call to
+ * revalidate_pending_facets() revalidates the queue in order until it either
+ * empties or exceeds the time budget set with
+ * other_config:revalidation-budget in the Open_vSwitch table (see
+ * ofproto_set_revalidation_budget()).  The main loop keeps handling upcalls in
+ * between.  facet_lookup_valid() revalidates a pending facet before using it,
+ * so that packets never see the old configuration through a facet that the
+ * pass has yet to reach. */
 
-    i = 0;
-    LIST_FOR_EACH (subfacet, list_node, &facet->subfacets) {
-        subfacet->slow = (subfacet->slow & SLOW_MATCH) | ctx.slow;
+static bool
+facet_is_pending(const struct facet *facet)
+{
+    return !list_is_empty(&facet->pending_node);
+}
+
+/* Revalidates facets from 'ofproto''s 'pending_facets' until either none are
+ * left or 'revalidation_budget' is exhausted. */
+static void
+revalidate_pending_facets(struct ofproto_dpif *ofproto)
+{
+    size_t max_batch = MIN(REVALIDATE_SHARD * (n_revalidators + 1),
+                           REVALIDATE_MAX_BATCH);
+    struct facet **facets = xmalloc(max_batch * sizeof *facets);
+    long long int deadline;
 
-        if (new_actions && new_actions[i].odp_actions) {
-            free(subfacet->actions);
-            subfacet->actions = new_actions[i].odp_actions;
-            subfacet->actions_len = new_actions[i].actions_len;
+    time_refresh();
+    deadline = time_msec() + revalidation_budget;
+    while (!list_is_empty(&ofproto->pending_facets)) {
+        size_t n = 0;
+
+        while (n < max_batch && !list_is_empty(&ofproto->pending_facets)) {
+            struct list *node = list_pop_front(&ofproto->pending_facets);
+
+            list_init(node);
+            facets[n++] = CONTAINER_OF(node, struct facet, pending_node);
         }
-        i++;
+        revalidate_facets(ofproto, facets, n);
+
+        if (revalidation_budget) {
+            time_refresh();
+            if (time_msec() >= deadline) {
+                COVERAGE_INC(revalidate_sliced);
+                break;
+            }
+        }
+    }
+    free(facets);
+}
+
+/* Stops the revalidator threads, if any, and starts 'n' of them. */
+static void
+set_n_revalidator_threads(size_t n)
+{
+    sigset_t sigs, oldsigs;
+    size_t i;
+
+    if (n == n_revalidators) {
+        return;
     }
-    free(new_actions);
 
-    if (facet->rule != new_rule) {
-        COVERAGE_INC(facet_changed_rule);
-        list_remove(&facet->list_node);
-        list_push_back(&new_rule->facets, &facet->list_node);
-        facet->rule = new_rule;
-        facet->used = new_rule->up.created;
-        facet->prev_used = facet->used;
+    if (n_revalidators) {
+        pthread_mutex_lock(&xlate_mutex);
+        revalidators_exit = true;
+        pthread_cond_broadcast(&xlate_work_cond);
+        pthread_mutex_unlock(&xlate_mutex);
+
+        for (i = 0; i < n_revalidators; i++) {
+            pthread_join(revalidator_threads[i], NULL);
+        }
+        free(revalidator_threads);
+        revalidator_threads = NULL;
+        revalidators_exit = false;
     }
+
+    n_revalidators = n;
+    if (!n) {
+        return;
+    }
+
+    /* Signals, e.g. the SIGALRM used by the timeval module, should only be
+     * delivered to the main thread, so block them all in the revalidator
+     * threads, which inherit our signal mask. */
+    revalidator_threads = xmalloc(n * sizeof *revalidator_threads);
+    sigfillset(&sigs);
+    pthread_sigmask(SIG_SETMASK, &sigs, &oldsigs);
+    for (i = 0; i < n; i++) {
+        int error = pthread_create(&revalidator_threads[i], NULL,
+                                   revalidator_main, NULL);
+        if (error) {
+            VLOG_FATAL("failed to start revalidator thread (%s)",
+                       strerror(error));
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    VLOG_INFO("started %zu revalidator threads", n);
 }
 
 /* Updates 'facet''s used time.  Caller is responsible for calling
@@ -4583,7 +6882,10 @@ facet_update_time(struct facet *facet, long long int used)
     if (used > facet->used) {
         facet->used = used;
         ofproto_rule_update_used(&facet->rule->up, used);
-        netflow_flow_update_time(ofproto->netflow, &facet->nf_flow, used);
+        if (ofproto->netflow) {
+            netflow_flow_update_time(ofproto->netflow,
+                                     facet_get_nf_flow(facet), used);
+        }
     }
 }
 
@@ -4597,6 +6899,9 @@ facet_reset_counters(struct facet *facet)
     facet->accounted_bytes = 0;
 }
 
+/* Pushes the statistics that 'facet' accumulated since the last push to its
+ * rule, to the rules that its translation resubmits into, and to its
+ * mirrors. */
 static void
 facet_push_stats(struct facet *facet)
 {
@@ -4616,7 +6921,19 @@ facet_push_stats(struct facet *facet)
         facet->prev_byte_count = facet->byte_count;
         facet->prev_used = facet->used;
 
-        flow_push_stats(facet->rule, &facet->flow, &stats);
+        ofproto_rule_update_used(&facet->rule->up, stats.used);
+        if (facet_xc_is_valid(facet)) {
+            size_t i;
+
+            COVERAGE_INC(facet_xc_hit);
+            for (i = 0; i < facet->n_xc; i++) {
+                if (facet->xc[i].type == XC_RULE) {
+                    rule_credit_stats(facet->xc[i].u.rule, &stats);
+                }
+            }
+        } else {
+            facet_xlate_side_effects(facet, &stats, false);
+        }
 
         update_mirror_stats(ofproto_dpif_cast(facet->rule->up.ofproto),
                             facet->mirrors, stats.n_packets, stats.n_bytes);
@@ -4631,24 +6948,6 @@ rule_credit_stats(struct rule_dpif *rule, const struct dpif_flow_stats *stats)
     ofproto_rule_update_used(&rule->up, stats->used);
 }
 
-/* Pushes flow statistics to the rules which 'flow' resubmits into given
- * 'rule''s actions and mirrors. */
-static void
-flow_push_stats(struct rule_dpif *rule,
-                const struct flow *flow, const struct dpif_flow_stats *stats)
-{
-    struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
-    struct action_xlate_ctx ctx;
-
-    ofproto_rule_update_used(&rule->up, stats->used);
-
-    action_xlate_ctx_init(&ctx, ofproto, flow, flow->vlan_tci, rule,
-                          0, NULL);
-    ctx.resubmit_stats = stats;
-    xlate_actions_for_side_effects(&ctx, rule->up.ofpacts,
-                                   rule->up.ofpacts_len);
-}
-
 /* Subfacets. */
 
 static struct subfacet *
@@ -4719,12 +7018,13 @@ subfacet_create(struct facet *facet, enum odp_key_fitness key_fitness,
     subfacet->used = now;
     subfacet->dp_packet_count = 0;
     subfacet->dp_byte_count = 0;
-    subfacet->actions_len = 0;
     subfacet->actions = NULL;
     subfacet->slow = (subfacet->key_fitness == ODP_FIT_TOO_LITTLE
                       ? SLOW_MATCH
                       : 0);
     subfacet->path = SF_NOT_INSTALLED;
+    subfacet->put_pending = false;
+    subfacet->install_seq = 0;
     subfacet->initial_tci = initial_tci;
 
     return subfacet;
@@ -4742,7 +7042,7 @@ subfacet_destroy__(struct subfacet *subfacet)
     hmap_remove(&ofproto->subfacets, &subfacet->hmap_node);
     list_remove(&subfacet->list_node);
     free(subfacet->key);
-    free(subfacet->actions);
+    odp_actions_unref(subfacet->actions);
     if (subfacet != &facet->one_subfacet) {
         free(subfacet);
     }
@@ -4786,7 +7086,7 @@ subfacet_destroy_batch(struct ofproto_dpif *ofproto,
     dpif_operate(ofproto->backer->dpif, opsp, n);
     for (i = 0; i < n; i++) {
         subfacet_reset_dp_stats(subfacets[i], &stats[i]);
-        subfacets[i]->path = SF_NOT_INSTALLED;
+        subfacet_set_path(subfacets[i], SF_NOT_INSTALLED);
         subfacet_destroy(subfacets[i]);
     }
 }
@@ -4812,6 +7112,22 @@ subfacet_get_key(struct subfacet *subfacet, struct odputil_keybuf *keybuf,
     }
 }
 
+/* Composes into 'mask', which must have room for an ODP flow key, the
+ * datapath flow mask to install along with 'subfacet''s key.  Leaves 'mask'
+ * empty if 'subfacet' should be installed as an exact-match flow. */
+static void
+subfacet_get_mask(const struct subfacet *subfacet, struct ofpbuf *mask)
+{
+    const struct facet *facet = subfacet->facet;
+
+    if (facet->has_mask && subfacet->key_fitness == ODP_FIT_PERFECT) {
+        struct flow_wildcards wc;
+
+        minimask_expand(&facet->mask, &wc);
+        odp_flow_key_from_mask(mask, &wc.masks, &facet->flow, UINT32_MAX);
+    }
+}
+
 /* Composes the datapath actions for 'subfacet' based on its rule's actions.
  * Translates the actions into 'odp_actions', which the caller must have
  * initialized and is responsible for uninitializing. */
@@ -4824,24 +7140,168 @@ subfacet_make_actions(struct subfacet *subfacet, const struct ofpbuf *packet,
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
 
     struct action_xlate_ctx ctx;
+    struct ofpbuf xlate_deps;
+    struct ofpbuf xc;
+    unsigned int xc_seq;
 
+    ofpbuf_init(&xlate_deps, 0);
+    ofpbuf_init(&xc, 0);
+    xc_seq = ofproto->xc_seq;
     action_xlate_ctx_init(&ctx, ofproto, &facet->flow, subfacet->initial_tci,
                           rule, 0, packet);
+    ctx.deps = &xlate_deps;
+    ctx.xc = &xc;
     xlate_actions(&ctx, rule->up.ofpacts, rule->up.ofpacts_len, odp_actions);
     facet->tags = ctx.tags;
+    facet_set_deps(facet, &xlate_deps);
+    ofpbuf_uninit(&xlate_deps);
+    facet_set_xc(facet, &xc, xc_seq);
+    ofpbuf_uninit(&xc);
     facet->has_learn = ctx.has_learn;
     facet->has_normal = ctx.has_normal;
     facet->has_fin_timeout = ctx.has_fin_timeout;
-    facet->nf_flow.output_iface = ctx.nf_output_iface;
+    facet_set_nf_output_iface(facet, ctx.nf_output_iface);
     facet->mirrors = ctx.mirrors;
+    facet_set_mask(facet, &ctx.wc);
 
     subfacet->slow = (subfacet->slow & SLOW_MATCH) | ctx.slow;
-    if (subfacet->actions_len != odp_actions->size
-        || memcmp(subfacet->actions, odp_actions->data, odp_actions->size)) {
-        free(subfacet->actions);
-        subfacet->actions_len = odp_actions->size;
-        subfacet->actions = xmemdup(odp_actions->data, odp_actions->size);
+    subfacet_set_actions(subfacet, odp_actions);
+}
+
+/* Returns 'subfacet''s datapath actions, or NULL if they have not yet been
+ * composed. */
+static const struct nlattr *
+subfacet_actions(const struct subfacet *subfacet)
+{
+    return (subfacet->actions
+            ? (const struct nlattr *) (subfacet->actions + 1)
+            : NULL);
+}
+
+/* Returns the number of bytes in 'subfacet''s datapath actions. */
+static size_t
+subfacet_actions_len(const struct subfacet *subfacet)
+{
+    return subfacet->actions ? subfacet->actions->size : 0;
+}
+
+/* Sets 'subfacet''s datapath actions to a copy of 'odp_actions', sharing the
+ * copy with any other subfacet that has the same actions. */
+static void
+subfacet_set_actions(struct subfacet *subfacet,
+                     const struct ofpbuf *odp_actions)
+{
+    if (!subfacet->actions
+        || subfacet->actions->size != odp_actions->size
+        || memcmp(subfacet->actions + 1, odp_actions->data,
+                  odp_actions->size)) {
+        odp_actions_unref(subfacet->actions);
+        subfacet->actions = odp_actions_intern(odp_actions->data,
+                                               odp_actions->size);
+    }
+}
+
+/* Returns the interned copy of the 'size' bytes of datapath actions in
+ * 'data', creating it if necessary, with a new reference that the caller
+ * must eventually release with odp_actions_unref(). */
+static struct odp_actions *
+odp_actions_intern(const struct nlattr *data, size_t size)
+{
+    uint32_t hash = hash_bytes(data, size, 0);
+    struct odp_actions *actions;
+
+    HMAP_FOR_EACH_WITH_HASH (actions, hmap_node, hash, &all_odp_actions) {
+        if (actions->size == size && !memcmp(actions + 1, data, size)) {
+            actions->n_refs++;
+            return actions;
+        }
+    }
+
+    actions = xmalloc(sizeof *actions + size);
+    hmap_insert(&all_odp_actions, &actions->hmap_node, hash);
+    actions->n_refs = 1;
+    actions->size = size;
+    memcpy(actions + 1, data, size);
+    return actions;
+}
+
+/* Releases a reference to 'actions', freeing it if this was the last one.
+ * Does nothing if 'actions' is NULL. */
+static void
+odp_actions_unref(struct odp_actions *actions)
+{
+    if (actions && !--actions->n_refs) {
+        hmap_remove(&all_odp_actions, &actions->hmap_node);
+        free(actions);
+    }
+}
+
+/* Initializes 'put' to update 'subfacet''s datapath flow, setting its actions
+ * to 'actions_len' bytes of actions in 'actions', when 'put->op' is executed
+ * with dpif_operate().  If 'want_stats' is true, statistics counters in the
+ * datapath will be zeroed and subfacet_put_finish() will store traffic new
+ * since 'subfacet' was last updated in 'put->stats'.
+ *
+ * 'actions' must remain valid until 'put->op' is executed. */
+static void
+subfacet_put_init(struct subfacet_put *put, struct subfacet *subfacet,
+                  const struct nlattr *actions, size_t actions_len,
+                  bool want_stats, enum slow_path_reason slow)
+{
+    struct facet *facet = subfacet->facet;
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+    struct dpif_flow_put *fp = &put->op.u.flow_put;
+    struct ofpbuf mask;
+    struct ofpbuf key;
+
+    put->subfacet = subfacet;
+    put->path = subfacet_want_path(slow);
+    backer_reserve_flow(subfacet);
+
+    if (put->path == SF_SLOW_PATH) {
+        compose_slow_path(ofproto, &facet->flow, slow,
+                          put->slow_path_stub, sizeof put->slow_path_stub,
+                          &actions, &actions_len);
+    }
+
+    ofpbuf_use_stack(&mask, &put->maskbuf, sizeof put->maskbuf);
+    if (put->path == SF_FAST_PATH) {
+        subfacet_get_mask(subfacet, &mask);
+    }
+    subfacet_get_key(subfacet, &put->keybuf, &key);
+
+    put->op.type = DPIF_OP_FLOW_PUT;
+    fp->flags = DPIF_FP_CREATE | DPIF_FP_MODIFY;
+    if (want_stats) {
+        fp->flags |= DPIF_FP_ZERO_STATS;
+    }
+    fp->key = key.data;
+    fp->key_len = key.size;
+    fp->mask = mask.data;
+    fp->mask_len = mask.size;
+    fp->actions = actions;
+    fp->actions_len = actions_len;
+    fp->stats = want_stats ? &put->stats : NULL;
+}
+
+/* Updates 'put->subfacet' to reflect the outcome of executing 'put->op'.
+ * Returns 0 if successful, otherwise a positive errno value. */
+static int
+subfacet_put_finish(struct subfacet_put *put)
+{
+    struct subfacet *subfacet = put->subfacet;
+    struct ofproto_dpif *ofproto;
+
+    ofproto = ofproto_dpif_cast(subfacet->facet->rule->up.ofproto);
+    if (put->op.u.flow_put.stats) {
+        subfacet_reset_dp_stats(subfacet, &put->stats);
     }
+    if (!put->op.error) {
+        subfacet_set_path(subfacet, put->path);
+        subfacet->install_seq = ofproto->backer->stats_dump_seq;
+    }
+    backer_release_flow(subfacet);
+    return put->op.error;
 }
 
 /* Updates 'subfacet''s datapath flow, setting its actions to 'actions_len'
@@ -4856,45 +7316,170 @@ subfacet_install(struct subfacet *subfacet,
                  struct dpif_flow_stats *stats,
                  enum slow_path_reason slow)
 {
-    struct facet *facet = subfacet->facet;
-    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
-    enum subfacet_path path = subfacet_want_path(slow);
-    uint64_t slow_path_stub[128 / 8];
-    struct odputil_keybuf keybuf;
-    enum dpif_flow_put_flags flags;
-    struct ofpbuf key;
-    int ret;
+    struct ofproto_dpif *ofproto;
+    struct subfacet_put put;
+    struct dpif_flow_put *fp;
+    int error;
 
-    flags = DPIF_FP_CREATE | DPIF_FP_MODIFY;
+    ofproto = ofproto_dpif_cast(subfacet->facet->rule->up.ofproto);
+    subfacet_put_init(&put, subfacet, actions, actions_len, stats != NULL,
+                      slow);
+    fp = &put.op.u.flow_put;
+    put.op.error = dpif_flow_put(ofproto->backer->dpif, fp->flags,
+                                 fp->key, fp->key_len, fp->mask, fp->mask_len,
+                                 fp->actions, fp->actions_len, fp->stats);
+    error = subfacet_put_finish(&put);
     if (stats) {
-        flags |= DPIF_FP_ZERO_STATS;
+        *stats = put.stats;
     }
+    return error;
+}
 
-    if (path == SF_SLOW_PATH) {
-        compose_slow_path(ofproto, &facet->flow, slow,
-                          slow_path_stub, sizeof slow_path_stub,
-                          &actions, &actions_len);
+static int
+subfacet_reinstall(struct subfacet *subfacet, struct dpif_flow_stats *stats)
+{
+    return subfacet_install(subfacet, subfacet_actions(subfacet),
+                            subfacet_actions_len(subfacet),
+                            stats, subfacet->slow);
+}
+
+/* Datapath flow limit.
+ *
+ * Expiration only runs every so often, so between expiration passes a busy
+ * datapath can fill up with flows.  With a nonzero 'flow_limit' (see
+ * ofproto_set_flow_limit()), installing a subfacet in a backer that already
+ * has that many datapath flows first uninstalls the installed subfacet that is
+ * least worth keeping, whose packets then take the slow path until it is
+ * installed again.
+ *
+ * A subfacet's worth is its eviction value, a moving average of the number of
+ * packets that it handles between statistics updates, multiplied by the cost
+ * of setting it up again, that is, of translating its actions.  Each backer
+ * keeps its installed subfacets in a heap, with priorities that decrease as
+ * the value increases, so that the cheapest subfacet to evict is always at
+ * the top.
+ *
+ * A subfacet whose datapath flow put is still pending in a dpif_operate()
+ * batch is counted in the backer's 'n_reserved' instead of its heap, so that
+ * eviction never uninstalls a flow that the same batch is about to put. */
+
+static struct dpif_backer *
+subfacet_backer(const struct subfacet *subfacet)
+{
+    return ofproto_dpif_cast(subfacet->facet->rule->up.ofproto)->backer;
+}
+
+/* Returns the relative cost of setting up 'subfacet' again after evicting it,
+ * based on the number of OpenFlow table lookups in its translation. */
+static uint32_t
+subfacet_setup_cost(const struct subfacet *subfacet)
+{
+    return 1 + MIN(subfacet->facet->n_deps, 255);
+}
+
+/* Returns true if 'subfacet' belongs in its backer's heap of installed
+ * subfacets, that is, if eviction may uninstall it. */
+static bool
+subfacet_is_evictable(const struct subfacet *subfacet)
+{
+    return subfacet->path != SF_NOT_INSTALLED && !subfacet->put_pending;
+}
+
+/* Adds 'subfacet' to or removes it from its backer's heap of installed
+ * subfacets, if it became evictable or stopped being evictable since
+ * 'was_evictable'. */
+static void
+subfacet_update_evictable(struct subfacet *subfacet, bool was_evictable)
+{
+    bool evictable = subfacet_is_evictable(subfacet);
+
+    if (evictable && !was_evictable) {
+        heap_insert(&subfacet_backer(subfacet)->installed,
+                    &subfacet->evict_node, subfacet->evict_node.priority);
+    } else if (!evictable && was_evictable) {
+        heap_remove(&subfacet_backer(subfacet)->installed,
+                    &subfacet->evict_node);
     }
+}
 
-    subfacet_get_key(subfacet, &keybuf, &key);
-    ret = dpif_flow_put(ofproto->backer->dpif, flags, key.data, key.size,
-                        actions, actions_len, stats);
+/* Records that 'subfacet' is now installed along 'path' (or not installed, if
+ * 'path' is SF_NOT_INSTALLED), adding it to or removing it from its backer's
+ * heap of installed subfacets as necessary.  A newly installed subfacet starts
+ * out with an eviction value of one packet. */
+static void
+subfacet_set_path(struct subfacet *subfacet, enum subfacet_path path)
+{
+    bool was_evictable = subfacet_is_evictable(subfacet);
 
-    if (stats) {
-        subfacet_reset_dp_stats(subfacet, stats);
+    if (subfacet->path == SF_NOT_INSTALLED && path != SF_NOT_INSTALLED) {
+        subfacet->evict_node.priority
+            = UINT32_MAX - subfacet_setup_cost(subfacet);
     }
+    subfacet->path = path;
+    subfacet_update_evictable(subfacet, was_evictable);
+}
+
+/* Updates the eviction value of 'subfacet', which must be installed, for
+ * 'n_packets' packets that its datapath flow handled since the last
+ * update. */
+static void
+subfacet_update_eviction_value(struct subfacet *subfacet, uint64_t n_packets)
+{
+    uint64_t value = UINT32_MAX - subfacet->evict_node.priority;
+    uint32_t priority;
 
-    if (!ret) {
-        subfacet->path = path;
+    value += MIN(n_packets, UINT32_MAX) * subfacet_setup_cost(subfacet);
+    priority = UINT32_MAX - MIN(value / 2, UINT32_MAX);
+    if (priority == subfacet->evict_node.priority) {
+        /* Nothing to do. */
+    } else if (subfacet_is_evictable(subfacet)) {
+        heap_change(&subfacet_backer(subfacet)->installed,
+                    &subfacet->evict_node, priority);
+    } else {
+        subfacet->evict_node.priority = priority;
     }
-    return ret;
 }
 
-static int
-subfacet_reinstall(struct subfacet *subfacet, struct dpif_flow_stats *stats)
+/* Reserves room in 'subfacet''s backer for the datapath flow that a put about
+ * to be executed will install or modify, by uninstalling the least valuable
+ * installed subfacets if the backer would otherwise exceed 'flow_limit'.
+ * Until the caller calls backer_release_flow() after executing the put,
+ * 'subfacet' counts toward 'n_reserved' instead of the backer's heap, so
+ * that it is not itself evicted while its put is pending. */
+static void
+backer_reserve_flow(struct subfacet *subfacet)
 {
-    return subfacet_install(subfacet, subfacet->actions, subfacet->actions_len,
-                            stats, subfacet->slow);
+    struct dpif_backer *backer = subfacet_backer(subfacet);
+    bool was_evictable = subfacet_is_evictable(subfacet);
+
+    assert(!subfacet->put_pending);
+    subfacet->put_pending = true;
+    subfacet_update_evictable(subfacet, was_evictable);
+
+    backer->n_reserved++;
+    while (flow_limit
+           && heap_count(&backer->installed) + backer->n_reserved > flow_limit
+           && !heap_is_empty(&backer->installed)) {
+        struct subfacet *victim;
+
+        victim = CONTAINER_OF(heap_max(&backer->installed), struct subfacet,
+                              evict_node);
+        COVERAGE_INC(subfacet_evicted);
+        subfacet_uninstall(victim);
+    }
+}
+
+/* Releases the reservation that backer_reserve_flow() made for 'subfacet',
+ * whose put has now been executed. */
+static void
+backer_release_flow(struct subfacet *subfacet)
+{
+    bool was_evictable = subfacet_is_evictable(subfacet);
+
+    assert(subfacet->put_pending);
+    subfacet->put_pending = false;
+    subfacet_update_evictable(subfacet, was_evictable);
+    subfacet_backer(subfacet)->n_reserved--;
 }
 
 /* If 'subfacet' is installed in the datapath, uninstalls it. */
@@ -4916,7 +7501,7 @@ subfacet_uninstall(struct subfacet *subfacet)
         if (!error) {
             subfacet_update_stats(subfacet, &stats);
         }
-        subfacet->path = SF_NOT_INSTALLED;
+        subfacet_set_path(subfacet, SF_NOT_INSTALLED);
     } else {
         assert(subfacet->dp_packet_count == 0);
         assert(subfacet->dp_byte_count == 0);
@@ -4972,7 +7557,9 @@ subfacet_update_stats(struct subfacet *subfacet,
         facet->byte_count += stats->n_bytes;
         facet->tcp_flags |= stats->tcp_flags;
         facet_push_stats(facet);
-        netflow_flow_update_flags(&facet->nf_flow, stats->tcp_flags);
+        if (facet->nf_flow) {
+            netflow_flow_update_flags(facet->nf_flow, stats->tcp_flags);
+        }
     }
 }
 
@@ -4983,17 +7570,19 @@ rule_dpif_lookup(struct ofproto_dpif *ofproto, const struct flow *flow)
 {
     struct rule_dpif *rule;
 
-    rule = rule_dpif_lookup__(ofproto, flow, 0);
+    rule = rule_dpif_lookup__(ofproto, flow, 0, NULL);
     if (rule) {
         return rule;
     }
 
-    return rule_dpif_miss_rule(ofproto, flow);
+    return rule_dpif_miss_rule(ofproto, flow, true);
 }
 
+/* Looks up 'flow' in 'ofproto''s OpenFlow table 'table_id'.  If 'wc' is
+ * nonnull, adds to it the fields that the lookup examined. */
 static struct rule_dpif *
 rule_dpif_lookup__(struct ofproto_dpif *ofproto, const struct flow *flow,
-                   uint8_t table_id)
+                   uint8_t table_id, struct flow_wildcards *wc)
 {
     struct cls_rule *cls_rule;
     struct classifier *cls;
@@ -5010,21 +7599,27 @@ rule_dpif_lookup__(struct ofproto_dpif *ofproto, const struct flow *flow,
         struct flow ofpc_normal_flow = *flow;
         ofpc_normal_flow.tp_src = htons(0);
         ofpc_normal_flow.tp_dst = htons(0);
-        cls_rule = classifier_lookup(cls, &ofpc_normal_flow);
+        cls_rule = classifier_lookup(cls, &ofpc_normal_flow, wc);
     } else {
-        cls_rule = classifier_lookup(cls, flow);
+        cls_rule = classifier_lookup(cls, flow, wc);
     }
     return rule_dpif_cast(rule_from_cls_rule(cls_rule));
 }
 
+/* Returns the rule that sends 'flow' to the controller in 'ofproto'.  Logs a
+ * warning if 'flow''s input port does not exist, if 'warn' is true. */
 static struct rule_dpif *
-rule_dpif_miss_rule(struct ofproto_dpif *ofproto, const struct flow *flow)
+rule_dpif_miss_rule(struct ofproto_dpif *ofproto, const struct flow *flow,
+                    bool warn)
 {
     struct ofport_dpif *port;
 
     port = get_ofp_port(ofproto, flow->in_port);
     if (!port) {
-        VLOG_WARN_RL(&rl, "packet-in on unknown port %"PRIu16, flow->in_port);
+        if (warn) {
+            VLOG_WARN_RL(&rl, "packet-in on unknown port %"PRIu16,
+                         flow->in_port);
+        }
         return ofproto->miss_rule;
     }
 
@@ -5053,6 +7648,7 @@ static struct rule *
 rule_alloc(void)
 {
     struct rule_dpif *rule = xmalloc(sizeof *rule);
+    rule->in_expirations = false;
     return &rule->up;
 }
 
@@ -5060,6 +7656,7 @@ static void
 rule_dealloc(struct rule *rule_)
 {
     struct rule_dpif *rule = rule_dpif_cast(rule_);
+    rule_unschedule_expiration(rule);
     free(rule);
 }
 
@@ -5067,9 +7664,7 @@ static enum ofperr
 rule_construct(struct rule *rule_)
 {
     struct rule_dpif *rule = rule_dpif_cast(rule_);
-    struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
     struct rule_dpif *victim;
-    uint8_t table_id;
 
     rule->packet_count = 0;
     rule->byte_count = 0;
@@ -5095,19 +7690,7 @@ rule_construct(struct rule *rule_)
         list_init(&rule->facets);
     }
 
-    table_id = rule->up.table_id;
-    if (victim) {
-        rule->tag = victim->tag;
-    } else if (table_id == 0) {
-        rule->tag = 0;
-    } else {
-        struct flow flow;
-
-        miniflow_expand(&rule->up.cr.match.flow, &flow);
-        rule->tag = rule_calculate_tag(&flow, &rule->up.cr.match.mask,
-                                       ofproto->tables[table_id].basis);
-    }
-
+    rule_schedule_expiration(rule);
     complete_operation(rule);
     return 0;
 }
@@ -5116,8 +7699,11 @@ static void
 rule_destruct(struct rule *rule_)
 {
     struct rule_dpif *rule = rule_dpif_cast(rule_);
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
     struct facet *facet, *next_facet;
 
+    ofproto->xc_seq++;
+    rule_unschedule_expiration(rule);
     LIST_FOR_EACH_SAFE (facet, next_facet, list_node, &rule->facets) {
         facet_revalidate(facet);
     }
@@ -5257,7 +7843,7 @@ compose_slow_path(const struct ofproto_dpif *ofproto, const struct flow *flow,
 
     ofpbuf_use_stack(&buf, stub, stub_size);
     if (slow & (SLOW_CFM | SLOW_LACP | SLOW_STP)) {
-        uint32_t pid = dpif_port_get_pid(ofproto->backer->dpif, UINT16_MAX);
+        uint32_t pid = dpif_port_get_pid(ofproto->backer->dpif, UINT32_MAX);
         odp_put_userspace_action(pid, &cookie, &buf);
     } else {
         put_userspace_action(ofproto, &buf, flow, &cookie);
@@ -5425,10 +8011,47 @@ compose_output_action__(struct action_xlate_ctx *ctx, uint16_t ofp_port,
     ctx->flow.nw_tos = flow_nw_tos;
 }
 
-static void
-compose_output_action(struct action_xlate_ctx *ctx, uint16_t ofp_port)
+static void
+compose_output_action(struct action_xlate_ctx *ctx, uint16_t ofp_port)
+{
+    compose_output_action__(ctx, ofp_port, true);
+}
+
+/* If 'ctx' is recording dependencies, records that translation looked up
+ * 'ctx->flow' in OpenFlow table 'table_id' and found 'rule' (which may be
+ * null). */
+static void
+xlate_record_dep(struct action_xlate_ctx *ctx, uint8_t table_id,
+                 const struct rule_dpif *rule)
+{
+    struct xlate_dep *xd;
+
+    if (!ctx->deps || table_id >= N_TABLES) {
+        return;
+    }
+
+    xd = ofpbuf_put_uninit(ctx->deps, sizeof *xd);
+    xd->flow = ctx->flow;
+    if (xd->flow.nw_frag & FLOW_NW_FRAG_ANY
+        && ctx->ofproto->up.frag_handling == OFPC_FRAG_NORMAL) {
+        /* rule_dpif_lookup__() looks up fragments without L4 ports. */
+        xd->flow.tp_src = htons(0);
+        xd->flow.tp_dst = htons(0);
+    }
+    xd->matched = rule != NULL;
+    xd->priority = rule ? rule->up.cr.priority : 0;
+    xd->table_id = table_id;
+}
+
+/* Appends an entry of the given 'type' to 'ctx->xc', which must be nonnull,
+ * and returns it for the caller to fill in. */
+static struct xc_entry *
+xlate_add_xc(struct action_xlate_ctx *ctx, enum xc_type type)
 {
-    compose_output_action__(ctx, ofp_port, true);
+    struct xc_entry *entry = ofpbuf_put_uninit(ctx->xc, sizeof *entry);
+
+    entry->type = type;
+    return entry;
 }
 
 static void
@@ -5447,19 +8070,8 @@ xlate_table_action(struct action_xlate_ctx *ctx,
         /* Look up a flow with 'in_port' as the input port. */
         old_in_port = ctx->flow.in_port;
         ctx->flow.in_port = in_port;
-        rule = rule_dpif_lookup__(ofproto, &ctx->flow, table_id);
-
-        /* Tag the flow. */
-        if (table_id > 0 && table_id < N_TABLES) {
-            struct table_dpif *table = &ofproto->tables[table_id];
-            if (table->other_table) {
-                ctx->tags |= (rule && rule->tag
-                              ? rule->tag
-                              : rule_calculate_tag(&ctx->flow,
-                                                   &table->other_table->mask,
-                                                   table->basis));
-            }
-        }
+        rule = rule_dpif_lookup__(ofproto, &ctx->flow, table_id, &ctx->wc);
+        xlate_record_dep(ctx, table_id, rule);
 
         /* Restore the original input port.  Otherwise OFPP_NORMAL and
          * OFPP_IN_PORT will have surprising behavior. */
@@ -5477,7 +8089,7 @@ xlate_table_action(struct action_xlate_ctx *ctx,
              * OFPTC_TABLE_MISS_DROP
              * When OF1.0, OFPTC_TABLE_MISS_CONTINUE is used. What to do?
              */
-            rule = rule_dpif_miss_rule(ofproto, &ctx->flow);
+            rule = rule_dpif_miss_rule(ofproto, &ctx->flow, ctx->may_log);
         }
 
         if (rule) {
@@ -5486,6 +8098,9 @@ xlate_table_action(struct action_xlate_ctx *ctx,
             if (ctx->resubmit_stats) {
                 rule_credit_stats(rule, ctx->resubmit_stats);
             }
+            if (ctx->xc) {
+                xlate_add_xc(ctx, XC_RULE)->u.rule = rule;
+            }
 
             ctx->recurse++;
             ctx->rule = rule;
@@ -5496,10 +8111,9 @@ xlate_table_action(struct action_xlate_ctx *ctx,
 
         ctx->table_id = old_table_id;
     } else {
-        static struct vlog_rate_limit recurse_rl = VLOG_RATE_LIMIT_INIT(1, 1);
-
-        VLOG_ERR_RL(&recurse_rl, "resubmit actions recursed over %d times",
-                    MAX_RESUBMIT_RECURSION);
+        if (ctx->may_log) {
+            log_resubmit_recursion();
+        }
         ctx->max_resubmit_trigger = true;
     }
 }
@@ -5559,7 +8173,10 @@ execute_controller_action(struct action_xlate_ctx *ctx, int len,
         return;
     }
 
-    packet = ofpbuf_clone(ctx->packet);
+    /* This is the only copy of the packet on its way to the controller:
+     * connmgr_send_packet_in() composes the packet-in in its headroom. */
+    packet = ofpbuf_clone_with_headroom(ctx->packet,
+                                        OFPUTIL_PACKET_IN_HEADROOM);
 
     if (packet->l2 && packet->l3) {
         struct eth_header *eh;
@@ -5598,8 +8215,6 @@ execute_controller_action(struct action_xlate_ctx *ctx, int len,
         }
     }
 
-    pin.packet = packet->data;
-    pin.packet_len = packet->size;
     pin.reason = reason;
     pin.controller_id = controller_id;
     pin.table_id = ctx->table_id;
@@ -5608,8 +8223,7 @@ execute_controller_action(struct action_xlate_ctx *ctx, int len,
     pin.send_len = len;
     flow_get_metadata(&ctx->flow, &pin.fmd);
 
-    connmgr_send_packet_in(ctx->ofproto->up.connmgr, &pin);
-    ofpbuf_delete(packet);
+    connmgr_send_packet_in(ctx->ofproto->up.connmgr, &pin, packet);
 }
 
 static bool
@@ -5652,6 +8266,8 @@ xlate_output_action(struct action_xlate_ctx *ctx,
         xlate_table_action(ctx, ctx->flow.in_port, 0, may_packet_in);
         break;
     case OFPP_NORMAL:
+        /* OFPP_NORMAL may examine any field, e.g. to learn MAC addresses. */
+        flow_wildcards_init_exact(&ctx->wc);
         xlate_normal(ctx);
         break;
     case OFPP_FLOOD:
@@ -5813,22 +8429,43 @@ static void
 xlate_learn_action(struct action_xlate_ctx *ctx,
                    const struct ofpact_learn *learn)
 {
-    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 1);
-    struct ofputil_flow_mod fm;
+    struct ofputil_flow_mod stack_fm, *fm;
     uint64_t ofpacts_stub[1024 / 8];
     struct ofpbuf ofpacts;
-    int error;
 
     ofpbuf_use_stack(&ofpacts, ofpacts_stub, sizeof ofpacts_stub);
-    learn_execute(learn, &ctx->flow, &fm, &ofpacts);
+    if (ctx->xc) {
+        struct xc_learn *xl = xmalloc(sizeof *xl);
 
-    error = ofproto_flow_mod(&ctx->ofproto->up, &fm);
+        ofpbuf_init(&xl->ofpacts, 0);
+        learn_execute(learn, &ctx->flow, &xl->fm, &xl->ofpacts);
+        xlate_add_xc(ctx, XC_LEARN)->u.learn = xl;
+        fm = &xl->fm;
+    } else {
+        learn_execute(learn, &ctx->flow, &stack_fm, &ofpacts);
+        fm = &stack_fm;
+    }
+
+    if (ctx->may_learn) {
+        execute_learned_flow_mod(ctx->ofproto, fm);
+    }
+
+    ofpbuf_uninit(&ofpacts);
+}
+
+/* Adds or refreshes the flow that a "learn" action composed as 'fm'. */
+static void
+execute_learned_flow_mod(struct ofproto_dpif *ofproto,
+                         const struct ofputil_flow_mod *fm)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 1);
+    int error;
+
+    error = ofproto_flow_mod(&ofproto->up, fm);
     if (error && !VLOG_DROP_WARN(&rl)) {
         VLOG_WARN("learning action failed to modify flow table (%s)",
                   ofperr_get_name(error));
     }
-
-    ofpbuf_uninit(&ofpacts);
 }
 
 /* Reduces '*timeout' to no more than 'max'.  A value of zero in either case
@@ -5845,17 +8482,33 @@ static void
 xlate_fin_timeout(struct action_xlate_ctx *ctx,
                   const struct ofpact_fin_timeout *oft)
 {
-    if (ctx->tcp_flags & (TCP_FIN | TCP_RST) && ctx->rule) {
-        struct rule_dpif *rule = ctx->rule;
+    if (ctx->xc && ctx->rule) {
+        struct xc_entry *entry = xlate_add_xc(ctx, XC_FIN_TIMEOUT);
 
-        reduce_timeout(oft->fin_idle_timeout, &rule->up.idle_timeout);
-        reduce_timeout(oft->fin_hard_timeout, &rule->up.hard_timeout);
+        entry->u.fin.rule = ctx->rule;
+        entry->u.fin.idle = oft->fin_idle_timeout;
+        entry->u.fin.hard = oft->fin_hard_timeout;
+    }
+    if (ctx->tcp_flags & (TCP_FIN | TCP_RST) && ctx->rule) {
+        rule_reduce_timeouts(ctx->rule, oft->fin_idle_timeout,
+                             oft->fin_hard_timeout);
     }
 }
 
+static void
+rule_reduce_timeouts(struct rule_dpif *rule, uint16_t idle, uint16_t hard)
+{
+    reduce_timeout(idle, &rule->up.idle_timeout);
+    reduce_timeout(hard, &rule->up.hard_timeout);
+    rule_schedule_expiration(rule);
+}
+
 static bool
 may_receive(const struct ofport_dpif *port, struct action_xlate_ctx *ctx)
 {
+    if (port->up.pp.config & (OFPUTIL_PC_NO_RECV | OFPUTIL_PC_NO_RECV_STP)) {
+        memset(ctx->wc.masks.dl_dst, 0xff, sizeof ctx->wc.masks.dl_dst);
+    }
     if (port->up.pp.config & (eth_addr_equals(ctx->flow.dl_dst, eth_addr_stp)
                               ? OFPUTIL_PC_NO_RECV_STP
                               : OFPUTIL_PC_NO_RECV)) {
@@ -5874,6 +8527,54 @@ may_receive(const struct ofport_dpif *port, struct action_xlate_ctx *ctx)
     return true;
 }
 
+/* Returns true if translating 'a' examines and modifies only fields of the
+ * flow that translation already accounts for in 'ctx->wc', so that the
+ * resulting datapath flow may still be wildcarded, false if the datapath flow
+ * must be exact-match. */
+static bool
+xlate_action_may_wildcard(const struct ofpact *a)
+{
+    switch (a->type) {
+    case OFPACT_OUTPUT:
+    case OFPACT_CONTROLLER:
+    case OFPACT_ENQUEUE:
+    case OFPACT_RESUBMIT:
+    case OFPACT_SET_QUEUE:
+    case OFPACT_POP_QUEUE:
+    case OFPACT_NOTE:
+    case OFPACT_EXIT:
+    case OFPACT_CLEAR_ACTIONS:
+    case OFPACT_WRITE_METADATA:
+    case OFPACT_GOTO_TABLE:
+        return true;
+
+    case OFPACT_OUTPUT_REG:
+    case OFPACT_BUNDLE:
+    case OFPACT_SET_VLAN_VID:
+    case OFPACT_SET_VLAN_PCP:
+    case OFPACT_STRIP_VLAN:
+    case OFPACT_PUSH_VLAN:
+    case OFPACT_SET_ETH_SRC:
+    case OFPACT_SET_ETH_DST:
+    case OFPACT_SET_IPV4_SRC:
+    case OFPACT_SET_IPV4_DST:
+    case OFPACT_SET_IPV4_DSCP:
+    case OFPACT_SET_L4_SRC_PORT:
+    case OFPACT_SET_L4_DST_PORT:
+    case OFPACT_REG_MOVE:
+    case OFPACT_REG_LOAD:
+    case OFPACT_DEC_TTL:
+    case OFPACT_SET_TUNNEL:
+    case OFPACT_FIN_TIMEOUT:
+    case OFPACT_LEARN:
+    case OFPACT_MULTIPATH:
+    case OFPACT_AUTOPATH:
+        return false;
+    }
+
+    NOT_REACHED();
+}
+
 static void
 do_xlate_actions(const struct ofpact *ofpacts, size_t ofpacts_len,
                  struct action_xlate_ctx *ctx)
@@ -5888,8 +8589,10 @@ do_xlate_actions(const struct ofpact *ofpacts, size_t ofpacts_len,
         return;
     }
 
-    if (ctx->rule) {
-        /* Don't let the rule we're working on get evicted underneath us. */
+    if (ctx->rule && ctx->may_learn) {
+        /* Don't let the rule we're working on get evicted underneath us by a
+         * "learn" action.  Without 'may_learn' no flows can be added, and
+         * revalidator threads must not write to the rule. */
         was_evictable = ctx->rule->up.evictable;
         ctx->rule->up.evictable = false;
     }
@@ -5901,6 +8604,10 @@ do_xlate_actions(const struct ofpact *ofpacts, size_t ofpacts_len,
             break;
         }
 
+        if (!xlate_action_may_wildcard(a)) {
+            flow_wildcards_init_exact(&ctx->wc);
+        }
+
         switch (a->type) { //handle each type of action
         case OFPACT_OUTPUT:
             xlate_output_action(ctx, ofpact_get_OUTPUT(a)->port,
@@ -6004,7 +8711,7 @@ do_xlate_actions(const struct ofpact *ofpacts, size_t ofpacts_len,
             break;
         case OFPACT_LEARN:
             ctx->has_learn = true;
-            if (ctx->may_learn) {
+            if (ctx->may_learn || ctx->xc) {
                 xlate_learn_action(ctx, ofpact_get_LEARN(a));
             }
             break;
@@ -6048,7 +8755,7 @@ out:
         ofpbuf_clear(ctx->odp_actions);
         add_sflow_action(ctx);
     }
-    if (ctx->rule) {
+    if (ctx->rule && ctx->may_learn) {
         ctx->rule->up.evictable = was_evictable;
     }
 }
@@ -6067,10 +8774,88 @@ action_xlate_ctx_init(struct action_xlate_ctx *ctx,
     ctx->rule = rule;
     ctx->packet = packet;
     ctx->may_learn = packet != NULL;
+    ctx->may_log = true;
     ctx->tcp_flags = tcp_flags;
     ctx->resubmit_hook = NULL;
     ctx->report_hook = NULL;
     ctx->resubmit_stats = NULL;
+    ctx->deps = NULL;
+    ctx->xc = NULL;
+}
+
+/* Initializes 'ctx->wc' for translating 'ctx->flow'.  Fields that every
+ * datapath flow must match exactly are marked significant, as are the fields
+ * that looking up 'ctx->flow' in OpenFlow table 0 examines.  If megaflows are
+ * disabled, or if a feature that may examine any field is in use, makes
+ * 'ctx->wc' exact instead. */
+static void
+xlate_wc_init(struct action_xlate_ctx *ctx)
+{
+    struct ofproto_dpif *ofproto = ctx->ofproto;
+    struct flow_wildcards *wc = &ctx->wc;
+    const struct ofport_dpif *port;
+
+    port = get_ofp_port(ofproto, ctx->flow.in_port);
+    if (!enable_megaflows
+        || ofproto->has_mirrors || ofproto->netflow || ofproto->stp
+        || !hmap_is_empty(&ofproto->vlandev_map)
+        || connmgr_has_in_band(ofproto->up.connmgr)
+        || (port && (port->cfm || (port->bundle && port->bundle->lacp)))) {
+        flow_wildcards_init_exact(wc);
+        return;
+    }
+
+    flow_wildcards_init_catchall(wc);
+    memset(&wc->masks.tunnel, 0xff, sizeof wc->masks.tunnel);
+    wc->masks.in_port = UINT32_MAX;
+    wc->masks.skb_priority = UINT32_MAX;
+    wc->masks.vlan_tci = htons(UINT16_MAX);
+    wc->masks.dl_type = htons(UINT16_MAX);
+    wc->masks.nw_proto = UINT8_MAX;
+    wc->masks.nw_frag = UINT8_MAX;
+
+    if (ctx->rule) {
+        rule_dpif_lookup__(ofproto, &ctx->flow, 0, wc);
+    }
+}
+
+/* Normally false.  Set to true if we ever hit MAX_RESUBMIT_RECURSION, so that
+ * in the future xlate_actions() always keeps a copy of the original flow for
+ * tracing purposes.  Only the main thread sets it, and never while revalidator
+ * threads are translating. */
+static bool hit_resubmit_limit;
+
+static void
+log_resubmit_recursion(void)
+{
+    static struct vlog_rate_limit recurse_rl = VLOG_RATE_LIMIT_INIT(1, 1);
+
+    VLOG_ERR_RL(&recurse_rl, "resubmit actions recursed over %d times",
+                MAX_RESUBMIT_RECURSION);
+}
+
+/* Reports that translating 'orig_flow' for 'ofproto', with 'packet' (which may
+ * be null) and 'initial_tci', recursed more than MAX_RESUBMIT_RECURSION times,
+ * by logging a trace of the translation.  'orig_flow' is null if the caller
+ * did not record the original flow, which is the case until the first time
+ * that this function is called.  Only the main thread may call this
+ * function. */
+static void
+report_resubmit_limit(struct ofproto_dpif *ofproto,
+                      const struct flow *orig_flow,
+                      const struct ofpbuf *packet, ovs_be16 initial_tci)
+{
+    static struct vlog_rate_limit trace_rl = VLOG_RATE_LIMIT_INIT(1, 1);
+
+    hit_resubmit_limit = true;
+    if (orig_flow && !VLOG_DROP_ERR(&trace_rl)) {
+        struct ds ds = DS_EMPTY_INITIALIZER;
+
+        ofproto_trace(ofproto, orig_flow, packet, initial_tci, &ds);
+        VLOG_ERR("Trace triggered by excessive resubmit recursion:\n%s",
+                 ds_cstr(&ds));
+        ds_destroy(&ds);
+    }
 }
 
 /* Translates the 'ofpacts_len' bytes of "struct ofpacts" starting at 'ofpacts'
@@ -6080,11 +8865,6 @@ xlate_actions(struct action_xlate_ctx *ctx,
               const struct ofpact *ofpacts, size_t ofpacts_len,
               struct ofpbuf *odp_actions)
 {
-    /* Normally false.  Set to true if we ever hit MAX_RESUBMIT_RECURSION, so
-     * that in the future we always keep a copy of the original flow for
-     * tracing purposes. */
-    static bool hit_resubmit_limit;
-
     enum slow_path_reason special;
 
     COVERAGE_INC(ofproto_dpif_xlate);
@@ -6105,6 +8885,13 @@ xlate_actions(struct action_xlate_ctx *ctx,
     ctx->orig_skb_priority = ctx->flow.skb_priority;
     ctx->table_id = 0;
     ctx->exit = false;
+    if (ctx->deps) {
+        ofpbuf_clear(ctx->deps);
+    }
+    if (ctx->xc) {
+        xc_clear(ctx->xc);
+    }
+    xlate_wc_init(ctx);
 
     if (ctx->ofproto->has_mirrors || hit_resubmit_limit) {
         /* Do this conditionally because the copy is expensive enough that it
@@ -6135,30 +8922,25 @@ xlate_actions(struct action_xlate_ctx *ctx,
         }
     }
 
+    if (ctx->rule) {
+        xlate_record_dep(ctx, 0, (ctx->rule->up.table_id == 0
+                                  ? ctx->rule : NULL));
+    }
+
     special = process_special(ctx->ofproto, &ctx->flow, ctx->packet);//get slow path reason
     if (special) {
         ctx->slow |= special;
     } else {
-        static struct vlog_rate_limit trace_rl = VLOG_RATE_LIMIT_INIT(1, 1);
         ovs_be16 initial_tci = ctx->base_flow.vlan_tci;
 
         add_sflow_action(ctx);
         do_xlate_actions(ofpacts, ofpacts_len, ctx);
 
-        if (ctx->max_resubmit_trigger && !ctx->resubmit_hook) {
-            if (!hit_resubmit_limit) {
-                /* We didn't record the original flow.  Make sure we do from
-                 * now on. */
-                hit_resubmit_limit = true;
-            } else if (!VLOG_DROP_ERR(&trace_rl)) {
-                struct ds ds = DS_EMPTY_INITIALIZER;
-
-                ofproto_trace(ctx->ofproto, &ctx->orig_flow, ctx->packet,
-                              initial_tci, &ds);
-                VLOG_ERR("Trace triggered by excessive resubmit "
-                         "recursion:\n%s", ds_cstr(&ds));
-                ds_destroy(&ds);
-            }
+        if (ctx->max_resubmit_trigger && !ctx->resubmit_hook
+            && ctx->may_log) {
+            report_resubmit_limit(ctx->ofproto, (hit_resubmit_limit
+                                                 ? &ctx->orig_flow : NULL),
+                                  ctx->packet, initial_tci);
         }
 
         if (!connmgr_may_set_up_flow(ctx->ofproto->up.connmgr, &ctx->flow,
@@ -6710,6 +9492,12 @@ xlate_normal(struct action_xlate_ctx *ctx)
     }
 
     /* Learn source MAC. */
+    if (ctx->xc) {
+        struct xc_entry *entry = xlate_add_xc(ctx, XC_NORMAL);
+
+        entry->u.normal.flow = xmemdup(&ctx->flow, sizeof ctx->flow);
+        entry->u.normal.vlan = vlan;
+    }
     if (ctx->may_learn) {
         update_learning_table(ctx->ofproto, &ctx->flow, vlan, in_bundle);
     }
@@ -6744,88 +9532,229 @@ xlate_normal(struct action_xlate_ctx *ctx)
  *
  * It's a difficult problem, in general, to tell which facets need to have
  * their actions recalculated whenever the OpenFlow flow table changes.  We
- * don't try to solve that general problem: for most kinds of OpenFlow flow
- * table changes, we recalculate the actions for every facet.  This is
- * relatively expensive, but it's good enough if the OpenFlow flow table
- * doesn't change very often.
+ * approach it by having flow translation record each OpenFlow table lookup
+ * that it performs, as a "struct facet_dep" that is indexed by the table that
+ * was searched.  A change to a rule in that table queues a copy of the rule's
+ * match.  Later, run() considers only the facets that searched the table and,
+ * of those, revalidates only the ones whose lookups the changed rule could
+ * match, for any packet that the facet's datapath flows cover.
  *
- * However, we can expect one particular kind of OpenFlow flow table change to
- * happen frequently: changes caused by MAC learning.  To avoid wasting a lot
- * of CPU on revalidating every facet whenever MAC learning modifies the flow
- * table, we add a special case that applies to flow tables in which every rule
- * has the same form (that is, the same wildcards), except that the table is
- * also allowed to have a single "catch-all" flow that matches all packets.  We
- * optimize this case by tagging all of the facets that resubmit into the table
- * and invalidating the same tag whenever a flow changes in that table.  The
- * end result is that we revalidate just the facets that need it (and sometimes
- * a few more, but not all of the facets or even all of the facets that
- * resubmit to the table modified by MAC learning). */
-
-/* Calculates the tag to use for 'flow' and mask 'mask' when it is inserted
- * into an OpenFlow table with the given 'basis'. */
-static tag_type
-rule_calculate_tag(const struct flow *flow, const struct minimask *mask,
-                   uint32_t secret)
-{
-    if (minimask_is_catchall(mask)) {
-        return 0;
-    } else {
-        uint32_t hash = flow_hash_in_minimask(flow, mask, secret);
-        return tag_create_deterministic(hash);
+ * Changes caused by MAC learning and bonding are tracked separately, using
+ * the tags that translation collects in 'tags'. */
+
+/* Returns true if 'change', a change to a rule in 'dep''s OpenFlow table,
+ * might change the result of 'dep''s lookup for some packet covered by
+ * 'dep''s facet's datapath flows.
+ *
+ * A datapath flow for the facet covers every packet that agrees with the
+ * facet's flow on the fields in the facet's mask (or on every field, if it has
+ * no mask).  The flow looked up for such a packet agrees with 'dep''s flow on
+ * those fields and also on any field that translation changed before the
+ * lookup.  The rule might match the lookup only if it agrees with 'dep''s flow
+ * on all of those fields that it matches.  Also, a rule with lower priority
+ * than the one the lookup found cannot displace it. */
+static bool
+facet_dep_is_affected(const struct facet_dep *dep,
+                      const struct table_change *change)
+{
+    const struct facet *facet = dep->facet;
+    const struct flow *lookup = dep->flow ? dep->flow : &facet->flow;
+    const uint32_t *facet_u32 = (const uint32_t *) &facet->flow;
+    const uint32_t *lookup_u32 = (const uint32_t *) lookup;
+    const struct minimatch *match = &change->match;
+    const uint32_t *p;
+    int i;
+
+    if (dep->matched && change->priority < dep->priority) {
+        return false;
+    }
+
+    p = match->mask.masks.values;
+    for (i = 0; i < MINI_N_MAPS; i++) {
+        uint32_t map;
+
+        for (map = match->mask.masks.map[i]; map;
+             map = zero_rightmost_1bit(map)) {
+            int ofs = raw_ctz(map) + i * 32;
+            uint32_t fixed;
+
+            fixed = (facet->has_mask
+                     ? minimask_get(&facet->mask, ofs)
+                     : UINT32_MAX);
+            fixed |= lookup_u32[ofs] ^ facet_u32[ofs];
+            if ((miniflow_get(&match->flow, ofs) ^ lookup_u32[ofs])
+                & *p & fixed) {
+                return false;
+            }
+            p++;
+        }
     }
+
+    return true;
 }
 
-/* Following a change to OpenFlow table 'table_id' in 'ofproto', update the
- * taggability of that table.
- *
- * This function must be called after *each* change to a flow table.  If you
- * skip calling it on some changes then the pointer comparisons at the end can
- * be invalid if you get unlucky.  For example, if a flow removal causes a
- * cls_table to be destroyed and then a flow insertion causes a cls_table with
- * different wildcards to be created with the same address, then this function
- * will incorrectly skip revalidation. */
+/* Returns true if 'dep''s lookup might be affected by any of the rules that
+ * changed in its OpenFlow table since the last revalidation. */
+static bool
+facet_dep_is_stale(const struct facet_dep *dep,
+                   const struct table_dpif *table)
+{
+    size_t i;
+
+    if (table->changes_overflow) {
+        return true;
+    }
+    for (i = 0; i < table->n_changes; i++) {
+        if (facet_dep_is_affected(dep, &table->changes[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns true if a rule that changed since the last revalidation might
+ * affect one of the OpenFlow table lookups that 'facet''s translation did. */
+static bool
+facet_has_changed_deps(const struct facet *facet)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+    size_t i;
+
+    if (!ofproto->tables_changed) {
+        return false;
+    }
+    for (i = 0; i < facet->n_deps; i++) {
+        const struct facet_dep *dep = &facet->deps[i];
+
+        if (facet_dep_is_stale(dep, &ofproto->tables[dep->table_id])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Removes 'facet''s dependencies from their tables and frees them. */
 static void
-table_update_taggable(struct ofproto_dpif *ofproto, uint8_t table_id)
+facet_clear_deps(struct facet *facet)
 {
-    struct table_dpif *table = &ofproto->tables[table_id];
-    const struct oftable *oftable = &ofproto->up.tables[table_id];
-    struct cls_table *catchall, *other;
-    struct cls_table *t;
+    size_t i;
 
-    catchall = other = NULL;
+    for (i = 0; i < facet->n_deps; i++) {
+        struct facet_dep *dep = &facet->deps[i];
 
-    switch (hmap_count(&oftable->cls.tables)) {
-    case 0:
-        /* We could tag this OpenFlow table but it would make the logic a
-         * little harder and it's a corner case that doesn't seem worth it
-         * yet. */
-        break;
+        list_remove(&dep->list_node);
+        free(dep->flow);
+    }
+    free(facet->deps);
+    facet->deps = NULL;
+    facet->n_deps = 0;
+}
 
-    case 1:
-    case 2:
-        HMAP_FOR_EACH (t, hmap_node, &oftable->cls.tables) {
-            if (cls_table_is_catchall(t)) {
-                catchall = t;
-            } else if (!other) {
-                other = t;
-            } else {
-                /* Indicate that we can't tag this by setting both tables to
-                 * NULL.  (We know that 'catchall' is already NULL.) */
-                other = NULL;
-            }
+/* Replaces 'facet''s dependencies by the "struct xlate_dep"s in 'xlate_deps',
+ * as recorded by xlate_actions(). */
+static void
+facet_set_deps(struct facet *facet, const struct ofpbuf *xlate_deps)
+{
+    struct ofproto_dpif *ofproto = ofproto_dpif_cast(facet->rule->up.ofproto);
+    const struct xlate_dep *xd = xlate_deps->data;
+    size_t n = xlate_deps->size / sizeof *xd;
+    size_t i;
+
+    facet_clear_deps(facet);
+    if (!n) {
+        return;
+    }
+
+    facet->deps = xmalloc(n * sizeof *facet->deps);
+    facet->n_deps = n;
+    for (i = 0; i < n; i++) {
+        struct facet_dep *dep = &facet->deps[i];
+
+        dep->facet = facet;
+        dep->flow = (flow_equal(&xd[i].flow, &facet->flow)
+                     ? NULL
+                     : xmemdup(&xd[i].flow, sizeof xd[i].flow));
+        dep->priority = xd[i].priority;
+        dep->matched = xd[i].matched;
+        dep->table_id = xd[i].table_id;
+        list_push_back(&ofproto->tables[dep->table_id].deps, &dep->list_node);
+    }
+}
+
+/* Forgets the rule changes queued in 'table'. */
+static void
+table_clear_changes(struct table_dpif *table)
+{
+    size_t i;
+
+    for (i = 0; i < table->n_changes; i++) {
+        minimatch_destroy(&table->changes[i].match);
+    }
+    table->n_changes = 0;
+    table->changes_overflow = false;
+}
+
+/* Forgets the rule changes queued in every table in 'ofproto'. */
+static void
+clear_table_changes(struct ofproto_dpif *ofproto)
+{
+    if (ofproto->tables_changed) {
+        int i;
+
+        for (i = 0; i < N_TABLES; i++) {
+            table_clear_changes(&ofproto->tables[i]);
         }
-        break;
+        ofproto->tables_changed = false;
+    }
+}
 
-    default:
-        /* Can't tag this table. */
-        break;
+/* Revalidates each facet in 'ofproto' that one of the rule changes queued by
+ * rule_invalidate() might affect, then forgets the changes. */
+static void
+revalidate_changed_facets(struct ofproto_dpif *ofproto)
+{
+    struct facet **facets = NULL;
+    size_t n_facets = 0;
+    size_t allocated_facets = 0;
+    size_t i;
+
+    for (i = 0; i < N_TABLES; i++) {
+        struct table_dpif *table = &ofproto->tables[i];
+        struct facet_dep *dep;
+
+        if (!table->n_changes && !table->changes_overflow) {
+            continue;
+        }
+
+        LIST_FOR_EACH (dep, list_node, &table->deps) {
+            struct facet *facet = dep->facet;
+
+            if (facet->stale) {
+                continue;
+            }
+
+            COVERAGE_INC(rev_flow_table_check);
+            if (facet_dep_is_stale(dep, table)) {
+                if (n_facets >= allocated_facets) {
+                    facets = x2nrealloc(facets, &allocated_facets,
+                                        sizeof *facets);
+                }
+                facets[n_facets++] = facet;
+                facet->stale = true;
+            }
+        }
+        table_clear_changes(table);
     }
+    ofproto->tables_changed = false;
 
-    if (table->catchall_table != catchall || table->other_table != other) {
-        table->catchall_table = catchall;
-        table->other_table = other;
-        ofproto->need_revalidate = REV_FLOW_TABLE;
+    /* Revalidation rewrites the revalidated facets' dependencies, so it must
+     * not start until the loop above has finished with them. */
+    for (i = 0; i < n_facets; i++) {
+        COVERAGE_INC(rev_flow_table_facet);
+        facets[i]->stale = false;
     }
+    revalidate_facets(ofproto, facets, n_facets);
+    free(facets);
 }
 
 /* Given 'rule' that has changed in some way (either it is a rule being
@@ -6833,26 +9762,37 @@ table_update_taggable(struct ofproto_dpif *ofproto, uint8_t table_id)
  * modified), marks facets for revalidation to ensure that packets will be
  * forwarded correctly according to the new state of the flow table.
  *
- * This function must be called after *each* change to a flow table.  See
- * the comment on table_update_taggable() for more information. */
+ * This function must be called after *each* change to a flow table. */
 static void
 rule_invalidate(const struct rule_dpif *rule)
 {
     struct ofproto_dpif *ofproto = ofproto_dpif_cast(rule->up.ofproto);
+    struct table_dpif *table = &ofproto->tables[rule->up.table_id];
+    struct table_change *change;
 
-    table_update_taggable(ofproto, rule->up.table_id);
-
-    if (!ofproto->need_revalidate) {
-        struct table_dpif *table = &ofproto->tables[rule->up.table_id];
+    COVERAGE_INC(rev_flow_table);
+    if (ofproto->need_revalidate
+        || table->changes_overflow
+        || list_is_empty(&table->deps)) {
+        /* Every affected facet will be revalidated anyway. */
+        return;
+    }
 
-        if (table->other_table && rule->tag) {
-            tag_set_add(&ofproto->revalidate_set, rule->tag);
-        } else {
-            ofproto->need_revalidate = REV_FLOW_TABLE;
+    if (table->n_changes >= MAX_TABLE_CHANGES) {
+        table_clear_changes(table);
+        table->changes_overflow = true;
+    } else {
+        if (!table->changes) {
+            table->changes = xmalloc(MAX_TABLE_CHANGES
+                                     * sizeof *table->changes);
         }
+        change = &table->changes[table->n_changes++];
+        minimatch_clone(&change->match, &rule->up.cr.match);
+        change->priority = rule->up.cr.priority;
     }
+    ofproto->tables_changed = true;
 }
-
+
 static bool
 set_frag_handling(struct ofproto *ofproto_,
                   enum ofp_config_flags frag_handling)
@@ -6916,6 +9856,15 @@ set_netflow(struct ofproto *ofproto_,
         }
         return netflow_set_options(ofproto->netflow, netflow_options);
     } else {
+        struct facet *facet;
+
+        /* Free the facets' NetFlow tracking data, which is no longer
+         * needed. */
+        HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
+            free(facet->nf_flow);
+            facet->nf_flow = NULL;
+        }
+
         netflow_destroy(ofproto->netflow);
         ofproto->netflow = NULL;
         return 0;
@@ -6935,7 +9884,8 @@ static void
 send_active_timeout(struct ofproto_dpif *ofproto, struct facet *facet)
 {
     if (!facet_is_controller_flow(facet) &&
-        netflow_active_timeout_expired(ofproto->netflow, &facet->nf_flow)) {
+        netflow_active_timeout_expired(ofproto->netflow,
+                                       facet_get_nf_flow(facet))) {
         struct subfacet *subfacet;
         struct ofexpired expired;
 
@@ -6952,7 +9902,7 @@ send_active_timeout(struct ofproto_dpif *ofproto, struct facet *facet)
         expired.packet_count = facet->packet_count;
         expired.byte_count = facet->byte_count;
         expired.used = facet->used;
-        netflow_expire(ofproto->netflow, &facet->nf_flow, &expired);
+        netflow_expire(ofproto->netflow, facet->nf_flow, &expired);
     }
 }
 
@@ -7340,6 +10290,39 @@ ofproto_dpif_clog(struct unixctl_conn *conn OVS_UNUSED, int argc OVS_UNUSED,
     unixctl_command_reply(conn, NULL);
 }
 
+/* Sets 'enable_megaflows' to 'enable' and revalidates every facet, so that
+ * datapath flows get reinstalled with the appropriate masks. */
+static void
+ofproto_dpif_set_megaflows(struct unixctl_conn *conn, bool enable)
+{
+    struct ofproto_dpif *ofproto;
+
+    enable_megaflows = enable;
+    HMAP_FOR_EACH (ofproto, all_ofproto_dpifs_node, &all_ofproto_dpifs) {
+        ofproto->need_revalidate = REV_RECONFIGURE;
+    }
+    unixctl_command_reply(conn, enable ? "megaflows enabled"
+                                       : "megaflows disabled");
+}
+
+static void
+ofproto_dpif_enable_megaflows(struct unixctl_conn *conn,
+                              int argc OVS_UNUSED,
+                              const char *argv[] OVS_UNUSED,
+                              void *aux OVS_UNUSED)
+{
+    ofproto_dpif_set_megaflows(conn, true);
+}
+
+static void
+ofproto_dpif_disable_megaflows(struct unixctl_conn *conn,
+                               int argc OVS_UNUSED,
+                               const char *argv[] OVS_UNUSED,
+                               void *aux OVS_UNUSED)
+{
+    ofproto_dpif_set_megaflows(conn, false);
+}
+
 static void
 ofproto_dpif_unclog(struct unixctl_conn *conn OVS_UNUSED, int argc OVS_UNUSED,
                     const char *argv[] OVS_UNUSED, void *aux OVS_UNUSED)
@@ -7358,7 +10341,7 @@ ofproto_dpif_self_check__(struct ofproto_dpif *ofproto, struct ds *reply)
 
     errors = 0;
     HMAP_FOR_EACH (facet, hmap_node, &ofproto->facets) {
-        if (!facet_check_consistency(facet)) {
+        if (!facet_is_pending(facet) && !facet_check_consistency(facet)) {
             errors++;
         }
     }
@@ -7464,6 +10447,7 @@ show_dp_format(const struct ofproto_dpif *ofproto, struct ds *ds)
         struct ofport *ofport = node->data;
         const char *name = netdev_get_name(ofport->netdev);
         const char *type = netdev_get_type(ofport->netdev);
+        const struct ofport_dpif *port;
 
         ds_put_format(ds, "\t%s %u/%u:", name, ofport->ofp_port,
                       ofp_port_to_odp_port(ofproto, ofport->ofp_port));
@@ -7498,6 +10482,11 @@ show_dp_format(const struct ofproto_dpif *ofproto, struct ds *ds)
             ds_put_char(ds, ')');
         }
         ds_put_char(ds, '\n');
+
+        port = ofport_dpif_cast(ofport);
+        ds_put_format(ds, "\t\tupcalls: handled:%"PRIu64" dropped:%"PRIu64
+                      " weight:%u\n", port->n_upcalls_handled,
+                      port->n_upcalls_dropped, port->upcall_weight);
     }
     free(ports);
 }
@@ -7577,7 +10566,8 @@ ofproto_unixctl_dpif_dump_flows(struct unixctl_conn *conn,
         }
 
         ds_put_cstr(&ds, ", actions:");
-        format_odp_actions(&ds, subfacet->actions, subfacet->actions_len);
+        format_odp_actions(&ds, subfacet_actions(subfacet),
+                           subfacet_actions_len(subfacet));
         ds_put_char(&ds, '\n');
     }
 
@@ -7605,6 +10595,63 @@ ofproto_unixctl_dpif_del_flows(struct unixctl_conn *conn,
     ds_destroy(&ds);
 }
 
+static void
+ofproto_dpif_show_flow_setup(struct unixctl_conn *conn, int argc OVS_UNUSED,
+                             const char *argv[], void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+    const struct ofproto_dpif *ofproto;
+
+    ofproto = ofproto_dpif_lookup(argv[1]);
+    if (!ofproto) {
+        unixctl_command_reply_error(conn, "no such bridge");
+        return;
+    }
+
+    if (ofproto->governor) {
+        governor_format(ofproto->governor, &ds);
+    } else {
+        ds_put_cstr(&ds, "governor: disengaged\nbudget: unlimited\n");
+    }
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
+static void
+ofproto_dpif_show_revalidation(struct unixctl_conn *conn,
+                               int argc OVS_UNUSED,
+                               const char *argv[] OVS_UNUSED,
+                               void *aux OVS_UNUSED)
+{
+    struct ds ds = DS_EMPTY_INITIALIZER;
+    const struct shash_node **ofprotos;
+    struct shash ofproto_shash;
+    size_t i;
+
+    if (revalidation_budget) {
+        ds_put_format(&ds, "budget: %ums\n", revalidation_budget);
+    } else {
+        ds_put_cstr(&ds, "budget: unlimited\n");
+    }
+
+    shash_init(&ofproto_shash);
+    ofprotos = get_ofprotos(&ofproto_shash);
+    for (i = 0; i < shash_count(&ofproto_shash); i++) {
+        const struct ofproto_dpif *ofproto = ofprotos[i]->data;
+
+        ds_put_format(&ds, "%s: pending:%zu passes:%u longest:%lldms\n",
+                      ofprotos[i]->name,
+                      list_size(&ofproto->pending_facets),
+                      ofproto->n_revalidation_passes,
+                      ofproto->max_revalidation_msec);
+    }
+    shash_destroy(&ofproto_shash);
+    free(ofprotos);
+
+    unixctl_command_reply(conn, ds_cstr(&ds));
+    ds_destroy(&ds);
+}
+
 static void
 ofproto_dpif_unixctl_init(void)
 {
@@ -7636,6 +10683,14 @@ ofproto_dpif_unixctl_init(void)
                              ofproto_unixctl_dpif_dump_flows, NULL);
     unixctl_command_register("dpif/del-flows", "bridge", 1, 1,
                              ofproto_unixctl_dpif_del_flows, NULL);
+    unixctl_command_register("dpif/enable-megaflows", "", 0, 0,
+                             ofproto_dpif_enable_megaflows, NULL);
+    unixctl_command_register("dpif/disable-megaflows", "", 0, 0,
+                             ofproto_dpif_disable_megaflows, NULL);
+    unixctl_command_register("dpif/show-revalidation", "", 0, 0,
+                             ofproto_dpif_show_revalidation, NULL);
+    unixctl_command_register("dpif/show-flow-setup", "bridge", 1, 1,
+                             ofproto_dpif_show_flow_setup, NULL);
 }
 
 /* Linux VLAN device support (e.g. "eth0.10" for VLAN 10.)
@@ -7915,6 +10970,7 @@ const struct ofproto_class ofproto_dpif_class = {
     set_stp_port,
     get_stp_port_status,
     set_queues,
+    set_upcall_weight,
     bundle_set,
     bundle_remove,
     mirror_set,
@@ -7922,6 +10978,7 @@ const struct ofproto_class ofproto_dpif_class = {
     set_flood_vlans,
     is_mirror_output_bundle,
     forward_bpdu_changed,
+    flow_setup_budget_changed,
     set_mac_idle_time,
     set_realdev,
 };
@@ -52,6 +52,10 @@ struct ofproto {
                                        * ofproto-dpif implementation */
     bool forward_bpdu;          /* Option to allow forwarding of BPDU frames
                                  * when NORMAL action is invoked. */
+    unsigned flow_setup_rate;   /* Flow setups per second for each source of
+                                 * flows, 0 for no limit. */
+    unsigned flow_setup_burst;  /* Maximum flow setups in a burst. */
+    enum ofproto_flow_setup_key flow_setup_key; /* Sources of flows. */
     char *mfr_desc;             /* Manufacturer. */
     char *hw_desc;              /* Hardware. */
     char *sw_desc;              /* Software version. */
@@ -79,6 +83,8 @@ struct ofproto {
     struct list pending;        /* List of "struct ofopgroup"s. */
     unsigned int n_pending;     /* list_size(&pending). */
     struct hmap deletions;      /* All OFOPERATION_DELETE "ofoperation"s. */
+    struct ofopgroup *flow_mod_batch; /* Flow_mods not yet submitted. */
+    struct list flow_dumps;     /* Flow stats dumps in progress. */
 
     /* Flow table operation logging. */
     int n_add, n_delete, n_modify; /* Number of unreported ops of each kind. */
@@ -151,6 +157,8 @@ enum oftable_flags {
 struct oftable {
     enum oftable_flags flags;
     struct classifier cls;      /* Contains "struct rule"s. */
+    struct list rules;          /* Also contains all of them, via
+                                 * 'table_node', for flow stats dumps. */
     char *name;                 /* Table name exposed via OpenFlow, or NULL. */
 
     /* Maximum number of flows or UINT_MAX if there is no limit besides any
@@ -178,6 +186,23 @@ struct oftable {
     uint32_t eviction_group_id_basis;
     struct hmap eviction_groups_by_id;
     struct heap eviction_groups_by_size;
+
+    /* Secondary indexes.
+     *
+     * These group the rules in 'cls' by flow cookie and by the ports that
+     * their actions output to, so that flow_mods and flow stats requests that
+     * select rules by exact cookie or by out_port need only visit the rules
+     * that they select.  Both contain "struct rule_index_group"s. */
+    struct hmap cookie_groups;
+    struct hmap out_port_groups;
+};
+
+/* A rule's membership in one of the groups in its oftable's 'cookie_groups'
+ * or 'out_port_groups'. */
+struct rule_index_ref {
+    struct list list_node;          /* In group's "refs" list. */
+    struct rule_index_group *group; /* Containing group, NULL if none. */
+    struct rule *rule;              /* The rule that this references. */
 };
 
 /* Assigns TABLE to each oftable, in turn, in OFPROTO.
@@ -196,6 +221,7 @@ struct rule {
     struct list ofproto_node;    /* Owned by ofproto base code. */
     struct ofproto *ofproto;     /* The ofproto that contains this rule. */
     struct cls_rule cr;          /* In owning ofproto's classifier. */
+    struct list table_node;      /* In owning oftable's 'rules'. */
 
     struct ofoperation *pending; /* Operation now in progress, if nonnull. */
 
@@ -217,6 +243,11 @@ struct rule {
     struct ofpact *ofpacts;      /* Sequence of "struct ofpacts". */
     unsigned int ofpacts_len;    /* Size of 'ofpacts', in bytes. */
 
+    /* Secondary indexes. */
+    struct rule_index_ref cookie_ref;     /* In 'flow_cookie''s group. */
+    struct rule_index_ref *out_port_refs; /* One per port output to. */
+    size_t n_out_port_refs;
+
     /* Flow monitors. */
     enum nx_flow_monitor_flags monitor_flags;
     uint64_t add_seqno;         /* Sequence number when added. */
@@ -1198,6 +1229,16 @@ struct ofproto_class {
     int (*set_queues)(struct ofport *ofport,
                       const struct ofproto_port_queue *queues, size_t n_qdscp);
 
+    /* Sets the weight of 'ofport' in the scheduling of the packets that it
+     * receives and that need userspace processing, e.g. to set up flows, to
+     * 'weight', which is at least 1.  When several ports compete for this
+     * processing, each of them gets a share proportional to its weight.  The
+     * default weight is 1.
+     *
+     * EOPNOTSUPP as a return value indicates that this ofproto_class does not
+     * support weighted scheduling, as does a null pointer. */
+    int (*set_upcall_weight)(struct ofport *ofport, unsigned int weight);
+
     /* If 's' is nonnull, this function registers a "bundle" associated with
      * client data pointer 'aux' in 'ofproto'.  A bundle is the same concept as
      * a Port in OVSDB, that is, it consists of one or more "slave" devices
@@ -1268,6 +1309,11 @@ struct ofproto_class {
      * will be invoked. */
     void (*forward_bpdu_changed)(struct ofproto *ofproto);
 
+    /* When the flow setup budget in 'ofproto''s flow_setup_rate,
+     * flow_setup_burst, and flow_setup_key changes, this function will be
+     * invoked. */
+    void (*flow_setup_budget_changed)(struct ofproto *ofproto);
+
     /* Sets the MAC aging timeout for the OFPP_NORMAL action to 'idle_time',
      * in seconds. */
     void (*set_mac_idle_time)(struct ofproto *ofproto, unsigned int idle_time);
@@ -1294,6 +1340,16 @@ struct ofproto_class {
 
 extern const struct ofproto_class ofproto_dpif_class;
 
+/* Configuration of every datapath, from the ofproto_set_*() functions that do
+ * not take an ofproto.  ofproto providers apply it as they run. */
+extern unsigned n_handler_threads;
+extern unsigned n_revalidator_threads;
+extern unsigned revalidation_budget; /* In milliseconds, 0 for no limit. */
+extern unsigned stats_batch;         /* In flows, 0 for no limit. */
+extern unsigned flow_limit;          /* In flows, 0 for no limit. */
+extern unsigned flow_miss_batch;     /* In upcalls. */
+extern unsigned flow_miss_hold;      /* In milliseconds. */
+
 int ofproto_class_register(const struct ofproto_class *);
 int ofproto_class_unregister(const struct ofproto_class *);
 
@@ -103,13 +103,26 @@ struct ofopgroup {
     struct ofconn *ofconn;      /* ofconn for reply (but see note above). */
     struct ofp_header *request; /* Original request (truncated at 64 bytes). */
     uint32_t buffer_id;         /* Buffer id from original request. */
+
+    /* A batch of flow_mods (see handle_flow_mod__()) has no single original
+     * request.  Instead, 'requests' holds a copy of each request (truncated
+     * at 64 bytes), each ofoperation refers to its own request by offset
+     * within 'requests', and 'request' is NULL. */
+    bool batch;                 /* Is this a batch of flow_mods? */
+    struct ofpbuf requests;     /* Batch only: original requests. */
+    size_t request_ofs;         /* Batch only: offset of current request. */
 };
 
 static struct ofopgroup *ofopgroup_create_unattached(struct ofproto *);
 static struct ofopgroup *ofopgroup_create(struct ofproto *, struct ofconn *,
                                           const struct ofp_header *,
                                           uint32_t buffer_id);
+static struct ofopgroup *ofopgroup_create_flow_mod(
+    struct ofproto *, struct ofconn *, const struct ofp_header *,
+    uint32_t buffer_id);
 static void ofopgroup_submit(struct ofopgroup *);
+static void ofopgroup_submit_flow_mod(struct ofopgroup *);
+static void flow_mod_batch_commit(struct ofproto *);
 static void ofopgroup_complete(struct ofopgroup *);
 
 /* A single flow table operation. */
@@ -132,6 +145,10 @@ struct ofoperation {
 
     ovs_be64 flow_cookie;       /* Rule's old flow cookie. */
     enum ofperr error;          /* 0 if no error. */
+
+    /* If 'group' is a batch, the offset of the request that initiated this
+     * operation within 'group->requests'. */
+    size_t request_ofs;
 };
 
 static struct ofoperation *ofoperation_create(struct ofopgroup *,
@@ -155,6 +172,41 @@ static void oftable_remove_rule(struct rule *);
 static struct rule *oftable_replace_rule(struct rule *);
 static void oftable_substitute_rule(struct rule *old, struct rule *new);
 
+/* A set of rules within a single oftable that have the same flow cookie (in
+ * the oftable's 'cookie_groups') or that output to the same port (in its
+ * 'out_port_groups').  A rule belongs to exactly one cookie group and to one
+ * output port group for each distinct port that its actions output to.
+ *
+ * Unlike eviction groups, membership is exact: the group's 'key' is the
+ * cookie (in host byte order) or the port number itself, not a hash. */
+struct rule_index_group {
+    struct hmap_node hmap_node; /* In oftable's "cookie_groups" or
+                                 * "out_port_groups". */
+    uint64_t key;               /* Cookie or OpenFlow port number. */
+    struct list refs;           /* Contains "struct rule_index_ref"s. */
+    size_t n_refs;              /* Number of elements in 'refs'. */
+};
+
+static void oftable_index_rule(struct rule *,
+                               struct rule_index_ref *old_cookie_ref,
+                               struct rule_index_ref *old_port_refs,
+                               size_t n_old_port_refs);
+static void oftable_reindex_rule(struct rule *);
+static void oftable_unindex_rule(struct rule *);
+/* Flow stats dumps. */
+struct flow_dump;
+static void flow_dumps_run(struct ofproto *);
+static void flow_dumps_wait(struct ofproto *);
+static void flow_dumps_destroy(struct ofproto *);
+static void flow_dumps_unlink(struct ofproto *, const struct list *node);
+static void flow_dumps_relocate(struct ofproto *, const struct list *old,
+                                const struct list *new);
+static void flow_dumps_forget(struct ofproto *, const struct list *head);
+
+static const struct rule_index_group *oftable_index_lookup(
+    const struct oftable *, ovs_be64 cookie, ovs_be64 cookie_mask,
+    uint16_t out_port, bool *usable);
+
 /* A set of rules within a single OpenFlow table (oftable) that have the same
  * values for the oftable's eviction_fields.  A rule to be evicted, when one is
  * needed, is taken from the eviction group that contains the greatest number
@@ -200,6 +252,9 @@ static enum ofperr add_flow(struct ofproto *, struct ofconn *,
                             const struct ofp_header *);
 static void delete_flow__(struct rule *, struct ofopgroup *);
 static bool handle_openflow(struct ofconn *, struct ofpbuf *);
+static enum ofperr apply_flow_mod(struct ofproto *, struct ofconn *,
+                                  const struct ofputil_flow_mod *,
+                                  const struct ofp_header *);
 static enum ofperr handle_flow_mod__(struct ofproto *, struct ofconn *,
                                      const struct ofputil_flow_mod *,
                                      const struct ofp_header *);
@@ -226,6 +281,15 @@ static struct shash init_ofp_ports = SHASH_INITIALIZER(&init_ofp_ports);
 
 static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
 
+/* Configuration of every datapath.  See ofproto-provider.h. */
+unsigned n_handler_threads;
+unsigned n_revalidator_threads;
+unsigned revalidation_budget;
+unsigned stats_batch;
+unsigned flow_limit;
+unsigned flow_miss_batch = OFPROTO_DEFAULT_MISS_BATCH;
+unsigned flow_miss_hold;
+
 /* Must be called to initialize the ofproto library.
  *
  * The caller may pass in 'iface_hints', which contains an shash of
@@ -424,6 +488,8 @@ ofproto_create(const char *datapath_name, const char *datapath_type,
     list_init(&ofproto->pending);
     ofproto->n_pending = 0;
     hmap_init(&ofproto->deletions);
+    ofproto->flow_mod_batch = NULL;
+    list_init(&ofproto->flow_dumps);
     ofproto->n_add = ofproto->n_delete = ofproto->n_modify = 0;
     ofproto->first_op = ofproto->last_op = LLONG_MIN;
     ofproto->next_op_report = LLONG_MAX;
@@ -556,6 +622,60 @@ ofproto_set_in_band_queue(struct ofproto *ofproto, int queue_id)
     connmgr_set_in_band_queue(ofproto->connmgr, queue_id);
 }
 
+/* Sets the number of threads that receive upcalls from each datapath to
+ * 'n_threads', but no more than OFPROTO_MAX_HANDLER_THREADS.  With 0 threads,
+ * the main thread receives upcalls itself. */
+void
+ofproto_set_n_handler_threads(unsigned n_threads)
+{
+    n_handler_threads = MIN(n_threads, OFPROTO_MAX_HANDLER_THREADS);
+}
+
+/* Sets the number of threads that help the main thread revalidate flows to
+ * 'n_threads', but no more than OFPROTO_MAX_REVALIDATOR_THREADS.  With 0
+ * threads, the main thread revalidates every flow itself. */
+void
+ofproto_set_n_revalidator_threads(unsigned n_threads)
+{
+    n_revalidator_threads = MIN(n_threads, OFPROTO_MAX_REVALIDATOR_THREADS);
+}
+
+/* Limits the time that each datapath spends revalidating flows in one
+ * iteration of the main loop to roughly 'msec' milliseconds, but no more than
+ * OFPROTO_MAX_REVALIDATION_BUDGET.  0 means no limit. */
+void
+ofproto_set_revalidation_budget(unsigned msec)
+{
+    revalidation_budget = MIN(msec, OFPROTO_MAX_REVALIDATION_BUDGET);
+}
+
+/* Limits the number of datapath flows whose statistics each datapath collects
+ * in one iteration of the main loop to 'n_flows'.  0 means no limit. */
+void
+ofproto_set_stats_batch(unsigned n_flows)
+{
+    stats_batch = n_flows;
+}
+
+/* Limits the number of flows in each datapath to 'n_flows'.  0 means that
+ * only expiration limits the number of flows. */
+void
+ofproto_set_flow_limit(unsigned n_flows)
+{
+    flow_limit = n_flows;
+}
+
+/* Sets the number of upcalls that each datapath handles together in one batch
+ * to 'n_upcalls', between 1 and OFPROTO_MAX_MISS_BATCH, and the longest time
+ * that a partial batch waits for more upcalls to 'hold_msec' milliseconds, but
+ * no more than OFPROTO_MAX_MISS_HOLD. */
+void
+ofproto_set_miss_batch(unsigned n_upcalls, unsigned hold_msec)
+{
+    flow_miss_batch = MAX(1, MIN(n_upcalls, OFPROTO_MAX_MISS_BATCH));
+    flow_miss_hold = MIN(hold_msec, OFPROTO_MAX_MISS_HOLD);
+}
+
 /* Sets the number of flows at which eviction from the kernel flow table
  * will occur. */
 void
@@ -583,6 +703,25 @@ ofproto_set_forward_bpdu(struct ofproto *ofproto, bool forward_bpdu)
     }
 }
 
+/* Limits each source of new flows in 'ofproto', as distinguished according to
+ * 'key', to setting up 'rate' flows per second, in bursts of up to 'burst'
+ * flows.  A 'rate' of 0 removes the limit. */
+void
+ofproto_set_flow_setup_budget(struct ofproto *ofproto, unsigned rate,
+                              unsigned burst, enum ofproto_flow_setup_key key)
+{
+    if (rate != ofproto->flow_setup_rate
+        || burst != ofproto->flow_setup_burst
+        || key != ofproto->flow_setup_key) {
+        ofproto->flow_setup_rate = rate;
+        ofproto->flow_setup_burst = burst;
+        ofproto->flow_setup_key = key;
+        if (ofproto->ofproto_class->flow_setup_budget_changed) {
+            ofproto->ofproto_class->flow_setup_budget_changed(ofproto);
+        }
+    }
+}
+
 /* Sets the MAC aging timeout for the OFPP_NORMAL action on 'ofproto' to
  * 'idle_time', in seconds. */
 void
@@ -778,6 +917,28 @@ ofproto_port_set_queues(struct ofproto *ofproto, uint16_t ofp_port,
             ? ofproto->ofproto_class->set_queues(ofport, queues, n_queues)
             : EOPNOTSUPP);
 }
+
+/* Sets the weight of 'ofp_port' in 'ofproto' in the scheduling of packets
+ * that need userspace processing, such as flow setups, to 'weight'.  Ports
+ * that compete for this processing get shares proportional to their weights.
+ * A weight of 0 is treated as 1, the default. */
+int
+ofproto_port_set_upcall_weight(struct ofproto *ofproto, uint16_t ofp_port,
+                               unsigned int weight)
+{
+    struct ofport *ofport = ofproto_get_port(ofproto, ofp_port);
+
+    if (!ofport) {
+        VLOG_WARN("%s: cannot set upcall weight on nonexistent port %"PRIu16,
+                  ofproto->name, ofp_port);
+        return ENODEV;
+    }
+
+    return (ofproto->ofproto_class->set_upcall_weight
+            ? ofproto->ofproto_class->set_upcall_weight(ofport,
+                                                        MAX(weight, 1))
+            : EOPNOTSUPP);
+}
 
 /* Connectivity Fault Management configuration. */
 
@@ -1033,8 +1194,10 @@ ofproto_destroy__(struct ofproto *ofproto)
 
     assert(list_is_empty(&ofproto->pending));
     assert(!ofproto->n_pending);
+    assert(!ofproto->flow_mod_batch);
 
     connmgr_destroy(ofproto->connmgr);
+    flow_dumps_destroy(ofproto);
 
     hmap_remove(&all_ofprotos, &ofproto->hmap_node);
     free(ofproto->name);
@@ -1196,6 +1359,7 @@ ofproto_run(struct ofproto *p)
     switch (p->state) {
     case S_OPENFLOW: //of commands, run its parser
         connmgr_run(p->connmgr, handle_openflow);
+        flow_mod_batch_commit(p);
         break;
 
     case S_EVICT: //evict flow from over-limit tables
@@ -1219,6 +1383,8 @@ ofproto_run(struct ofproto *p)
         NOT_REACHED();
     }
 
+    flow_dumps_run(p);
+
     /* periodical log */
     if (time_msec() >= p->next_op_report) {//time to report ops
         long long int ago = (time_msec() - p->first_op) / 1000;
@@ -1309,6 +1475,8 @@ ofproto_wait(struct ofproto *p)
         }
         break;
     }
+
+    flow_dumps_wait(p);
 }
 
 bool
@@ -1533,6 +1701,7 @@ ofproto_add_flow(struct ofproto *ofproto, const struct match *match,
 {
     const struct rule *rule;
 
+    flow_mod_batch_commit(ofproto);
     rule = rule_from_cls_rule(classifier_find_match_exactly(
                                   &ofproto->tables[0].cls, match, priority));
     if (!rule || !ofpacts_equal(rule->ofpacts, rule->ofpacts_len,
@@ -1571,6 +1740,7 @@ ofproto_delete_flow(struct ofproto *ofproto,
 {
     struct rule *rule;
 
+    flow_mod_batch_commit(ofproto);
     rule = rule_from_cls_rule(classifier_find_match_exactly(
                                   &ofproto->tables[0].cls, target, priority));
     if (!rule) {
@@ -2634,6 +2804,25 @@ next_matching_table(const struct ofproto *ofproto,
          (TABLE) != NULL;                                         \
          (TABLE) = next_matching_table(OFPROTO, TABLE, TABLE_ID))
 
+/* Appends 'rule' to 'rules' if it is not hidden, has a cookie that matches
+ * 'cookie' within 'cookie_mask', and outputs to 'out_port' (unless 'out_port'
+ * is OFPP_NONE).  Returns OFPROTO_POSTPONE if 'rule' has a pending operation,
+ * otherwise 0. */
+static enum ofperr
+collect_rule(struct rule *rule, ovs_be64 cookie, ovs_be64 cookie_mask,
+             uint16_t out_port, struct list *rules)
+{
+    if (rule->pending) {
+        return OFPROTO_POSTPONE;
+    }
+    if (!ofproto_rule_is_hidden(rule)
+        && ofproto_rule_has_out_port(rule, out_port)
+        && !((rule->flow_cookie ^ cookie) & cookie_mask)) {
+        list_push_back(rules, &rule->ofproto_node);
+    }
+    return 0;
+}
+
 /* Searches 'ofproto' for rules in table 'table_id' (or in all tables, if
  * 'table_id' is 0xff) that match 'match' in the "loose" way required for
  * OpenFlow OFPFC_MODIFY and OFPFC_DELETE requests and puts them on list
@@ -2644,6 +2833,10 @@ next_matching_table(const struct ofproto *ofproto,
  *
  * Hidden rules are always omitted.
  *
+ * If 'cookie_mask' is all-1-bits or 'out_port' is not OFPP_NONE, then each
+ * table's cookie or output port index limits the search to the rules with
+ * that cookie or output port, instead of every rule in the table.
+ *
  * Returns 0 on success, otherwise an OpenFlow error code. */
 static enum ofperr
 collect_rules_loose(struct ofproto *ofproto, uint8_t table_id,
@@ -2663,20 +2856,42 @@ collect_rules_loose(struct ofproto *ofproto, uint8_t table_id,
     list_init(rules);
     cls_rule_init(&cr, match, 0);
     FOR_EACH_MATCHING_TABLE (table, table_id, ofproto) {
+        const struct rule_index_group *group;
         struct cls_cursor cursor;
         struct rule *rule;
+        bool indexed;
+
+        if (classifier_is_empty(&table->cls)) {
+            continue;
+        }
+
+        group = oftable_index_lookup(table, cookie, cookie_mask, out_port,
+                                     &indexed);
+        if (indexed) {
+            const struct rule_index_ref *ref;
+
+            if (!group) {
+                continue;
+            }
+            LIST_FOR_EACH (ref, list_node, &group->refs) {
+                rule = ref->rule;
+                if (cls_rule_is_loose_match(&rule->cr, &cr.match)) {
+                    error = collect_rule(rule, cookie, cookie_mask, out_port,
+                                         rules);
+                    if (error) {
+                        goto exit;
+                    }
+                }
+            }
+            continue;
+        }
 
         cls_cursor_init(&cursor, &table->cls, &cr);
         CLS_CURSOR_FOR_EACH (rule, cr, &cursor) {
-            if (rule->pending) {
-                error = OFPROTO_POSTPONE;
+            error = collect_rule(rule, cookie, cookie_mask, out_port, rules);
+            if (error) {
                 goto exit;
             }
-            if (!ofproto_rule_is_hidden(rule)
-                && ofproto_rule_has_out_port(rule, out_port)
-                    && !((rule->flow_cookie ^ cookie) & cookie_mask)) {
-                list_push_back(rules, &rule->ofproto_node);
-            }
         }
     }
 
@@ -2716,24 +2931,23 @@ collect_rules_strict(struct ofproto *ofproto, uint8_t table_id,
     FOR_EACH_MATCHING_TABLE (table, table_id, ofproto) {
         struct rule *rule;
 
+        if (classifier_is_empty(&table->cls)) {
+            continue;
+        }
+
         rule = rule_from_cls_rule(classifier_find_rule_exactly(&table->cls,
                                                                &cr));
         if (rule) {
-            if (rule->pending) {
-                error = OFPROTO_POSTPONE;
+            error = collect_rule(rule, cookie, cookie_mask, out_port, rules);
+            if (error) {
                 goto exit;
             }
-            if (!ofproto_rule_is_hidden(rule)
-                && ofproto_rule_has_out_port(rule, out_port)
-                    && !((rule->flow_cookie ^ cookie) & cookie_mask)) {
-                list_push_back(rules, &rule->ofproto_node);
-            }
         }
     }
 
 exit:
     cls_rule_destroy(&cr);
-    return 0;
+    return error;
 }
 
 /* Returns 'age_ms' (a duration in milliseconds), converted to seconds and
@@ -2746,31 +2960,139 @@ age_secs(long long int age_ms)
             : (unsigned int) age_ms / 1000);
 }
 
-static enum ofperr
-handle_flow_stats_request(struct ofconn *ofconn,
-                          const struct ofp_header *request)
-{
-    struct ofproto *ofproto = ofconn_get_ofproto(ofconn);
+/* Flow stats dumps.
+ *
+ * A flow stats or aggregate stats request can select millions of rules.
+ * Instead of composing the entire reply at once, which would take time and
+ * memory proportional to the number of rules, ofproto walks the selected rules
+ * incrementally with a "struct flow_dump", visiting a bounded number of them
+ * in each call to ofproto_run().  A flow stats dump sends each reply segment
+ * as soon as it fills up and stops composing more while the controller has
+ * not yet accepted those already queued.
+ *
+ * A dump walks each table's 'rules' list or, when the request selects by
+ * cookie or out_port, the list in the appropriate index group (see
+ * oftable_index_lookup()), keeping a pointer to the next list node to visit.
+ * Code that unlinks or moves such a node calls flow_dumps_unlink(),
+ * flow_dumps_relocate(), or flow_dumps_forget() to keep the pointer valid.  A
+ * rule added to a table while a dump is in progress may or may not be
+ * reported.
+ *
+ * A dump in progress is on its ofconn's list of pending opgroups, so that a
+ * barrier request waits for it to finish and so that it is abandoned if the
+ * connection drops. */
+struct flow_dump {
+    struct list ofproto_node;   /* In ofproto's "flow_dumps". */
+    struct ofproto *ofproto;    /* Owning ofproto. */
+    struct list ofconn_node;    /* In ofconn's opgroups, or empty. */
+    struct ofconn *ofconn;      /* Valid only if 'ofconn_node' is nonempty. */
+    struct ofp_header *request; /* Copy of the stats request. */
+    bool aggregate;             /* Aggregate stats, instead of flow stats? */
+
+    /* Selection criteria. */
     struct ofputil_flow_stats_request fsr;
-    struct list replies;
-    struct list rules;
-    struct rule *rule;
-    enum ofperr error;
+    struct cls_rule cr;         /* 'fsr.match', as a cls_rule. */
 
-    error = ofputil_decode_flow_stats_request(&fsr, request);
-    if (error) {
-        return error;
-    }
+    /* Position. */
+    struct oftable *table;      /* Table being walked, NULL when done. */
+    const struct list *head;    /* List being walked within 'table'. */
+    const struct list *pos;     /* Next node to visit in 'head'. */
+    bool indexed;               /* 'head' contains rule_index_refs? */
 
-    error = collect_rules_loose(ofproto, fsr.table_id, &fsr.match,
-                                fsr.cookie, fsr.cookie_mask,
-                                fsr.out_port, &rules);
-    if (error) {
-        return error;
+    /* Results. */
+    struct list replies;        /* Flow stats reply segments not yet sent. */
+    struct ofputil_aggregate_stats stats;
+    bool unknown_packets, unknown_bytes;
+};
+
+/* Maximum number of rules that flow_dump_run() visits in one call. */
+#define FLOW_DUMP_MAX_RULES 1024
+
+/* A flow stats dump stops composing reply segments while at least this many
+ * replies are queued on its ofconn. */
+#define FLOW_DUMP_MAX_BACKLOG 4
+
+/* Points 'dump' at the first rule to visit in 'dump->table' or, if there is
+ * none, in the next matching table that has one.  Sets 'dump->table' to NULL
+ * if there are no more tables. */
+static void
+flow_dump_seek(struct flow_dump *dump)
+{
+    const struct ofputil_flow_stats_request *fsr = &dump->fsr;
+
+    for (; dump->table; dump->table = next_matching_table(dump->ofproto,
+                                                          dump->table,
+                                                          fsr->table_id)) {
+        const struct rule_index_group *group;
+
+        if (classifier_is_empty(&dump->table->cls)) {
+            continue;
+        }
+
+        group = oftable_index_lookup(dump->table, fsr->cookie,
+                                     fsr->cookie_mask, fsr->out_port,
+                                     &dump->indexed);
+        if (!dump->indexed) {
+            dump->head = &dump->table->rules;
+        } else if (group) {
+            dump->head = &group->refs;
+        } else {
+            continue;
+        }
+        dump->pos = dump->head->next;
+        return;
     }
+}
 
-    ofpmp_init(&replies, request);
-    LIST_FOR_EACH (rule, ofproto_node, &rules) {
+/* Returns the rule at 'dump''s position, which must not be at the end of the
+ * list that it is walking. */
+static struct rule *
+flow_dump_peek(const struct flow_dump *dump)
+{
+    return (dump->indexed
+            ? CONTAINER_OF(dump->pos, struct rule_index_ref, list_node)->rule
+            : CONTAINER_OF(dump->pos, struct rule, table_node));
+}
+
+/* Returns true if 'rule' satisfies 'dump''s selection criteria. */
+static bool
+flow_dump_selects(const struct flow_dump *dump, const struct rule *rule)
+{
+    const struct ofputil_flow_stats_request *fsr = &dump->fsr;
+
+    return (!ofproto_rule_is_hidden(rule)
+            && ofproto_rule_has_out_port(rule, fsr->out_port)
+            && !((rule->flow_cookie ^ fsr->cookie) & fsr->cookie_mask)
+            && cls_rule_is_loose_match(&rule->cr, &dump->cr.match));
+}
+
+/* Adds 'rule''s statistics to 'dump''s results. */
+static void
+flow_dump_add_rule(struct flow_dump *dump, struct rule *rule)
+{
+    struct ofproto *ofproto = dump->ofproto;
+
+    if (dump->aggregate) {
+        uint64_t packet_count;
+        uint64_t byte_count;
+
+        ofproto->ofproto_class->rule_get_stats(rule, &packet_count,
+                                               &byte_count);
+
+        if (packet_count == UINT64_MAX) {
+            dump->unknown_packets = true;
+        } else {
+            dump->stats.packet_count += packet_count;
+        }
+
+        if (byte_count == UINT64_MAX) {
+            dump->unknown_bytes = true;
+        } else {
+            dump->stats.byte_count += byte_count;
+        }
+
+        dump->stats.flow_count++;
+    } else {
         long long int now = time_msec();
         struct ofputil_flow_stats fs;
 
@@ -2788,13 +3110,246 @@ handle_flow_stats_request(struct ofconn *ofconn,
                                                &fs.byte_count);
         fs.ofpacts = rule->ofpacts;
         fs.ofpacts_len = rule->ofpacts_len;
-        ofputil_append_flow_stats_reply(&fs, &replies);
+        ofputil_append_flow_stats_reply(&fs, &dump->replies);
+
+        /* Send every segment but the one still being filled. */
+        while (!list_is_singleton(&dump->replies)) {
+            ofconn_send_reply(dump->ofconn, ofpbuf_from_list(
+                                  list_pop_front(&dump->replies)));
+        }
     }
-    ofconn_send_replies(ofconn, &replies);
+}
+
+/* Sends the final reply for 'dump', which has visited all of its rules. */
+static void
+flow_dump_finish(struct flow_dump *dump)
+{
+    if (dump->aggregate) {
+        struct ofpbuf *reply;
+
+        if (dump->unknown_packets) {
+            dump->stats.packet_count = UINT64_MAX;
+        }
+        if (dump->unknown_bytes) {
+            dump->stats.byte_count = UINT64_MAX;
+        }
+        reply = ofputil_encode_aggregate_stats_reply(&dump->stats,
+                                                     dump->request);
+        ofconn_send_reply(dump->ofconn, reply);
+    } else {
+        ofconn_send_replies(dump->ofconn, &dump->replies);
+    }
+}
 
+/* Returns true if flow_dump_run() can make progress on 'dump' right away. */
+static bool
+flow_dump_is_ready(const struct flow_dump *dump)
+{
+    if (list_is_empty(&dump->ofconn_node)) {
+        return true;
+    } else if (!dump->aggregate
+               && (ofconn_get_reply_backlog(dump->ofconn)
+                   >= FLOW_DUMP_MAX_BACKLOG)) {
+        return false;
+    } else {
+        return (!dump->table
+                || dump->pos == dump->head
+                || !flow_dump_peek(dump)->pending);
+    }
+}
+
+/* Visits up to FLOW_DUMP_MAX_RULES of the rules that 'dump' has yet to visit.
+ * Returns true if 'dump' is finished, either because it sent its final reply
+ * or because its connection went away, false if it has more work to do. */
+static bool
+flow_dump_run(struct flow_dump *dump)
+{
+    int i;
+
+    for (i = 0; i < FLOW_DUMP_MAX_RULES; i++) {
+        struct rule *rule;
+
+        if (!flow_dump_is_ready(dump)) {
+            return false;
+        } else if (list_is_empty(&dump->ofconn_node)) {
+            return true;
+        } else if (!dump->table) {
+            flow_dump_finish(dump);
+            return true;
+        } else if (dump->pos == dump->head) {
+            dump->table = next_matching_table(dump->ofproto, dump->table,
+                                              dump->fsr.table_id);
+            flow_dump_seek(dump);
+            continue;
+        }
+
+        rule = flow_dump_peek(dump);
+        dump->pos = dump->pos->next;
+        if (flow_dump_selects(dump, rule)) {
+            flow_dump_add_rule(dump, rule);
+        }
+    }
+    return false;
+}
+
+/* Frees 'dump' and detaches it from its ofproto and ofconn. */
+static void
+flow_dump_destroy(struct flow_dump *dump)
+{
+    list_remove(&dump->ofproto_node);
+    if (!list_is_empty(&dump->ofconn_node)) {
+        list_remove(&dump->ofconn_node);
+    }
+    free(dump->request);
+    cls_rule_destroy(&dump->cr);
+    ofpbuf_list_delete(&dump->replies);
+    free(dump);
+}
+
+/* Starts a dump of flow stats (or aggregate stats, if 'aggregate' is true) in
+ * reply to 'request' on 'ofconn'.  A dump that selects few rules finishes
+ * before this function returns. */
+static enum ofperr
+flow_dump_start(struct ofconn *ofconn, const struct ofp_header *request,
+                bool aggregate)
+{
+    struct ofproto *ofproto = ofconn_get_ofproto(ofconn);
+    struct ofputil_flow_stats_request fsr;
+    struct flow_dump *dump;
+    enum ofperr error;
+
+    error = ofputil_decode_flow_stats_request(&fsr, request);
+    if (error) {
+        return error;
+    }
+
+    error = check_table_id(ofproto, fsr.table_id);
+    if (error) {
+        return error;
+    }
+
+    dump = xmalloc(sizeof *dump);
+    list_push_back(&ofproto->flow_dumps, &dump->ofproto_node);
+    dump->ofproto = ofproto;
+    ofconn_add_opgroup(ofconn, &dump->ofconn_node);
+    dump->ofconn = ofconn;
+    dump->request = xmemdup(request, ntohs(request->length));
+    dump->aggregate = aggregate;
+
+    dump->fsr = fsr;
+    cls_rule_init(&dump->cr, &fsr.match, 0);
+
+    dump->table = first_matching_table(ofproto, fsr.table_id);
+    flow_dump_seek(dump);
+
+    if (aggregate) {
+        list_init(&dump->replies);
+    } else {
+        ofpmp_init(&dump->replies, dump->request);
+    }
+    memset(&dump->stats, 0, sizeof dump->stats);
+    dump->unknown_packets = dump->unknown_bytes = false;
+
+    if (flow_dump_run(dump)) {
+        flow_dump_destroy(dump);
+    }
     return 0;
 }
 
+/* Makes progress on each of the flow stats dumps in progress in 'ofproto'. */
+static void
+flow_dumps_run(struct ofproto *ofproto)
+{
+    struct flow_dump *dump, *next;
+    bool finished = false;
+
+    LIST_FOR_EACH_SAFE (dump, next, ofproto_node, &ofproto->flow_dumps) {
+        if (flow_dump_run(dump)) {
+            flow_dump_destroy(dump);
+            finished = true;
+        }
+    }
+
+    if (finished) {
+        /* Requests such as barriers might have been waiting for the dump. */
+        connmgr_retry(ofproto->connmgr);
+    }
+}
+
+/* Abandons all of the flow stats dumps in progress in 'ofproto'. */
+static void
+flow_dumps_destroy(struct ofproto *ofproto)
+{
+    struct flow_dump *dump, *next;
+
+    LIST_FOR_EACH_SAFE (dump, next, ofproto_node, &ofproto->flow_dumps) {
+        flow_dump_destroy(dump);
+    }
+}
+
+static void
+flow_dumps_wait(struct ofproto *ofproto)
+{
+    struct flow_dump *dump;
+
+    LIST_FOR_EACH (dump, ofproto_node, &ofproto->flow_dumps) {
+        if (flow_dump_is_ready(dump)) {
+            poll_immediate_wake();
+            return;
+        }
+    }
+}
+
+/* Tells the flow dumps in progress in 'ofproto' that 'node' is about to be
+ * removed from the list that contains it. */
+static void
+flow_dumps_unlink(struct ofproto *ofproto, const struct list *node)
+{
+    struct flow_dump *dump;
+
+    LIST_FOR_EACH (dump, ofproto_node, &ofproto->flow_dumps) {
+        if (dump->pos == node) {
+            dump->pos = node->next;
+        }
+    }
+}
+
+/* Tells the flow dumps in progress in 'ofproto' that 'new' has taken the
+ * place of 'old' in the list that contains it. */
+static void
+flow_dumps_relocate(struct ofproto *ofproto, const struct list *old,
+                    const struct list *new)
+{
+    struct flow_dump *dump;
+
+    LIST_FOR_EACH (dump, ofproto_node, &ofproto->flow_dumps) {
+        if (dump->pos == old) {
+            dump->pos = new;
+        }
+    }
+}
+
+/* Tells the flow dumps in progress in 'ofproto' that 'head', which is the
+ * head of an empty list, is about to be freed. */
+static void
+flow_dumps_forget(struct ofproto *ofproto, const struct list *head)
+{
+    struct flow_dump *dump;
+
+    LIST_FOR_EACH (dump, ofproto_node, &ofproto->flow_dumps) {
+        if (dump->head == head) {
+            dump->head = dump->pos = NULL;
+        }
+    }
+}
+
+static enum ofperr
+handle_flow_stats_request(struct ofconn *ofconn,
+                          const struct ofp_header *request)
+{
+    return flow_dump_start(ofconn, request, false);
+}
+
 static void
 flow_stats_ds(struct rule *rule, struct ds *results)
 {
@@ -2910,61 +3465,7 @@ static enum ofperr
 handle_aggregate_stats_request(struct ofconn *ofconn,
                                const struct ofp_header *oh)
 {
-    struct ofproto *ofproto = ofconn_get_ofproto(ofconn);
-    struct ofputil_flow_stats_request request;
-    struct ofputil_aggregate_stats stats;
-    bool unknown_packets, unknown_bytes;
-    struct ofpbuf *reply;
-    struct list rules;
-    struct rule *rule;
-    enum ofperr error;
-
-    error = ofputil_decode_flow_stats_request(&request, oh);
-    if (error) {
-        return error;
-    }
-
-    error = collect_rules_loose(ofproto, request.table_id, &request.match,
-                                request.cookie, request.cookie_mask,
-                                request.out_port, &rules);
-    if (error) {
-        return error;
-    }
-
-    memset(&stats, 0, sizeof stats);
-    unknown_packets = unknown_bytes = false;
-    LIST_FOR_EACH (rule, ofproto_node, &rules) {
-        uint64_t packet_count;
-        uint64_t byte_count;
-
-        ofproto->ofproto_class->rule_get_stats(rule, &packet_count,
-                                               &byte_count);
-
-        if (packet_count == UINT64_MAX) {
-            unknown_packets = true;
-        } else {
-            stats.packet_count += packet_count;
-        }
-
-        if (byte_count == UINT64_MAX) {
-            unknown_bytes = true;
-        } else {
-            stats.byte_count += byte_count;
-        }
-
-        stats.flow_count++;
-    }
-    if (unknown_packets) {
-        stats.packet_count = UINT64_MAX;
-    }
-    if (unknown_bytes) {
-        stats.byte_count = UINT64_MAX;
-    }
-
-    reply = ofputil_encode_aggregate_stats_reply(&stats, oh);
-    ofconn_send_reply(ofconn, reply);
-
-    return 0;
+    return flow_dump_start(ofconn, oh, true);
 }
 
 struct queue_stats_cbdata {
@@ -3199,7 +3700,8 @@ add_flow(struct ofproto *ofproto, struct ofconn *ofconn,
             evict = NULL;
         }
 
-        group = ofopgroup_create(ofproto, ofconn, request, fm->buffer_id);
+        group = ofopgroup_create_flow_mod(ofproto, ofconn, request,
+                                          fm->buffer_id);
         op = ofoperation_create(group, rule, OFOPERATION_ADD, 0);
         op->victim = victim;
 
@@ -3210,7 +3712,7 @@ add_flow(struct ofproto *ofproto, struct ofconn *ofconn,
         } else if (evict) {
             delete_flow__(evict, group);
         }
-        ofopgroup_submit(group);
+        ofopgroup_submit_flow_mod(group);
     }
 
 exit:
@@ -3240,7 +3742,7 @@ modify_flows__(struct ofproto *ofproto, struct ofconn *ofconn,
     struct rule *rule;
     enum ofperr error;
 
-    group = ofopgroup_create(ofproto, ofconn, request, fm->buffer_id);
+    group = ofopgroup_create_flow_mod(ofproto, ofconn, request, fm->buffer_id);
     error = OFPERR_OFPBRC_EPERM;
     LIST_FOR_EACH (rule, ofproto_node, rules) {
         struct ofoperation *op;
@@ -3271,12 +3773,15 @@ modify_flows__(struct ofproto *ofproto, struct ofconn *ofconn,
             op->ofpacts_len = rule->ofpacts_len;
             rule->ofpacts = xmemdup(fm->ofpacts, fm->ofpacts_len);
             rule->ofpacts_len = fm->ofpacts_len;
+        }
+        oftable_reindex_rule(rule);
+        if (actions_changed) {
             rule->ofproto->ofproto_class->rule_modify_actions(rule);
         } else {
             ofoperation_complete(op, 0);
         }
     }
-    ofopgroup_submit(group);
+    ofopgroup_submit_flow_mod(group);
 
     return error;
 }
@@ -3369,11 +3874,11 @@ delete_flows__(struct ofproto *ofproto, struct ofconn *ofconn,
     struct rule *rule, *next;
     struct ofopgroup *group;
 
-    group = ofopgroup_create(ofproto, ofconn, request, UINT32_MAX);
+    group = ofopgroup_create_flow_mod(ofproto, ofconn, request, UINT32_MAX);
     LIST_FOR_EACH_SAFE (rule, next, ofproto_node, rules) {
         delete_flow__(rule, group);
     }
-    ofopgroup_submit(group);
+    ofopgroup_submit_flow_mod(group);
 
     return 0;
 }
@@ -3550,16 +4055,82 @@ exit:
     return error;
 }
 
+/* Flow_mods received from a controller are applied in batches: consecutive
+ * flow_mods from one ofconn share a single ofopgroup, 'flow_mod_batch', that
+ * is submitted only when some other message arrives, when a flow_mod from
+ * another source arrives, or at the end of connmgr_run().  This saves the
+ * per-flow_mod cost of creating, submitting, and completing an ofopgroup
+ * (including flushing flow monitor updates), and lets the ofproto
+ * implementation see a whole batch of flow table changes before it next
+ * revalidates.
+ *
+ * A flow_mod that refers to a buffered packet is never batched, because the
+ * packet must be sent only after the flow_mod's own operations finish. */
 static enum ofperr
 handle_flow_mod__(struct ofproto *ofproto, struct ofconn *ofconn,
                   const struct ofputil_flow_mod *fm,
                   const struct ofp_header *oh)
 {
+    struct ofopgroup *batch;
+    int error;
+
     if (ofproto->n_pending >= 50) {
         assert(!list_is_empty(&ofproto->pending));
         return OFPROTO_POSTPONE;
     }
 
+    batch = ofproto->flow_mod_batch;
+    if (batch && (batch->ofconn != ofconn
+                  || list_is_empty(&batch->ofconn_node)
+                  || fm->buffer_id != UINT32_MAX)) {
+        flow_mod_batch_commit(ofproto);
+        batch = NULL;
+    }
+    if (ofconn && fm->buffer_id == UINT32_MAX) {
+        size_t request_len = MIN(ntohs(oh->length), 64);
+
+        if (!batch) {
+            batch = ofopgroup_create_unattached(ofproto);
+            ofconn_add_opgroup(ofconn, &batch->ofconn_node);
+            batch->ofconn = ofconn;
+            batch->buffer_id = UINT32_MAX;
+            batch->batch = true;
+            ofpbuf_init(&batch->requests, 0);
+            ofproto->flow_mod_batch = batch;
+        }
+        batch->request_ofs = batch->requests.size;
+        ofpbuf_put(&batch->requests, oh, request_len);
+        ofpbuf_put_zeros(&batch->requests,
+                         ROUND_UP(request_len, 8) - request_len);
+    }
+
+    error = apply_flow_mod(ofproto, ofconn, fm, oh);
+    if (error == OFPROTO_POSTPONE && batch && !list_is_empty(&batch->ops)) {
+        /* The flow_mod might only be waiting for an operation earlier in the
+         * batch, so submit the batch and try again. */
+        flow_mod_batch_commit(ofproto);
+        error = handle_flow_mod__(ofproto, ofconn, fm, oh);
+    }
+    return error;
+}
+
+/* Submits 'ofproto''s batch of flow_mods, if it has one. */
+static void
+flow_mod_batch_commit(struct ofproto *ofproto)
+{
+    struct ofopgroup *batch = ofproto->flow_mod_batch;
+
+    if (batch) {
+        ofproto->flow_mod_batch = NULL;
+        ofopgroup_submit(batch);
+    }
+}
+
+static enum ofperr
+apply_flow_mod(struct ofproto *ofproto, struct ofconn *ofconn,
+               const struct ofputil_flow_mod *fm,
+               const struct ofp_header *oh)
+{
     switch (fm->command) {
     case OFPFC_ADD:
         return add_flow(ofproto, ofconn, fm, oh);
@@ -3999,6 +4570,12 @@ handle_openflow__(struct ofconn *ofconn, const struct ofpbuf *msg)
         return error;
     }
 
+    if (type != OFPTYPE_FLOW_MOD) {
+        /* Whatever this message is, it must see the effects of earlier
+         * flow_mods. */
+        flow_mod_batch_commit(ofconn_get_ofproto(ofconn));
+    }
+
     switch (type) { //msg are sent from controller to switch
         /* OpenFlow requests. */
     case OFPTYPE_ECHO_REQUEST:
@@ -4163,6 +4740,47 @@ ofopgroup_create(struct ofproto *ofproto, struct ofconn *ofconn,
     return group;
 }
 
+/* Returns the ofopgroup to which a flow_mod should add its operations: the
+ * batch of flow_mods that handle_flow_mod__() started for 'ofconn', if there
+ * is one, otherwise a new ofopgroup created as if by ofopgroup_create().
+ *
+ * The caller should submit the returned group with
+ * ofopgroup_submit_flow_mod(). */
+static struct ofopgroup *
+ofopgroup_create_flow_mod(struct ofproto *ofproto, struct ofconn *ofconn,
+                          const struct ofp_header *request, uint32_t buffer_id)
+{
+    struct ofopgroup *batch = ofproto->flow_mod_batch;
+
+    if (batch && batch->ofconn == ofconn && buffer_id == UINT32_MAX) {
+        return batch;
+    }
+    return ofopgroup_create(ofproto, ofconn, request, buffer_id);
+}
+
+/* Submits 'group', obtained from ofopgroup_create_flow_mod(), for processing,
+ * unless it is a batch of flow_mods, which flow_mod_batch_commit() will submit
+ * later. */
+static void
+ofopgroup_submit_flow_mod(struct ofopgroup *group)
+{
+    if (!group->batch) {
+        ofopgroup_submit(group);
+    }
+}
+
+/* Returns the (truncated) request that initiated 'op'. */
+static const struct ofp_header *
+ofoperation_get_request(const struct ofoperation *op)
+{
+    const struct ofopgroup *group = op->group;
+
+    return (group->batch
+            ? ofpbuf_at_assert(&group->requests, op->request_ofs,
+                               sizeof(struct ofp_header))
+            : group->request);
+}
+
 /* Submits 'group' for processing.
  *
  * If 'group' contains no operations (e.g. none were ever added, or all of the
@@ -4193,11 +4811,15 @@ ofopgroup_complete(struct ofopgroup *group)
 
     assert(!group->n_running);
 
+    /* A batch of flow_mods reports errors for each flow_mod separately,
+     * below. */
     error = 0;
-    LIST_FOR_EACH (op, group_node, &group->ops) {
-        if (op->error) {
-            error = op->error;
-            break;
+    if (!group->batch) {
+        LIST_FOR_EACH (op, group_node, &group->ops) {
+            if (op->error) {
+                error = op->error;
+                break;
+            }
         }
     }
 
@@ -4218,9 +4840,24 @@ ofopgroup_complete(struct ofopgroup *group)
         }
     }
 
+    if (group->batch && !list_is_empty(&group->ofconn_node)) {
+        /* Each flow_mod in a batch succeeds or fails on its own.  A flow_mod's
+         * operations are adjacent in 'ops', so report each failed flow_mod
+         * once. */
+        size_t reported_ofs = SIZE_MAX;
+
+        LIST_FOR_EACH (op, group_node, &group->ops) {
+            if (op->error && op->request_ofs != reported_ofs) {
+                ofconn_send_error(group->ofconn, ofoperation_get_request(op),
+                                  op->error);
+                reported_ofs = op->request_ofs;
+            }
+        }
+    }
+
     if (!error && !list_is_empty(&group->ofconn_node)) {
         abbrev_ofconn = group->ofconn;
-        abbrev_xid = group->request->xid;
+        abbrev_xid = group->batch ? htonl(0) : group->request->xid;
     } else {
         abbrev_ofconn = NULL;
         abbrev_xid = htonl(0);
@@ -4228,6 +4865,9 @@ ofopgroup_complete(struct ofopgroup *group)
     LIST_FOR_EACH_SAFE (op, next_op, group_node, &group->ops) {
         struct rule *rule = op->rule;
 
+        if (group->batch && abbrev_ofconn) {
+            abbrev_xid = ofoperation_get_request(op)->xid;
+        }
         if (!op->error && !ofproto_rule_is_hidden(rule)) {
             /* Check that we can just cast from ofoperation_type to
              * nx_flow_update_event. */
@@ -4287,6 +4927,7 @@ ofopgroup_complete(struct ofopgroup *group)
                     op->ofpacts = NULL;
                     op->ofpacts_len = 0;
                 }
+                oftable_reindex_rule(rule);
             }
             break;
 
@@ -4312,6 +4953,9 @@ ofopgroup_complete(struct ofopgroup *group)
         connmgr_retry(ofproto->connmgr);
     }
     free(group->request);
+    if (group->batch) {
+        ofpbuf_uninit(&group->requests);
+    }
     free(group);
 }
 
@@ -4340,6 +4984,7 @@ ofoperation_create(struct ofopgroup *group, struct rule *rule,
     op->type = type;
     op->reason = reason;
     op->flow_cookie = rule->flow_cookie;
+    op->request_ofs = group->request_ofs;
 
     group->n_running++;
 
@@ -4705,10 +5350,13 @@ oftable_init(struct oftable *table)
 {
     memset(table, 0, sizeof *table);
     classifier_init(&table->cls);
+    list_init(&table->rules);
     table->max_flows = UINT_MAX;
+    hmap_init(&table->cookie_groups);
+    hmap_init(&table->out_port_groups);
 }
 
-/* Destroys 'table', including its classifier and eviction groups.
+/* Destroys 'table', including its classifier, eviction groups, and indexes.
  *
  * The caller is responsible for freeing 'table' itself. */
 static void
@@ -4717,6 +5365,11 @@ oftable_destroy(struct oftable *table)
     assert(classifier_is_empty(&table->cls));
     oftable_disable_eviction(table);
     classifier_destroy(&table->cls);
+    assert(list_is_empty(&table->rules));
+    assert(hmap_is_empty(&table->cookie_groups));
+    hmap_destroy(&table->cookie_groups);
+    assert(hmap_is_empty(&table->out_port_groups));
+    hmap_destroy(&table->out_port_groups);
     free(table->name);
 }
 
@@ -4808,12 +5461,19 @@ oftable_remove_rule(struct rule *rule)
     struct oftable *table = &ofproto->tables[rule->table_id];
 
     classifier_remove(&table->cls, &rule->cr);
+    flow_dumps_unlink(ofproto, &rule->table_node);
+    list_remove(&rule->table_node);
     eviction_group_remove_rule(rule);
+    oftable_unindex_rule(rule);
 }
 
 /* Inserts 'rule' into its oftable.  Removes any existing rule from 'rule''s
  * oftable that has an identical cls_rule.  Returns the rule that was removed,
- * if any, and otherwise NULL. */
+ * if any, and otherwise NULL.
+ *
+ * 'rule' takes over the removed rule's place in the oftable's 'rules' list and
+ * in any index group that both belong to, so that a flow stats dump in
+ * progress reports one or the other but not both. */
 static struct rule *
 oftable_replace_rule(struct rule *rule)
 {
@@ -4823,7 +5483,17 @@ oftable_replace_rule(struct rule *rule)
 
     victim = rule_from_cls_rule(classifier_replace(&table->cls, &rule->cr));
     if (victim) {
+        list_replace(&rule->table_node, &victim->table_node);
+        flow_dumps_relocate(ofproto, &victim->table_node, &rule->table_node);
         eviction_group_remove_rule(victim);
+        oftable_index_rule(rule, &victim->cookie_ref, victim->out_port_refs,
+                           victim->n_out_port_refs);
+        free(victim->out_port_refs);
+        victim->out_port_refs = NULL;
+        victim->n_out_port_refs = 0;
+    } else {
+        list_push_back(&table->rules, &rule->table_node);
+        oftable_index_rule(rule, NULL, NULL, 0);
     }
     eviction_group_add_rule(rule);
     return victim;
@@ -4839,6 +5509,242 @@ oftable_substitute_rule(struct rule *old, struct rule *new)
         oftable_remove_rule(old);
     }
 }
+
+/* Returns the hash of 'key' within an oftable index. */
+static uint32_t
+rule_index_hash(uint64_t key)
+{
+    return hash_2words(key, key >> 32);
+}
+
+/* Returns the group within 'index' whose key is 'key', or a null pointer if
+ * there is none. */
+static struct rule_index_group *
+rule_index_find(const struct hmap *index, uint64_t key)
+{
+    struct rule_index_group *group;
+
+    HMAP_FOR_EACH_WITH_HASH (group, hmap_node, rule_index_hash(key), index) {
+        if (group->key == key) {
+            return group;
+        }
+    }
+    return NULL;
+}
+
+/* Adds 'rule' to the group within 'index' whose key is 'key', creating the
+ * group if necessary, using 'ref' to record its membership. */
+static void
+rule_index_add(struct hmap *index, uint64_t key, struct rule *rule,
+               struct rule_index_ref *ref)
+{
+    struct rule_index_group *group;
+
+    group = rule_index_find(index, key);
+    if (!group) {
+        group = xmalloc(sizeof *group);
+        group->key = key;
+        list_init(&group->refs);
+        group->n_refs = 0;
+        hmap_insert(index, &group->hmap_node, rule_index_hash(key));
+    }
+
+    ref->group = group;
+    ref->rule = rule;
+    list_push_back(&group->refs, &ref->list_node);
+    group->n_refs++;
+}
+
+/* Makes 'to' record, on behalf of 'rule', the group membership now recorded
+ * in 'from', in the same position within the group, and clears 'from'. */
+static void
+rule_index_move(struct rule_index_ref *from, struct rule_index_ref *to,
+                struct rule *rule)
+{
+    to->group = from->group;
+    to->rule = rule;
+    list_replace(&to->list_node, &from->list_node);
+    flow_dumps_relocate(rule->ofproto, &from->list_node, &to->list_node);
+    from->group = NULL;
+}
+
+/* Removes the membership recorded in 'ref' from its group within 'index', if
+ * any, destroying the group if that leaves it empty. */
+static void
+rule_index_remove(struct hmap *index, struct rule_index_ref *ref)
+{
+    struct rule_index_group *group = ref->group;
+
+    if (group) {
+        struct ofproto *ofproto = ref->rule->ofproto;
+
+        ref->group = NULL;
+        flow_dumps_unlink(ofproto, &ref->list_node);
+        list_remove(&ref->list_node);
+        if (!--group->n_refs) {
+            flow_dumps_forget(ofproto, &group->refs);
+            hmap_remove(index, &group->hmap_node);
+            free(group);
+        }
+    }
+}
+
+/* Returns the port that 'a' outputs to, for the purpose of OpenFlow out_port
+ * matching, or OFPP_NONE if 'a' doesn't output to a single port.  This must
+ * agree with ofpact_outputs_to_port(). */
+static uint16_t
+ofpact_get_out_port(const struct ofpact *a)
+{
+    return (a->type == OFPACT_OUTPUT ? ofpact_get_OUTPUT(a)->port
+            : a->type == OFPACT_ENQUEUE ? ofpact_get_ENQUEUE(a)->port
+            : a->type == OFPACT_CONTROLLER ? OFPP_CONTROLLER
+            : OFPP_NONE);
+}
+
+/* Adds 'rule' to its oftable's cookie and output port indexes, based on its
+ * current 'flow_cookie' and 'ofpacts'.
+ *
+ * 'old_cookie_ref' (if nonnull) and the 'n_old_port_refs' elements of
+ * 'old_port_refs' are index memberships that 'rule' replaces, either its own
+ * before a change to its cookie or actions or those of a rule that it is
+ * replacing.  'rule' takes over the position of each of these whose group it
+ * still belongs to, and the rest are removed.  The caller retains ownership of
+ * 'old_port_refs' itself.
+ *
+ * On return, 'rule->out_port_refs' is newly allocated. */
+static void
+oftable_index_rule(struct rule *rule, struct rule_index_ref *old_cookie_ref,
+                   struct rule_index_ref *old_port_refs,
+                   size_t n_old_port_refs)
+{
+    struct oftable *table = &rule->ofproto->tables[rule->table_id];
+    uint64_t cookie = ntohll(rule->flow_cookie);
+    struct rule_index_ref *refs;
+    const struct ofpact *a;
+    size_t n_ports, n_refs;
+    size_t i;
+
+    if (old_cookie_ref && old_cookie_ref->group
+        && old_cookie_ref->group->key == cookie) {
+        if (old_cookie_ref != &rule->cookie_ref) {
+            rule_index_move(old_cookie_ref, &rule->cookie_ref, rule);
+        }
+    } else {
+        if (old_cookie_ref) {
+            rule_index_remove(&table->cookie_groups, old_cookie_ref);
+        }
+        rule_index_add(&table->cookie_groups, cookie, rule, &rule->cookie_ref);
+    }
+
+    n_ports = 0;
+    OFPACT_FOR_EACH (a, rule->ofpacts, rule->ofpacts_len) {
+        n_ports += ofpact_get_out_port(a) != OFPP_NONE;
+    }
+
+    refs = n_ports ? xmalloc(n_ports * sizeof *refs) : NULL;
+    n_refs = 0;
+    OFPACT_FOR_EACH (a, rule->ofpacts, rule->ofpacts_len) {
+        uint16_t port = ofpact_get_out_port(a);
+
+        if (port == OFPP_NONE) {
+            continue;
+        }
+        for (i = 0; i < n_refs; i++) {
+            if (refs[i].group->key == port) {
+                break;
+            }
+        }
+        if (i < n_refs) {
+            continue;
+        }
+
+        for (i = 0; i < n_old_port_refs; i++) {
+            if (old_port_refs[i].group
+                && old_port_refs[i].group->key == port) {
+                break;
+            }
+        }
+        if (i < n_old_port_refs) {
+            rule_index_move(&old_port_refs[i], &refs[n_refs++], rule);
+        } else {
+            rule_index_add(&table->out_port_groups, port, rule,
+                           &refs[n_refs++]);
+        }
+    }
+    for (i = 0; i < n_old_port_refs; i++) {
+        rule_index_remove(&table->out_port_groups, &old_port_refs[i]);
+    }
+
+    rule->out_port_refs = refs;
+    rule->n_out_port_refs = n_refs;
+}
+
+/* Updates 'rule''s memberships in its oftable's indexes following a change to
+ * its 'flow_cookie' or 'ofpacts'. */
+static void
+oftable_reindex_rule(struct rule *rule)
+{
+    struct rule_index_ref *old_port_refs = rule->out_port_refs;
+
+    oftable_index_rule(rule, &rule->cookie_ref, old_port_refs,
+                       rule->n_out_port_refs);
+    free(old_port_refs);
+}
+
+/* Removes 'rule' from its oftable's cookie and output port indexes.  Does
+ * nothing if 'rule' is not indexed. */
+static void
+oftable_unindex_rule(struct rule *rule)
+{
+    struct oftable *table = &rule->ofproto->tables[rule->table_id];
+    size_t i;
+
+    rule_index_remove(&table->cookie_groups, &rule->cookie_ref);
+    for (i = 0; i < rule->n_out_port_refs; i++) {
+        rule_index_remove(&table->out_port_groups, &rule->out_port_refs[i]);
+    }
+    free(rule->out_port_refs);
+    rule->out_port_refs = NULL;
+    rule->n_out_port_refs = 0;
+}
+
+/* Determines whether 'table''s indexes can narrow down a search for rules
+ * whose cookie matches 'cookie' within 'cookie_mask' and that output to
+ * 'out_port' (or any port, if 'out_port' is OFPP_NONE).
+ *
+ * If not, sets '*usable' to false and returns NULL.  Otherwise, sets '*usable'
+ * to true and returns the smallest group that contains every such rule, or
+ * NULL if there are no such rules.  The caller must still check each rule in
+ * the group against the search criteria, including any criteria that did not
+ * select the group. */
+static const struct rule_index_group *
+oftable_index_lookup(const struct oftable *table,
+                     ovs_be64 cookie, ovs_be64 cookie_mask,
+                     uint16_t out_port, bool *usable)
+{
+    const struct rule_index_group *by_cookie = NULL;
+    const struct rule_index_group *by_port = NULL;
+    bool use_cookie = cookie_mask == htonll(UINT64_MAX);
+    bool use_port = out_port != OFPP_NONE;
+
+    *usable = use_cookie || use_port;
+    if (use_cookie) {
+        by_cookie = rule_index_find(&table->cookie_groups, ntohll(cookie));
+        if (!by_cookie) {
+            return NULL;
+        }
+    }
+    if (use_port) {
+        by_port = rule_index_find(&table->out_port_groups, out_port);
+        if (!by_port) {
+            return NULL;
+        }
+    }
+    return (!by_cookie ? by_port
+            : !by_port ? by_cookie
+            : by_port->n_refs < by_cookie->n_refs ? by_port
+            : by_cookie);
+}
 
 /* unixctl commands. */
 
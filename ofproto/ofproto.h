@@ -207,6 +207,13 @@ int ofproto_port_dump_done(struct ofproto_port_dump *);
 #define OFPROTO_FLOW_EVICTION_THRESHOLD_DEFAULT  1000
 #define OFPROTO_FLOW_EVICTION_THRESHOLD_MIN 100
 
+#define OFPROTO_MAX_HANDLER_THREADS 64
+#define OFPROTO_MAX_REVALIDATOR_THREADS 64
+#define OFPROTO_MAX_REVALIDATION_BUDGET 60000 /* In milliseconds. */
+#define OFPROTO_DEFAULT_MISS_BATCH 50
+#define OFPROTO_MAX_MISS_BATCH 1000
+#define OFPROTO_MAX_MISS_HOLD 60000             /* In milliseconds. */
+
 int ofproto_port_add(struct ofproto *, struct netdev *, uint16_t *ofp_portp);
 int ofproto_port_del(struct ofproto *, uint16_t ofp_port);
 int ofproto_port_get_stats(const struct ofport *, struct netdev_stats *stats);
@@ -214,6 +221,22 @@ int ofproto_port_get_stats(const struct ofport *, struct netdev_stats *stats);
 int ofproto_port_query_by_name(const struct ofproto *, const char *devname,
                                struct ofproto_port *);
 
+/* What distinguishes the sources of new flows that a flow setup budget limits
+ * separately.  See ofproto_set_flow_setup_budget(). */
+enum ofproto_flow_setup_key {
+    OFPROTO_FLOW_SETUP_PER_PORT,   /* Input port. */
+    OFPROTO_FLOW_SETUP_PER_VLAN,   /* Input port and VLAN ID. */
+    OFPROTO_FLOW_SETUP_PER_TUNNEL  /* Input port and tunnel ID. */
+};
+
+/* Configuration of every datapath. */
+void ofproto_set_n_handler_threads(unsigned n_threads);
+void ofproto_set_n_revalidator_threads(unsigned n_threads);
+void ofproto_set_revalidation_budget(unsigned msec);
+void ofproto_set_stats_batch(unsigned n_flows);
+void ofproto_set_flow_limit(unsigned n_flows);
+void ofproto_set_miss_batch(unsigned n_upcalls, unsigned hold_msec);
+
 /* Top-level configuration. */
 uint64_t ofproto_get_datapath_id(const struct ofproto *);
 void ofproto_set_datapath_id(struct ofproto *, uint64_t datapath_id);
@@ -226,6 +249,9 @@ void ofproto_set_extra_in_band_remotes(struct ofproto *,
 void ofproto_set_in_band_queue(struct ofproto *, int queue_id);
 void ofproto_set_flow_eviction_threshold(struct ofproto *, unsigned threshold);
 void ofproto_set_forward_bpdu(struct ofproto *, bool forward_bpdu);
+void ofproto_set_flow_setup_budget(struct ofproto *, unsigned rate,
+                                   unsigned burst,
+                                   enum ofproto_flow_setup_key);
 void ofproto_set_mac_idle_time(struct ofproto *, unsigned idle_time);
 void ofproto_set_desc(struct ofproto *,
                       const char *mfr_desc, const char *hw_desc,
@@ -252,6 +278,8 @@ int ofproto_port_get_stp_status(struct ofproto *, uint16_t ofp_port,
 int ofproto_port_set_queues(struct ofproto *, uint16_t ofp_port,
                             const struct ofproto_port_queue *,
                             size_t n_queues);
+int ofproto_port_set_upcall_weight(struct ofproto *, uint16_t ofp_port,
+                                   unsigned int weight);
 
 /* The behaviour of the port regarding VLAN handling */
 enum port_vlan_mode {
@@ -91,6 +91,32 @@ make_id(unsigned int buffer_idx, unsigned int cookie)
     return buffer_idx | (cookie << PKTBUF_BITS);
 }
 
+/* Claims the next packet buffer in 'pb' for a new packet, discarding the
+ * packet that it held, if any.  Returns NULL if that packet is too recent to
+ * overwrite. */
+static struct packet *
+pktbuf_claim(struct pktbuf *pb, uint16_t in_port)
+{
+    struct packet *p = &pb->packets[pb->buffer_idx];
+    pb->buffer_idx = (pb->buffer_idx + 1) & PKTBUF_MASK;
+    if (p->buffer) {
+        if (time_msec() < p->timeout) {
+            return NULL;
+        }
+        ofpbuf_delete(p->buffer);
+        p->buffer = NULL;
+    }
+
+    /* Don't use maximum cookie value since all-1-bits ID is special. */
+    if (++p->cookie >= COOKIE_MAX) {
+        p->cookie = 0;
+    }
+
+    p->timeout = time_msec() + OVERWRITE_MSECS;
+    p->in_port = in_port;
+    return p;
+}
+
 /* Attempts to allocate an OpenFlow packet buffer id within 'pb'.  The packet
  * buffer will store a copy of 'buffer_size' bytes in 'buffer' and the port
  * number 'in_port', which should be the OpenFlow port number on which 'buffer'
@@ -106,25 +132,29 @@ uint32_t
 pktbuf_save(struct pktbuf *pb, const void *buffer, size_t buffer_size,
             uint16_t in_port)
 {
-    struct packet *p = &pb->packets[pb->buffer_idx];
-    pb->buffer_idx = (pb->buffer_idx + 1) & PKTBUF_MASK;
-    if (p->buffer) {
-        if (time_msec() < p->timeout) {
-            return UINT32_MAX;
-        }
-        ofpbuf_delete(p->buffer);
+    struct packet *p = pktbuf_claim(pb, in_port);
+    if (!p) {
+        return UINT32_MAX;
     }
 
-    /* Don't use maximum cookie value since all-1-bits ID is special. */
-    if (++p->cookie >= COOKIE_MAX) {
-        p->cookie = 0;
-    }
     p->buffer = ofpbuf_clone_data_with_headroom(buffer, buffer_size,
                                                 sizeof(struct ofp_packet_in));
+    return make_id(p - pb->packets, p->cookie);
+}
 
+/* Like pktbuf_save(), except that on success the packet buffer takes
+ * ownership of 'buffer' itself instead of storing a copy of its data.  On
+ * failure, the caller retains ownership of 'buffer'. */
+uint32_t
+pktbuf_adopt(struct pktbuf *pb, struct ofpbuf *buffer, uint16_t in_port)
+{
+    struct packet *p = pktbuf_claim(pb, in_port);
+    if (!p) {
+        return UINT32_MAX;
+    }
 
-    p->timeout = time_msec() + OVERWRITE_MSECS;
-    p->in_port = in_port;
+    ofpbuf_prealloc_headroom(buffer, sizeof(struct ofp_packet_in));
+    p->buffer = buffer;
     return make_id(p - pb->packets, p->cookie);
 }
 
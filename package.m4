@@ -0,0 +1,6 @@
+# Signature of the current package.
+m4_define([AT_PACKAGE_NAME],      [openvswitch])
+m4_define([AT_PACKAGE_TARNAME],   [openvswitch])
+m4_define([AT_PACKAGE_VERSION],   [1.9.90])
+m4_define([AT_PACKAGE_STRING],    [openvswitch 1.9.90])
+m4_define([AT_PACKAGE_BUGREPORT], [ovs-bugs@openvswitch.org])
@@ -35,6 +35,7 @@ TESTSUITE_AT = \
 	tests/lockfile.at \
 	tests/reconnect.at \
 	tests/ofproto-dpif.at \
+	tests/dpif-netdev.at \
 	tests/ofproto-macros.at \
 	tests/ofproto.at \
 	tests/ovsdb.at \
@@ -99,7 +100,9 @@ valgrind_wrappers = \
 	tests/valgrind/test-byte-order \
 	tests/valgrind/test-classifier \
 	tests/valgrind/test-csum \
+	tests/valgrind/test-dpif-netdev \
 	tests/valgrind/test-file_name \
+	tests/valgrind/test-flow-mods \
 	tests/valgrind/test-flows \
 	tests/valgrind/test-hash \
 	tests/valgrind/test-heap \
@@ -111,6 +114,7 @@ valgrind_wrappers = \
 	tests/valgrind/test-multipath \
 	tests/valgrind/test-odp \
 	tests/valgrind/test-ovsdb \
+	tests/valgrind/test-packet-ins \
 	tests/valgrind/test-packets \
 	tests/valgrind/test-random \
 	tests/valgrind/test-reconnect \
@@ -178,6 +182,14 @@ noinst_PROGRAMS += tests/test-csum
 tests_test_csum_SOURCES = tests/test-csum.c
 tests_test_csum_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
+noinst_PROGRAMS += tests/test-dpif-netdev
+tests_test_dpif_netdev_SOURCES = tests/test-dpif-netdev.c
+tests_test_dpif_netdev_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
+
+noinst_PROGRAMS += tests/test-flow-mods
+tests_test_flow_mods_SOURCES = tests/test-flow-mods.c
+tests_test_flow_mods_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
+
 noinst_PROGRAMS += tests/test-file_name
 tests_test_file_name_SOURCES = tests/test-file_name.c
 tests_test_file_name_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
@@ -219,6 +231,10 @@ noinst_PROGRAMS += tests/test-multipath
 tests_test_multipath_SOURCES = tests/test-multipath.c
 tests_test_multipath_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
 
+noinst_PROGRAMS += tests/test-packet-ins
+tests_test_packet_ins_SOURCES = tests/test-packet-ins.c
+tests_test_packet_ins_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
+
 noinst_PROGRAMS += tests/test-packets
 tests_test_packets_SOURCES = tests/test-packets.c
 tests_test_packets_LDADD = lib/libopenvswitch.a $(SSL_LIBS)
@@ -29,11 +29,14 @@
 #include "classifier.h"
 #include <errno.h>
 #include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include "byte-order.h"
 #include "command-line.h"
 #include "flow.h"
 #include "ofp-util.h"
 #include "packets.h"
+#include "timeval.h"
 #include "unaligned.h"
 
 #undef NDEBUG
@@ -381,6 +384,30 @@ get_value(unsigned int *x, unsigned n_values)
     return rem;
 }
 
+/* Initializes 'flow' with a random combination of the values above. */
+static void
+make_random_flow(struct flow *flow)
+{
+    unsigned int x = rand () % N_FLOW_VALUES;
+
+    memset(flow, 0, sizeof *flow);
+    flow->nw_src = nw_src_values[get_value(&x, N_NW_SRC_VALUES)];
+    flow->nw_dst = nw_dst_values[get_value(&x, N_NW_DST_VALUES)];
+    flow->tunnel.tun_id = tun_id_values[get_value(&x, N_TUN_ID_VALUES)];
+    flow->metadata = metadata_values[get_value(&x, N_METADATA_VALUES)];
+    flow->in_port = in_port_values[get_value(&x, N_IN_PORT_VALUES)];
+    flow->vlan_tci = vlan_tci_values[get_value(&x, N_VLAN_TCI_VALUES)];
+    flow->dl_type = dl_type_values[get_value(&x, N_DL_TYPE_VALUES)];
+    flow->tp_src = tp_src_values[get_value(&x, N_TP_SRC_VALUES)];
+    flow->tp_dst = tp_dst_values[get_value(&x, N_TP_DST_VALUES)];
+    memcpy(flow->dl_src, dl_src_values[get_value(&x, N_DL_SRC_VALUES)],
+           ETH_ADDR_LEN);
+    memcpy(flow->dl_dst, dl_dst_values[get_value(&x, N_DL_DST_VALUES)],
+           ETH_ADDR_LEN);
+    flow->nw_proto = nw_proto_values[get_value(&x, N_NW_PROTO_VALUES)];
+    flow->nw_tos = nw_dscp_values[get_value(&x, N_NW_DSCP_VALUES)];
+}
+
 static void
 compare_classifiers(struct classifier *cls, struct tcls *tcls)
 {
@@ -391,27 +418,9 @@ compare_classifiers(struct classifier *cls, struct tcls *tcls)
     for (i = 0; i < confidence; i++) {
         struct cls_rule *cr0, *cr1;
         struct flow flow;
-        unsigned int x;
-
-        x = rand () % N_FLOW_VALUES;
-        memset(&flow, 0, sizeof flow);
-        flow.nw_src = nw_src_values[get_value(&x, N_NW_SRC_VALUES)];
-        flow.nw_dst = nw_dst_values[get_value(&x, N_NW_DST_VALUES)];
-        flow.tunnel.tun_id = tun_id_values[get_value(&x, N_TUN_ID_VALUES)];
-        flow.metadata = metadata_values[get_value(&x, N_METADATA_VALUES)];
-        flow.in_port = in_port_values[get_value(&x, N_IN_PORT_VALUES)];
-        flow.vlan_tci = vlan_tci_values[get_value(&x, N_VLAN_TCI_VALUES)];
-        flow.dl_type = dl_type_values[get_value(&x, N_DL_TYPE_VALUES)];
-        flow.tp_src = tp_src_values[get_value(&x, N_TP_SRC_VALUES)];
-        flow.tp_dst = tp_dst_values[get_value(&x, N_TP_DST_VALUES)];
-        memcpy(flow.dl_src, dl_src_values[get_value(&x, N_DL_SRC_VALUES)],
-               ETH_ADDR_LEN);
-        memcpy(flow.dl_dst, dl_dst_values[get_value(&x, N_DL_DST_VALUES)],
-               ETH_ADDR_LEN);
-        flow.nw_proto = nw_proto_values[get_value(&x, N_NW_PROTO_VALUES)];
-        flow.nw_tos = nw_dscp_values[get_value(&x, N_NW_DSCP_VALUES)];
-
-        cr0 = classifier_lookup(cls, &flow);
+
+        make_random_flow(&flow);
+        cr0 = classifier_lookup(cls, &flow, NULL);
         cr1 = tcls_lookup(tcls, &flow);
         assert((cr0 == NULL) == (cr1 == NULL));
         if (cr0 != NULL) {
@@ -438,6 +447,36 @@ destroy_classifier(struct classifier *cls)
     classifier_destroy(cls);
 }
 
+/* Checks the structure of the prefix trie rooted at 'node', at depth 'ofs'
+ * bits, and returns the number of rules that it contains. */
+static unsigned int
+check_trie(const struct trie_node *node, unsigned int ofs)
+{
+    unsigned int n_rules;
+    int i;
+
+    if (!node) {
+        return 0;
+    }
+
+    assert(node->n_bits <= 32);
+    assert(node->n_bits > 0 || ofs == 0);
+    n_rules = node->n_rules;
+    for (i = 0; i < 2; i++) {
+        const struct trie_node *child = node->edges[i];
+
+        if (child) {
+            assert(child->n_bits > 0);
+            assert(child->prefix >> 31 == i);
+            n_rules += check_trie(child, ofs + node->n_bits);
+        }
+    }
+
+    /* Every leaf has rules. */
+    assert(node->n_rules || node->edges[0] || node->edges[1]);
+    return n_rules;
+}
+
 static void
 check_tables(const struct classifier *cls,
              int n_tables, int n_rules, int n_dups)
@@ -449,9 +488,14 @@ check_tables(const struct classifier *cls,
     int found_rules = 0;
     int found_dups = 0;
     int found_rules2 = 0;
+    int trie_rules[CLS_N_TRIES];
+    size_t i;
 
+    memset(trie_rules, 0, sizeof trie_rules);
     HMAP_FOR_EACH (table, hmap_node, &cls->tables) {
         const struct cls_rule *head;
+        unsigned int max_priority = 0;
+        unsigned int max_count = 0;
 
         assert(!hmap_is_empty(&table->rules));
 
@@ -460,6 +504,13 @@ check_tables(const struct classifier *cls,
             unsigned int prev_priority = UINT_MAX;
             const struct cls_rule *rule;
 
+            if (head->priority > max_priority) {
+                max_priority = head->priority;
+                max_count = 1;
+            } else if (head->priority == max_priority) {
+                max_count++;
+            }
+
             found_rules++;
             LIST_FOR_EACH (rule, list, &head->list) {
                 assert(rule->priority < prev_priority);
@@ -469,6 +520,41 @@ check_tables(const struct classifier *cls,
                 assert(classifier_find_rule_exactly(cls, rule) == rule);
             }
         }
+        assert(table->max_priority == max_priority);
+        assert(table->max_count == max_count);
+        assert(cls->tables_priority[table->priority_idx] == table);
+
+        /* Each stage index counts every head exactly once. */
+        assert(table->n_stages <= CLS_N_STAGES);
+        for (i = 0; i + 1 < table->n_stages; i++) {
+            const struct cls_stage_hash *sh;
+            size_t n_heads = 0;
+
+            assert(table->stages[i] < table->stages[i + 1]);
+            HMAP_FOR_EACH (sh, hmap_node, &table->indices[i]) {
+                assert(sh->n_heads > 0);
+                n_heads += sh->n_heads;
+            }
+            assert(n_heads == hmap_count(&table->rules));
+        }
+        for (; i < CLS_N_STAGES - 1; i++) {
+            assert(hmap_is_empty(&table->indices[i]));
+        }
+
+        for (i = 0; i < CLS_N_TRIES; i++) {
+            if (table->trie_plens[i]) {
+                trie_rules[i] += table->n_table_rules;
+            }
+        }
+    }
+
+    for (i = 1; i < hmap_count(&cls->tables); i++) {
+        assert(cls->tables_priority[i - 1]->max_priority
+               >= cls->tables_priority[i]->max_priority);
+    }
+
+    for (i = 0; i < CLS_N_TRIES; i++) {
+        assert(check_trie(cls->tries[i], 0) == trie_rules[i]);
     }
 
     assert(found_tables == hmap_count(&cls->tables));
@@ -494,6 +580,11 @@ make_rule(int wc_fields, unsigned int priority, int value_pat)
     for (f = &cls_fields[0]; f < &cls_fields[CLS_N_FIELDS]; f++) {
         int f_idx = f - cls_fields;
         int value_idx = (value_pat & (1u << f_idx)) != 0;
+
+        if (wc_fields & (1u << f_idx)) {
+            continue;
+        }
+
         memcpy((char *) &match.flow + f->ofs,
                values[f_idx][value_idx], f->len);
 
@@ -969,6 +1060,226 @@ test_many_rules_in_five_tables(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
     test_many_rules_in_n_tables(5);
 }
 
+/* Prefix tests. */
+
+enum { N_PREFIX_ADDRS = 8 };
+
+/* Addresses from which prefix rules and flows are drawn. */
+struct prefix_addrs {
+    ovs_be32 ip[N_PREFIX_ADDRS];
+    struct in6_addr ipv6[N_PREFIX_ADDRS];
+};
+
+static uint32_t
+random_u32(void)
+{
+    return ((uint32_t) rand() << 16) ^ rand();
+}
+
+static ovs_be32
+ip_prefix_mask(int plen)
+{
+    return plen ? htonl(UINT32_MAX << (32 - plen)) : htonl(0);
+}
+
+static void
+init_prefix_addrs(struct prefix_addrs *addrs)
+{
+    int i, j;
+
+    for (i = 0; i < N_PREFIX_ADDRS; i++) {
+        addrs->ip[i] = htonl(random_u32());
+        for (j = 0; j < 16; j++) {
+            addrs->ipv6[i].s6_addr[j] = rand();
+        }
+    }
+}
+
+/* Returns a new rule at the given 'priority' that matches either IPv4 or IPv6
+ * and random prefixes of random addresses in 'addrs' in the source and
+ * destination address fields. */
+static struct test_rule *
+make_prefix_rule(const struct prefix_addrs *addrs, unsigned int priority)
+{
+    struct test_rule *rule;
+    struct match match;
+
+    match_init_catchall(&match);
+    if (rand() % 2) {
+        match_set_dl_type(&match, htons(ETH_TYPE_IP));
+        match_set_nw_dst_masked(&match, addrs->ip[rand() % N_PREFIX_ADDRS],
+                                ip_prefix_mask(rand() % 33));
+        if (rand() % 2) {
+            match_set_nw_src_masked(&match,
+                                    addrs->ip[rand() % N_PREFIX_ADDRS],
+                                    ip_prefix_mask(rand() % 33));
+        }
+    } else {
+        struct in6_addr mask;
+
+        match_set_dl_type(&match, htons(ETH_TYPE_IPV6));
+        mask = ipv6_create_mask(rand() % 129);
+        match_set_ipv6_dst_masked(&match,
+                                  &addrs->ipv6[rand() % N_PREFIX_ADDRS],
+                                  &mask);
+        if (rand() % 2) {
+            mask = ipv6_create_mask(rand() % 129);
+            match_set_ipv6_src_masked(&match,
+                                      &addrs->ipv6[rand() % N_PREFIX_ADDRS],
+                                      &mask);
+        }
+    }
+
+    rule = xzalloc(sizeof *rule);
+    cls_rule_init(&rule->cls_rule, &match, priority);
+    return rule;
+}
+
+/* Initializes 'flow' as an IPv4 or IPv6 flow whose addresses share a random
+ * number of leading bits with addresses in 'addrs'. */
+static void
+make_prefix_flow(const struct prefix_addrs *addrs, struct flow *flow)
+{
+    memset(flow, 0, sizeof *flow);
+    if (rand() % 2) {
+        flow->dl_type = htons(ETH_TYPE_IP);
+        flow->nw_src = (addrs->ip[rand() % N_PREFIX_ADDRS]
+                        ^ htonl(random_u32() >> (rand() % 32)));
+        flow->nw_dst = (addrs->ip[rand() % N_PREFIX_ADDRS]
+                        ^ htonl(random_u32() >> (rand() % 32)));
+    } else {
+        int ofs = rand() % 128;
+        int i;
+
+        flow->dl_type = htons(ETH_TYPE_IPV6);
+        flow->ipv6_src = addrs->ipv6[rand() % N_PREFIX_ADDRS];
+        flow->ipv6_dst = addrs->ipv6[rand() % N_PREFIX_ADDRS];
+        for (i = ofs / 8 + 1; i < 16; i++) {
+            flow->ipv6_src.s6_addr[i] ^= rand();
+            flow->ipv6_dst.s6_addr[i] ^= rand();
+        }
+    }
+}
+
+/* Returns true if 'rule' matches 'flow', considering every field. */
+static bool
+rule_matches_flow(const struct cls_rule *rule, const struct flow *flow)
+{
+    const uint32_t *flow_u32 = (const uint32_t *) flow;
+    const uint32_t *value_u32, *mask_u32;
+    struct match match;
+    size_t i;
+
+    minimatch_expand(&rule->match, &match);
+    value_u32 = (const uint32_t *) &match.flow;
+    mask_u32 = (const uint32_t *) &match.wc.masks;
+    for (i = 0; i < FLOW_U32S; i++) {
+        if ((flow_u32[i] ^ value_u32[i]) & mask_u32[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Compares lookups in 'cls' against a linear search of 'tcls', and checks
+ * that the result of each lookup in 'cls' stays the same when any bits of the
+ * flow outside of the wildcards that the lookup reported are changed. */
+static void
+compare_prefix_lookups(struct classifier *cls, const struct tcls *tcls,
+                       const struct prefix_addrs *addrs)
+{
+    int i;
+
+    assert(classifier_count(cls) == tcls->n_rules);
+    for (i = 0; i < 200; i++) {
+        struct cls_rule *cr0, *cr1, *cr2;
+        struct flow_wildcards wc;
+        struct flow flow, flow2;
+        uint32_t *flow2_u32;
+        const uint32_t *wc_u32;
+        size_t j;
+
+        make_prefix_flow(addrs, &flow);
+        flow_wildcards_init_catchall(&wc);
+        cr0 = classifier_lookup(cls, &flow, &wc);
+
+        cr1 = NULL;
+        for (j = 0; j < tcls->n_rules; j++) {
+            if (rule_matches_flow(&tcls->rules[j]->cls_rule, &flow)) {
+                cr1 = &tcls->rules[j]->cls_rule;
+                break;
+            }
+        }
+        assert((cr0 == NULL) == (cr1 == NULL));
+        if (cr0) {
+            assert(cls_rule_equal(cr0, cr1));
+        }
+
+        flow2 = flow;
+        flow2_u32 = (uint32_t *) &flow2;
+        wc_u32 = (const uint32_t *) &wc.masks;
+        for (j = 0; j < FLOW_U32S; j++) {
+            flow2_u32[j] ^= random_u32() & ~wc_u32[j];
+        }
+        cr2 = classifier_lookup(cls, &flow2, NULL);
+        assert(cr2 == cr0);
+    }
+}
+
+/* Tests classification with rules that match IPv4 and IPv6 address prefixes of
+ * many different lengths, as in routing tables, which the classifier tracks in
+ * prefix tries. */
+static void
+test_prefix_rules(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    enum { N_RULES = 100 };
+    int iteration;
+
+    for (iteration = 0; iteration < 30; iteration++) {
+        unsigned int priorities[N_RULES];
+        struct test_rule *rules[N_RULES];
+        struct test_rule *tcls_rules[N_RULES];
+        struct prefix_addrs addrs;
+        struct classifier cls;
+        struct tcls tcls;
+        int i;
+
+        srand(iteration);
+        init_prefix_addrs(&addrs);
+        for (i = 0; i < N_RULES; i++) {
+            priorities[i] = i;
+        }
+        shuffle(priorities, N_RULES);
+
+        classifier_init(&cls);
+        tcls_init(&tcls);
+
+        for (i = 0; i < N_RULES; i++) {
+            rules[i] = make_prefix_rule(&addrs, priorities[i]);
+            tcls_rules[i] = tcls_insert(&tcls, rules[i]);
+            classifier_insert(&cls, &rules[i]->cls_rule);
+            check_tables(&cls, -1, i + 1, -1);
+            if (i % 10 == 9) {
+                compare_prefix_lookups(&cls, &tcls, &addrs);
+            }
+        }
+
+        for (i = 0; i < N_RULES; i++) {
+            classifier_remove(&cls, &rules[i]->cls_rule);
+            tcls_remove(&tcls, tcls_rules[i]);
+            free_rule(rules[i]);
+            check_tables(&cls, -1, N_RULES - i - 1, -1);
+            if (i % 10 == 9) {
+                compare_prefix_lookups(&cls, &tcls, &addrs);
+            }
+        }
+        assert(classifier_is_empty(&cls));
+
+        classifier_destroy(&cls);
+        tcls_destroy(&tcls);
+    }
+}
+
 /* Miniflow tests. */
 
 static uint32_t
@@ -1262,6 +1573,198 @@ test_minimask_combine(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
     }
 }
 
+/* Benchmarks. */
+
+/* Builds a classifier with 'n_masks' distinct masks, each with a few rules
+ * whose priorities decrease from one mask to the next, plus a low-priority
+ * catch-all rule, then performs 'n_lookups' lookups of random flows.  Returns
+ * the elapsed time in milliseconds. */
+static long long int
+benchmark__(int n_masks, int n_lookups)
+{
+    enum { RULES_PER_MASK = 4, N_FLOWS = 1024 };
+    enum { N_WCFS = (1u << CLS_N_FIELDS) - 2 };
+    struct classifier cls;
+    unsigned int *wcfs;
+    struct flow *flows;
+    long long int start, elapsed;
+    int i, j;
+
+    /* Choose 'n_masks' distinct masks, other than exact-match (0) and
+     * catch-all (all bits set). */
+    srand(n_masks);
+    wcfs = xmalloc(N_WCFS * sizeof *wcfs);
+    for (i = 0; i < N_WCFS; i++) {
+        wcfs[i] = i + 1;
+    }
+    shuffle(wcfs, N_WCFS);
+
+    classifier_init(&cls);
+    for (i = 0; i < n_masks; i++) {
+        for (j = 0; j < RULES_PER_MASK; j++) {
+            unsigned int priority = (n_masks - i) * RULES_PER_MASK - j;
+            struct test_rule *rule = make_rule(wcfs[i], priority, rand());
+
+            classifier_insert(&cls, &rule->cls_rule);
+        }
+    }
+    classifier_insert(&cls, &make_rule(N_WCFS + 1, 0, 0)->cls_rule);
+
+    flows = xmalloc(N_FLOWS * sizeof *flows);
+    for (i = 0; i < N_FLOWS; i++) {
+        make_random_flow(&flows[i]);
+    }
+
+    time_refresh();
+    start = time_msec();
+    for (i = 0; i < n_lookups; i++) {
+        if (!classifier_lookup(&cls, &flows[i % N_FLOWS], NULL)) {
+            NOT_REACHED();
+        }
+    }
+    time_refresh();
+    elapsed = time_msec() - start;
+
+    free(flows);
+    free(wcfs);
+    destroy_classifier(&cls);
+
+    return elapsed;
+}
+
+static void
+benchmark(int argc, char *argv[])
+{
+    int max_masks = argc > 1 ? atoi(argv[1]) : 256;
+    int n_lookups = argc > 2 ? atoi(argv[2]) : 1000000;
+    int n_masks;
+
+    if (max_masks <= 0 || max_masks > (1u << CLS_N_FIELDS) - 2
+        || n_lookups <= 0) {
+        ovs_fatal(0, "invalid mask or lookup count");
+    }
+
+    for (n_masks = 1; n_masks <= max_masks; n_masks *= 2) {
+        long long int elapsed = benchmark__(n_masks, n_lookups);
+
+        printf("%4d masks: %d lookups in %lld ms (%.0f lookups/s)\n",
+               n_masks, n_lookups, elapsed,
+               n_lookups * 1000.0 / MAX(elapsed, 1));
+    }
+}
+
+/* Returns a random prefix length with roughly the distribution found in an
+ * Internet routing table: mostly /24, then /16 to /23, and a few others. */
+static int
+random_route_plen(void)
+{
+    int x = rand() % 100;
+
+    return (x < 55 ? 24
+            : x < 90 ? 16 + rand() % 8
+            : x < 95 ? 8 + rand() % 8
+            : 25 + rand() % 8);
+}
+
+/* Builds a routing table of 'n_routes' nw_dst prefixes, each at a priority
+ * equal to its length, plus a default route, then performs 'n_lookups' lookups
+ * of addresses within the routes, with prefix tries enabled or disabled
+ * according to 'use_tries'.  Stores the number of tables in '*n_tables' and
+ * returns the elapsed time in milliseconds. */
+static long long int
+benchmark_routing__(int n_routes, int n_lookups, bool use_tries,
+                    size_t *n_tables)
+{
+    enum { N_FLOWS = 1024 };
+    struct test_rule *rule;
+    struct classifier cls;
+    struct match match;
+    struct flow *flows;
+    long long int start, elapsed;
+    int i;
+
+    srand(n_routes);
+    classifier_init(&cls);
+    classifier_set_prefix_lookup(&cls, use_tries);
+
+    flows = xmalloc(N_FLOWS * sizeof *flows);
+    for (i = 0; i < n_routes; i++) {
+        struct cls_rule *displaced;
+        int plen = random_route_plen();
+        ovs_be32 addr = htonl(random_u32());
+
+        match_init_catchall(&match);
+        match_set_dl_type(&match, htons(ETH_TYPE_IP));
+        match_set_nw_dst_masked(&match, addr, ip_prefix_mask(plen));
+        rule = xzalloc(sizeof *rule);
+        cls_rule_init(&rule->cls_rule, &match, plen);
+        displaced = classifier_replace(&cls, &rule->cls_rule);
+        if (displaced) {
+            free_rule(test_rule_from_cls_rule(displaced));
+        }
+
+        if (i < N_FLOWS) {
+            memset(&flows[i], 0, sizeof flows[i]);
+            flows[i].dl_type = htons(ETH_TYPE_IP);
+            flows[i].nw_dst = addr ^ (htonl(random_u32())
+                                      & ~ip_prefix_mask(plen));
+        }
+    }
+    for (; i < N_FLOWS; i++) {
+        flows[i] = flows[i % n_routes];
+    }
+
+    match_init_catchall(&match);
+    match_set_dl_type(&match, htons(ETH_TYPE_IP));
+    rule = xzalloc(sizeof *rule);
+    cls_rule_init(&rule->cls_rule, &match, 0);
+    classifier_insert(&cls, &rule->cls_rule);
+
+    *n_tables = hmap_count(&cls.tables);
+
+    time_refresh();
+    start = time_msec();
+    for (i = 0; i < n_lookups; i++) {
+        if (!classifier_lookup(&cls, &flows[i % N_FLOWS], NULL)) {
+            NOT_REACHED();
+        }
+    }
+    time_refresh();
+    elapsed = time_msec() - start;
+
+    free(flows);
+    destroy_classifier(&cls);
+
+    return elapsed;
+}
+
+static void
+benchmark_routing(int argc, char *argv[])
+{
+    int max_routes = argc > 1 ? atoi(argv[1]) : 100000;
+    int n_lookups = argc > 2 ? atoi(argv[2]) : 1000000;
+    int n_routes;
+
+    if (max_routes <= 0 || n_lookups <= 0) {
+        ovs_fatal(0, "invalid route or lookup count");
+    }
+
+    for (n_routes = 10; n_routes <= max_routes; n_routes *= 10) {
+        int use_tries;
+
+        for (use_tries = 0; use_tries < 2; use_tries++) {
+            size_t n_tables;
+            long long int elapsed = benchmark_routing__(n_routes, n_lookups,
+                                                        use_tries, &n_tables);
+
+            printf("%6d routes, %2zu tables, tries %-3s: "
+                   "%d lookups in %lld ms (%.0f lookups/s)\n",
+                   n_routes, n_tables, use_tries ? "on" : "off",
+                   n_lookups, elapsed, n_lookups * 1000.0 / MAX(elapsed, 1));
+        }
+    }
+}
+
 static const struct command commands[] = {
     /* Classifier tests. */
     {"empty", 0, 0, test_empty},
@@ -1272,12 +1775,17 @@ static const struct command commands[] = {
     {"many-rules-in-one-table", 0, 0, test_many_rules_in_one_table},
     {"many-rules-in-two-tables", 0, 0, test_many_rules_in_two_tables},
     {"many-rules-in-five-tables", 0, 0, test_many_rules_in_five_tables},
+    {"prefix-rules", 0, 0, test_prefix_rules},
 
     /* Miniflow and minimask tests. */
     {"miniflow", 0, 0, test_miniflow},
 	{"minimask_has_extra", 0, 0, test_minimask_has_extra},
 	{"minimask_combine", 0, 0, test_minimask_combine},
 
+    /* Benchmarks. */
+    {"benchmark", 0, 2, benchmark},
+    {"benchmark-routing", 0, 2, benchmark_routing},
+
     {NULL, 0, 0, NULL},
 };
 
@@ -0,0 +1,621 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Tests and benchmarks for the netdev-based userspace datapath, run over
+ * dummy network devices. */
+
+#include <config.h>
+#include "dpif-netdev.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "command-line.h"
+#include "dummy.h"
+#include "flow.h"
+#include "netdev.h"
+#include "netlink.h"
+#include "odp-util.h"
+#include "ofpbuf.h"
+#include "packets.h"
+#include "timeval.h"
+#include "util.h"
+#include "vlog.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Port numbers assigned by dpif-netdev to the dummy ports "p1" and "p2". */
+enum { IN_PORT = 1, OUT_PORT = 2 };
+
+/* Creates a dummy datapath with ports "p1" and "p2". */
+static struct dpif *
+create_dp(void)
+{
+    static const char *port_names[] = { "p1", "p2" };
+    struct dpif *dpif;
+    size_t i;
+    int error;
+
+    error = dpif_create_and_open("dp0", "dummy", &dpif);
+    if (error) {
+        ovs_fatal(error, "failed to create datapath");
+    }
+
+    for (i = 0; i < ARRAY_SIZE(port_names); i++) {
+        struct netdev *netdev;
+        uint32_t port_no;
+
+        error = netdev_open(port_names[i], "dummy", &netdev);
+        if (error) {
+            ovs_fatal(error, "%s: failed to open network device",
+                      port_names[i]);
+        }
+        port_no = UINT32_MAX;
+        error = dpif_port_add(dpif, netdev, &port_no);
+        if (error) {
+            ovs_fatal(error, "%s: failed to add port", port_names[i]);
+        }
+        assert(port_no == i + 1);
+        netdev_close(netdev);
+    }
+
+    return dpif;
+}
+
+static void
+destroy_dp(struct dpif *dpif)
+{
+    dpif_delete(dpif);
+    dpif_close(dpif);
+}
+
+/* Composes a UDP packet that is distinct for each value of 'idx' and stores
+ * its flow, as the datapath will extract it, in '*flow'. */
+static struct ofpbuf *
+make_packet(uint32_t idx, struct flow *flow)
+{
+    struct ofpbuf *packet;
+    struct flow template;
+
+    memset(&template, 0, sizeof template);
+    template.dl_type = htons(ETH_TYPE_IP);
+    template.nw_proto = IPPROTO_UDP;
+    template.nw_ttl = 64;
+    template.nw_src = htonl(0x0a000001);
+    template.nw_dst = htonl(0x0a000000 | (idx >> 16));
+    template.tp_src = htons(idx & 0xffff);
+    template.tp_dst = htons(53);
+    eth_addr_from_uint64(0x020000000001ULL, template.dl_src);
+    eth_addr_from_uint64(0x020000000002ULL, template.dl_dst);
+
+    packet = ofpbuf_new(0);
+    flow_compose(packet, &template);
+    flow_extract(packet, 0, NULL, IN_PORT, flow);
+    return packet;
+}
+
+/* Installs or modifies, according to 'flags', a flow that outputs packets
+ * matching 'flow' to OUT_PORT.  If 'wc' is nonnull, the flow matches only the
+ * fields that 'wc' does not wildcard; otherwise it is an exact-match flow. */
+static void
+put_masked_flow(struct dpif *dpif, enum dpif_flow_put_flags flags,
+                const struct flow *flow, const struct flow_wildcards *wc)
+{
+    struct odputil_keybuf keybuf, maskbuf;
+    struct ofpbuf key, mask, actions;
+    int error;
+
+    ofpbuf_use_stack(&key, &keybuf, sizeof keybuf);
+    odp_flow_key_from_flow(&key, flow, flow->in_port);
+
+    ofpbuf_use_stack(&mask, &maskbuf, sizeof maskbuf);
+    if (wc) {
+        odp_flow_key_from_mask(&mask, &wc->masks, flow, UINT32_MAX);
+    }
+
+    ofpbuf_init(&actions, 0);
+    nl_msg_put_u32(&actions, OVS_ACTION_ATTR_OUTPUT, OUT_PORT);
+
+    error = dpif_flow_put(dpif, flags, key.data, key.size,
+                          mask.data, mask.size,
+                          actions.data, actions.size, NULL);
+    assert(!error);
+    ofpbuf_uninit(&actions);
+}
+
+/* Installs a flow that outputs packets matching 'flow' to OUT_PORT. */
+static void
+put_flow(struct dpif *dpif, const struct flow *flow)
+{
+    put_masked_flow(dpif, DPIF_FP_CREATE, flow, NULL);
+}
+
+static void
+del_flow(struct dpif *dpif, const struct flow *flow)
+{
+    struct odputil_keybuf keybuf;
+    struct ofpbuf key;
+
+    ofpbuf_use_stack(&key, &keybuf, sizeof keybuf);
+    odp_flow_key_from_flow(&key, flow, flow->in_port);
+    assert(!dpif_flow_del(dpif, key.data, key.size, NULL));
+}
+
+static uint64_t
+get_flow_packets(struct dpif *dpif, const struct flow *flow)
+{
+    struct odputil_keybuf keybuf;
+    struct dpif_flow_stats stats;
+    struct ofpbuf key;
+    int error;
+
+    ofpbuf_use_stack(&key, &keybuf, sizeof keybuf);
+    odp_flow_key_from_flow(&key, flow, flow->in_port);
+    error = dpif_flow_get(dpif, key.data, key.size, NULL, &stats);
+    assert(!error);
+    return stats.n_packets;
+}
+
+/* Receives interleaved packets for two flows that are in the flow table and
+ * one that is not, all in a single batch, and checks that the flow statistics,
+ * the datapath statistics, and the upcalls come out right. */
+static void
+test_batch(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    static const int pattern[] = { 0, 1, 2, 0, 0, 2, 1, 0, 2 };
+    struct ofpbuf *packets[3];
+    struct flow flows[3];
+    struct dpif_dp_stats stats;
+    struct dpif *dpif;
+    size_t i;
+
+    dpif = create_dp();
+    for (i = 0; i < ARRAY_SIZE(flows); i++) {
+        packets[i] = make_packet(i, &flows[i]);
+    }
+    put_flow(dpif, &flows[0]);
+    put_flow(dpif, &flows[1]);
+
+    for (i = 0; i < ARRAY_SIZE(pattern); i++) {
+        assert(netdev_dummy_queue_packet("p1", packets[pattern[i]]) == 1);
+    }
+    dpif_run(dpif);
+
+    assert(get_flow_packets(dpif, &flows[0]) == 4);
+    assert(get_flow_packets(dpif, &flows[1]) == 2);
+
+    dpif_get_dp_stats(dpif, &stats);
+    assert(stats.n_hit == 6);
+    assert(stats.n_missed == 3);
+    assert(stats.n_lost == 0);
+
+    for (i = 0; i < 3; i++) {
+        struct dpif_upcall upcall;
+        struct ofpbuf buf;
+        struct flow flow;
+
+        ofpbuf_init(&buf, 0);
+        assert(!dpif_recv(dpif, 0, &upcall, &buf));
+        assert(upcall.type == DPIF_UC_MISS);
+        assert(odp_flow_key_to_flow(upcall.key, upcall.key_len, &flow)
+               == ODP_FIT_PERFECT);
+        assert(flow_equal(&flow, &flows[2]));
+        assert(upcall.packet->size >= packets[2]->size);
+        assert(!memcmp(upcall.packet->data, packets[2]->data,
+                       packets[2]->size));
+        ofpbuf_uninit(&buf);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(packets); i++) {
+        ofpbuf_delete(packets[i]);
+    }
+    destroy_dp(dpif);
+}
+
+/* Sends one packet for each of 'n' flows through 'dpif' and checks that the
+ * datapath's exact-match cache hit and miss counters advance by 'n_hit' and
+ * 'n_missed', respectively. */
+static void
+check_cache(struct dpif *dpif, struct ofpbuf *packets[], size_t n,
+            uint64_t n_hit, uint64_t n_missed)
+{
+    struct dpif_dp_stats before, after;
+    size_t i;
+
+    dpif_get_dp_stats(dpif, &before);
+    for (i = 0; i < n; i++) {
+        assert(netdev_dummy_queue_packet("p1", packets[i]) == 1);
+    }
+    dpif_run(dpif);
+    dpif_get_dp_stats(dpif, &after);
+
+    assert(after.n_cache_hit - before.n_cache_hit == n_hit);
+    assert(after.n_cache_missed - before.n_cache_missed == n_missed);
+}
+
+/* Checks that flows are found in the exact-match cache once they have been
+ * looked up, and that deleting a flow removes it from the cache. */
+static void
+test_cache(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    struct ofpbuf *packets[3];
+    struct flow flows[3];
+    struct dpif *dpif;
+    size_t i;
+
+    dpif = create_dp();
+    for (i = 0; i < ARRAY_SIZE(flows); i++) {
+        packets[i] = make_packet(i, &flows[i]);
+    }
+    put_flow(dpif, &flows[0]);
+    put_flow(dpif, &flows[1]);
+
+    /* Cold cache, then warm cache.  The packet for flows[2] always misses,
+     * because there is no flow to cache. */
+    check_cache(dpif, packets, 3, 0, 3);
+    check_cache(dpif, packets, 3, 2, 1);
+    check_cache(dpif, packets, 3, 2, 1);
+
+    /* Deleting flows[0] invalidates the whole cache, and adding it back must
+     * not resurrect a stale entry. */
+    del_flow(dpif, &flows[0]);
+    check_cache(dpif, packets, 3, 0, 3);
+    put_flow(dpif, &flows[0]);
+    check_cache(dpif, packets, 1, 0, 1);
+    check_cache(dpif, packets, 1, 1, 0);
+    assert(get_flow_packets(dpif, &flows[0]) == 2);
+
+    for (i = 0; i < ARRAY_SIZE(packets); i++) {
+        ofpbuf_delete(packets[i]);
+    }
+    destroy_dp(dpif);
+}
+
+/* Waits until the datapath has processed a total of 'n' packets, running it
+ * from this thread if it has no forwarding threads of its own, and stores
+ * its final statistics in '*stats'. */
+static void
+wait_for_packets(struct dpif *dpif, uint64_t n, struct dpif_dp_stats *stats)
+{
+    for (;;) {
+        dpif_run(dpif);
+        dpif_get_dp_stats(dpif, stats);
+        if (stats->n_hit + stats->n_missed + stats->n_lost >= n) {
+            break;
+        }
+        sched_yield();
+    }
+}
+
+/* Like test_batch(), but with packets received on both ports, from a pair of
+ * forwarding threads, so that upcalls arrive through the per-thread queues. */
+static void
+test_threads(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    enum { N_ROUNDS = 100 };
+    struct ofpbuf *packets[3];
+    struct flow flows[3];
+    struct dpif_dp_stats stats;
+    struct dpif *dpif;
+    size_t i;
+
+    dpif_netdev_set_n_threads(2);
+    dpif = create_dp();
+    for (i = 0; i < ARRAY_SIZE(flows); i++) {
+        packets[i] = make_packet(i, &flows[i]);
+    }
+    put_flow(dpif, &flows[0]);
+    put_flow(dpif, &flows[1]);
+
+    for (i = 0; i < N_ROUNDS; i++) {
+        assert(netdev_dummy_queue_packet("p1", packets[0]) == 1);
+        assert(netdev_dummy_queue_packet("p1", packets[1]) == 1);
+    }
+    assert(netdev_dummy_queue_packet("p1", packets[2]) == 1);
+    assert(netdev_dummy_queue_packet("p2", packets[2]) == 1);
+    wait_for_packets(dpif, 2 * N_ROUNDS + 2, &stats);
+
+    assert(stats.n_hit == 2 * N_ROUNDS);
+    assert(stats.n_missed == 2);
+    assert(stats.n_lost == 0);
+    assert(get_flow_packets(dpif, &flows[0]) == N_ROUNDS);
+    assert(get_flow_packets(dpif, &flows[1]) == N_ROUNDS);
+
+    for (i = 0; i < 2; i++) {
+        struct dpif_upcall upcall;
+        struct ofpbuf buf;
+        struct flow flow;
+
+        ofpbuf_init(&buf, 0);
+        assert(!dpif_recv(dpif, 0, &upcall, &buf));
+        assert(upcall.type == DPIF_UC_MISS);
+        assert(odp_flow_key_to_flow(upcall.key, upcall.key_len, &flow)
+               == ODP_FIT_PERFECT);
+        assert(flow.nw_dst == flows[2].nw_dst);
+        assert(flow.tp_src == flows[2].tp_src);
+        ofpbuf_uninit(&buf);
+    }
+    {
+        struct dpif_upcall upcall;
+        struct ofpbuf buf;
+
+        ofpbuf_init(&buf, 0);
+        assert(dpif_recv(dpif, 0, &upcall, &buf) == EAGAIN);
+        ofpbuf_uninit(&buf);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(packets); i++) {
+        ofpbuf_delete(packets[i]);
+    }
+    destroy_dp(dpif);
+    dpif_netdev_set_n_threads(0);
+}
+
+/* Receives and discards upcalls for 'handler_id' from 'dpif' until there are
+ * none left, and returns the number received. */
+static size_t
+drain_handler(struct dpif *dpif, uint32_t handler_id)
+{
+    size_t n = 0;
+
+    for (;;) {
+        struct dpif_upcall upcall;
+        struct ofpbuf buf;
+        int error;
+
+        ofpbuf_init(&buf, 0);
+        error = dpif_recv(dpif, handler_id, &upcall, &buf);
+        ofpbuf_uninit(&buf);
+        if (error) {
+            assert(error == EAGAIN);
+            return n;
+        }
+        n++;
+    }
+}
+
+/* Checks that dpif_handlers_set() divides the upcalls from a pair of
+ * forwarding threads among handlers, so that each upcall is received by
+ * exactly one handler. */
+static void
+test_handlers(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    struct ofpbuf *packets[2];
+    struct flow flows[2];
+    struct dpif_dp_stats stats;
+    struct dpif *dpif;
+    size_t i;
+
+    dpif_netdev_set_n_threads(2);
+    dpif = create_dp();
+    assert(dpif_handlers_set(dpif, 0) == EINVAL);
+
+    for (i = 0; i < ARRAY_SIZE(flows); i++) {
+        packets[i] = make_packet(i, &flows[i]);
+    }
+    assert(netdev_dummy_queue_packet("p1", packets[0]) == 1);
+    assert(netdev_dummy_queue_packet("p2", packets[1]) == 1);
+    wait_for_packets(dpif, 2, &stats);
+    assert(stats.n_missed == 2);
+
+    /* Each forwarding thread's miss queue belongs to a different one of
+     * handlers 1 and 2.  Handler 0 gets only the main thread's queues, which
+     * are empty. */
+    assert(!dpif_handlers_set(dpif, 3));
+    assert(drain_handler(dpif, 0) == 0);
+    assert(drain_handler(dpif, 1) == 1);
+    assert(drain_handler(dpif, 2) == 1);
+
+    /* With a single handler, it receives everything again. */
+    assert(!dpif_handlers_set(dpif, 1));
+    assert(netdev_dummy_queue_packet("p1", packets[0]) == 1);
+    assert(netdev_dummy_queue_packet("p2", packets[1]) == 1);
+    wait_for_packets(dpif, 4, &stats);
+    assert(drain_handler(dpif, 0) == 2);
+
+    for (i = 0; i < ARRAY_SIZE(packets); i++) {
+        ofpbuf_delete(packets[i]);
+    }
+    destroy_dp(dpif);
+    dpif_netdev_set_n_threads(0);
+}
+
+/* Sends packets for 'n' flows, starting from index 'first', through 'dpif' and
+ * checks that 'n_hit' of them match a flow and the rest miss. */
+static void
+check_hits(struct dpif *dpif, uint32_t first, size_t n, uint64_t n_hit)
+{
+    struct dpif_dp_stats before, after;
+    size_t i;
+
+    dpif_get_dp_stats(dpif, &before);
+    for (i = 0; i < n; i++) {
+        struct ofpbuf *packet;
+        struct flow flow;
+
+        packet = make_packet(first + i, &flow);
+        assert(netdev_dummy_queue_packet("p1", packet) == 1);
+        ofpbuf_delete(packet);
+    }
+    wait_for_packets(dpif, before.n_hit + before.n_missed + before.n_lost + n,
+                     &after);
+
+    assert(after.n_hit - before.n_hit == n_hit);
+    assert(after.n_missed - before.n_missed == n - n_hit);
+}
+
+/* Checks that a flow installed with a mask matches every packet that agrees
+ * with its key in the masked bits, that dumping it reports the mask, that
+ * replacing the mask takes effect, and that a flow whose masked key duplicates
+ * it takes precedence for the packets that its own key describes. */
+static void
+test_megaflow(int argc OVS_UNUSED, char *argv[] OVS_UNUSED)
+{
+    const struct nlattr *key, *mask;
+    size_t key_len, mask_len;
+    struct flow_wildcards wc, dumped;
+    struct dpif_flow_dump dump;
+    struct flow flow, overlap;
+    uint64_t n_packets;
+    struct dpif *dpif;
+
+    dpif = create_dp();
+    ofpbuf_delete(make_packet(0, &flow));
+    ofpbuf_delete(make_packet(5, &overlap));
+
+    /* Wildcard the UDP source port, which make_packet() varies with the low
+     * 16 bits of its index, but not the IP destination, which it varies with
+     * the high bits. */
+    flow_wildcards_init_exact(&wc);
+    wc.masks.tp_src = htons(0);
+    put_masked_flow(dpif, DPIF_FP_CREATE, &flow, &wc);
+
+    check_hits(dpif, 0, 100, 100);
+    check_hits(dpif, 0x10000, 10, 0);
+    assert(get_flow_packets(dpif, &flow) == 100);
+
+    /* The dump reports the original key along with the mask. */
+    dpif_flow_dump_start(&dump, dpif);
+    assert(dpif_flow_dump_next(&dump, &key, &key_len, &mask, &mask_len,
+                               NULL, NULL, NULL));
+    assert(mask_len > 0);
+    assert(!odp_flow_key_to_mask(mask, mask_len, &dumped));
+    assert(dumped.masks.tp_src == htons(0));
+    assert(dumped.masks.tp_dst == htons(UINT16_MAX));
+    assert(dumped.masks.nw_dst == htonl(UINT32_MAX));
+    assert(!dpif_flow_dump_next(&dump, NULL, NULL, NULL, NULL,
+                                NULL, NULL, NULL));
+    assert(!dpif_flow_dump_done(&dump));
+
+    /* Making the flow exact-match narrows it back to a single packet. */
+    put_masked_flow(dpif, DPIF_FP_MODIFY, &flow, NULL);
+    check_hits(dpif, 0, 10, 1);
+
+    /* Widening it again restores the wildcarded behavior. */
+    put_masked_flow(dpif, DPIF_FP_MODIFY, &flow, &wc);
+    check_hits(dpif, 0, 10, 10);
+
+    /* 'overlap' has the same masked key, so the datapath installs it as an
+     * exact-match flow.  Its packet stops hitting the wildcarded flow, even
+     * though the exact-match cache still remembers the wildcarded flow for
+     * it. */
+    put_masked_flow(dpif, DPIF_FP_CREATE, &overlap, &wc);
+    n_packets = get_flow_packets(dpif, &flow);
+    check_hits(dpif, 0, 10, 10);
+    assert(get_flow_packets(dpif, &overlap) == 1);
+    assert(get_flow_packets(dpif, &flow) == n_packets + 9);
+
+    destroy_dp(dpif);
+}
+
+/* Runs the datapath over 'n_packets' packets spread round-robin over
+ * 'n_flows' flows, all of which are in the flow table, with receive batches
+ * of at most 'batch' packets.  Returns the elapsed time in milliseconds. */
+static long long int
+benchmark__(int n_packets, int n_flows, size_t batch)
+{
+    enum { CHUNK = 1024 };
+    struct ofpbuf **packets;
+    struct dpif_dp_stats stats;
+    struct dpif *dpif;
+    long long int elapsed;
+    int i;
+
+    dpif_netdev_set_rx_batch(batch);
+    dpif = create_dp();
+
+    packets = xmalloc(n_flows * sizeof *packets);
+    for (i = 0; i < n_flows; i++) {
+        struct flow flow;
+
+        packets[i] = make_packet(i, &flow);
+        put_flow(dpif, &flow);
+    }
+
+    elapsed = 0;
+    for (i = 0; i < n_packets; ) {
+        long long int start;
+        int end = MIN(i + CHUNK, n_packets);
+
+        for (; i < end; i++) {
+            netdev_dummy_queue_packet("p1", packets[i % n_flows]);
+        }
+
+        time_refresh();
+        start = time_msec();
+        wait_for_packets(dpif, i, &stats);
+        time_refresh();
+        elapsed += time_msec() - start;
+    }
+    assert(stats.n_hit == n_packets && stats.n_missed == 0);
+
+    for (i = 0; i < n_flows; i++) {
+        ofpbuf_delete(packets[i]);
+    }
+    free(packets);
+    destroy_dp(dpif);
+
+    return elapsed;
+}
+
+static void
+benchmark(int argc, char *argv[])
+{
+    int n_packets = argc > 1 ? atoi(argv[1]) : 1000000;
+    int n_flows = argc > 2 ? atoi(argv[2]) : 16;
+    int n_threads = argc > 3 ? atoi(argv[3]) : 0;
+    size_t batches[] = { 1, NETDEV_MAX_RX_BATCH };
+    size_t i;
+
+    if (n_packets <= 0 || n_flows <= 0 || n_threads < 0) {
+        ovs_fatal(0, "invalid packet, flow, or thread count");
+    }
+    dpif_netdev_set_n_threads(n_threads);
+
+    for (i = 0; i < ARRAY_SIZE(batches); i++) {
+        long long int elapsed = benchmark__(n_packets, n_flows, batches[i]);
+
+        printf("batch %2zu: %d packets in %lld ms (%.0f packets/s)\n",
+               batches[i], n_packets, elapsed,
+               n_packets * 1000.0 / MAX(elapsed, 1));
+    }
+}
+
+static const struct command commands[] = {
+    { "batch", 0, 0, test_batch, },
+    { "threads", 0, 0, test_threads, },
+    { "handlers", 0, 0, test_handlers, },
+    { "cache", 0, 0, test_cache, },
+    { "megaflow", 0, 0, test_megaflow, },
+    { "benchmark", 0, 3, benchmark, },
+    { NULL, 0, 0, NULL, },
+};
+
+int
+main(int argc, char *argv[])
+{
+    set_program_name(argv[0]);
+    vlog_set_levels(NULL, VLF_ANY_FACILITY, VLL_EMER);
+    dpif_dummy_register(false);
+    netdev_dummy_register(false);
+
+    run_command(argc - 1, argv + 1, commands);
+
+    return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A stand-in for an OpenFlow controller that programs a switch in bulk, for
+ * measuring how fast the switch takes flow_mods.
+ *
+ * Unlike "ovs-ofctl add-flows", which waits for a barrier reply after each
+ * flow_mod, this sends all of its flow_mods back to back, followed by a
+ * single barrier request, the way a controller that pushes a large flow
+ * table would. */
+
+#include <config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "byte-order.h"
+#include "command-line.h"
+#include "list.h"
+#include "match.h"
+#include "ofp-actions.h"
+#include "ofp-msgs.h"
+#include "ofp-print.h"
+#include "ofp-util.h"
+#include "ofpbuf.h"
+#include "packets.h"
+#include "poll-loop.h"
+#include "timeval.h"
+#include "util.h"
+#include "vconn.h"
+#include "vlog.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Appends to 'msgs' 'n' flow_mods with the given 'command', each of which
+ * matches IP packets to a different destination address and outputs them to
+ * port 2. */
+static void
+make_flow_mods(enum ofputil_protocol protocol, uint16_t command, int n,
+               struct list *msgs)
+{
+    uint64_t ofpacts_stub[64 / 8];
+    struct ofputil_flow_mod fm;
+    struct ofpbuf ofpacts;
+    int i;
+
+    ofpbuf_use_stub(&ofpacts, ofpacts_stub, sizeof ofpacts_stub);
+    ofpact_put_OUTPUT(&ofpacts)->port = 2;
+    ofpact_pad(&ofpacts);
+
+    memset(&fm, 0, sizeof fm);
+    fm.priority = OFP_DEFAULT_PRIORITY;
+    fm.new_cookie = htonll(0);
+    fm.command = command;
+    fm.buffer_id = UINT32_MAX;
+    fm.out_port = OFPP_NONE;
+    fm.table_id = 0xff;
+    fm.ofpacts = ofpacts.data;
+    fm.ofpacts_len = ofpacts.size;
+
+    for (i = 0; i < n; i++) {
+        struct ofpbuf *msg;
+
+        match_init_catchall(&fm.match);
+        match_set_dl_type(&fm.match, htons(ETH_TYPE_IP));
+        match_set_nw_dst(&fm.match, htonl(0x0a000001 + i));
+
+        msg = ofputil_encode_flow_mod(&fm, protocol);
+        list_push_back(msgs, &msg->list_node);
+    }
+
+    ofpbuf_uninit(&ofpacts);
+}
+
+/* Sends all of the messages in 'msgs' on 'vconn', followed by a barrier
+ * request, without waiting for replies in between, and waits for the
+ * barrier reply.  Returns the number of error replies received. */
+static int
+send_and_barrier(struct vconn *vconn, struct list *msgs)
+{
+    struct ofpbuf *barrier;
+    ovs_be32 barrier_xid;
+    int n_errors = 0;
+
+    barrier = ofputil_encode_barrier_request(vconn_get_version(vconn));
+    barrier_xid = ((struct ofp_header *) barrier->data)->xid;
+    list_push_back(msgs, &barrier->list_node);
+
+    for (;;) {
+        struct ofpbuf *msg;
+        int error;
+
+        vconn_run(vconn);
+
+        while (!list_is_empty(msgs)) {
+            msg = ofpbuf_from_list(list_pop_front(msgs));
+            error = vconn_send(vconn, msg);
+            if (error == EAGAIN) {
+                list_push_front(msgs, &msg->list_node);
+                break;
+            } else if (error) {
+                ovs_fatal(error, "%s: send failed", vconn_get_name(vconn));
+            }
+        }
+
+        for (;;) {
+            const struct ofp_header *oh;
+            enum ofptype type;
+
+            error = vconn_recv(vconn, &msg);
+            if (error == EAGAIN) {
+                break;
+            } else if (error) {
+                ovs_fatal(error, "%s: receive failed",
+                          vconn_get_name(vconn));
+            }
+
+            oh = msg->data;
+            if (oh->xid == barrier_xid) {
+                ofpbuf_delete(msg);
+                return n_errors;
+            } else if (!ofptype_decode(&type, oh)
+                       && type == OFPTYPE_ERROR) {
+                if (!n_errors++) {
+                    ofp_print(stderr, msg->data, msg->size, 1);
+                }
+            }
+            ofpbuf_delete(msg);
+        }
+
+        vconn_run_wait(vconn);
+        if (!list_is_empty(msgs)) {
+            vconn_send_wait(vconn);
+        }
+        vconn_recv_wait(vconn);
+        poll_block();
+    }
+}
+
+/* Sends 'n' messages of the given 'command' and reports the rate. */
+static void
+run_phase(struct vconn *vconn, const char *name, uint16_t command, int n)
+{
+    enum ofputil_protocol protocol;
+    long long int start, elapsed;
+    struct list msgs;
+    int n_errors;
+
+    protocol = ofputil_protocol_from_ofp_version(vconn_get_version(vconn));
+    list_init(&msgs);
+    make_flow_mods(protocol, command, n, &msgs);
+
+    start = time_msec();
+    n_errors = send_and_barrier(vconn, &msgs);
+    elapsed = time_msec() - start;
+
+    printf("%s: %d flow_mods in %lld ms (%.0f flow_mods/s)\n",
+           name, n, elapsed, n * 1000.0 / MAX(elapsed, 1));
+    if (n_errors) {
+        ovs_fatal(0, "%s: %d flow_mods failed", name, n_errors);
+    }
+}
+
+/* Connects to the switch at 'target'. */
+static struct vconn *
+open_target(const char *target)
+{
+    struct vconn *vconn;
+    int error;
+
+    error = vconn_open_block(target, 0, &vconn);
+    if (error) {
+        ovs_fatal(error, "%s: connection failed", target);
+    }
+    return vconn;
+}
+
+/* "add TARGET N": adds N flows to the switch at TARGET. */
+static void
+test_add(int argc OVS_UNUSED, char *argv[])
+{
+    struct vconn *vconn = open_target(argv[1]);
+
+    run_phase(vconn, "add", OFPFC_ADD, atoi(argv[2]));
+    vconn_close(vconn);
+}
+
+/* "delete TARGET N": deletes the N flows that "add" added, one flow_mod per
+ * flow. */
+static void
+test_delete(int argc OVS_UNUSED, char *argv[])
+{
+    struct vconn *vconn = open_target(argv[1]);
+
+    run_phase(vconn, "delete", OFPFC_DELETE_STRICT, atoi(argv[2]));
+    vconn_close(vconn);
+}
+
+/* "bench TARGET [N]": adds N (default 10000) flows to the switch at TARGET,
+ * then deletes them again. */
+static void
+test_bench(int argc, char *argv[])
+{
+    int n = argc > 2 ? atoi(argv[2]) : 10000;
+    struct vconn *vconn = open_target(argv[1]);
+
+    run_phase(vconn, "add", OFPFC_ADD, n);
+    run_phase(vconn, "delete", OFPFC_DELETE_STRICT, n);
+    vconn_close(vconn);
+}
+
+static const struct command commands[] = {
+    {"add", 2, 2, test_add},
+    {"delete", 2, 2, test_delete},
+    {"bench", 1, 2, test_bench},
+    {NULL, 0, 0, NULL},
+};
+
+int
+main(int argc, char *argv[])
+{
+    set_program_name(argv[0]);
+    vlog_set_levels(NULL, VLF_ANY_FACILITY, VLL_EMER);
+    vlog_set_levels(NULL, VLF_CONSOLE, VLL_WARN);
+    signal(SIGPIPE, SIG_IGN);
+
+    run_command(argc - 1, argv + 1, commands);
+
+    return 0;
+}
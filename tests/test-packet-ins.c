@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2012 Nicira, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at:
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A stand-in for a reactive OpenFlow controller, for measuring how fast the
+ * switch sends packet-ins.
+ *
+ * It sends the switch packet-outs that look their packets up in the flow
+ * table.  The flow table should be empty, so that each packet comes back as
+ * a packet-in.  It answers each packet-in that refers to a buffered packet
+ * with a packet-out that drops the buffered packet, the way a reactive
+ * controller would.  It keeps only a few packets in flight at a time, so that
+ * the switch does not need to drop packet-ins. */
+
+#include <config.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "byte-order.h"
+#include "command-line.h"
+#include "list.h"
+#include "ofp-actions.h"
+#include "ofp-msgs.h"
+#include "ofp-print.h"
+#include "ofp-util.h"
+#include "ofpbuf.h"
+#include "openflow/openflow.h"
+#include "packets.h"
+#include "poll-loop.h"
+#include "socket-util.h"
+#include "timeval.h"
+#include "util.h"
+#include "vconn.h"
+#include "vlog.h"
+
+#undef NDEBUG
+#include <assert.h>
+
+/* Maximum number of packets in flight. */
+#define WINDOW 50
+
+/* Ethernet type of the packets that this program sends. */
+#define BENCH_ETH_TYPE 0x88b5   /* IEEE 802 local experimental. */
+
+/* Composes the 'size'-byte packet with sequence number 'seq' into 'b'. */
+static void
+make_packet(struct ofpbuf *b, int size, uint32_t seq)
+{
+    static const uint8_t eth_src[ETH_ADDR_LEN] = {
+        0x50, 0x54, 0x00, 0x00, 0x00, 0x01
+    };
+    int payload_len = size - ETH_HEADER_LEN;
+    struct eth_header *eh;
+    uint8_t *payload;
+    int i;
+
+    ofpbuf_clear(b);
+    eh = ofpbuf_put_uninit(b, sizeof *eh);
+    memcpy(eh->eth_dst, eth_addr_broadcast, ETH_ADDR_LEN);
+    memcpy(eh->eth_src, eth_src, ETH_ADDR_LEN);
+    eh->eth_type = htons(BENCH_ETH_TYPE);
+
+    payload = ofpbuf_put_uninit(b, payload_len);
+    for (i = 0; i < 4; i++) {
+        payload[i] = seq >> (8 * i);
+    }
+    memset(payload + 4, 0x5a, payload_len - 4);
+}
+
+/* Returns the sequence number of 'packet', which was composed by
+ * make_packet(). */
+static uint32_t
+packet_seq(const uint8_t *packet)
+{
+    const uint8_t *payload = packet + ETH_HEADER_LEN;
+
+    return payload[0] | (payload[1] << 8) | (payload[2] << 16)
+        | ((uint32_t) payload[3] << 24);
+}
+
+/* Returns a packet-out that sends 'packet' to the flow table (if 'buffer_id'
+ * is UINT32_MAX) or drops buffered packet 'buffer_id' (otherwise). */
+static struct ofpbuf *
+make_packet_out(enum ofputil_protocol protocol, const struct ofpbuf *packet,
+                uint32_t buffer_id)
+{
+    uint64_t ofpacts_stub[64 / 8];
+    struct ofputil_packet_out po;
+    struct ofpbuf ofpacts;
+    struct ofpbuf *msg;
+
+    ofpbuf_use_stub(&ofpacts, ofpacts_stub, sizeof ofpacts_stub);
+    if (buffer_id == UINT32_MAX) {
+        ofpact_put_OUTPUT(&ofpacts)->port = OFPP_TABLE;
+        ofpact_pad(&ofpacts);
+    }
+
+    po.packet = buffer_id == UINT32_MAX ? packet->data : NULL;
+    po.packet_len = buffer_id == UINT32_MAX ? packet->size : 0;
+    po.buffer_id = buffer_id;
+    po.in_port = OFPP_NONE;
+    po.ofpacts = ofpacts.data;
+    po.ofpacts_len = ofpacts.size;
+    msg = ofputil_encode_packet_out(&po, protocol);
+
+    ofpbuf_uninit(&ofpacts);
+    return msg;
+}
+
+/* Sends as many of the messages in 'txq' on 'vconn' as it will take. */
+static void
+send_queued(struct vconn *vconn, struct list *txq)
+{
+    while (!list_is_empty(txq)) {
+        struct ofpbuf *msg = ofpbuf_from_list(list_pop_front(txq));
+        int error = vconn_send(vconn, msg);
+        if (error == EAGAIN) {
+            list_push_front(txq, &msg->list_node);
+            break;
+        } else if (error) {
+            ovs_fatal(error, "%s: send failed", vconn_get_name(vconn));
+        }
+    }
+}
+
+/* Checks that 'pin' is the packet-in for a 'size'-byte packet composed by
+ * make_packet(). */
+static void
+check_packet_in(const struct ofputil_packet_in *pin, int size,
+                struct ofpbuf *scratch)
+{
+    if (pin->reason != OFPR_NO_MATCH
+        || pin->total_len != size
+        || pin->packet_len < ETH_HEADER_LEN + 4
+        || pin->packet_len > size) {
+        ovs_fatal(0, "unexpected packet-in (reason %d, total_len %"PRIu16", "
+                  "data_len %zu)", pin->reason, pin->total_len,
+                  pin->packet_len);
+    }
+
+    make_packet(scratch, size, packet_seq(pin->packet));
+    if (memcmp(pin->packet, scratch->data, pin->packet_len)) {
+        ovs_fatal(0, "packet-in for packet %"PRIu32" has wrong data",
+                  packet_seq(pin->packet));
+    }
+}
+
+/* Sends 'n' 'size'-byte packets to the switch over 'vconn', waits for all of
+ * them to come back as packet-ins, and reports the rate. */
+static void
+run_bench(struct vconn *vconn, int n, int size)
+{
+    enum ofputil_protocol protocol;
+    long long int start, elapsed;
+    struct ofpbuf packet, scratch;
+    int n_sent, n_received, n_buffered, n_errors;
+    ovs_be32 barrier_xid;
+    bool barrier_sent, done;
+    struct list txq;
+
+    if (size < ETH_HEADER_LEN + 4 || size > UINT16_MAX) {
+        ovs_fatal(0, "packet size must be between %d and %d",
+                  ETH_HEADER_LEN + 4, UINT16_MAX);
+    }
+
+    protocol = ofputil_protocol_from_ofp_version(vconn_get_version(vconn));
+    ofpbuf_init(&packet, size);
+    ofpbuf_init(&scratch, size);
+    list_init(&txq);
+
+    n_sent = n_received = n_buffered = n_errors = 0;
+    barrier_xid = htonl(0);
+    barrier_sent = done = false;
+    start = time_msec();
+    while (!done) {
+        vconn_run(vconn);
+
+        while (!done) {
+            struct ofputil_packet_in pin;
+            const struct ofp_header *oh;
+            struct ofpbuf *msg;
+            enum ofptype type;
+            int error;
+
+            error = vconn_recv(vconn, &msg);
+            if (error == EAGAIN) {
+                break;
+            } else if (error) {
+                ovs_fatal(error, "%s: receive failed",
+                          vconn_get_name(vconn));
+            }
+
+            oh = msg->data;
+            if (ofptype_decode(&type, oh)) {
+                /* Ignore it. */
+            } else if (type == OFPTYPE_PACKET_IN) {
+                error = ofputil_decode_packet_in(&pin, oh);
+                if (error) {
+                    ovs_fatal(0, "%s: bad packet-in (%s)",
+                              vconn_get_name(vconn), ofperr_to_string(error));
+                }
+                check_packet_in(&pin, size, &scratch);
+                n_received++;
+
+                if (pin.buffer_id != UINT32_MAX) {
+                    struct ofpbuf *reply;
+
+                    reply = make_packet_out(protocol, NULL, pin.buffer_id);
+                    list_push_back(&txq, &reply->list_node);
+                    n_buffered++;
+                }
+            } else if (type == OFPTYPE_ECHO_REQUEST) {
+                struct ofpbuf *reply = make_echo_reply(oh);
+                list_push_back(&txq, &reply->list_node);
+            } else if (type == OFPTYPE_ERROR) {
+                if (!n_errors++) {
+                    ofp_print(stderr, msg->data, msg->size, 1);
+                }
+            } else if (type == OFPTYPE_BARRIER_REPLY
+                       && barrier_sent && oh->xid == barrier_xid) {
+                done = true;
+            }
+            ofpbuf_delete(msg);
+        }
+
+        while (n_sent < n && n_sent - n_received < WINDOW) {
+            struct ofpbuf *msg;
+
+            make_packet(&packet, size, n_sent++);
+            msg = make_packet_out(protocol, &packet, UINT32_MAX);
+            list_push_back(&txq, &msg->list_node);
+        }
+        if (n_received >= n && !barrier_sent) {
+            /* Wait for the switch to process the last packet-outs, so that
+             * any errors that they cause show up. */
+            struct ofpbuf *barrier;
+
+            barrier = ofputil_encode_barrier_request(
+                vconn_get_version(vconn));
+            barrier_xid = ((struct ofp_header *) barrier->data)->xid;
+            list_push_back(&txq, &barrier->list_node);
+            barrier_sent = true;
+        }
+        send_queued(vconn, &txq);
+
+        if (!done) {
+            vconn_run_wait(vconn);
+            if (!list_is_empty(&txq)) {
+                vconn_send_wait(vconn);
+            }
+            vconn_recv_wait(vconn);
+            poll_block();
+        }
+    }
+    elapsed = time_msec() - start;
+
+    printf("bench: %d packet_ins (%d buffered) in %lld ms "
+           "(%.0f packet_ins/s)\n",
+           n, n_buffered, elapsed, n * 1000.0 / MAX(elapsed, 1));
+    if (n_received > n) {
+        ovs_fatal(0, "%d extra packet-ins", n_received - n);
+    } else if (n_errors) {
+        ovs_fatal(0, "%d packet-outs failed", n_errors);
+    }
+
+    ofpbuf_uninit(&packet);
+    ofpbuf_uninit(&scratch);
+}
+
+/* Connects to the switch at 'target', or, if 'target' is a passive vconn
+ * name such as "punix:FILE", waits for the switch to connect there. */
+static struct vconn *
+open_target(const char *target)
+{
+    struct vconn *vconn;
+    int error;
+
+    if (!pvconn_verify_name(target)) {
+        struct pvconn *pvconn;
+
+        error = pvconn_open(target, 0, &pvconn, DSCP_DEFAULT);
+        if (error) {
+            ovs_fatal(error, "%s: listen failed", target);
+        }
+        while ((error = pvconn_accept(pvconn, &vconn)) == EAGAIN) {
+            pvconn_wait(pvconn);
+            poll_block();
+        }
+        if (error) {
+            ovs_fatal(error, "%s: accept failed", target);
+        }
+        pvconn_close(pvconn);
+
+        error = vconn_connect_block(vconn);
+    } else {
+        error = vconn_open_block(target, 0, &vconn);
+    }
+    if (error) {
+        ovs_fatal(error, "%s: connection failed", target);
+    }
+    return vconn;
+}
+
+/* Asks the switch to send packet-ins on 'vconn', even if it is a service
+ * connection, which does not get packet-ins by default. */
+static void
+enable_packet_ins(struct vconn *vconn)
+{
+    struct ofp_switch_config *osc;
+    struct ofpbuf *request;
+    int error;
+
+    request = ofpraw_alloc(OFPRAW_OFPT_SET_CONFIG, vconn_get_version(vconn),
+                           0);
+    osc = ofpbuf_put_zeros(request, sizeof *osc);
+    osc->miss_send_len = htons(OFP_DEFAULT_MISS_SEND_LEN);
+
+    error = vconn_send_block(vconn, request);
+    if (error) {
+        ovs_fatal(error, "%s: send failed", vconn_get_name(vconn));
+    }
+}
+
+/* "bench TARGET [N [SIZE]]": sends N (default 100000) SIZE-byte (default
+ * 1000) packets to the switch at TARGET and waits for them all to come back
+ * as packet-ins. */
+static void
+test_bench(int argc, char *argv[])
+{
+    int n = argc > 2 ? atoi(argv[2]) : 100000;
+    int size = argc > 3 ? atoi(argv[3]) : 1000;
+    struct vconn *vconn = open_target(argv[1]);
+
+    enable_packet_ins(vconn);
+    run_bench(vconn, n, size);
+    vconn_close(vconn);
+}
+
+static const struct command commands[] = {
+    {"bench", 1, 3, test_bench},
+    {NULL, 0, 0, NULL},
+};
+
+int
+main(int argc, char *argv[])
+{
+    set_program_name(argv[0]);
+    vlog_set_levels(NULL, VLF_ANY_FACILITY, VLL_EMER);
+    vlog_set_levels(NULL, VLF_CONSOLE, VLL_WARN);
+    signal(SIGPIPE, SIG_IGN);
+
+    run_command(argc - 1, argv + 1, commands);
+
+    return 0;
+}
@@ -418,6 +418,149 @@ test_send_invalid_version_hello(int argc OVS_UNUSED, char *argv[])
     ofpbuf_delete(hello);
 }
 
+/* Sends N (default 10000) 64-byte echo requests through a vconn of the given
+ * type to a vconn accepted from a pvconn, which replies to each of them, then
+ * verifies the replies and prints the message rate. */
+static void
+test_bench(int argc, char *argv[])
+{
+    const char *type = argv[1];
+    int n = argc > 2 ? atoi(argv[2]) : 10000;
+    struct vconn *client, *server;
+    struct ofpbuf *pending_reply;
+    struct fake_pvconn fpv;
+    struct pvconn *pvconn;
+    int n_sent, n_replies;
+    long long int start, elapsed;
+    struct timeval tv;
+
+    /* Logging every message would swamp the measurement. */
+    vlog_set_levels(NULL, VLF_CONSOLE, VLL_WARN);
+
+    fpv_create(type, &fpv);
+    fpv_close(&fpv);
+    CHECK_ERRNO(pvconn_open(fpv.pvconn_name, 0, &pvconn, DSCP_DEFAULT), 0);
+    CHECK_ERRNO(vconn_open(fpv.vconn_name, 0, &client, DSCP_DEFAULT), 0);
+
+    server = NULL;
+    for (;;) {
+        int client_error, server_error;
+
+        if (!server) {
+            int error = pvconn_accept(pvconn, &server);
+            if (error) {
+                CHECK_ERRNO(error, EAGAIN);
+                server = NULL;
+            }
+        }
+        vconn_run(client);
+        client_error = vconn_connect(client);
+        server_error = EAGAIN;
+        if (server) {
+            vconn_run(server);
+            server_error = vconn_connect(server);
+        }
+        if (!client_error && !server_error) {
+            break;
+        }
+        if (client_error) {
+            CHECK_ERRNO(client_error, EAGAIN);
+        }
+        if (server_error) {
+            CHECK_ERRNO(server_error, EAGAIN);
+        }
+
+        vconn_run_wait(client);
+        vconn_connect_wait(client);
+        if (server) {
+            vconn_run_wait(server);
+            vconn_connect_wait(server);
+        } else {
+            pvconn_wait(pvconn);
+        }
+        poll_block();
+    }
+
+    xgettimeofday(&tv);
+    start = timeval_to_msec(&tv);
+
+    pending_reply = NULL;
+    n_sent = n_replies = 0;
+    for (;;) {
+        struct ofpbuf *msg;
+
+        /* Client sends requests. */
+        while (n_sent < n) {
+            msg = ofpraw_alloc_xid(OFPRAW_OFPT_ECHO_REQUEST, OFP10_VERSION,
+                                   htonl(n_sent), 64);
+            ofpbuf_put_zeros(msg, 64);
+            if (vconn_send(client, msg)) {
+                ofpbuf_delete(msg);
+                break;
+            }
+            n_sent++;
+        }
+
+        /* Server replies to them. */
+        for (;;) {
+            if (!pending_reply) {
+                int error = vconn_recv(server, &msg);
+                if (error) {
+                    CHECK_ERRNO(error, EAGAIN);
+                    break;
+                }
+                pending_reply = make_echo_reply(msg->data);
+                ofpbuf_delete(msg);
+            }
+            if (vconn_send(server, pending_reply)) {
+                break;
+            }
+            pending_reply = NULL;
+        }
+
+        /* Client checks the replies. */
+        for (;;) {
+            int error = vconn_recv(client, &msg);
+            if (error) {
+                CHECK_ERRNO(error, EAGAIN);
+                break;
+            }
+            CHECK(ntohl(((struct ofp_header *) msg->data)->xid), n_replies);
+            CHECK(msg->size, sizeof(struct ofp_header) + 64);
+            ofpbuf_delete(msg);
+            n_replies++;
+        }
+        if (n_replies >= n) {
+            break;
+        }
+
+        vconn_run(client);
+        vconn_run(server);
+        vconn_run_wait(client);
+        vconn_run_wait(server);
+        vconn_recv_wait(client);
+        vconn_recv_wait(server);
+        if (n_sent < n) {
+            vconn_send_wait(client);
+        }
+        if (pending_reply) {
+            vconn_send_wait(server);
+        }
+        poll_block();
+    }
+
+    xgettimeofday(&tv);
+    elapsed = timeval_to_msec(&tv) - start;
+    printf("%s: %d echo requests and replies in %lld ms (%.0f round trips/s)\n",
+           type, n, elapsed, n * 1000.0 / MAX(elapsed, 1));
+
+    ofpbuf_delete(pending_reply);
+    vconn_close(client);
+    vconn_close(server);
+    pvconn_close(pvconn);
+    fpv_destroy(&fpv);
+}
+
 static const struct command commands[] = {
     {"refuse-connection", 1, 1, test_refuse_connection},
     {"accept-then-close", 1, 1, test_accept_then_close},
@@ -427,6 +570,7 @@ static const struct command commands[] = {
     {"send-echo-hello", 1, 1, test_send_echo_hello},
     {"send-short-hello", 1, 1, test_send_short_hello},
     {"send-invalid-version-hello", 1, 1, test_send_invalid_version_hello},
+    {"bench", 1, 2, test_bench},
     {NULL, 0, 0, NULL},
 };
 
@@ -538,6 +538,10 @@ show_dpif(struct dpif *dpif)
         printf("\tlookups: hit:%"PRIu64" missed:%"PRIu64" lost:%"PRIu64"\n"
                "\tflows: %"PRIu64"\n",
                stats.n_hit, stats.n_missed, stats.n_lost, stats.n_flows);
+        if (stats.n_cache_hit != UINT64_MAX) {
+            printf("\tcache: hit:%"PRIu64" missed:%"PRIu64"\n",
+                   stats.n_cache_hit, stats.n_cache_missed);
+        }
     }
     DPIF_PORT_FOR_EACH (&dpif_port, &dump, dpif) {
         printf("\tport %u: %s", dpif_port.port_no, dpif_port.name);
@@ -718,9 +722,11 @@ dpctl_dump_flows(int argc, char *argv[])
     const struct dpif_flow_stats *stats;
     const struct nlattr *actions;
     struct dpif_flow_dump dump;
+    const struct nlattr *mask;
     const struct nlattr *key;
     size_t actions_len;
     struct dpif *dpif;
+    size_t mask_len;
     size_t key_len;
     struct ds ds;
     char *name;
@@ -731,10 +737,14 @@ dpctl_dump_flows(int argc, char *argv[])
 
     ds_init(&ds);
     dpif_flow_dump_start(&dump, dpif);
-    while (dpif_flow_dump_next(&dump, &key, &key_len,
+    while (dpif_flow_dump_next(&dump, &key, &key_len, &mask, &mask_len,
                                &actions, &actions_len, &stats)) {
         ds_clear(&ds);
         odp_flow_key_format(key, key_len, &ds);
+        if (mask_len) {
+            ds_put_cstr(&ds, ", mask:");
+            odp_flow_key_format(mask, mask_len, &ds);
+        }
         ds_put_cstr(&ds, ", ");
         dpif_flow_stats_format(stats, &ds);
         ds_put_cstr(&ds, ", actions:");
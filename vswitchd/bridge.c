@@ -25,6 +25,7 @@
 #include "coverage.h"
 #include "daemon.h"
 #include "dirs.h"
+#include "dpif-netdev.h"
 #include "dynamic-string.h"
 #include "hash.h"
 #include "hmap.h"
@@ -181,6 +182,7 @@ static void bridge_configure_datapath_id(struct bridge *);
 static void bridge_configure_flow_eviction_threshold(struct bridge *);
 static void bridge_configure_netflow(struct bridge *);
 static void bridge_configure_forward_bpdu(struct bridge *);
+static void bridge_configure_flow_setup_budget(struct bridge *);
 static void bridge_configure_mac_idle_time(struct bridge *);
 static void bridge_configure_sflow(struct bridge *, int *sflow_bridge_number);
 static void bridge_configure_stp(struct bridge *);
@@ -198,6 +200,10 @@ static void bridge_queue_if_cfg(struct bridge *,
                                 const struct ovsrec_interface *,
                                 const struct ovsrec_port *);
 static uint64_t dpid_from_hash(const void *, size_t nbytes);
+static unsigned int other_config_get_uint(const struct smap *,
+                                          const char *key,
+                                          unsigned int min, unsigned int max,
+                                          unsigned int default_value);
 static bool bridge_has_bond_fake_iface(const struct bridge *,
                                        const char *name);
 static bool port_is_bond_fake_iface(const struct port *);
@@ -216,6 +222,7 @@ static void port_configure_bond(struct port *, struct bond_settings *,
 static bool port_is_synthetic(const struct port *);
 
 static void reconfigure_system_stats(const struct ovsrec_open_vswitch *);
+static void reconfigure_datapaths(const struct ovsrec_open_vswitch *);
 static void run_system_stats(void);
 
 static void bridge_configure_mirrors(struct bridge *);
@@ -240,6 +247,7 @@ static void iface_set_ofport(const struct ovsrec_interface *, int64_t ofport);
 static void iface_clear_db_record(const struct ovsrec_interface *if_cfg);
 static void iface_configure_qos(struct iface *, const struct ovsrec_qos *);
 static void iface_configure_cfm(struct iface *);
+static void iface_configure_upcall_weight(struct iface *);
 static void iface_refresh_cfm_stats(struct iface *);
 static void iface_refresh_stats(struct iface *);
 static void iface_refresh_status(struct iface *);
@@ -482,6 +490,9 @@ bridge_reconfigure(const struct ovsrec_open_vswitch *ovs_cfg)
     assert(!reconfiguring);
     reconfiguring = true;
 
+    /* Datapaths created below need their configuration already. */
+    reconfigure_datapaths(ovs_cfg);
+
     /* Destroy "struct bridge"s, "struct port"s, and "struct iface"s according
      * to 'ovs_cfg' while update the "if_cfg_queue", with only very minimal
      * configuration otherwise.
@@ -598,12 +609,14 @@ bridge_reconfigure_continue(const struct ovsrec_open_vswitch *ovs_cfg)
             LIST_FOR_EACH (iface, port_elem, &port->ifaces) {
                 iface_configure_cfm(iface);
                 iface_configure_qos(iface, port->cfg->qos);
+                iface_configure_upcall_weight(iface);
                 iface_set_mac(iface);
             }
         }
         bridge_configure_mirrors(br);                       //port mirroring
         bridge_configure_flow_eviction_threshold(br);       //flow eviction threshold
         bridge_configure_forward_bpdu(br);                  //whether to fwd bpdu for STP
+        bridge_configure_flow_setup_budget(br);             //flow setups per source
         bridge_configure_mac_idle_time(br);                 //mac aging time
         bridge_configure_remotes(br, managers, n_managers); //config controller
         bridge_configure_netflow(br);
@@ -1492,6 +1505,36 @@ bridge_configure_forward_bpdu(struct bridge *br)
                                            false));
 }
 
+/* Set the flow setup budget for 'br'. */
+static void
+bridge_configure_flow_setup_budget(struct bridge *br)
+{
+    const struct smap *oc = &br->cfg->other_config;
+    enum ofproto_flow_setup_key key;
+    unsigned int rate, burst;
+    const char *key_str;
+
+    rate = other_config_get_uint(oc, "flow-setup-rate", 0, INT_MAX, 0);
+    burst = other_config_get_uint(oc, "flow-setup-burst", 1, INT_MAX,
+                                  MAX(rate, 1));
+
+    key_str = smap_get(oc, "flow-setup-key");
+    if (!key_str || !strcmp(key_str, "port")) {
+        key = OFPROTO_FLOW_SETUP_PER_PORT;
+    } else if (!strcmp(key_str, "vlan")) {
+        key = OFPROTO_FLOW_SETUP_PER_VLAN;
+    } else if (!strcmp(key_str, "tunnel")) {
+        key = OFPROTO_FLOW_SETUP_PER_TUNNEL;
+    } else {
+        static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+
+        VLOG_WARN_RL(&rl, "%s: other_config:flow-setup-key must be port, "
+                     "vlan, or tunnel (using port)", br->name);
+        key = OFPROTO_FLOW_SETUP_PER_PORT;
+    }
+    ofproto_set_flow_setup_budget(br->ofproto, rate, burst, key);
+}
+
 /* Set MAC aging time for 'br'. */
 static void
 bridge_configure_mac_idle_time(struct bridge *br)
@@ -1937,6 +1980,58 @@ reconfigure_system_stats(const struct ovsrec_open_vswitch *cfg)
     }
 }
 
+/* Returns the value of 'key' in 'other_config', if it is an integer between
+ * 'min' and 'max', inclusive.  Otherwise returns 'default_value', after
+ * warning about the invalid value, if there is one. */
+static unsigned int
+other_config_get_uint(const struct smap *other_config, const char *key,
+                      unsigned int min, unsigned int max,
+                      unsigned int default_value)
+{
+    const char *value_str = smap_get(other_config, key);
+    unsigned int value;
+
+    if (!value_str) {
+        return default_value;
+    } else if (!str_to_uint(value_str, 10, &value)
+               || value < min || value > max) {
+        static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(1, 5);
+
+        VLOG_WARN_RL(&rl, "other_config:%s must be an integer between %u "
+                     "and %u (using %u)", key, min, max, default_value);
+        return default_value;
+    }
+    return value;
+}
+
+/* Applies the settings in 'cfg' that apply to every datapath. */
+static void
+reconfigure_datapaths(const struct ovsrec_open_vswitch *cfg)
+{
+    const struct smap *oc = &cfg->other_config;
+
+    ofproto_set_n_handler_threads(
+        other_config_get_uint(oc, "n-handler-threads",
+                         0, OFPROTO_MAX_HANDLER_THREADS, 0));
+    ofproto_set_n_revalidator_threads(
+        other_config_get_uint(oc, "n-revalidator-threads",
+                         0, OFPROTO_MAX_REVALIDATOR_THREADS, 0));
+    ofproto_set_revalidation_budget(
+        other_config_get_uint(oc, "revalidation-budget",
+                         0, OFPROTO_MAX_REVALIDATION_BUDGET, 0));
+    ofproto_set_stats_batch(
+        other_config_get_uint(oc, "stats-batch", 0, INT_MAX, 0));
+    ofproto_set_flow_limit(
+        other_config_get_uint(oc, "flow-limit", 0, INT_MAX, 0));
+    ofproto_set_miss_batch(
+        other_config_get_uint(oc, "miss-batch", 1, OFPROTO_MAX_MISS_BATCH,
+                         OFPROTO_DEFAULT_MISS_BATCH),
+        other_config_get_uint(oc, "miss-hold", 0, OFPROTO_MAX_MISS_HOLD, 0));
+    dpif_netdev_set_n_threads(
+        other_config_get_uint(oc, "n-forwarding-threads",
+                              0, DPIF_NETDEV_MAX_THREADS, 0));
+}
+
 static void
 run_system_stats(void)
 {
@@ -3465,6 +3560,20 @@ iface_configure_cfm(struct iface *iface)
     ofproto_port_set_cfm(iface->port->bridge->ofproto, iface->ofp_port, &s);
 }
 
+static void
+iface_configure_upcall_weight(struct iface *iface)
+{
+    int weight;
+
+    if (iface->ofp_port < 0) {
+        return;
+    }
+
+    weight = smap_get_int(&iface->cfg->other_config, "upcall-weight", 1);
+    ofproto_port_set_upcall_weight(iface->port->bridge->ofproto,
+                                   iface->ofp_port, MAX(weight, 1));
+}
+
 /* Returns true if 'iface' is synthetic, that is, if we constructed it locally
  * instead of obtaining it from the database. */
 static bool